@@ -0,0 +1,392 @@
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "rexlang_vm.h"
+#include "rexlang_stdlib.h"
+#include "rexlang_batch.h"
+
+// microbenchmarks of representative kernels. every kernel loops forever, so each run executes
+// exactly its instruction budget. results are printed as CSV rows of
+//   bench,config,metric,value
+// see bench.sh.
+
+struct kernel {
+    const char *name;
+    uint8_t prgm[80];
+};
+
+static const struct kernel kernels[] = {
+    {
+        // tight arithmetic on the stack: acc = (acc*3+1)^0x55; acc += acc & 15
+        "arith",
+        {
+            0b01000000, 1,                      // push-u8    1
+            0b01010001, 3,                      // mul-imm8   3
+            0b01001111, 1,                      // add-imm8   1
+            0b01001110, 0x55,                   // xor-imm8   0x55
+            0b00111101,                         // dup
+            0b01001100, 0x0F,                   // and-imm8   0x0F
+            0b00001111,                         // add
+            0b01101001, 2,                      // jump-abs-imm8 2
+        },
+    },
+    {
+        // byte copy d[0x80+i] = d[i], i = (i+1) & 0x7F
+        "memcopy",
+        {
+            0b01000000, 0,                      // push-u8    i=0
+            0b00111101,                         // dup
+            0b01010101, 0x00,                   // ld-u8-offs-imm8 0x00
+            0b01110010, 1,                      // ldsp-offs-imm8 1
+            0b01100101, 0x80,                   // st-u8-offs-discard-imm8 0x80
+            0b01001111, 1,                      // add-imm8   1
+            0b01001100, 0x7F,                   // and-imm8   0x7F
+            0b01101001, 2,                      // jump-abs-imm8 2
+        },
+    },
+    {
+        // poll chip 0 until it reads 0xFF, one syscall per iteration
+        "syscall-poll",
+        {
+            0b01000000, 0,                      // push-u8    chip=0
+            0b01101111, 0x01,                   // syscall-u8 1 (chip-rdn-u8)
+            0b01000010, 0xFF,                   // eq-imm8    0xFF
+            0b01101110, -8,                     // jump-rel-if-not-imm8 -8
+            0,                                  // halt
+        },
+    },
+    {
+        // recursion 12 calls deep: f(n) { if (n) f(n-1); }
+        "call-return",
+        {
+            0b01000000, 12,                     // push-u8    12
+            0b01101000, 6,                      // call-imm8  f
+            0b01101001, 0,                      // jump-abs-imm8 0
+            0b00111101,                         // f: dup
+            0b01101101, 2,                      // jump-rel-if-imm8 +2
+            0b00111011,                         // discard
+            0b00111000,                         // return
+            0b01010000, 1,                      // sub-imm8   1
+            0b01101000, 6,                      // call-imm8  f
+            0b00111000,                         // return
+        },
+    },
+    {
+        // 4-state machine driven by an LCG; counts visits per state in d[0x10..0x17]
+        "state-machine",
+        {
+            0b01000000, 1,                      // push-u8    rng=1
+            0b01010001, 5,                      // loop: mul-imm8 5
+            0b01001111, 1,                      // add-imm8   1
+            0b00111101,                         // dup
+            0b01110001, 3,                      // shr-imm8   3
+            0b01001100, 3,                      // and-imm8   3
+            0b01010010, 0x00,                   // ld-u8-imm8 0x00 (state)
+            0b00001111,                         // add
+            0b01001100, 3,                      // and-imm8   3
+            0b00111101,                         // dup
+            0b01100010, 0x00,                   // st-u8-discard-imm8 0x00 (state)
+            0b00111101,                         // dup
+            0b01101110, 19,                     // jump-rel-if-not-imm8 s0
+            0b00111101,                         // dup
+            0b01000010, 1,                      // eq-imm8    1
+            0b01101101, 23,                     // jump-rel-if-imm8 s1
+            0b00111101,                         // dup
+            0b01000010, 2,                      // eq-imm8    2
+            0b01101101, 27,                     // jump-rel-if-imm8 s2
+            0b00111011,                         // s3: discard
+            0b01010011, 0x16,                   // ld-u16-imm8 0x16
+            0b01001111, 1,                      // add-imm8   1
+            0b01100011, 0x16,                   // st-u16-discard-imm8 0x16
+            0b01101001, 2,                      // jump-abs-imm8 loop
+            0b00111011,                         // s0: discard
+            0b01010011, 0x10,                   // ld-u16-imm8 0x10
+            0b01001111, 1,                      // add-imm8   1
+            0b01100011, 0x10,                   // st-u16-discard-imm8 0x10
+            0b01101001, 2,                      // jump-abs-imm8 loop
+            0b00111011,                         // s1: discard
+            0b01010011, 0x12,                   // ld-u16-imm8 0x12
+            0b01001111, 1,                      // add-imm8   1
+            0b01100011, 0x12,                   // st-u16-discard-imm8 0x12
+            0b01101001, 2,                      // jump-abs-imm8 loop
+            0b00111011,                         // s2: discard
+            0b01010011, 0x14,                   // ld-u16-imm8 0x14
+            0b01001111, 1,                      // add-imm8   1
+            0b01100011, 0x14,                   // st-u16-discard-imm8 0x14
+            0b01101001, 2,                      // jump-abs-imm8 loop
+        },
+    },
+};
+
+enum config {
+    CONFIG_PLAIN,
+    CONFIG_VERIFIED,
+    CONFIG_FUSED,           // fused, predecoded and verified
+    CONFIG_JIT,
+    CONFIG_COUNT,
+};
+
+static const char *config_names[CONFIG_COUNT] = {
+    "plain", "verified", "fused", "jit",
+};
+
+#define RUNS        5
+#define TOTAL_INSNS 20000000u
+#define CALL_INSNS  100000u
+
+static uint8_t wram[0x10000];
+static uint32_t ki[REXLANG_DATA_STACKSZ];
+static rexlang_ip cs[REXLANG_CALL_STACKSZ];
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// returns false if verification was asked for and failed:
+static int setup(struct rexlang_vm *vm, struct rexlang_stdlib *lib, const uint8_t *prgm, uint8_t *data,
+    struct rexlang_insn *x, uint16_t *scratch, int verify, int predecode) {
+    static const struct rexlang_chip wram_chip = {wram, sizeof(wram), NULL, NULL, NULL};
+
+    rexlang_stdlib_init(lib);
+    rexlang_stdlib_set_chip(lib, 0, &wram_chip);
+    memset(data, 0, 256);
+    rexlang_vm_init(vm, sizeof(kernels[0].prgm), prgm, 256, data, rexlang_stdlib_syscall,
+        ki, REXLANG_DATA_STACKSZ, cs, REXLANG_CALL_STACKSZ);
+    vm->ctx = lib;
+    if (predecode) {
+        rexlang_vm_predecode(vm, x, sizeof(kernels[0].prgm));
+    }
+    return !verify || rexlang_vm_verify(vm, rexlang_stdlib_sigs, REXLANG_STDLIB_SIG_COUNT, scratch,
+        sizeof(kernels[0].prgm), NULL) == REXLANG_ERR_SUCCESS;
+}
+
+// best time in ns per instruction of running `k` in configuration `c`; 0 if unsupported.
+// programs that do not verify (such as recursive ones) run with runtime checks:
+static double bench_kernel(const struct kernel *k, enum config c) {
+    struct rexlang_vm vm;
+    struct rexlang_stdlib lib;
+    struct rexlang_insn x[sizeof(k->prgm)];
+    uint16_t scratch[sizeof(k->prgm)];
+    uint8_t prgm[sizeof(k->prgm)];
+    uint8_t data[256];
+#ifdef REXLANG_JIT
+    struct rexlang_jit jit = {0};
+#endif
+    double best = 0;
+
+    memcpy(prgm, k->prgm, sizeof(k->prgm));
+    if (c == CONFIG_FUSED) {
+        rexlang_vm_fuse(k->prgm, sizeof(k->prgm), sizeof(k->prgm), prgm);
+    }
+#ifndef REXLANG_JIT
+    if (c == CONFIG_JIT) {
+        return 0;
+    }
+#endif
+
+    for (int run = 0; run < RUNS; run++) {
+        double t0, t;
+
+        if (!setup(&vm, &lib, prgm, data, x, scratch, c != CONFIG_PLAIN, c == CONFIG_FUSED) && run == 0) {
+            fprintf(stderr, "%s,%s: does not verify; running checked\n", k->name, config_names[c]);
+        }
+#ifdef REXLANG_JIT
+        if (c == CONFIG_JIT && run == 0 && !rexlang_vm_jit_compile(&vm, &jit)) {
+            return 0;
+        }
+#endif
+
+        t0 = now_ns();
+        for (unsigned int n = 0; n < TOTAL_INSNS / CALL_INSNS; n++) {
+#ifdef REXLANG_JIT
+            if (c == CONFIG_JIT) {
+                rexlang_vm_jit_exec(&vm, &jit, CALL_INSNS);
+            } else
+#endif
+            rexlang_vm_exec(&vm, CALL_INSNS);
+        }
+        t = (now_ns() - t0) / TOTAL_INSNS;
+
+        if (vm.err != REXLANG_ERR_SUCCESS) {
+            fprintf(stderr, "warning: %s stopped with error %d\n", k->name, vm.err);
+        }
+        if (run == 0 || t < best) {
+            best = t;
+        }
+    }
+
+#ifdef REXLANG_JIT
+    rexlang_vm_jit_free(&jit);
+#endif
+    return best;
+}
+
+// best time in ns per instruction and VM of running `k` on REXLANG_LOCKSTEP_LANES VMs in lockstep:
+static double bench_lanes(const struct kernel *k) {
+    static uint32_t lanes_ki[REXLANG_LOCKSTEP_LANES][REXLANG_DATA_STACKSZ];
+    static rexlang_ip lanes_cs[REXLANG_LOCKSTEP_LANES][REXLANG_CALL_STACKSZ];
+    static uint32_t scratch[REXLANG_DATA_STACKSZ * REXLANG_LOCKSTEP_LANES];
+    struct rexlang_vm vm[REXLANG_LOCKSTEP_LANES];
+    struct rexlang_vm *lanes[REXLANG_LOCKSTEP_LANES];
+    struct rexlang_stdlib lib;
+    static const struct rexlang_chip wram_chip = {wram, sizeof(wram), NULL, NULL, NULL};
+    uint8_t data[REXLANG_LOCKSTEP_LANES][256];
+    double best = 0;
+
+    rexlang_stdlib_init(&lib);
+    rexlang_stdlib_set_chip(&lib, 0, &wram_chip);
+    for (int run = 0; run < RUNS; run++) {
+        double t0, t;
+
+        for (int l = 0; l < REXLANG_LOCKSTEP_LANES; l++) {
+            memset(data[l], 0, 256);
+            rexlang_vm_init(&vm[l], sizeof(k->prgm), k->prgm, 256, data[l], rexlang_stdlib_syscall,
+                lanes_ki[l], REXLANG_DATA_STACKSZ, lanes_cs[l], REXLANG_CALL_STACKSZ);
+            vm[l].ctx = &lib;
+            lanes[l] = &vm[l];
+        }
+
+        t0 = now_ns();
+        for (unsigned int n = 0; n < TOTAL_INSNS / CALL_INSNS / REXLANG_LOCKSTEP_LANES; n++) {
+            rexlang_vm_exec_lockstep(lanes, REXLANG_LOCKSTEP_LANES, CALL_INSNS, scratch, sizeof(scratch) / sizeof(uint32_t));
+        }
+        t = (now_ns() - t0) / (TOTAL_INSNS / CALL_INSNS / REXLANG_LOCKSTEP_LANES * CALL_INSNS * REXLANG_LOCKSTEP_LANES);
+
+        if (run == 0 || t < best) {
+            best = t;
+        }
+    }
+
+    return best;
+}
+
+// rexlang_vm_exec() as it was when it set up a longjmp destination on every call:
+static enum rexlang_error exec_setjmp(struct rexlang_vm *vm, jmp_buf *j, unsigned int count) {
+    if (setjmp(*j)) {
+        return vm->err;
+    }
+    return rexlang_vm_exec(vm, count);
+}
+
+// best time in ns per rexlang_vm_exec() call of `budget` instructions of the arith kernel:
+static double bench_calls(unsigned int budget, int with_setjmp) {
+    struct rexlang_vm vm;
+    struct rexlang_stdlib lib;
+    uint8_t data[256];
+    jmp_buf j;
+    const long calls = budget < 16 ? 4000000 : 64000000 / budget;
+    double best = 0;
+
+    for (int run = 0; run < RUNS; run++) {
+        double t0, t;
+
+        setup(&vm, &lib, kernels[0].prgm, data, NULL, NULL, 0, 0);
+
+        t0 = now_ns();
+        for (long i = 0; i < calls; i++) {
+            if (with_setjmp) {
+                exec_setjmp(&vm, &j, budget);
+            } else {
+                rexlang_vm_exec(&vm, budget);
+            }
+        }
+        t = (now_ns() - t0) / calls;
+
+        if (run == 0 || t < best) {
+            best = t;
+        }
+    }
+
+    return best;
+}
+
+#define BATCH_IMAGES 4096
+#define BATCH_INSNS  20000u
+
+static uint8_t batch_data[BATCH_IMAGES][256];
+static uint32_t batch_stacks[BATCH_IMAGES * REXLANG_DATA_STACKSZ];
+static struct rexlang_batch_result batch_results[BATCH_IMAGES];
+
+// best time in ns per image of running the verified arith kernel over a batch on `threads` threads:
+static double bench_batch(unsigned int threads) {
+    static uint8_t *images[BATCH_IMAGES];
+    struct rexlang_vm vm;
+    struct rexlang_stdlib lib;
+    uint16_t scratch[sizeof(kernels[0].prgm)];
+    struct rexlang_batch b = {0};
+    double best = 0;
+
+    for (int n = 0; n < BATCH_IMAGES; n++) {
+        images[n] = batch_data[n];
+    }
+    b.verified = setup(&vm, &lib, kernels[0].prgm, batch_data[0], NULL, scratch, 1, 0);
+    b.m = kernels[0].prgm;
+    b.m_size = sizeof(kernels[0].prgm);
+    b.syscall = rexlang_stdlib_syscall;
+    b.instruction_count = BATCH_INSNS;
+    b.d = images;
+    b.d_size = sizeof(batch_data[0]);
+    b.count = BATCH_IMAGES;
+    b.stacks = batch_stacks;
+    b.ki_size = REXLANG_DATA_STACKSZ;
+    b.cs_size = REXLANG_CALL_STACKSZ;
+
+    for (int run = 0; run < RUNS; run++) {
+        double t0, t;
+
+        t0 = now_ns();
+        if (!rexlang_batch_run(&b, threads, batch_results)) {
+            return 0;
+        }
+        t = (now_ns() - t0) / BATCH_IMAGES;
+
+        if (run == 0 || t < best) {
+            best = t;
+        }
+    }
+
+    return best;
+}
+
+int main(void) {
+    static const unsigned int budgets[] = {1, 16, 256};
+
+    printf("bench,config,metric,value\n");
+    for (size_t i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+        for (int c = 0; c < CONFIG_COUNT; c++) {
+            double ns = bench_kernel(&kernels[i], c);
+            if (ns == 0) {
+                continue;
+            }
+            printf("%s,%s,ns_per_insn,%.3f\n", kernels[i].name, config_names[c], ns);
+            printf("%s,%s,insns_per_sec,%.0f\n", kernels[i].name, config_names[c], 1e9 / ns);
+        }
+        double ns = bench_lanes(&kernels[i]);
+        printf("%s,lanes=%d,ns_per_insn,%.3f\n", kernels[i].name, REXLANG_LOCKSTEP_LANES, ns);
+        printf("%s,lanes=%d,insns_per_sec,%.0f\n", kernels[i].name, REXLANG_LOCKSTEP_LANES, 1e9 / ns);
+        fflush(stdout);
+    }
+
+    // fixed cost of entering and leaving the interpreter, against the old setjmp-per-call entry:
+    for (size_t i = 0; i < sizeof(budgets)/sizeof(budgets[0]); i++) {
+        printf("exec-call,budget=%u,ns_per_call,%.1f\n", budgets[i], bench_calls(budgets[i], 0));
+        printf("exec-call,budget=%u+setjmp,ns_per_call,%.1f\n", budgets[i], bench_calls(budgets[i], 1));
+    }
+    printf("vm,sizeof,bytes,%u\n", (unsigned)sizeof(struct rexlang_vm));
+
+    // scaling of the batch runner; threads=0 is one per online CPU:
+    for (unsigned int threads = 0; threads <= 8; threads = threads ? threads * 2 : 1) {
+        double ns = bench_batch(threads);
+        if (ns == 0) {
+            continue;
+        }
+        printf("batch,threads=%u,ns_per_image,%.1f\n", threads, ns);
+        printf("batch,threads=%u,insns_per_sec,%.0f\n", threads, 1e9 * BATCH_INSNS / ns);
+    }
+
+    return 0;
+}
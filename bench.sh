@@ -0,0 +1,7 @@
+#!/bin/sh
+# build and run the VM microbenchmarks; CSV results (bench,config,metric,value) go to bench_output.txt.
+# extra arguments are passed to the compiler, e.g. ./bench.sh -DREXLANG_TOS_CACHE
+set -e
+cd "$(dirname "$0")"
+${CC:-cc} -O2 -DNDEBUG "$@" -o bench bench.c rexlang_vm.c rexlang_vm_verify.c rexlang_vm_profile.c rexlang_vm_jit.c rexlang_vm_lockstep.c rexlang_vm_snapshot.c rexlang_vm_mmio.c rexlang_stdlib.c rexlang_channel.c rexlang_batch.c -pthread
+./bench | tee bench_output.txt
@@ -1,4 +1,169 @@
-
+#include <assert.h>
+#include <string.h>
 #include "rex.h"
 
+#if REXLANG_VM_COUNT > 32
+#  error "rex_state.runnable holds one bit per VM"
+#endif
+
 struct rex_state rex;
+
+static uint8_t unit_cost[256];
+
+void rex_init(enum rex_policy policy)
+{
+	memset(unit_cost, 1, sizeof(unit_cost));
+
+	rex.cycles = 0;
+	rex.next_exec_cycle = 0;
+	rex.policy = policy;
+	rex.slice = REX_SLICE_CYCLES;
+	rex.runnable = 0;
+	rex.turn = 0;
+	rex.parked = 0;
+	rex.timed = 0;
+	for (unsigned int i = 0; i < REXLANG_VM_COUNT; i++) {
+		rex.cost[i] = unit_cost;
+	}
+}
+
+void rex_start(unsigned int i, const uint8_t *cost)
+{
+	assert(i < REXLANG_VM_COUNT);
+	// a free opcode would let a VM run unbounded within its slice:
+	for (unsigned int op = 0; cost && op < 256; op++) {
+		assert(cost[op] != 0 && "cost entries must be nonzero");
+	}
+
+	if (rex.vm[i].err != REXLANG_ERR_SUCCESS) {
+		rexlang_vm_error_ack(&rex.vm[i]);
+	}
+	rex.cost[i] = cost ? cost : unit_cost;
+	rex.runnable |= 1u << i;
+	rex.parked &= ~(1u << i);
+	rex.timed &= ~(1u << i);
+}
+
+void rex_stop(unsigned int i)
+{
+	assert(i < REXLANG_VM_COUNT);
+
+	rex.runnable &= ~(1u << i);
+	rex.parked &= ~(1u << i);
+	rex.timed &= ~(1u << i);
+}
+
+void rex_signal(uint32_t events)
+{
+	for (uint32_t p = rex.parked; p; p &= p - 1) {
+		unsigned int i = __builtin_ctz(p);
+
+		if (rex.wait_events[i] & events) {
+			rex.parked &= ~(1u << i);
+			rex.timed &= ~(1u << i);
+		}
+	}
+}
+
+// resume VM `i` after it yielded, parking it if it waits for something. returns whether it
+// only gave up its turn:
+static bool park(unsigned int i)
+{
+	struct rexlang_vm *vm = &rex.vm[i];
+	uint32_t events = vm->wait_events;
+	uint32_t cycles = vm->wait_cycles;
+
+	rexlang_vm_error_ack(vm);
+	if (!events && !cycles) {
+		return true;
+	}
+
+	rex.parked |= 1u << i;
+	rex.wait_events[i] = events;
+	if (cycles) {
+		rex.timed |= 1u << i;
+		rex.wake_cycle[i] = rex.next_exec_cycle + cycles;
+	}
+	return false;
+}
+
+// wake the timed VMs whose deadline has come on the VM clock. returns the bit of the timed VM
+// due next, or 0 if there is none:
+static uint32_t wake_due(void)
+{
+	uint32_t next = 0;
+	int32_t next_wait = 0;
+
+	for (uint32_t p = rex.timed; p; p &= p - 1) {
+		unsigned int i = __builtin_ctz(p);
+		int32_t wait = (int32_t)(rex.wake_cycle[i] - rex.next_exec_cycle);
+
+		if (wait <= 0) {
+			rex.parked &= ~(1u << i);
+			rex.timed &= ~(1u << i);
+		} else if (!next || wait < next_wait) {
+			next = 1u << i;
+			next_wait = wait;
+		}
+	}
+
+	return next;
+}
+
+// next runnable VM at or after `turn`, wrapping around; `runnable` must not be empty:
+static unsigned int next_runnable(uint32_t runnable, unsigned int turn)
+{
+	uint32_t after = runnable & ~((1u << turn) - 1);
+
+	return __builtin_ctz(after ? after : runnable);
+}
+
+void rex_advance_clock(uint32_t cycles)
+{
+	// VMs that gave up their turn in this advance:
+	uint32_t yielded = 0;
+
+	rex.cycles += cycles;
+
+	// run while the VMs are behind the host clock; differences are signed to survive wrapping:
+	while ((int32_t)(rex.cycles - rex.next_exec_cycle) > 0) {
+		int32_t budget = (int32_t)(rex.cycles - rex.next_exec_cycle);
+		uint32_t next = wake_due();
+		uint32_t ready = rex.runnable & ~rex.parked & ~yielded;
+		unsigned int i;
+
+		if (!ready) {
+			if (next) {
+				// skip ahead to the next deadline, which is before the host clock:
+				i = __builtin_ctz(next);
+				if ((int32_t)(rex.cycles - rex.wake_cycle[i]) > 0) {
+					rex.next_exec_cycle = rex.wake_cycle[i];
+					continue;
+				}
+			}
+			// idle time is not banked:
+			rex.next_exec_cycle = rex.cycles;
+			break;
+		}
+
+		if (rex.policy == REX_PRIORITY) {
+			i = __builtin_ctz(ready);
+		} else {
+			i = next_runnable(ready, rex.turn);
+			if (budget > rex.slice) {
+				budget = rex.slice;
+			}
+			rex.turn = (i + 1) % REXLANG_VM_COUNT;
+		}
+
+		rex.next_exec_cycle += budget - rexlang_vm_exec_cycles(&rex.vm[i], rex.cost[i], budget);
+
+		if (rex.vm[i].err == REXLANG_ERR_YIELDED) {
+			if (park(i)) {
+				yielded |= 1u << i;
+			}
+		} else if (rex.vm[i].err != REXLANG_ERR_SUCCESS) {
+			rex.runnable &= ~(1u << i);
+		}
+	}
+}
@@ -1,4 +1,3 @@
-
 #ifndef _REX_H_
 #define _REX_H_
 
@@ -7,16 +6,54 @@
 
 #define REXLANG_VM_COUNT 2
 
+// most cycles a VM runs before the round-robin policy moves on to the next runnable VM:
+#define REX_SLICE_CYCLES 64
+
+enum rex_policy {
+	REX_ROUND_ROBIN,        // runnable VMs take turns of at most `slice` cycles
+	REX_PRIORITY,           // the lowest numbered runnable VM runs until it stops
+};
+
 struct rex_state {
-	int cycles;
-	int next_exec_cycle;
+	uint32_t cycles;            // host clock; advanced by rex_advance_clock()
+	uint32_t next_exec_cycle;   // clock at which the VMs run next; ahead of `cycles` while in debt
+
+	enum rex_policy policy;
+	int32_t  slice;             // round-robin turn length in cycles
+	uint32_t runnable;          // bit per VM that is started and has no pending error
+	unsigned int turn;          // VM to consider first for the next round-robin turn
+
+	uint32_t parked;            // bit per runnable VM waiting for an event or deadline
+	uint32_t timed;             // bit per parked VM that has a deadline
+	uint32_t wait_events[REXLANG_VM_COUNT]; // events each parked VM waits for
+	uint32_t wake_cycle[REXLANG_VM_COUNT];  // clock at which each timed VM wakes
+
+	const uint8_t *cost[REXLANG_VM_COUNT];  // per-opcode cycle costs of each VM
 	struct rexlang_vm vm[REXLANG_VM_COUNT];
 };
 
 extern struct rex_state rex;
 
-static void rex_advance_clock(int cycles) {
-	rexlang_exec(&rex.vm[i]);
-}
+// reset the scheduler with no VMs runnable:
+void rex_init(enum rex_policy policy);
+
+// make VM `i`, initialised with rexlang_vm_init(), runnable with the given cost per opcode
+// (256 nonzero entries; NULL costs 1 cycle per instruction). also acknowledges a pending error:
+void rex_start(unsigned int i, const uint8_t *cost);
+
+// stop scheduling VM `i`:
+void rex_stop(unsigned int i);
+
+// wake the parked VMs waiting for any of `events`. VMs that are not waiting yet miss them, so
+// programs should check for what they wait for before waiting:
+void rex_signal(uint32_t events);
+
+// advance the host clock by `cycles` and run the VMs for as long as it allows. cycles that
+// an instruction overdraws are repaid from the next advance; VMs that halt or raise an error
+// stop being scheduled until rex_start() is called for them again.
+// a VM that yields (REXLANG_ERR_YIELDED) is resumed without rex_start(): after a plain yield
+// it sits out the rest of this advance, otherwise it is parked until one of its wait_events is
+// signalled or its wait_cycles have passed on the VM clock:
+void rex_advance_clock(uint32_t cycles);
 
 #endif
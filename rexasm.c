@@ -0,0 +1,146 @@
+// command line front end of the rexlang assembler:
+//
+//   rexasm [-b] [-O] [-i] [-c] [-o out] [in]
+//
+// assembles `in` (standard input if omitted or "-") into a binary program written to `out`
+// (standard output if omitted). with -c the program is written as a C initializer instead.
+// -b reads `in` as a binary program rather than source, and -O optimises the program and
+// reports its size before and after on standard error; it treats offset 0 as the only entry
+// point and drops code reached from anywhere else (see rexlang_asm_optimize). -i writes a program image with
+// relocations and entry points (see rexlang_image.h) instead; it takes neither -b nor -O.
+// build with:
+//
+//   cc -O2 -o rexasm rexasm.c rexlang_asm.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rexlang_asm.h"
+
+// program memory is addressed with 32 bits, but uploads are far smaller:
+#define MAX_PRGM (16u << 20)
+
+static char *read_all(FILE *f, size_t *len)
+{
+	size_t cap = 4096, n = 0;
+	char *buf = malloc(cap);
+
+	while (buf) {
+		size_t r = fread(buf + n, 1, cap - n, f);
+
+		n += r;
+		if (n < cap) {
+			if (ferror(f)) {
+				free(buf);
+				return NULL;
+			}
+			*len = n;
+			return buf;
+		}
+		char *b = realloc(buf, cap *= 2);
+		if (!b) {
+			free(buf);
+		}
+		buf = b;
+	}
+	return NULL;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: rexasm [-b] [-O] [-i] [-c] [-o out] [in]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *in_name = "-", *out_name = NULL;
+	struct rexlang_asm_result res;
+	struct rexlang_opt_result opt;
+	bool c_array = false, binary = false, optimize = false, image = false;
+	uint8_t *prgm;
+	size_t len;
+	char *src;
+	FILE *f;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-c") == 0) {
+			c_array = true;
+		} else if (strcmp(argv[i], "-b") == 0) {
+			binary = true;
+		} else if (strcmp(argv[i], "-O") == 0) {
+			optimize = true;
+		} else if (strcmp(argv[i], "-i") == 0) {
+			image = true;
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			out_name = argv[++i];
+		} else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+			usage();
+		} else {
+			in_name = argv[i];
+		}
+	}
+	if (image && (binary || optimize)) {
+		usage();
+	}
+
+	f = strcmp(in_name, "-") == 0 ? stdin : fopen(in_name, "rb");
+	if (!f || !(src = read_all(f, &len))) {
+		perror(in_name);
+		return 1;
+	}
+	if (f != stdin) {
+		fclose(f);
+	}
+
+	prgm = malloc(MAX_PRGM);
+	if (!prgm) {
+		perror("rexasm");
+		return 1;
+	}
+	if (binary) {
+		if (len > MAX_PRGM) {
+			fprintf(stderr, "%s: program too large\n", in_name);
+			return 1;
+		}
+		memcpy(prgm, src, len);
+		res.size = len;
+	} else if (!(image ? rexlang_asm_image : rexlang_asm)(src, len, prgm, MAX_PRGM, &res)) {
+		if (res.line) {
+			fprintf(stderr, "%s:%u: %s\n", in_name, res.line, res.error);
+		} else {
+			fprintf(stderr, "%s: %s\n", in_name, res.error);
+		}
+		return 1;
+	}
+	if (optimize) {
+		if (!rexlang_asm_optimize(prgm, res.size, prgm, MAX_PRGM, &opt)) {
+			fprintf(stderr, "%s: offset %u: %s\n", in_name, opt.ip, opt.error);
+			return 1;
+		}
+		fprintf(stderr, "%s: %u instructions, %u bytes -> %u instructions, %u bytes\n", in_name,
+			opt.insns_before, opt.bytes_before, opt.insns_after, opt.bytes_after);
+		res.size = opt.bytes_after;
+	}
+
+	f = out_name ? fopen(out_name, c_array ? "w" : "wb") : stdout;
+	if (!f) {
+		perror(out_name);
+		return 1;
+	}
+	if (c_array) {
+		for (uint32_t p = 0; p < res.size; p++) {
+			fprintf(f, "0x%02X,%s", prgm[p], p % 12 == 11 || p + 1 == res.size ? "\n" : " ");
+		}
+	} else {
+		fwrite(prgm, 1, res.size, f);
+	}
+	if (fflush(f) != 0 || ferror(f)) {
+		perror(out_name ? out_name : "stdout");
+		return 1;
+	}
+
+	free(prgm);
+	free(src);
+	return 0;
+}
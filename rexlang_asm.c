@@ -0,0 +1,1337 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rexlang_vm_impl.h"
+#include "rexlang_asm.h"
+#include "rexlang_image.h"
+
+// every line holds at most one statement:
+//
+//   [name:]... [mnemonic [operand] | .directive [operand, ...]] [; comment]
+//
+// operands are sums and differences of numbers (decimal, 0x hex or 0b binary) and names,
+// adding at most one label. a label stands for the program memory offset of what follows it.
+// the operand of jump-rel* naming a label is turned into the offset relative to the next
+// instruction; a plain number is used as the offset as it is.
+//
+// items whose immediate depends on a label start out with the smallest immediate and grow
+// until every operand fits. a grown item only moves labels further apart, so items never
+// need to shrink again and the passes end once nothing grows.
+//
+// for images, operands holding label addresses other than jump-rel* offsets are always 32
+// bits, so that the relocation table can move them.
+
+typedef int64_t s64;
+
+#define W8      1
+#define W16     2
+#define W32     4
+#define WALL    (W8 | W16 | W32)
+
+struct mnemonic {
+	const char *name;
+	s16 stack;              // opcode of the form without immediate, or -1
+	s16 imm;                // base opcode of the immediate forms, or -1
+	u8 widths;              // sizes in bytes of the immediate forms that exist
+};
+
+static const struct mnemonic mnemonics[] = {
+	{"halt",                0x00, -1,   0},
+	{"nop",                 0x01, -1,   0},
+	{"push",                -1,   0x00, WALL},      // push-u* or push-s*, by the sign of the value
+	{"eq",                  0x02, 0x02, WALL},
+	{"ne",                  0x03, 0x03, WALL},
+	{"le-ui",               0x04, 0x04, WALL},
+	{"le-si",               0x05, 0x05, WALL},
+	{"gt-ui",               0x06, 0x06, WALL},
+	{"gt-si",               0x07, 0x07, WALL},
+	{"lt-ui",               0x08, 0x08, WALL},
+	{"lt-si",               0x09, 0x09, WALL},
+	{"ge-ui",               0x0A, 0x0A, WALL},
+	{"ge-si",               0x0B, 0x0B, WALL},
+	{"and",                 0x0C, 0x0C, WALL},
+	{"or",                  0x0D, 0x0D, WALL},
+	{"xor",                 0x0E, 0x0E, WALL},
+	{"add",                 0x0F, 0x0F, WALL},
+	{"sub",                 0x10, 0x10, WALL},
+	{"mul",                 0x11, 0x11, WALL},
+	{"ld-u8",               0x12, 0x12, WALL},
+	{"ld-u16",              0x13, 0x13, WALL},
+	{"ld-u32",              0x14, 0x14, WALL},
+	{"ld-u8-offs",          0x15, 0x15, WALL},
+	{"ld-u16-offs",         0x16, 0x16, WALL},
+	{"ld-u32-offs",         0x17, 0x17, WALL},
+	{"ld-s8",               0x18, 0x18, WALL},
+	{"ld-s16",              0x19, 0x19, WALL},
+	{"ld-s8-offs",          0x1A, 0x1A, WALL},
+	{"ld-s16-offs",         0x1B, 0x1B, WALL},
+	{"st-u8",               0x1C, 0x1C, WALL},
+	{"st-u16",              0x1D, 0x1D, WALL},
+	{"st-u32",              0x1E, 0x1E, WALL},
+	{"st-u8-offs",          0x1F, 0x1F, WALL},
+	{"st-u16-offs",         0x20, 0x20, WALL},
+	{"st-u32-offs",         0x21, 0x21, WALL},
+	{"st-u8-discard",       0x22, 0x22, WALL},
+	{"st-u16-discard",      0x23, 0x23, WALL},
+	{"st-u32-discard",      0x24, 0x24, WALL},
+	{"st-u8-offs-discard",  0x25, 0x25, WALL},
+	{"st-u16-offs-discard", 0x26, 0x26, WALL},
+	{"st-u32-offs-discard", 0x27, 0x27, WALL},
+	{"call",                0x28, 0x28, WALL},
+	{"jump-abs",            0x29, 0x29, WALL},
+	{"jump-abs-if",         0x2A, 0x2A, WALL},
+	{"jump-abs-if-not",     0x2B, 0x2B, WALL},
+	{"jump-rel",            0x2C, 0x2C, WALL},
+	{"jump-rel-if",         0x2D, 0x2D, WALL},
+	{"jump-rel-if-not",     0x2E, 0x2E, WALL},
+	{"syscall",             0x2F, 0x2F, WALL},
+	{"shl",                 0x30, 0x30, W8},
+	{"shr",                 0x31, 0x31, W8},
+	{"yield",               0x32, -1,   0},
+	{"ldsp-offs",           -1,   0x32, W8},
+	{"return",              0x38, -1,   0},
+	{"not",                 0x39, -1,   0},
+	{"neg",                 0x3A, -1,   0},
+	{"discard",             0x3B, 0x33, W8},
+	{"swap",                0x3C, -1,   0},
+	{"dup",                 0x3D, -1,   0},
+	{"dcopy",               0x3E, -1,   0},
+	{"pcopy",               0x3F, -1,   0},
+};
+
+#define MNEMONIC_COUNT (sizeof(mnemonics) / sizeof(mnemonics[0]))
+
+struct label {
+	const char *name;       // in the source text
+	u32 len;
+	bool defined;
+	bool constant;          // defined by .equ
+	bool exported;          // named by .export
+	u32 item;               // item the label stands before, if not constant
+	s64 value;              // value, if constant
+	unsigned int line;      // line of the first reference or the definition
+};
+
+// operand: `value`, plus the value of label `label` unless that is -1:
+struct expr {
+	s32 label;
+	s64 value;
+};
+
+enum item_kind {
+	ITEM_INSN,
+	ITEM_DATA,              // .byte, .u16 or .u32 element
+	ITEM_BAD,               // reserved opcode met by the optimiser, kept as it is
+};
+
+struct item {
+	u8 kind;
+	u8 op;                  // opcode without immediate, or base opcode of the immediate forms
+	u8 width;               // bytes of immediate or data; 0 for an instruction without
+	u8 grow;                // sizes the immediate may still take; 0 once fixed
+	bool push;              // the sign of the operand picks push-u* or push-s*
+	bool rel;               // the operand is a label to make relative to the next instruction
+	bool target;            // optimiser: control may arrive other than from the item before
+	bool dead;              // optimiser: the item goes away
+	unsigned int line;
+	u32 addr;
+	struct expr arg;
+};
+
+struct state {
+	const char *p;          // cursor in the current line
+	const char *end;        // end of the current line, without comment
+	unsigned int line;
+
+	struct item *items;
+	u32 n_items;
+	u32 cap_items;
+
+	struct label *labels;
+	u32 n_labels;
+	u32 cap_labels;
+
+	bool image;             // assembling an image; see rexlang_asm_image()
+	s32 rodata;             // first item of read-only data, or -1
+
+	const char *error;
+	unsigned int error_line;
+};
+
+static bool fail(struct state *st, unsigned int line, const char *error)
+{
+	if (!st->error) {
+		st->error = error;
+		st->error_line = line;
+	}
+	return false;
+}
+
+static bool grow_array(void **a, u32 *cap, u32 n, size_t size)
+{
+	void *b;
+	u32 c;
+
+	if (n < *cap) {
+		return true;
+	}
+	c = *cap ? *cap * 2 : 64;
+	if (!(b = realloc(*a, c * size))) {
+		return false;
+	}
+	*a = b;
+	*cap = c;
+	return true;
+}
+
+static inline bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool is_name_start(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static inline bool is_name(char c)
+{
+	return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+static void skip_space(struct state *st)
+{
+	while (st->p < st->end && is_space(*st->p)) {
+		st->p++;
+	}
+}
+
+static inline bool at_end(struct state *st)
+{
+	skip_space(st);
+	return st->p == st->end;
+}
+
+// consume character `c` if it is next:
+static bool accept(struct state *st, char c)
+{
+	skip_space(st);
+	if (st->p < st->end && *st->p == c) {
+		st->p++;
+		return true;
+	}
+	return false;
+}
+
+// length of the name at the cursor, which is not consumed:
+static u32 name_len(const struct state *st)
+{
+	const char *q = st->p;
+
+	if (q == st->end || !is_name_start(*q)) {
+		return 0;
+	}
+	while (q < st->end && is_name(*q)) {
+		q++;
+	}
+	return q - st->p;
+}
+
+static s32 find_label(struct state *st, const char *name, u32 len)
+{
+	for (u32 i = 0; i < st->n_labels; i++) {
+		if (st->labels[i].len == len && memcmp(st->labels[i].name, name, len) == 0) {
+			return i;
+		}
+	}
+
+	if (!grow_array((void **)&st->labels, &st->cap_labels, st->n_labels, sizeof(struct label))) {
+		return fail(st, st->line, "out of memory"), -1;
+	}
+	st->labels[st->n_labels] = (struct label){
+		.name = name,
+		.len = len,
+		.line = st->line,
+	};
+	return st->n_labels++;
+}
+
+static bool number(struct state *st, s64 *v)
+{
+	unsigned int base = 10;
+	u32 digits = 0;
+	uint64_t n = 0;
+
+	if (st->end - st->p > 2 && st->p[0] == '0' && (st->p[1] == 'x' || st->p[1] == 'X')) {
+		base = 16;
+		st->p += 2;
+	} else if (st->end - st->p > 2 && st->p[0] == '0' && (st->p[1] == 'b' || st->p[1] == 'B')) {
+		base = 2;
+		st->p += 2;
+	}
+
+	for (; st->p < st->end; st->p++, digits++) {
+		char c = *st->p;
+		unsigned int d;
+
+		if (c >= '0' && c <= '9') {
+			d = c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			d = c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			d = c - 'A' + 10;
+		} else if (c == '_') {
+			continue;
+		} else {
+			break;
+		}
+		if (d >= base) {
+			break;
+		}
+		n = n * base + d;
+		if (n > UINT32_MAX) {
+			return fail(st, st->line, "number out of range");
+		}
+	}
+	if (digits == 0 || (st->p < st->end && is_name(*st->p))) {
+		return fail(st, st->line, "malformed number");
+	}
+
+	*v = n;
+	return true;
+}
+
+// value of `e`, which must only refer to constants defined already:
+static bool constant(struct state *st, const struct expr *e, s64 *v)
+{
+	if (e->label >= 0 && !st->labels[e->label].constant) {
+		return fail(st, st->line, "operand must be a constant defined before");
+	}
+	*v = e->value + (e->label >= 0 ? st->labels[e->label].value : 0);
+	return true;
+}
+
+static bool expr(struct state *st, struct expr *e)
+{
+	bool neg = false;
+
+	e->label = -1;
+	e->value = 0;
+
+	if (accept(st, '-')) {
+		neg = true;
+	} else {
+		accept(st, '+');
+	}
+	for (;;) {
+		u32 n;
+		s64 v;
+
+		skip_space(st);
+		if ((n = name_len(st)) != 0) {
+			if (neg || e->label >= 0) {
+				return fail(st, st->line, "an operand can only add one name");
+			}
+			if ((e->label = find_label(st, st->p, n)) < 0) {
+				return false;
+			}
+			st->p += n;
+		} else if (st->p < st->end && *st->p >= '0' && *st->p <= '9') {
+			if (!number(st, &v)) {
+				return false;
+			}
+			e->value += neg ? -v : v;
+		} else {
+			return fail(st, st->line, "expected a number or a name");
+		}
+
+		if (accept(st, '+')) {
+			neg = false;
+		} else if (accept(st, '-')) {
+			neg = true;
+		} else {
+			return true;
+		}
+	}
+}
+
+static struct item *add_item(struct state *st, u8 kind)
+{
+	struct item *it;
+
+	if (!grow_array((void **)&st->items, &st->cap_items, st->n_items, sizeof(struct item))) {
+		fail(st, st->line, "out of memory");
+		return NULL;
+	}
+	it = &st->items[st->n_items++];
+	memset(it, 0, sizeof(*it));
+	it->kind = kind;
+	it->line = st->line;
+	it->arg.label = -1;
+	return it;
+}
+
+static bool directive(struct state *st)
+{
+	static const struct {
+		const char *name;
+		u8 width;
+	} data[] = {
+		{".byte", 1},
+		{".u16", 2},
+		{".u32", 4},
+	};
+	const char *name = st->p++;
+	u32 n = name_len(st) + 1;
+	struct expr e;
+
+	st->p = name + n;
+
+	if (n == 7 && memcmp(name, ".rodata", 7) == 0) {
+		if (st->rodata >= 0) {
+			return fail(st, st->line, "read-only data started twice");
+		}
+		st->rodata = st->n_items;
+		return true;
+	}
+
+	if (n == 7 && memcmp(name, ".export", 7) == 0) {
+		do {
+			s32 i;
+
+			skip_space(st);
+			if ((n = name_len(st)) == 0) {
+				return fail(st, st->line, "expected a name");
+			}
+			if ((i = find_label(st, st->p, n)) < 0) {
+				return false;
+			}
+			st->p += n;
+			st->labels[i].exported = true;
+		} while (accept(st, ','));
+		return true;
+	}
+
+	if (n == 4 && memcmp(name, ".equ", 4) == 0) {
+		struct label *l;
+		s32 i;
+
+		skip_space(st);
+		if ((n = name_len(st)) == 0) {
+			return fail(st, st->line, "expected a name");
+		}
+		if ((i = find_label(st, st->p, n)) < 0) {
+			return false;
+		}
+		st->p += n;
+		l = &st->labels[i];
+		if (l->defined) {
+			return fail(st, st->line, "name defined twice");
+		}
+		if (!accept(st, ',') || !expr(st, &e) || !constant(st, &e, &l->value)) {
+			return fail(st, st->line, "expected name, value");
+		}
+		l->defined = true;
+		l->constant = true;
+		l->line = st->line;
+		return true;
+	}
+
+	for (u32 k = 0; k < sizeof(data) / sizeof(data[0]); k++) {
+		if (strlen(data[k].name) != n || memcmp(name, data[k].name, n) != 0) {
+			continue;
+		}
+		do {
+			struct item *it;
+
+			if (!expr(st, &e) || !(it = add_item(st, ITEM_DATA))) {
+				return false;
+			}
+			it->width = data[k].width;
+			it->arg = e;
+		} while (accept(st, ','));
+		return true;
+	}
+
+	return fail(st, st->line, "unknown directive");
+}
+
+static bool instruction(struct state *st)
+{
+	const char *name = st->p;
+	const struct mnemonic *mn = NULL;
+	struct item *it;
+	u32 n = 0;
+	u8 fixed = 0;
+	s16 push_base = -1;
+
+	while (st->p < st->end && (is_name(*st->p) || *st->p == '-')) {
+		st->p++;
+	}
+	n = st->p - name;
+
+	// an explicit immediate size, or push with an explicit type:
+	if (n > 5 && memcmp(name + n - 5, "-imm8", 5) == 0) {
+		fixed = W8;
+		n -= 5;
+	} else if (n > 6 && memcmp(name + n - 6, "-imm16", 6) == 0) {
+		fixed = W16;
+		n -= 6;
+	} else if (n > 6 && memcmp(name + n - 6, "-imm32", 6) == 0) {
+		fixed = W32;
+		n -= 6;
+	} else if (n >= 7 && memcmp(name, "push-", 5) == 0 && (name[5] == 'u' || name[5] == 's')) {
+		if (n == 7 && name[6] == '8') {
+			fixed = W8;
+		} else if (n == 8 && memcmp(name + 6, "16", 2) == 0) {
+			fixed = W16;
+		} else if (n == 8 && memcmp(name + 6, "32", 2) == 0) {
+			fixed = W32;
+		}
+		if (fixed) {
+			push_base = name[5] == 's';
+			n = 4;
+		}
+	}
+
+	for (u32 k = 0; k < MNEMONIC_COUNT; k++) {
+		if (strlen(mnemonics[k].name) == n && memcmp(mnemonics[k].name, name, n) == 0) {
+			mn = &mnemonics[k];
+			break;
+		}
+	}
+	if (!mn || (fixed && !(mn->widths & fixed))) {
+		return fail(st, st->line, "unknown instruction");
+	}
+	if (!(it = add_item(st, ITEM_INSN))) {
+		return false;
+	}
+
+	if (at_end(st)) {
+		if (mn->stack < 0 || fixed) {
+			return fail(st, st->line, "missing operand");
+		}
+		it->op = mn->stack;
+		return true;
+	}
+	if (mn->imm < 0) {
+		return fail(st, st->line, "instruction takes no operand");
+	}
+	if (!expr(st, &it->arg)) {
+		return false;
+	}
+
+	it->op = push_base >= 0 ? push_base : mn->imm;
+	it->push = mn->imm == 0x00 && push_base < 0;
+	it->rel = it->arg.label >= 0 && mn->imm >= 0x2C && mn->imm <= 0x2E;
+	if (fixed) {
+		it->width = fixed;
+	} else {
+		it->grow = mn->widths;
+		it->width = mn->widths & -mn->widths;
+	}
+	return true;
+}
+
+// one line, from `line` to `end`:
+static bool statement(struct state *st, const char *line, const char *end)
+{
+	const char *c = memchr(line, ';', end - line);
+
+	st->p = line;
+	st->end = c ? c : end;
+
+	// labels:
+	for (;;) {
+		const char *q;
+		u32 n;
+		s32 i;
+
+		skip_space(st);
+		if ((n = name_len(st)) == 0) {
+			break;
+		}
+		q = st->p + n;
+		while (q < st->end && is_space(*q)) {
+			q++;
+		}
+		if (q == st->end || *q != ':') {
+			break;
+		}
+		if ((i = find_label(st, st->p, n)) < 0) {
+			return false;
+		}
+		if (st->labels[i].defined) {
+			return fail(st, st->line, "name defined twice");
+		}
+		st->labels[i].defined = true;
+		st->labels[i].item = st->n_items;
+		st->labels[i].line = st->line;
+		st->p = q + 1;
+	}
+
+	if (at_end(st)) {
+		return true;
+	}
+	if (*st->p == '.') {
+		if (!directive(st)) {
+			return false;
+		}
+	} else if (!instruction(st)) {
+		return false;
+	}
+	if (!at_end(st)) {
+		return fail(st, st->line, "unexpected text after operand");
+	}
+	return true;
+}
+
+// total bytes of items before `i`, as of the last layout():
+static inline u32 addr_of(const struct state *st, u32 i)
+{
+	const struct item *it;
+
+	if (i < st->n_items) {
+		return st->items[i].addr;
+	}
+	if (st->n_items == 0) {
+		return 0;
+	}
+	it = &st->items[st->n_items - 1];
+	return it->addr + (it->kind != ITEM_DATA) + it->width;
+}
+
+static void layout(struct state *st)
+{
+	u32 addr = 0;
+
+	for (u32 i = 0; i < st->n_items; i++) {
+		struct item *it = &st->items[i];
+
+		it->addr = addr;
+		addr += (it->kind != ITEM_DATA) + it->width;
+	}
+}
+
+// operand of `it` if its immediate takes `w` bytes:
+static s64 value(const struct state *st, const struct item *it, u8 w)
+{
+	const struct label *l;
+	s64 v = it->arg.value;
+
+	if (it->arg.label < 0) {
+		return v;
+	}
+	l = &st->labels[it->arg.label];
+	if (l->constant) {
+		return v + l->value;
+	}
+	v += addr_of(st, l->item);
+	if (it->rel) {
+		v -= it->addr + 1 + w;
+	}
+	return v;
+}
+
+// `v` fits `w` bytes, read as signed or unsigned:
+static inline bool holds(bool sign, u8 w, s64 v)
+{
+	if (w == 4) {
+		return v >= INT32_MIN && v <= UINT32_MAX;
+	}
+	if (sign) {
+		return v >= -((s64)1 << (8*w - 1)) && v < ((s64)1 << (8*w - 1));
+	}
+	return v >= 0 && v < ((s64)1 << (8*w));
+}
+
+static bool fits(const struct item *it, u8 w, s64 v)
+{
+	if (it->kind != ITEM_INSN) {
+		return holds(false, w, v) || holds(true, w, v);
+	}
+	if (w == 0) {
+		// no immediate:
+		return true;
+	}
+	return holds(it->push ? v < 0 : imm_is_signed(0x40 | it->op), w, v);
+}
+
+// size every immediate to hold its operand:
+static bool relax(struct state *st)
+{
+	bool grown;
+
+	do {
+		layout(st);
+		grown = false;
+		for (u32 i = 0; i < st->n_items; i++) {
+			struct item *it = &st->items[i];
+			u8 w;
+
+			if (!it->grow) {
+				continue;
+			}
+			for (w = it->width; w <= 4 && !((it->grow & w) && fits(it, w, value(st, it, w))); w <<= 1) {
+			}
+			if (w > 4) {
+				return fail(st, it->line, "operand out of range");
+			}
+			if (w != it->width) {
+				it->width = w;
+				grown = true;
+			}
+		}
+	} while (grown);
+
+	for (u32 i = 0; i < st->n_items; i++) {
+		struct item *it = &st->items[i];
+
+		if (!fits(it, it->width, value(st, it, it->width))) {
+			return fail(st, it->line, "operand out of range");
+		}
+	}
+	return true;
+}
+
+static void emit(const struct state *st, u8 *out)
+{
+	for (u32 i = 0; i < st->n_items; i++) {
+		const struct item *it = &st->items[i];
+		u8 *o = out + it->addr;
+		u32 v = (u32)value(st, it, it->width);
+
+		if (it->kind == ITEM_BAD) {
+			*o++ = it->op;
+		} else if (it->kind == ITEM_INSN) {
+			if (it->width == 0) {
+				*o = it->op;
+				continue;
+			}
+			*o++ = (it->width == 4 ? 0xC0 : it->width << 6) | it->op | (it->push && (s32)v < 0);
+		}
+		for (u8 k = 0; k < it->width; k++) {
+			*o++ = v >> (8*k);
+		}
+	}
+}
+
+// parse the `len` bytes of source text at `src` and size every item:
+static bool assemble(struct state *st, const char *src, size_t len)
+{
+	const char *line = src, *end = src + len;
+
+	while (line < end) {
+		const char *nl = memchr(line, '\n', end - line);
+
+		st->line++;
+		if (!statement(st, line, nl ? nl : end)) {
+			return false;
+		}
+		line = nl ? nl + 1 : end;
+	}
+
+	for (u32 i = 0; i < st->n_labels; i++) {
+		if (!st->labels[i].defined) {
+			return fail(st, st->labels[i].line, "undefined name");
+		}
+		if (st->labels[i].exported && st->labels[i].constant) {
+			return fail(st, st->labels[i].line, "only labels can be exported");
+		}
+	}
+
+	for (u32 i = 0; st->image && i < st->n_items; i++) {
+		struct item *it = &st->items[i];
+
+		if (it->arg.label < 0 || st->labels[it->arg.label].constant || it->rel) {
+			continue;
+		}
+		// the address is relocated:
+		if (!(it->grow & W32) && it->width != W32) {
+			return fail(st, it->line, "relocated operand needs 32 bits");
+		}
+		it->width = W32;
+		it->grow = 0;
+	}
+
+	return relax(st);
+}
+
+static inline void put32(u8 *p, u32 v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+// write the image of the assembled program to `out`, which holds `size` bytes:
+static void emit_image(const struct state *st, u8 *out, u32 size)
+{
+	const u32 m_size = addr_of(st, st->n_items);
+	struct rexlang_image_header h = {
+		.magic = REXLANG_IMAGE_MAGIC,
+		.version = REXLANG_IMAGE_VERSION,
+		.code_size = st->rodata >= 0 ? addr_of(st, st->rodata) : m_size,
+	};
+	u8 *p;
+
+	memset(out, 0, size);
+	emit(st, out + sizeof(h));
+	p = out + sizeof(h) + ((m_size + 3) & ~3u);
+
+	for (u32 i = 0; i < st->n_items; i++) {
+		const struct item *it = &st->items[i];
+
+		if (it->arg.label >= 0 && !st->labels[it->arg.label].constant && !it->rel) {
+			put32(p, it->addr + (it->kind == ITEM_INSN));
+			p += 4;
+			h.reloc_count++;
+		}
+	}
+	for (u32 i = 0; i < st->n_labels; i++) {
+		if (st->labels[i].exported) {
+			put32(p, h.strings_size);
+			put32(p + 4, addr_of(st, st->labels[i].item));
+			p += sizeof(struct rexlang_image_symbol);
+			h.symbol_count++;
+			h.strings_size += st->labels[i].len + 1;
+		}
+	}
+	for (u32 i = 0; i < st->n_labels; i++) {
+		if (st->labels[i].exported) {
+			memcpy(p, st->labels[i].name, st->labels[i].len);
+			p += st->labels[i].len + 1;
+		}
+	}
+
+	h.rodata_size = m_size - h.code_size;
+	put32(out, h.magic);
+	put32(out + 4, h.version);
+	put32(out + 8, h.code_size);
+	put32(out + 12, h.rodata_size);
+	put32(out + 16, h.reloc_count);
+	put32(out + 20, h.symbol_count);
+	put32(out + 24, h.strings_size);
+	put32(out + 28, h.reserved);
+}
+
+// bytes of the image of the assembled program:
+static uint64_t image_size(const struct state *st)
+{
+	uint64_t n = sizeof(struct rexlang_image_header) + ((addr_of(st, st->n_items) + 3) & ~3u);
+
+	for (u32 i = 0; i < st->n_items; i++) {
+		const struct item *it = &st->items[i];
+
+		n += it->arg.label >= 0 && !st->labels[it->arg.label].constant && !it->rel ? 4 : 0;
+	}
+	for (u32 i = 0; i < st->n_labels; i++) {
+		n += st->labels[i].exported ? sizeof(struct rexlang_image_symbol) + st->labels[i].len + 1 : 0;
+	}
+	return n;
+}
+
+bool rexlang_asm(const char *src, size_t len, uint8_t *out, uint32_t out_size, struct rexlang_asm_result *res)
+{
+	struct state st;
+	bool ok;
+
+	assert((src || len == 0) && "src cannot be NULL");
+	assert((out || out_size == 0) && "out cannot be NULL");
+	assert(res && "res cannot be NULL");
+
+	memset(&st, 0, sizeof(st));
+	st.rodata = -1;
+
+	res->size = 0;
+	if ((ok = assemble(&st, src, len))) {
+		res->size = addr_of(&st, st.n_items);
+		if (res->size > out_size) {
+			ok = fail(&st, 0, "program does not fit");
+		} else {
+			emit(&st, out);
+		}
+	}
+
+	res->line = st.error_line;
+	res->error = st.error;
+	free(st.items);
+	free(st.labels);
+	return ok;
+}
+
+bool rexlang_asm_image(const char *src, size_t len, uint8_t *out, uint32_t out_size, struct rexlang_asm_result *res)
+{
+	struct state st;
+	uint64_t size;
+	bool ok;
+
+	assert((src || len == 0) && "src cannot be NULL");
+	assert((out || out_size == 0) && "out cannot be NULL");
+	assert(res && "res cannot be NULL");
+
+	memset(&st, 0, sizeof(st));
+	st.image = true;
+	st.rodata = -1;
+
+	res->size = 0;
+	if ((ok = assemble(&st, src, len))) {
+		u32 code_size = st.rodata >= 0 ? addr_of(&st, st.rodata) : addr_of(&st, st.n_items);
+
+		for (u32 i = 0; ok && i < st.n_labels; i++) {
+			if (st.labels[i].exported && addr_of(&st, st.labels[i].item) >= code_size) {
+				ok = fail(&st, st.labels[i].line, "entry point outside the code");
+			}
+		}
+		size = image_size(&st);
+		res->size = size > UINT32_MAX ? UINT32_MAX : (u32)size;
+		if (ok && size > out_size) {
+			ok = fail(&st, 0, "program does not fit");
+		} else if (ok) {
+			emit_image(&st, out, res->size);
+		}
+	}
+
+	res->line = st.error_line;
+	res->error = st.error;
+	free(st.items);
+	free(st.labels);
+	return ok;
+}
+
+// the optimiser decodes a program into one item per instruction, from offset 0 on, and turns
+// every jump into a reference to the item it lands on: label k stands before item k. a rewrite
+// replaces the first item of a sequence and drops the others, which is only done if nothing
+// jumps into the middle of the sequence. dropped items are removed after every pass, moving
+// jumps to them on to the next item that stays, and the result is sized by relax() like
+// assembled source, so jump offsets follow the new layout.
+
+// base opcode `op` transfers control to its operand:
+static inline bool is_branch(u8 op)
+{
+	return op >= 0x28 && op <= 0x2E;
+}
+
+// sizes of the immediate forms of base opcode `op`:
+static inline u8 imm_widths(u8 op)
+{
+	return op <= 0x2F ? WALL : op <= 0x33 ? W8 : 0;
+}
+
+static bool valid_opcode(u8 o)
+{
+	switch (o >> 6) {
+		case 0:
+			return (o & 0x3F) <= 0x32 || (o & 0x3F) >= 0x38;
+		case 1:
+			return (o & 0x3F) <= 0x33;
+		default:
+			return (o & 0x3F) <= 0x2F;
+	}
+}
+
+static void set_stack(struct item *it, u8 op)
+{
+	it->op = op;
+	it->width = 0;
+	it->grow = 0;
+	it->push = false;
+	it->rel = false;
+	it->arg.label = -1;
+	it->arg.value = 0;
+}
+
+// immediate form of base opcode `op` with operand `v`, sized by relax():
+static void set_imm(struct item *it, u8 op, u32 v)
+{
+	// push-u* or push-s* is chosen by emit() from the sign of the operand, as for `push`:
+	it->op = op <= 0x01 ? 0x00 : op;
+	it->width = W8;
+	it->grow = imm_widths(op);
+	it->push = op <= 0x01;
+	it->rel = false;
+	it->arg.label = -1;
+	it->arg.value = (it->push || imm_is_signed(0x40 | op)) && (s32)v < 0 ? (s64)(s32)v : (s64)v;
+}
+
+// immediate form of branch `op` to item `target`:
+static void set_branch(struct item *it, u8 op, u32 target)
+{
+	set_imm(it, op, 0);
+	it->rel = op >= 0x2C;
+	it->arg.label = target;
+}
+
+static inline bool is_stack_op(const struct item *it, u8 op)
+{
+	return it->kind == ITEM_INSN && it->width == 0 && it->op == op;
+}
+
+static inline bool is_jump_abs(const struct item *it)
+{
+	return it->kind == ITEM_INSN && it->width != 0 && it->op == 0x29;
+}
+
+// execution may go on to the next item after `it`:
+static bool falls_through(const struct item *it)
+{
+	if (it->kind != ITEM_INSN) {
+		return false;
+	}
+	if (it->width == 0) {
+		return it->op != 0x00 && it->op != 0x38;
+	}
+	return it->push || (it->op != 0x29 && it->op != 0x2C);
+}
+
+// first item from `i` on that stays:
+static u32 live_from(const struct state *st, u32 i)
+{
+	while (i < st->n_items && st->items[i].dead) {
+		i++;
+	}
+	return i;
+}
+
+// item starting at offset `addr` of the decoded program, or -1:
+static s32 item_at(const struct state *st, s64 addr)
+{
+	u32 lo = 0, hi = st->n_items;
+
+	while (lo < hi) {
+		u32 mid = lo + (hi - lo) / 2;
+
+		if (st->items[mid].addr < addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo < st->n_items && st->items[lo].addr == addr ? (s32)lo : -1;
+}
+
+static bool decode_program(struct state *st, const u8 *m, u32 m_size)
+{
+	u32 p = 0;
+
+	while (p < m_size) {
+		u8 o = unfuse(m[p]);
+		u32 len = 1 + imm_size(o);
+		struct item *it;
+
+		st->line = p;
+		if (len > m_size - p) {
+			return fail(st, p, "truncated instruction");
+		}
+		if (o == 0x3F) {
+			return fail(st, p, "pcopy reads program memory, which the optimiser moves");
+		}
+		if (!(it = add_item(st, valid_opcode(o) ? ITEM_INSN : ITEM_BAD))) {
+			return false;
+		}
+		it->addr = p;
+		if (it->kind == ITEM_BAD) {
+			it->op = o;
+			it->width = len - 1;
+			it->arg.value = rdimm(m, p, o);
+		} else if (len == 1) {
+			set_stack(it, o);
+		} else {
+			set_imm(it, o & 0x3F, rdimm(m, p, o));
+		}
+		if (it->kind == ITEM_INSN && len > 1 && is_branch(o & 0x3F)) {
+			// the destination, until resolve_branches() finds its item:
+			it->arg.value = (o & 0x3F) >= 0x2C ? p + len + (s64)(s32)rdimm(m, p, o) : rdimm(m, p, o);
+		}
+		p += len;
+	}
+	return true;
+}
+
+// control arrives at the targets of branches and at the return address of calls:
+static void mark_targets(struct state *st)
+{
+	for (u32 i = 0; i < st->n_items; i++) {
+		st->items[i].target = false;
+	}
+	for (u32 i = 0; i < st->n_items; i++) {
+		const struct item *it = &st->items[i];
+
+		if (it->dead || it->kind != ITEM_INSN) {
+			continue;
+		}
+		if (it->arg.label >= 0 && (u32)it->arg.label < st->n_items) {
+			st->items[it->arg.label].target = true;
+		}
+		if (it->op == 0x28 && !it->push && i + 1 < st->n_items) {
+			st->items[i + 1].target = true;
+		}
+	}
+}
+
+// turn the destinations of branches into items. the stack forms take their destination from
+// a push right before them, and become immediate forms:
+static bool resolve_branches(struct state *st)
+{
+	for (u32 i = 0; i < st->n_items; i++) {
+		struct item *it = &st->items[i];
+		s64 dest;
+		s32 t;
+
+		if (it->kind != ITEM_INSN || it->push || !is_branch(it->op)) {
+			continue;
+		}
+		if (it->width) {
+			dest = it->arg.value;
+		} else if (i > 0 && st->items[i - 1].kind == ITEM_INSN && st->items[i - 1].push) {
+			dest = (s64)(s32)st->items[i - 1].arg.value + (it->op >= 0x2C ? it->addr + 1 : 0);
+			if (it->op < 0x2C) {
+				dest = (u32)dest;
+			}
+		} else {
+			return fail(st, it->addr, "computed jump");
+		}
+		if ((t = item_at(st, dest)) < 0) {
+			return fail(st, it->addr, "jump into an instruction or out of the program");
+		}
+		it->arg.label = t;
+		it->arg.value = 0;
+		it->rel = it->op >= 0x2C;
+	}
+
+	mark_targets(st);
+	for (u32 i = 0; i < st->n_items; i++) {
+		struct item *it = &st->items[i];
+
+		if (it->kind != ITEM_INSN || it->push || !is_branch(it->op) || it->width) {
+			continue;
+		}
+		if (it->target) {
+			// reached without its push:
+			return fail(st, it->addr, "computed jump");
+		}
+		st->items[i - 1].dead = true;
+		set_branch(it, it->op, it->arg.label);
+	}
+	return true;
+}
+
+// rewrite sequences of two items:
+static bool fold(struct state *st)
+{
+	bool changed = false;
+
+	for (u32 i = live_from(st, 0); i < st->n_items; i = live_from(st, i + 1)) {
+		struct item *a = &st->items[i];
+		u32 j = live_from(st, i + 1);
+		struct item *b = &st->items[j];
+		u32 x, y;
+
+		if (j == st->n_items || b->target || a->kind != ITEM_INSN || b->kind != ITEM_INSN) {
+			continue;
+		}
+		x = (u32)a->arg.value;
+		y = (u32)b->arg.value;
+
+		if (a->push && b->width == 0 && b->op >= 0x02 && b->op <= 0x31 && (b->op < 0x30 || x < 256)) {
+			// the pushed value becomes the immediate operand:
+			set_imm(a, b->op, x);
+		} else if (a->push && b->width && b->op >= 0x02 && b->op <= 0x11) {
+			set_imm(a, 0x00, rexlang_pure_eval(b->op, x, y));
+		} else if (a->push && b->width && (b->op == 0x30 || b->op == 0x31) && y < 32) {
+			set_imm(a, 0x00, b->op == 0x30 ? x << y : x >> y);
+		} else if (a->push && is_stack_op(b, 0x39)) {
+			set_imm(a, 0x00, !x);
+		} else if (a->push && is_stack_op(b, 0x3A)) {
+			set_imm(a, 0x00, -x);
+		} else if (a->push && is_stack_op(b, 0x3B)) {
+			a->dead = true;
+		} else if (a->push && b->width && (b->op == 0x2A || b->op == 0x2B || b->op == 0x2D || b->op == 0x2E)) {
+			// a conditional branch on a constant:
+			if ((x != 0) == (b->op == 0x2A || b->op == 0x2D)) {
+				set_branch(a, 0x29, b->arg.label);
+			} else {
+				a->dead = true;
+			}
+		} else if (!a->push && a->op >= 0x1C && a->op <= 0x21 && is_stack_op(b, 0x3B)) {
+			// the store leaves nothing on the stack:
+			a->op += 6;
+		} else {
+			continue;
+		}
+		b->dead = true;
+		changed = true;
+		i = j;
+	}
+	return changed;
+}
+
+// point branches past unconditional jumps they land on, and drop branches to the next item:
+static bool thread(struct state *st)
+{
+	bool changed = false;
+
+	for (u32 i = 0; i < st->n_items; i++) {
+		struct item *it = &st->items[i];
+		u32 t, steps;
+
+		if (it->dead || it->kind != ITEM_INSN || it->push || !is_branch(it->op) || !it->width) {
+			continue;
+		}
+		t = live_from(st, it->arg.label);
+		for (steps = 0; steps < st->n_items && t < st->n_items && is_jump_abs(&st->items[t]); steps++) {
+			t = live_from(st, st->items[t].arg.label);
+		}
+		if (steps == st->n_items) {
+			// a loop of jumps:
+			continue;
+		}
+		if (t != (u32)it->arg.label) {
+			it->arg.label = t;
+			changed = true;
+		}
+
+		if (t != live_from(st, i + 1) || it->op == 0x28 || it->op == 0x2C) {
+			continue;
+		}
+		if (it->op == 0x29) {
+			it->dead = true;
+		} else {
+			// the condition is still popped:
+			set_stack(it, 0x3B);
+		}
+		changed = true;
+	}
+	return changed;
+}
+
+// drop items that execution starting at item 0 never reaches; `work` holds n_items entries:
+static bool unreachable(struct state *st, u32 *work)
+{
+	bool changed = false;
+	u32 n = 0;
+
+	for (u32 i = 0; i < st->n_items; i++) {
+		st->items[i].target = false;
+	}
+	// target marks what is reached here:
+	if ((work[0] = live_from(st, 0)) < st->n_items) {
+		st->items[work[n++]].target = true;
+	}
+	while (n) {
+		u32 i = work[--n];
+		const struct item *it = &st->items[i];
+		u32 next[2];
+		ui k = 0;
+
+		if (falls_through(it)) {
+			next[k++] = live_from(st, i + 1);
+		}
+		if (it->kind == ITEM_INSN && !it->push && is_branch(it->op)) {
+			next[k++] = live_from(st, it->arg.label);
+		}
+		while (k--) {
+			if (next[k] < st->n_items && !st->items[next[k]].target) {
+				st->items[next[k]].target = true;
+				work[n++] = next[k];
+			}
+		}
+	}
+
+	for (u32 i = 0; i < st->n_items; i++) {
+		if (!st->items[i].dead && !st->items[i].target) {
+			st->items[i].dead = true;
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+// remove dead items; `map` holds n_items+1 entries:
+static void compact(struct state *st, u32 *map)
+{
+	u32 n = 0;
+
+	for (u32 i = 0; i < st->n_items; i++) {
+		map[i] = n;
+		n += !st->items[i].dead;
+	}
+	map[st->n_items] = n;
+
+	n = 0;
+	for (u32 i = 0; i < st->n_items; i++) {
+		struct item *it = &st->items[i];
+
+		if (it->dead) {
+			continue;
+		}
+		if (it->kind == ITEM_INSN && it->arg.label >= 0) {
+			it->arg.label = map[it->arg.label];
+		}
+		st->items[n++] = *it;
+	}
+	st->n_items = n;
+}
+
+bool rexlang_asm_optimize(const uint8_t *m, uint32_t m_size, uint8_t *out, uint32_t out_size, struct rexlang_opt_result *res)
+{
+	struct state st;
+	u32 *map = NULL;
+	bool ok;
+
+	assert((m || m_size == 0) && "m cannot be NULL");
+	assert((out || out_size == 0) && "out cannot be NULL");
+	assert(res && "res cannot be NULL");
+
+	memset(&st, 0, sizeof(st));
+	memset(res, 0, sizeof(*res));
+
+	ok = decode_program(&st, m, m_size) && resolve_branches(&st);
+	res->insns_before = st.n_items;
+	res->bytes_before = m_size;
+	if (ok && !(map = malloc(sizeof(u32) * (st.n_items + 1)))) {
+		ok = fail(&st, 0, "out of memory");
+	}
+
+	while (ok) {
+		bool changed;
+
+		compact(&st, map);
+		mark_targets(&st);
+		changed = fold(&st);
+		changed |= thread(&st);
+		changed |= unreachable(&st, map);
+		if (!changed) {
+			break;
+		}
+	}
+
+	if (ok) {
+		// label k stands before item k:
+		st.labels = calloc(st.n_items + 1, sizeof(struct label));
+		if (!st.labels) {
+			ok = fail(&st, 0, "out of memory");
+		}
+		for (u32 i = 0; ok && i <= st.n_items; i++) {
+			st.labels[i].defined = true;
+			st.labels[i].item = i;
+		}
+	}
+	if (ok && (ok = relax(&st))) {
+		res->insns_after = st.n_items;
+		res->bytes_after = addr_of(&st, st.n_items);
+		if (res->bytes_after > out_size) {
+			ok = fail(&st, 0, "program does not fit");
+		} else {
+			emit(&st, out);
+		}
+	}
+
+	res->ip = st.error_line;
+	res->error = st.error;
+	free(map);
+	free(st.items);
+	free(st.labels);
+	return ok;
+}
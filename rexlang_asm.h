@@ -0,0 +1,57 @@
+#ifndef _REXLANG_ASM_H_
+#define _REXLANG_ASM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// host-side assembler for the textual form of rexlang programs described in rexlang.md.
+// an instruction given an operand uses its immediate form, and the assembler picks the
+// smallest immediate that holds the operand. operands that refer to labels are sized over
+// several passes, so relative jumps to nearby labels end up as jump-rel-*-imm8.
+// rexlang_asm_optimize() rewrites programs into smaller equivalent ones the same way.
+
+// outcome of rexlang_asm():
+struct rexlang_asm_result {
+	uint32_t size;          // bytes of program memory the program takes
+	unsigned int line;      // line of the first error, counting from 1; 0 if there is none
+	const char *error;      // description of the first error; NULL if there is none
+};
+
+// assemble the `len` bytes of source text at `src` into program memory at `out`, which holds
+// `out_size` bytes. returns false with the error in `res` if the source is invalid or the
+// program does not fit; in the latter case `res->size` is the size it needs:
+bool rexlang_asm(const char *src, size_t len, uint8_t *out, uint32_t out_size, struct rexlang_asm_result *res);
+
+// assemble like rexlang_asm(), but into a program image as described in rexlang_image.h.
+// labels named by .export become its entry points and whatever follows .rodata its read-only
+// data. label operands other than jump-rel* offsets are relocated, so they take 32 bits:
+bool rexlang_asm_image(const char *src, size_t len, uint8_t *out, uint32_t out_size, struct rexlang_asm_result *res);
+
+// outcome of rexlang_asm_optimize():
+struct rexlang_opt_result {
+	uint32_t insns_before;  // instructions of the program
+	uint32_t bytes_before;
+	uint32_t insns_after;   // instructions of the optimised program
+	uint32_t bytes_after;
+	uint32_t ip;            // offset of the instruction that stopped the optimiser, if any
+	const char *error;      // why the program cannot be optimised; NULL if it can
+};
+
+// rewrite the `m_size` byte program at `m` into an equivalent one at `out`, which holds
+// `out_size` bytes and may be `m`. pushes feeding an instruction become its immediate form,
+// stores followed by discard their -discard form, arithmetic on constants is evaluated,
+// unreachable code is removed and branches to unconditional jumps go straight on to where
+// those lead, with every branch resized to its new offset. fused opcodes are read as the
+// instructions they stand for; fuse the result again if wanted.
+// the program is decoded as instructions from offset 0 to its end. it must not jump into an
+// instruction, compute a jump destination other than by pushing it right before the jump, or
+// use pcopy, since code moves. offset 0 is taken as the only entry point: code reached only
+// through rexlang_vm_call, an image entry point or a vm->ip set by the host is removed as
+// unreachable, so do not optimise programs entered elsewhere. the result only differs in
+// program offsets, such as those jump-rel pushes and vm->ip after an error, and in stack
+// overflows it no longer runs into.
+// returns false with the reason in `res` otherwise, or if the program does not fit:
+bool rexlang_asm_optimize(const uint8_t *m, uint32_t m_size, uint8_t *out, uint32_t out_size, struct rexlang_opt_result *res);
+
+#endif
@@ -0,0 +1,219 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "rexlang_batch.h"
+
+#define CACHE_LINE 64
+
+// each worker owns a contiguous range of images, packed into one word so that the owner taking
+// from the front and thieves taking from the back agree through a single compare-and-swap:
+struct worker {
+	uint64_t range;         // images not taken yet: first in the low half, end in the high half
+	const struct rexlang_batch *b;
+	struct rexlang_batch_result *results;
+	struct worker *all;
+	unsigned int index;
+	unsigned int count;
+	rexlang_ip *cs;         // call stack per lane
+	uint32_t *scratch;      // for rexlang_vm_exec_lockstep()
+	pthread_t thread;
+	bool started;
+} __attribute__((aligned(CACHE_LINE)));
+
+static inline uint64_t pack(uint32_t first, uint32_t end)
+{
+	return (uint64_t)end << 32 | first;
+}
+
+// take up to `max` images from the front of our own range; returns how many:
+static uint32_t take(struct worker *w, uint32_t *i, uint32_t max)
+{
+	uint64_t r = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+	uint32_t first, end, n;
+
+	do {
+		first = (uint32_t)r;
+		end = (uint32_t)(r >> 32);
+		n = end - first < max ? end - first : max;
+		if (n == 0) {
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(&w->range, &r, pack(first + n, end), true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	*i = first;
+	return n;
+}
+
+// move the back half of another worker's range into our own, which is empty:
+static bool steal(struct worker *w)
+{
+	for (unsigned int k = 1; k < w->count; k++) {
+		struct worker *v = &w->all[(w->index + k) % w->count];
+		uint64_t r = __atomic_load_n(&v->range, __ATOMIC_ACQUIRE);
+		uint32_t first, end, half;
+
+		for (;;) {
+			first = (uint32_t)r;
+			end = (uint32_t)(r >> 32);
+			if (first == end) {
+				break;
+			}
+			half = (end - first + 1) / 2;
+			if (__atomic_compare_exchange_n(&v->range, &r, pack(first, end - half), true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				__atomic_store_n(&w->range, pack(end - half, end), __ATOMIC_RELEASE);
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+static void setup(struct worker *w, struct rexlang_vm *vm, uint32_t i, rexlang_ip *cs)
+{
+	const struct rexlang_batch *b = w->b;
+
+	rexlang_vm_init(vm, b->m_size, b->m, b->d_size, b->d[i], b->syscall,
+		b->stacks + (size_t)i * b->ki_size, b->ki_size, cs, b->cs_size);
+	// verification and pre-decoding depend only on the program and the sizes, so they are shared:
+	vm->generation = b->generation;
+	vm->x = b->x;
+	vm->verified = b->verified;
+	vm->unchecked = b->verified;
+	if (b->ctx) {
+		vm->ctx = b->ctx[i];
+	}
+}
+
+static void report(struct worker *w, const struct rexlang_vm *vm, uint32_t i)
+{
+	w->results[i].err = vm->err;
+	w->results[i].ip = vm->ip;
+	w->results[i].sp = vm->sp;
+}
+
+static void run_image(struct worker *w, uint32_t i)
+{
+	struct rexlang_vm vm;
+
+	setup(w, &vm, i, w->cs);
+#ifdef REXLANG_JIT
+	if (w->b->jit) {
+		rexlang_vm_jit_exec(&vm, w->b->jit, w->b->instruction_count);
+	} else
+#endif
+	rexlang_vm_exec(&vm, w->b->instruction_count);
+	report(w, &vm, i);
+}
+
+// run the `n` images from `i` on as many lanes:
+static void run_lanes(struct worker *w, uint32_t i, uint32_t n)
+{
+	const struct rexlang_batch *b = w->b;
+	struct rexlang_vm vm[REXLANG_LOCKSTEP_LANES];
+	struct rexlang_vm *lanes[REXLANG_LOCKSTEP_LANES] = {NULL};
+
+	for (uint32_t l = 0; l < n; l++) {
+		setup(w, &vm[l], i + l, w->cs + (size_t)b->cs_size * l);
+		lanes[l] = &vm[l];
+	}
+	rexlang_vm_exec_lockstep(lanes, n, b->instruction_count, w->scratch, b->ki_size * REXLANG_LOCKSTEP_LANES);
+	for (uint32_t l = 0; l < n; l++) {
+		report(w, &vm[l], i + l);
+	}
+}
+
+static void *work(void *arg)
+{
+	struct worker *w = arg;
+	uint32_t i, n;
+
+	do {
+		if (w->b->lockstep) {
+			while ((n = take(w, &i, REXLANG_LOCKSTEP_LANES)) != 0) {
+				run_lanes(w, i, n);
+			}
+		} else {
+			while (take(w, &i, 1)) {
+				run_image(w, i);
+			}
+		}
+	} while (steal(w));
+
+	return NULL;
+}
+
+bool rexlang_batch_run(const struct rexlang_batch *b, unsigned int threads, struct rexlang_batch_result *results)
+{
+	struct worker *all;
+	rexlang_ip *cs;
+	uint32_t *scratch = NULL;
+	uint32_t lanes = b->lockstep ? REXLANG_LOCKSTEP_LANES : 1;
+
+	assert(b && results);
+	assert((b->count == 0 || (b->d && b->stacks)) && "images and stacks cannot be NULL");
+#ifdef REXLANG_JIT
+	assert((!b->jit || b->verified) && "native code requires a verified program");
+	// rather than quietly interpret every image, refuse native code for another program:
+	if (b->jit && !b->lockstep
+		&& (b->jit->m != b->m || b->jit->m_size != b->m_size || b->jit->generation != b->generation)) {
+		return false;
+	}
+#endif
+
+	if (threads == 0) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = n > 0 ? (unsigned int)n : 1;
+	}
+	if (threads > b->count) {
+		threads = b->count;
+	}
+	if (threads == 0) {
+		return true;
+	}
+
+	if (posix_memalign((void **)&all, CACHE_LINE, sizeof(*all) * threads) != 0) {
+		return false;
+	}
+	cs = malloc(sizeof(*cs) * b->cs_size * lanes * threads);
+	if (b->lockstep) {
+		scratch = malloc(sizeof(*scratch) * b->ki_size * REXLANG_LOCKSTEP_LANES * threads);
+	}
+	if (!cs || (b->lockstep && !scratch)) {
+		free(scratch);
+		free(cs);
+		free(all);
+		return false;
+	}
+
+	for (unsigned int k = 0; k < threads; k++) {
+		struct worker *w = &all[k];
+
+		w->range = pack((uint64_t)b->count * k / threads, (uint64_t)b->count * (k + 1) / threads);
+		w->b = b;
+		w->results = results;
+		w->all = all;
+		w->index = k;
+		w->count = threads;
+		w->cs = cs + (size_t)b->cs_size * lanes * k;
+		w->scratch = scratch ? scratch + (size_t)b->ki_size * REXLANG_LOCKSTEP_LANES * k : NULL;
+		w->started = false;
+	}
+
+	// a worker whose thread cannot be created leaves its range to be stolen by the others:
+	for (unsigned int k = 1; k < threads; k++) {
+		all[k].started = pthread_create(&all[k].thread, NULL, work, &all[k]) == 0;
+	}
+	work(&all[0]);
+	for (unsigned int k = 1; k < threads; k++) {
+		if (all[k].started) {
+			pthread_join(all[k].thread, NULL);
+		}
+	}
+
+	free(scratch);
+	free(cs);
+	free(all);
+	return true;
+}
@@ -0,0 +1,48 @@
+#ifndef _REXLANG_BATCH_H_
+#define _REXLANG_BATCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rexlang_vm.h"
+
+// runs one program against many independent data memory images on a pool of threads.
+// every image gets a fresh VM; workers take images from their own share of the batch and
+// steal half of another worker's remaining share when theirs runs out, so uneven run times
+// balance out. the program and everything else in the batch description are shared read-only.
+struct rexlang_batch {
+	const uint8_t *m;               // program memory
+	uint32_t m_size;
+	const struct rexlang_insn *x;   // optional pre-decoded program memory
+	uint32_t generation;            // of the program memory; see rexlang_vm_patch()
+#ifdef REXLANG_JIT
+	const struct rexlang_jit *jit;  // optional native code for `m` in `generation`; requires `verified`
+#endif
+	bool verified;                  // program passed rexlang_vm_verify() with these stack sizes and d_size
+	bool lockstep;                  // run groups of images with rexlang_vm_exec_lockstep(); ignores `jit`
+
+	rexlang_call_f syscall;         // called concurrently from all workers
+	void *const *ctx;               // optional vm->ctx per image
+	unsigned int instruction_count; // budget per image
+
+	uint8_t *const *d;              // data memory per image
+	uint32_t d_size;                // size of every image
+	uint32_t count;                 // number of images
+
+	uint32_t *stacks;               // count * ki_size entries; the data stack of image i is at stacks + i*ki_size
+	uint32_t ki_size;
+	uint32_t cs_size;               // call stacks are per worker
+};
+
+struct rexlang_batch_result {
+	enum rexlang_error err;         // error the image stopped with; REXLANG_ERR_SUCCESS if out of budget
+	rexlang_ip ip;
+	rexlang_sp sp;                  // the final data stack is stacks[i*ki_size + sp .. (i+1)*ki_size)
+};
+
+// run every image of `b` until it stops or uses up its budget, on `threads` threads including
+// the calling one (0 for one per online CPU), and store the outcome of image i in `results[i]`.
+// returns false if `jit` was compiled for another program or generation, or the worker state
+// could not be allocated, in which case nothing was run:
+bool rexlang_batch_run(const struct rexlang_batch *b, unsigned int threads, struct rexlang_batch_result *results);
+
+#endif
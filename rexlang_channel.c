@@ -0,0 +1,126 @@
+#include <assert.h>
+#include <string.h>
+#include "rexlang_channel.h"
+
+// length field of the marker that sends the consumer back to offset 0:
+#define PAD 0xFFFFFFFFu
+
+// bytes taken by the frame of a `len` byte message:
+static inline uint32_t frame_size(uint32_t len)
+{
+	return 4 + ((len + 3) & ~3u);
+}
+
+static inline uint32_t load_u32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+// whether a frame of a `len` byte message at `pos` lies before the end of the buffer and within
+// the `avail` bytes written but not consumed. the buffer may be writable by others than the
+// producer, e.g. a program whose data memory holds it:
+static inline bool frame_fits(const struct rexlang_channel *ch, uint32_t pos, uint32_t avail, uint32_t len)
+{
+	return len <= ch->size - pos - 4 && frame_size(len) <= avail;
+}
+
+void rexlang_channel_init(struct rexlang_channel *ch, uint8_t *buf, uint32_t size)
+{
+	assert(ch && "ch cannot be NULL");
+	assert(buf && "buf cannot be NULL");
+	assert(size >= 8 && (size & (size - 1)) == 0 && "size must be a power of two");
+
+	ch->buf = buf;
+	ch->size = size;
+	ch->head = 0;
+	ch->tail = 0;
+	ch->bad = false;
+}
+
+bool rexlang_channel_write(struct rexlang_channel *ch, const void *msg, uint32_t len)
+{
+	uint32_t head = ch->head;
+	uint32_t tail = __atomic_load_n(&ch->tail, __ATOMIC_ACQUIRE);
+	uint32_t pos = head & (ch->size - 1);
+	uint32_t need;
+
+	if (len > REXLANG_CHANNEL_MAX_MSG(ch->size)) {
+		return false;
+	}
+	need = frame_size(len);
+
+	if (need > ch->size - pos) {
+		// skip the rest of the buffer. the marker is published on its own so that a message
+		// that only fits once the consumer has caught up is not blocked by it forever:
+		if (ch->size - (head - tail) < ch->size - pos) {
+			return false;
+		}
+		memcpy(ch->buf + pos, &(uint32_t){PAD}, 4);
+		head += ch->size - pos;
+		pos = 0;
+		__atomic_store_n(&ch->head, head, __ATOMIC_RELEASE);
+	}
+
+	if (ch->size - (head - tail) < need) {
+		return false;
+	}
+
+	memcpy(ch->buf + pos, &len, 4);
+	memcpy(ch->buf + pos + 4, msg, len);
+	__atomic_store_n(&ch->head, head + need, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+bool rexlang_channel_peek(struct rexlang_channel *ch, const uint8_t **msg, uint32_t *len)
+{
+	uint32_t tail = ch->tail;
+	uint32_t head = __atomic_load_n(&ch->head, __ATOMIC_ACQUIRE);
+	uint32_t pos;
+
+	if (tail == head || ch->bad) {
+		return false;
+	}
+
+	pos = tail & (ch->size - 1);
+	if (load_u32(ch->buf + pos) == PAD) {
+		if (ch->size - pos > head - tail) {
+			ch->bad = true;
+			return false;
+		}
+		tail += ch->size - pos;
+		__atomic_store_n(&ch->tail, tail, __ATOMIC_RELEASE);
+		if (tail == head) {
+			return false;
+		}
+		pos = 0;
+	}
+
+	*len = load_u32(ch->buf + pos);
+	if (!frame_fits(ch, pos, head - tail, *len)) {
+		ch->bad = true;
+		return false;
+	}
+	*msg = ch->buf + pos + 4;
+
+	return true;
+}
+
+void rexlang_channel_consume(struct rexlang_channel *ch)
+{
+	uint32_t tail = ch->tail;
+	uint32_t head = __atomic_load_n(&ch->head, __ATOMIC_ACQUIRE);
+	uint32_t pos = tail & (ch->size - 1);
+	uint32_t len = load_u32(ch->buf + pos);
+
+	assert(tail != head && "nothing was peeked");
+
+	// the frame may have changed since it was peeked:
+	if (ch->bad || !frame_fits(ch, pos, head - tail, len)) {
+		ch->bad = true;
+		return;
+	}
+	__atomic_store_n(&ch->tail, tail + frame_size(len), __ATOMIC_RELEASE);
+}
@@ -0,0 +1,43 @@
+#ifndef _REXLANG_CHANNEL_H_
+#define _REXLANG_CHANNEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// single-producer, single-consumer ring of framed messages. the producer and the consumer
+// may run on different threads without locks: each only advances its own counter and
+// publishes it with release semantics after touching the buffer.
+//
+// every message is stored contiguously as a u32 length followed by the payload, padded to
+// a multiple of 4 bytes, so the consumer can use it in place. a frame that would run past
+// the end of the buffer is preceded by a padding marker and starts over at offset 0.
+struct rexlang_channel {
+	uint8_t *buf;
+	uint32_t size;          // power of two, at least 8
+
+	uint32_t head;          // bytes ever written; advanced by the producer only
+	uint32_t tail;          // bytes ever consumed; advanced by the consumer only
+	bool bad;               // the consumer met a frame that does not fit; set by the consumer only
+};
+
+// longest message a channel of `size` bytes can hold:
+#define REXLANG_CHANNEL_MAX_MSG(size) ((size) - 4)
+
+// `buf` must be 4-byte aligned and hold `size` bytes:
+void rexlang_channel_init(struct rexlang_channel *ch, uint8_t *buf, uint32_t size);
+
+// producer: append a message of `len` bytes. returns false if there is no room for it yet,
+// in which case nothing was written that the consumer can see:
+bool rexlang_channel_write(struct rexlang_channel *ch, const void *msg, uint32_t len);
+
+// consumer: point `*msg` and `*len` at the oldest message without removing it.
+// returns false if the channel is empty or `bad`. a frame reaching past the end of the buffer
+// or past what was written makes the channel `bad` for good, e.g. after a program that holds
+// the buffer in its data memory overwrote it:
+bool rexlang_channel_peek(struct rexlang_channel *ch, const uint8_t **msg, uint32_t *len);
+
+// consumer: remove the message returned by the last rexlang_channel_peek(), handing its space
+// back to the producer. makes the channel `bad` instead if the frame no longer fits:
+void rexlang_channel_consume(struct rexlang_channel *ch);
+
+#endif
@@ -0,0 +1,165 @@
+#include <assert.h>
+#include <string.h>
+#include "rexlang_vm_impl.h"
+#include "rexlang_image.h"
+
+#ifndef REXLANG_NO_MMAP
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#define HEADER_SIZE sizeof(struct rexlang_image_header)
+#define SYMBOL_SIZE sizeof(struct rexlang_image_symbol)
+
+// fields of the image header, as u32 offsets:
+enum {
+	H_MAGIC,
+	H_VERSION,
+	H_CODE_SIZE,
+	H_RODATA_SIZE,
+	H_RELOC_COUNT,
+	H_SYMBOL_COUNT,
+	H_STRINGS_SIZE,
+	H_RESERVED,
+};
+
+static inline u32 field(const u8 *p, ui i)
+{
+	return rdmu32(p, 4 * i);
+}
+
+bool rexlang_image_open(struct rexlang_image *img, const void *buf, size_t size)
+{
+	const u8 *const in = buf;
+	uint64_t m_size, n;
+
+	assert(img && "img cannot be NULL");
+	assert((buf || size == 0) && "buf cannot be NULL");
+
+	if (size < HEADER_SIZE
+		|| field(in, H_MAGIC) != REXLANG_IMAGE_MAGIC
+		|| field(in, H_VERSION) != REXLANG_IMAGE_VERSION
+		|| field(in, H_RESERVED) != 0) {
+		return false;
+	}
+
+	// sizes add up in 64 bits, so no field can wrap the total around:
+	m_size = (uint64_t)field(in, H_CODE_SIZE) + field(in, H_RODATA_SIZE);
+	n = HEADER_SIZE
+		+ ((m_size + 3) & ~(uint64_t)3)
+		+ 4 * (uint64_t)field(in, H_RELOC_COUNT)
+		+ SYMBOL_SIZE * (uint64_t)field(in, H_SYMBOL_COUNT)
+		+ field(in, H_STRINGS_SIZE);
+	if (m_size > UINT32_MAX || n > size) {
+		return false;
+	}
+
+	img->m = in + HEADER_SIZE;
+	img->m_size = (u32)m_size;
+	img->code_size = field(in, H_CODE_SIZE);
+	img->relocs = img->m + ((m_size + 3) & ~(uint64_t)3);
+	img->reloc_count = field(in, H_RELOC_COUNT);
+	img->symbols = img->relocs + 4 * img->reloc_count;
+	img->symbol_count = field(in, H_SYMBOL_COUNT);
+	img->strings = (const char *)img->symbols + SYMBOL_SIZE * img->symbol_count;
+	img->strings_size = field(in, H_STRINGS_SIZE);
+	img->map = NULL;
+	img->map_size = 0;
+
+	for (u32 i = 0; i < img->reloc_count; i++) {
+		u32 p = rdmu32(img->relocs, 4 * i);
+
+		if (img->m_size < 4 || p > img->m_size - 4) {
+			return false;
+		}
+	}
+	// names are NUL-terminated within the strings:
+	if (img->strings_size && img->strings[img->strings_size - 1] != '\0') {
+		return false;
+	}
+	for (u32 i = 0; i < img->symbol_count; i++) {
+		if (rdmu32(img->symbols, SYMBOL_SIZE * i) >= img->strings_size
+			|| rdmu32(img->symbols, SYMBOL_SIZE * i + 4) >= img->code_size) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool rexlang_image_symbol(const struct rexlang_image *img, const char *name, uint32_t *ip)
+{
+	assert(name && "name cannot be NULL");
+
+	for (u32 i = 0; i < img->symbol_count; i++) {
+		if (strcmp(img->strings + rdmu32(img->symbols, SYMBOL_SIZE * i), name) == 0) {
+			if (ip) {
+				*ip = rdmu32(img->symbols, SYMBOL_SIZE * i + 4);
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+bool rexlang_image_relocate(const struct rexlang_image *img, uint8_t *m, uint32_t m_size, uint32_t base)
+{
+	assert(m && "m cannot be NULL");
+
+	if (base > m_size || img->m_size > m_size - base) {
+		return false;
+	}
+	memmove(m + base, img->m, img->m_size);
+
+	for (u32 i = 0; i < img->reloc_count; i++) {
+		u8 *p = m + base + rdmu32(img->relocs, 4 * i);
+		u32 v = rdmu32(p, 0) + base;
+
+		p[0] = v;
+		p[1] = v >> 8;
+		p[2] = v >> 16;
+		p[3] = v >> 24;
+	}
+	return true;
+}
+
+#ifndef REXLANG_NO_MMAP
+bool rexlang_image_map(struct rexlang_image *img, const char *path)
+{
+	struct stat s;
+	void *map;
+	int fd;
+
+	assert(path && "path cannot be NULL");
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return false;
+	}
+	if (fstat(fd, &s) != 0 || s.st_size < (off_t)HEADER_SIZE) {
+		close(fd);
+		return false;
+	}
+	map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return false;
+	}
+	if (!rexlang_image_open(img, map, s.st_size)) {
+		munmap(map, s.st_size);
+		return false;
+	}
+	img->map = map;
+	img->map_size = s.st_size;
+	return true;
+}
+
+void rexlang_image_unmap(struct rexlang_image *img)
+{
+	if (img->map) {
+		munmap(img->map, img->map_size);
+		img->map = NULL;
+		img->map_size = 0;
+	}
+}
+#endif
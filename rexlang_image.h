@@ -0,0 +1,80 @@
+#ifndef _REXLANG_IMAGE_H_
+#define _REXLANG_IMAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// program images package a program for loading: a header, program memory (code followed by
+// read-only data for pcopy), a relocation table and a table of named entry points. all fields
+// are little endian u32s:
+//
+//   header        struct rexlang_image_header
+//   program       code_size + rodata_size bytes, then zero padding to a multiple of 4
+//   relocations   reloc_count program memory offsets of u32 program addresses
+//   symbols       symbol_count struct rexlang_image_symbol
+//   strings       strings_size bytes of NUL-terminated symbol names
+//
+// program memory starts right after the header, so an image used where it lies (mapped from
+// a file on the host, or in flash on a device) needs no copy. relocations only matter when
+// the program is copied to an offset within a larger program memory.
+
+#define REXLANG_IMAGE_MAGIC     0x43584552u     // "REXC"
+#define REXLANG_IMAGE_VERSION   1
+
+struct rexlang_image_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t code_size;
+	uint32_t rodata_size;
+	uint32_t reloc_count;
+	uint32_t symbol_count;
+	uint32_t strings_size;
+	uint32_t reserved;      // 0
+};
+
+struct rexlang_image_symbol {
+	uint32_t name;          // offset of the name in the strings
+	uint32_t ip;            // entry point; within the code
+};
+
+// checked view of an image. everything points into the image; nothing is copied:
+struct rexlang_image {
+	const uint8_t *m;       // program memory, for rexlang_vm_init()
+	uint32_t m_size;
+	uint32_t code_size;     // read-only data follows the code up to m_size
+	const uint8_t *relocs;
+	uint32_t reloc_count;
+	const uint8_t *symbols;
+	uint32_t symbol_count;
+	const char *strings;
+	uint32_t strings_size;
+
+	void *map;              // mapping made by rexlang_image_map(), or NULL
+	size_t map_size;
+};
+
+// check the `size` byte image at `buf` and describe it in `img`. only the header and tables
+// are read, so program memory of an image mapped from a file is paged in as the VM first
+// touches it. returns false if the image is malformed:
+bool rexlang_image_open(struct rexlang_image *img, const void *buf, size_t size);
+
+// entry point of the symbol called `name`; returns false if there is none:
+bool rexlang_image_symbol(const struct rexlang_image *img, const char *name, uint32_t *ip);
+
+// copy the program into `m`, which holds `m_size` bytes, at offset `base`, adding `base` to
+// every relocated address so that the copy runs from there; its entry points are `base`
+// further on too. returns false if it does not fit:
+bool rexlang_image_relocate(const struct rexlang_image *img, uint8_t *m, uint32_t m_size, uint32_t base);
+
+#ifndef REXLANG_NO_MMAP
+// map the image file at `path` read-only and open it. programs mapped this way share their
+// pages between every VM and process that maps the file. returns false if the file cannot be
+// mapped or is malformed:
+bool rexlang_image_map(struct rexlang_image *img, const char *path);
+
+// unmap an image mapped by rexlang_image_map():
+void rexlang_image_unmap(struct rexlang_image *img);
+#endif
+
+#endif
@@ -0,0 +1,323 @@
+#include <assert.h>
+#include <string.h>
+#include "rexlang_vm_impl.h"
+#include "rexlang_stdlib.h"
+
+// indexed by function code; chip functions take the chip number as their first argument:
+const struct rexlang_syscall_sig rexlang_stdlib_sigs[REXLANG_STDLIB_SIG_COUNT] = {
+	{0x0000, 2, 0}, // chip-set-addr
+	{0x0001, 1, 1}, // chip-rdn-u8
+	{0x0002, 2, 0}, // chip-wrn-u8
+	{0x0003, 1, 1}, // chip-rda-u8
+	{0x0004, 1, 1}, // chip-rda-u16
+	{0x0005, 2, 0}, // chip-wra-u8
+	{0x0006, 2, 0}, // chip-wra-u16
+	{0x0007, 3, 1}, // chip-rda-blk
+	{0x0008, 3, 0}, // chip-wra-blk
+	{0x0009, 4, 1}, // chip-rda-gather
+	{0x000A, 4, 0}, // chip-wra-scatter
+	{0x000B, 3, 1}, // emit
+	{0x000C, 2, 1}, // emit-u32
+	{0x000D, 0, 1}, // recv-poll
+	{0x000E, 0, 2}, // recv-peek
+	{0x000F, 0, 2}, // recv
+	{0x0010, 0, 0}, // recv-release
+	{0x0011, 2, 0}, // wait-event
+};
+
+void rexlang_stdlib_init(struct rexlang_stdlib *lib)
+{
+	assert(lib && "lib cannot be NULL");
+
+	memset(lib, 0, sizeof(struct rexlang_stdlib));
+}
+
+void rexlang_stdlib_set_chip(struct rexlang_stdlib *lib, uint32_t n, const struct rexlang_chip *chip)
+{
+	assert(n < REXLANG_CHIP_COUNT);
+
+	lib->chip[n] = chip;
+	lib->addr[n] = 0;
+}
+
+void rexlang_stdlib_set_output(struct rexlang_stdlib *lib, uint32_t n, struct rexlang_channel *ch)
+{
+	assert(n < REXLANG_OUTPUT_COUNT);
+
+	lib->out[n] = ch;
+}
+
+void rexlang_stdlib_set_input(struct rexlang_stdlib *lib, struct rexlang_channel *ch)
+{
+	lib->in = ch;
+}
+
+// [p, p+len) lies within [0, size):
+static inline bool in_range(u32 p, u32 len, u32 size)
+{
+	return len <= size && p <= size - len;
+}
+
+// errors are recorded in vm->err and end the syscall; the interpreter stops on them:
+static bool chip_read(struct rexlang_vm *vm, const struct rexlang_chip *chip, u32 addr, u8 *dst, u32 len)
+{
+	if (chip->mem) {
+		if (!in_range(addr, len, chip->size)) {
+			vm->err = REXLANG_ERR_CALL_ARG_OUT_OF_RANGE;
+			return false;
+		}
+		memcpy(dst, chip->mem + addr, len);
+		return true;
+	}
+	if (!chip->read || !chip->read(chip->ctx, addr, dst, len)) {
+		vm->err = REXLANG_ERR_CALL_ARG_OUT_OF_RANGE;
+		return false;
+	}
+	return true;
+}
+
+static bool chip_write(struct rexlang_vm *vm, const struct rexlang_chip *chip, u32 addr, const u8 *src, u32 len)
+{
+	if (chip->mem) {
+		if (!in_range(addr, len, chip->size)) {
+			vm->err = REXLANG_ERR_CALL_ARG_OUT_OF_RANGE;
+			return false;
+		}
+		memcpy(chip->mem + addr, src, len);
+		return true;
+	}
+	if (!chip->write || !chip->write(chip->ctx, addr, src, len)) {
+		vm->err = REXLANG_ERR_CALL_ARG_OUT_OF_RANGE;
+		return false;
+	}
+	return true;
+}
+
+// data memory block [p, p+len), or NULL after recording the error:
+static u8 *data_block(struct rexlang_vm *vm, u32 p, u32 len)
+{
+	if (!in_range(p, len, vm->d_size)) {
+		vm->err = REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS;
+		return NULL;
+	}
+	return vm->d + p;
+}
+
+// move the spans listed at `list` between the chip and the contiguous block at `p`; returns
+// the end of the block:
+static u32 chip_spans(struct rexlang_vm *vm, const struct rexlang_chip *chip, u32 n, u32 list, u32 p, bool write)
+{
+	const u8 *l;
+
+	if (n > vm->d_size / sizeof(struct rexlang_chip_span) || !(l = data_block(vm, list, n * sizeof(struct rexlang_chip_span)))) {
+		vm->err = REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS;
+		return p;
+	}
+
+	for (u32 i = 0; i < n; i++) {
+		struct rexlang_chip_span s;
+		u8 *b;
+
+		memcpy(&s, l + i * sizeof(s), sizeof(s));
+		if (!(b = data_block(vm, p, s.len))) {
+			return p;
+		}
+		if (!(write ? chip_write(vm, chip, s.addr, b, s.len) : chip_read(vm, chip, s.addr, b, s.len))) {
+			return p;
+		}
+		if (!write && s.len) {
+			dirty_data(vm, p, s.len);
+		}
+		p += s.len;
+	}
+
+	return p;
+}
+
+// append a message to output channel `n`; pushes 1 if it was queued and 0 if the channel is full:
+static void emit(struct rexlang_vm *vm, struct rexlang_stdlib *lib, u32 n, const u8 *msg, u32 len)
+{
+	struct rexlang_channel *ch;
+
+	if (n >= REXLANG_OUTPUT_COUNT || !(ch = lib->out[n]) || len > REXLANG_CHANNEL_MAX_MSG(ch->size)) {
+		vm->err = REXLANG_ERR_CALL_ARG_OUT_OF_RANGE;
+		return;
+	}
+	push(vm, rexlang_channel_write(ch, msg, len));
+}
+
+// push the data memory address and length of the oldest input message, or 0 and 0 if there is
+// none; returns whether there was one:
+static bool recv_peek(struct rexlang_vm *vm, struct rexlang_channel *in)
+{
+	const u8 *msg;
+	u32 len;
+
+	if (!in) {
+		vm->err = REXLANG_ERR_CALL_ARG_OUT_OF_RANGE;
+		return false;
+	}
+	assert(in->buf >= vm->d && in->size <= vm->d_size && in->buf - vm->d <= vm->d_size - in->size
+		&& "input queue must lie within data memory");
+
+	// the program can overwrite the queue; peeking checks the frame against it:
+	if (!rexlang_channel_peek(in, &msg, &len)) {
+		if (in->bad) {
+			vm->err = REXLANG_ERR_CALL_ARG_OUT_OF_RANGE;
+			return false;
+		}
+		push(vm, 0);
+		push(vm, 0);
+		return false;
+	}
+	push(vm, msg - vm->d);
+	push(vm, len);
+	return true;
+}
+
+void rexlang_stdlib_syscall(struct rexlang_vm *vm, uint32_t fn)
+{
+	struct rexlang_stdlib *lib = vm->ctx;
+	const struct rexlang_chip *chip;
+	u32 a[4];
+	u32 *addr;
+	u8 b[4];
+	u8 *blk;
+	const u8 *msg;
+
+	assert(lib && "vm->ctx must point to a struct rexlang_stdlib");
+
+	if (fn >= REXLANG_STDLIB_SIG_COUNT) {
+		vm->err = REXLANG_ERR_BAD_SYSCALL;
+		return;
+	}
+
+	// arguments are pushed in order, so the last one is on top:
+	for (ui i = rexlang_stdlib_sigs[fn].args; i > 0; i--) {
+		a[i-1] = pop(vm);
+	}
+	if (vm->err != REXLANG_ERR_SUCCESS) {
+		return;
+	}
+
+	// functions that do not take a chip number:
+	switch (fn) {
+		case 0x000B: // emit
+			if ((blk = data_block(vm, a[2], a[1]))) {
+				emit(vm, lib, a[0], blk, a[1]);
+			}
+			return;
+		case 0x000C: // emit-u32
+			b[0] = a[1];
+			b[1] = a[1] >> 8;
+			b[2] = a[1] >> 16;
+			b[3] = a[1] >> 24;
+			emit(vm, lib, a[0], b, 4);
+			return;
+		case 0x000D: // recv-poll
+			if (!lib->in) {
+				vm->err = REXLANG_ERR_CALL_ARG_OUT_OF_RANGE;
+				return;
+			}
+			push(vm, rexlang_channel_peek(lib->in, &msg, &a[0]));
+			if (lib->in->bad) {
+				vm->err = REXLANG_ERR_CALL_ARG_OUT_OF_RANGE;
+			}
+			return;
+		case 0x000E: // recv-peek
+			recv_peek(vm, lib->in);
+			return;
+		case 0x000F: // recv
+			// wait for the host to write a message; the program retries after it resumes:
+			if (!recv_peek(vm, lib->in) && vm->err == REXLANG_ERR_SUCCESS) {
+				vm->err = REXLANG_ERR_YIELDED;
+			}
+			return;
+		case 0x0010: // recv-release
+			if (!lib->in) {
+				vm->err = REXLANG_ERR_CALL_ARG_OUT_OF_RANGE;
+				return;
+			}
+			if (rexlang_channel_peek(lib->in, &msg, &a[0])) {
+				rexlang_channel_consume(lib->in);
+			}
+			if (lib->in->bad) {
+				vm->err = REXLANG_ERR_CALL_ARG_OUT_OF_RANGE;
+			}
+			return;
+		case 0x0011: // wait-event
+			vm->wait_events = a[0];
+			vm->wait_cycles = a[1];
+			vm->err = REXLANG_ERR_YIELDED;
+			return;
+	}
+
+	if (a[0] >= REXLANG_CHIP_COUNT || !(chip = lib->chip[a[0]])) {
+		vm->err = REXLANG_ERR_CALL_ARG_OUT_OF_RANGE;
+		return;
+	}
+	addr = &lib->addr[a[0]];
+
+	switch (fn) {
+		case 0x0000: // chip-set-addr
+			*addr = a[1];
+			break;
+		case 0x0001: // chip-rdn-u8
+			if (chip_read(vm, chip, *addr, b, 1)) {
+				push(vm, b[0]);
+			}
+			break;
+		case 0x0002: // chip-wrn-u8
+			b[0] = a[1];
+			chip_write(vm, chip, *addr, b, 1);
+			break;
+		case 0x0003: // chip-rda-u8
+			if (chip_read(vm, chip, *addr, b, 1)) {
+				*addr += 1;
+				push(vm, b[0]);
+			}
+			break;
+		case 0x0004: // chip-rda-u16
+			if (chip_read(vm, chip, *addr, b, 2)) {
+				*addr += 2;
+				push(vm, b[0] | (b[1] << 8));
+			}
+			break;
+		case 0x0005: // chip-wra-u8
+			b[0] = a[1];
+			if (chip_write(vm, chip, *addr, b, 1)) {
+				*addr += 1;
+			}
+			break;
+		case 0x0006: // chip-wra-u16
+			b[0] = a[1];
+			b[1] = a[1] >> 8;
+			if (chip_write(vm, chip, *addr, b, 2)) {
+				*addr += 2;
+			}
+			break;
+		case 0x0007: // chip-rda-blk
+			if ((blk = data_block(vm, a[2], a[1])) && chip_read(vm, chip, *addr, blk, a[1])) {
+				if (a[1]) {
+					dirty_data(vm, a[2], a[1]);
+				}
+				*addr += a[1];
+				push(vm, a[2] + a[1]);
+			}
+			break;
+		case 0x0008: // chip-wra-blk
+			if ((blk = data_block(vm, a[2], a[1])) && chip_write(vm, chip, *addr, blk, a[1])) {
+				*addr += a[1];
+			}
+			break;
+		case 0x0009: // chip-rda-gather
+			a[3] = chip_spans(vm, chip, a[1], a[2], a[3], false);
+			if (vm->err == REXLANG_ERR_SUCCESS) {
+				push(vm, a[3]);
+			}
+			break;
+		case 0x000A: // chip-wra-scatter
+			chip_spans(vm, chip, a[1], a[2], a[3], true);
+			break;
+	}
+}
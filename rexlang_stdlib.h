@@ -0,0 +1,63 @@
+#ifndef _REXLANG_STDLIB_H_
+#define _REXLANG_STDLIB_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "rexlang_vm.h"
+#include "rexlang_channel.h"
+
+// reference implementation of the standard function library (see rexlang.md).
+// set vm->ctx to a struct rexlang_stdlib and vm->syscall to rexlang_stdlib_syscall.
+
+#define REXLANG_CHIP_COUNT 0x40
+#define REXLANG_OUTPUT_COUNT 0x10
+
+// chip backend. chips with plain memory set `mem` and `size` and are accessed directly;
+// otherwise `read` and `write` are called, and return false if the range is not mapped:
+struct rexlang_chip {
+	uint8_t *mem;
+	uint32_t size;
+
+	bool (*read)(void *ctx, uint32_t addr, uint8_t *dst, uint32_t len);
+	bool (*write)(void *ctx, uint32_t addr, const uint8_t *src, uint32_t len);
+	void *ctx;
+};
+
+struct rexlang_stdlib {
+	const struct rexlang_chip *chip[REXLANG_CHIP_COUNT];    // NULL if not present
+	uint32_t addr[REXLANG_CHIP_COUNT];                      // chip addresses
+
+	struct rexlang_channel *out[REXLANG_OUTPUT_COUNT];      // message channels to the host; NULL if not present
+	struct rexlang_channel *in;                             // message queue from the host in data memory; NULL if not present
+};
+
+// entry in the (addr, len) list of chip-rda-gather and chip-wra-scatter, as stored in data memory:
+struct rexlang_chip_span {
+	uint32_t addr;
+	uint32_t len;
+};
+
+// stack effects of the library's syscalls, for rexlang_vm_verify():
+#define REXLANG_STDLIB_SIG_COUNT 18
+extern const struct rexlang_syscall_sig rexlang_stdlib_sigs[REXLANG_STDLIB_SIG_COUNT];
+
+void rexlang_stdlib_init(struct rexlang_stdlib *lib);
+
+// attach chip `n`; pass NULL to detach it:
+void rexlang_stdlib_set_chip(struct rexlang_stdlib *lib, uint32_t n, const struct rexlang_chip *chip);
+
+// attach output channel `n`, which the program writes with emit and the host drains with
+// rexlang_channel_peek() and rexlang_channel_consume(), possibly from another thread.
+// pass NULL to detach it:
+void rexlang_stdlib_set_output(struct rexlang_stdlib *lib, uint32_t n, struct rexlang_channel *ch);
+
+// attach the input queue, which the host fills with rexlang_channel_write() and the program
+// reads in place with recv. its buffer must lie within the VM's data memory, which the program
+// should treat as read-only. a program waiting in recv yields with REXLANG_ERR_YIELDED; the
+// host acknowledges that once it has written a message. pass NULL to detach it:
+void rexlang_stdlib_set_input(struct rexlang_stdlib *lib, struct rexlang_channel *ch);
+
+// rexlang_call_f implementing the library for vm->ctx:
+void rexlang_stdlib_syscall(struct rexlang_vm *vm, uint32_t fn);
+
+#endif
@@ -1,1085 +1,277 @@
-
 #include <assert.h>
 #include <string.h>
 #include <stdbool.h>
 #include <setjmp.h>
 #include "rexlang_vm_impl.h"
 
-static void opcode(struct rexlang_vm *vm)
-{
-	u32 a;
-	u32 b;
-	u32 c;
-	s32 sa;
-	s32 sb;
+// threaded dispatch via GCC's labels-as-values extension is used when available;
+// define REXLANG_NO_COMPUTED_GOTO to force the portable switch-based dispatch.
+#if defined(__GNUC__) && !defined(REXLANG_NO_COMPUTED_GOTO)
+#  define REXLANG_COMPUTED_GOTO
+#endif
 
-	bounds_check_prgm(vm, vm->ip);
+// define REXLANG_TOS_CACHE to keep the top data stack item in a register across instructions.
+// an empty stack parks the cached item in ki[0], found by masking sp, so ki_size must be a
+// power of two.
 
-// the `goto error` pattern significantly reduces redundant branch targets
-// compared with inlined push()/pop() calls, when using arm-none-eabi-gcc v13.3.1
-#define push(v) { \
-	if (unlikely(vm->sp == 0)) { \
-		goto error_stack_full; \
-	} \
- \
-	vm->ki[--vm->sp] = v; \
-}
+#define LOOP_NAME exec_loop
+#include "rexlang_vm_loop.h"
 
-#define pop(v) { \
-	if (unlikely(vm->sp >= REXLANG_DATA_STACKSZ)) { \
-		goto error_stack_empty; \
-	} \
- \
-	v = vm->ki[vm->sp++]; \
-}
+#define LOOP_NAME exec_loop_predecoded
+#define LOOP_PREDECODED
+#include "rexlang_vm_loop.h"
 
-	u8 o = rdipu8(vm);
-	switch (o) {
-		// no immediates; stack-only operations:
-		case 0x00: // halt
-			vm->err = REXLANG_ERR_HALTED;
-			break;
-		case 0x01: // nop
-			break;
+#define LOOP_NAME exec_loop_verified
+#define LOOP_VERIFIED
+#include "rexlang_vm_loop.h"
 
-		case 0x02: // eq
-			pop(a);
-			pop(b);
-		impl_eq:
-			push(b == a);
-			break;
-		case 0x03: // ne
-			pop(a);
-			pop(b);
-		impl_ne:
-			push(b != a);
-			break;
-		case 0x04: // le-ui
-			pop(a);
-			pop(b);
-		impl_le_ui:
-			push(b <= a);
-			break;
-		case 0x05: // le-si
-			pop(sa);
-			pop(sb);
-		impl_le_si:
-			push(sb <= sa);
-			break;
-		case 0x06: // gt-ui
-			pop(a);
-			pop(b);
-		impl_gt_ui:
-			push(b > a);
-			break;
-		case 0x07: // gt-si
-			pop(sa);
-			pop(sb);
-		impl_gt_si:
-			push(sb > sa);
-			break;
-		case 0x08: // lt-ui
-			pop(a);
-			pop(b);
-		impl_lt_ui:
-			push(b < a);
-			break;
-		case 0x09: // lt-si
-			pop(sa);
-			pop(sb);
-		impl_lt_si:
-			push(sb < sa);
-			break;
-		case 0x0A: // ge-ui
-			pop(a);
-			pop(b);
-		impl_ge_ui:
-			push(b >= a);
-			break;
-		case 0x0B: // ge-si
-			pop(sa);
-			pop(sb);
-		impl_ge_si:
-			push(sb >= sa);
-			break;
-		case 0x0C: // and
-			pop(a);
-			pop(b);
-		impl_and:
-			push(b & a);
-			break;
-		case 0x0D: // or
-			pop(a);
-			pop(b);
-		impl_or:
-			push(b | a);
-			break;
-		case 0x0E: // xor
-			pop(a);
-			pop(b);
-		impl_xor:
-			push(b ^ a);
-			break;
-		case 0x0F: // add
-			pop(a);
-			pop(b);
-		impl_add:
-			push(b + a);
-			break;
-		case 0x10: // sub
-			pop(a);
-			pop(b);
-		impl_sub:
-			push(b - a);
-			break;
-		case 0x11: // mul
-			pop(a);
-			pop(b);
-		impl_mul:
-			push(b * a);
-			break;
+#define LOOP_NAME exec_loop_predecoded_verified
+#define LOOP_PREDECODED
+#define LOOP_VERIFIED
+#include "rexlang_vm_loop.h"
 
-		case 0x12: // ld-u8
-			pop(a);
-		impl_ld_u8:
-			push(rddu8(vm, a));
-			break;
-		case 0x13: // ld-u16
-			pop(a);
-		impl_ld_u16:
-			push(rddu16(vm, a));
-			break;
-		case 0x14: // ld-u32
-			pop(a);
-		impl_u32:
-			push(rddu32(vm, a));
-			break;
-		case 0x15: // ld-u8-offs
-			pop(a);
-			pop(b);
-		impl_ld_u8_offs:
-			push(rddu8(vm, b+a));
-			break;
-		case 0x16: // ld-u16-offs
-			pop(a);
-			pop(b);
-		impl_ld_u16_offs:
-			push(rddu16(vm, b+a));
-			break;
-		case 0x17: // ld-u32-offs
-			pop(a);
-			pop(b);
-		impl_ld_u32_offs:
-			push(rddu32(vm, b+a));
-			break;
-		case 0x18: // ld-s8
-			pop(a);
-		impl_ld_s8:
-			push((s8)rddu8(vm, a));
-			break;
-		case 0x19: // ld-s16
-			pop(a);
-		impl_ld_s16:
-			push((s16)rddu16(vm, a));
-			break;
-		case 0x1A: // ld-s8-offs
-			pop(a);
-			pop(b);
-		impl_ld_s8_offs:
-			push((s8)rddu8(vm, b+a));
-			break;
-		case 0x1B: // ld-s16-offs
-			pop(a);
-			pop(b);
-		impl_ld_s16_offs:
-			push((s16)rddu16(vm, b+a));
-			break;
-		case 0x1C: // st-u8
-			pop(a);
-			pop(b);
-		impl_st_u8:
-			wrdu8(vm, a, b);
-			push(b);
-			break;
-		case 0x1D: // st-u16
-			pop(a);
-			pop(b);
-		impl_st_u16:
-			wrdu16(vm, a, b);
-			push(b);
-			break;
-		case 0x1E: // st-u32
-			pop(a);
-			pop(b);
-		impl_st_u32:
-			wrdu32(vm, a, b);
-			push(b);
-			break;
-		case 0x1F: // st-u8-offs
-			pop(a);
-			pop(b);
-			pop(c);
-		impl_st_u8_offs:
-			wrdu8(vm, b+a, c);
-			push(c);
-			break;
-		case 0x20: // st-u16-offs
-			pop(a);
-			pop(b);
-			pop(c);
-		impl_st_u16_offs:
-			wrdu16(vm, b+a, c);
-			push(c);
-			break;
-		case 0x21: // st-u32-offs
-			pop(a);
-			pop(b);
-			pop(c);
-		impl_st_u32_offs:
-			wrdu32(vm, b+a, c);
-			push(c);
-			break;
-		case 0x22: // st-u8--discard
-			pop(a);
-			pop(b);
-		impl_st_u8_discard:
-			wrdu8(vm, a, b);
-			break;
-		case 0x23: // st-u16-discard
-			pop(a);
-			pop(b);
-		impl_st_u16_discard:
-			wrdu16(vm, a, b);
-			break;
-		case 0x24: // st-u32-discard
-			pop(a);
-			pop(b);
-		impl_st_u32_discard:
-			wrdu32(vm, a, b);
-			break;
-		case 0x25: // st-u8-offs-discard
-			pop(a);
-			pop(b);
-			pop(c);
-		impl_st_u8_offs_discard:
-			wrdu8(vm, b+a, c);
-			break;
-		case 0x26: // st-u16-offs-discard
-			pop(a);
-			pop(b);
-			pop(c);
-		impl_st_u16_offs_discard:
-			wrdu16(vm, b+a, c);
-			break;
-		case 0x27: // st-u32-offs-discard
-			pop(a);
-			pop(b);
-			pop(c);
-		impl_st_u32_offs_discard:
-			wrdu32(vm, b+a, c);
-			break;
-		case 0x28: // call
-			pop(a);
-			if (vm->cp == 0) {
-				vm->err = REXLANG_ERR_CALL_STACK_FULL;
-				goto error;
-			}
-			vm->cs[--vm->cp] = vm->ip;
-			vm->ip = a;
-			break;
-		case 0x29: // jump-abs
-			pop(a);
-		impl_jump_abs:
-			vm->ip = a;
-			break;
-		case 0x2A: // jump-abs-if
-			pop(a);
-			pop(b);
-		impl_jump_abs_if:
-			if (b != 0) {
-				vm->ip = a;
-			}
-			break;
-		case 0x2B: // jump-abs-if-not
-			pop(a);
-			pop(b);
-		impl_jump_abs_if_not:
-			if (b == 0) {
-				vm->ip = a;
-			}
-			break;
-		case 0x2C: // jump-rel
-			pop(sa);
-		impl_jump_rel:
-			push(vm->ip);
-			vm->ip += sa;
-			break;
-		case 0x2D: // jump-rel-if
-			pop(sa);
-			pop(b);
-		impl_jump_rel_if:
-			if (b != 0) {
-				vm->ip += sa;
-			}
-			break;
-		case 0x2E: // jump-rel-if-not
-			pop(sa);
-			pop(b);
-		impl_jump_rel_if_not:
-			if (b == 0) {
-				vm->ip += sa;
-			}
-			break;
-		case 0x2F: // syscall
-			pop(a);
-		impl_syscall:
-			if (!vm->syscall) {
-				vm->err = REXLANG_ERR_BAD_SYSCALL;
-				goto error;
-			}
-			vm->syscall(vm, a);
-			break;
+#define LOOP_NAME exec_loop_timed
+#define LOOP_TIMED
+#include "rexlang_vm_loop.h"
 
-		case 0x30: // shl
-			pop(a);
-			pop(b);
-		impl_shl:
-			push(b << a);
-			break;
-		case 0x31: // shr
-			pop(a);
-			pop(b);
-		impl_shr:
-			push(b >> a);
-			break;
+#define LOOP_NAME exec_loop_predecoded_timed
+#define LOOP_PREDECODED
+#define LOOP_TIMED
+#include "rexlang_vm_loop.h"
 
-		case 0x38: // return
-			if (vm->cp >= REXLANG_CALL_STACKSZ) {
-				vm->err = REXLANG_ERR_CALL_STACK_EMPTY;
-				goto error;
-			}
-			vm->ip = vm->cs[vm->cp++];
-			break;
-		case 0x39: // not
-			pop(a);
-			push(!a);
-			break;
-		case 0x3A: // neg
-			pop(a);
-			push(-a);
-			break;
-		case 0x3B: // discard
-			pop(a);
-			break;
-		case 0x3C: // swap
-			pop(a);
-			pop(b);
-			push(a);
-			push(b);
-			break;
-		case 0x3D: // dup
-			pop(a);
-			push(a);
-			push(a);
-			break;
-		case 0x3E: // dcopy
-			pop(a);
-			pop(b);
-			pop(c);
-			bounds_check_data(vm, c+a-1);
-			bounds_check_data(vm, b+a-1);
-			memcpy(vm->d + c, vm->d + b, a);
-			push(c + a);
-			break;
-		case 0x3F: // pcopy
-			pop(a);
-			pop(b);
-			pop(c);
-			bounds_check_data(vm, c+a-1);
-			bounds_check_prgm(vm, b+a-1);
-			memcpy(vm->d + c, vm->m + b, a);
-			push(c + a);
-			break;
+#define LOOP_NAME exec_loop_verified_timed
+#define LOOP_VERIFIED
+#define LOOP_TIMED
+#include "rexlang_vm_loop.h"
 
-		// 0x40..0x7F:
-		case 0x40: // push-u8
-			push(rdipu8(vm));
-			break;
-		case 0x41: // push-s8
-			push((s8)rdipu8(vm));
-			break;
+#define LOOP_NAME exec_loop_predecoded_verified_timed
+#define LOOP_PREDECODED
+#define LOOP_VERIFIED
+#define LOOP_TIMED
+#include "rexlang_vm_loop.h"
 
-		case 0x42: // eq
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_eq;
-		case 0x43: // ne
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_ne;
-		case 0x44: // le-ui
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_le_ui;
-		case 0x45: // le-si
-			sa = (s8)rdipu8(vm);
-			pop(sb);
-			goto impl_le_si;
-		case 0x46: // gt-ui
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_gt_ui;
-		case 0x47: // gt-si
-			sa = (s8)rdipu8(vm);
-			pop(sb);
-			goto impl_gt_si;
-		case 0x48: // lt-ui
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_lt_ui;
-		case 0x49: // lt-si
-			sa = (s8)rdipu8(vm);
-			pop(sb);
-			goto impl_lt_si;
-		case 0x4A: // ge-ui
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_ge_ui;
-		case 0x4B: // ge-si
-			sa = (s8)rdipu8(vm);
-			pop(sb);
-			goto impl_ge_si;
-		case 0x4C: // and
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_and;
-		case 0x4D: // or
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_or;
-		case 0x4E: // xor
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_xor;
-		case 0x4F: // add
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_add;
-		case 0x50: // sub
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_sub;
-		case 0x51: // mul
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_mul;
+enum rexlang_error rexlang_vm_exec(struct rexlang_vm *vm, unsigned int instruction_count)
+{
+	assert(vm->m);
 
-		case 0x52: // ld-u8
-			a = rdipu8(vm);
-			goto impl_ld_u8;
-		case 0x53: // ld-u16
-			a = rdipu8(vm);
-			goto impl_ld_u16;
-		case 0x54: // ld-u32
-			a = rdipu8(vm);
-			goto impl_u32;
-		case 0x55: // ld-u8-offs
-			pop(a);
-			b = rdipu8(vm);
-			goto impl_ld_u8_offs;
-		case 0x56: // ld-u16-offs
-			pop(a);
-			b = rdipu8(vm);
-			goto impl_ld_u16_offs;
-		case 0x57: // ld-u32-offs
-			pop(a);
-			b = rdipu8(vm);
-			goto impl_ld_u32_offs;
-		case 0x58: // ld-s8
-			a = rdipu8(vm);
-			goto impl_ld_s8;
-		case 0x59: // ld-s16
-			a = rdipu8(vm);
-			goto impl_ld_s16;
-		case 0x5A: // ld-s8-offs
-			pop(a);
-			b = rdipu8(vm);
-			goto impl_ld_s8_offs;
-		case 0x5B: // ld-s16-offs
-			pop(a);
-			b = rdipu8(vm);
-			goto impl_ld_s16_offs;
-		case 0x5C: // st-u8
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_st_u8;
-		case 0x5D: // st-u16
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_st_u16;
-		case 0x5E: // st-u32
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_st_u32;
-		case 0x5F: // st-u8-offs
-			pop(a);
-			b = rdipu8(vm);
-			pop(c);
-			goto impl_st_u8_offs;
-		case 0x60: // st-u16-offs
-			pop(a);
-			b = rdipu8(vm);
-			pop(c);
-			goto impl_st_u16_offs;
-		case 0x61: // st-u32-offs
-			pop(a);
-			b = rdipu8(vm);
-			pop(c);
-			goto impl_st_u32_offs;
-		case 0x62: // st-u8--discard
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_st_u8_discard;
-		case 0x63: // st-u16-discard
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_st_u16_discard;
-		case 0x64: // st-u32-discard
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_st_u32_discard;
-		case 0x65: // st-u8-offs-discard
-			pop(a);
-			b = rdipu8(vm);
-			pop(c);
-			goto impl_st_u8_offs_discard;
-		case 0x66: // st-u16-offs-discard
-			pop(a);
-			b = rdipu8(vm);
-			pop(c);
-			goto impl_st_u16_offs_discard;
-		case 0x67: // st-u32-offs-discard
-			pop(a);
-			b = rdipu8(vm);
-			pop(c);
-			goto impl_st_u32_offs_discard;
-		case 0x68: // call
-			a = rdipu8(vm);
-			if (vm->cp == 0) {
-				vm->err = REXLANG_ERR_CALL_STACK_FULL;
-				goto error;
-			}
-			vm->cs[--vm->cp] = vm->ip;
-			vm->ip = a;
-			break;
-		case 0x69: // return / jump-abs
-			a = rdipu8(vm);
-			goto impl_jump_abs;
-		case 0x6A: // jump-abs-if
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_jump_abs_if;
-		case 0x6B: // jump-abs-if-not
-			a = rdipu8(vm);
-			pop(b);
-			goto impl_jump_abs_if_not;
-		case 0x6C: // jump-rel
-			sa = (s8)rdipu8(vm);
-			goto impl_jump_rel;
-		case 0x6D: // jump-rel-if
-			sa = (s8)rdipu8(vm);
-			pop(b);
-			goto impl_jump_rel_if;
-		case 0x6E: // jump-rel-if-not
-			sa = (s8)rdipu8(vm);
-			pop(b);
-			goto impl_jump_rel_if_not;
-		case 0x6F: // syscall
-			a = rdipu8(vm);
-			goto impl_syscall;
-		case 0x70: // shl
-			a = rdipu8(vm);
-			pop(b);
-			push(b << a);
-			break;
-		case 0x71: // shr
-			a = rdipu8(vm);
-			pop(b);
-			push(b >> a);
-			break;
-		case 0x72: // ldsp-offs-imm8
-			a = rdipu8(vm);
-			if (vm->sp+a >= REXLANG_DATA_STACKSZ) {
-				vm->err = REXLANG_ERR_DATA_STACK_EMPTY;
-				goto error;
-			}
-			push(vm->ki[vm->sp+a]);
-			break;
-		case 0x73: // discard-imm8
-			a = rdipu8(vm);
-			vm->sp += a;
-			if (vm->sp >= REXLANG_DATA_STACKSZ) {
-				vm->err = REXLANG_ERR_DATA_STACK_EMPTY;
-				goto error;
-			}
-			break;
+	// require an explicit error acknowledgement:
+	if (vm->err != REXLANG_ERR_SUCCESS) {
+		return vm->err;
+	}
 
-		// 0x80..0xBF:
-		case 0x80: // push-u16
-			push(rdipu16(vm));
-			break;
-		case 0x81: // push-s16
-			push((s16)rdipu16(vm));
-			break;
+	// decode and execute opcodes. errors are returned by status; syscalls that throw_error()
+	// get their longjmp destination from rexlang_vm_syscall(), so no setjmp() is needed here:
+	if (vm->unchecked) {
+		if (vm->x) {
+			exec_loop_predecoded_verified(vm, instruction_count);
+		} else {
+			exec_loop_verified(vm, instruction_count);
+		}
+	} else {
+		if (vm->x) {
+			exec_loop_predecoded(vm, instruction_count);
+		} else {
+			exec_loop(vm, instruction_count);
+		}
+	}
 
-		case 0x82: // eq
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_eq;
-		case 0x83: // ne
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_ne;
-		case 0x84: // le-ui
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_le_ui;
-		case 0x85: // le-si
-			sa = (s16)rdipu16(vm);
-			pop(sb);
-			goto impl_le_si;
-		case 0x86: // gt-ui
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_gt_ui;
-		case 0x87: // gt-si
-			sa = (s16)rdipu16(vm);
-			pop(sb);
-			goto impl_gt_si;
-		case 0x88: // lt-ui
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_lt_ui;
-		case 0x89: // lt-si
-			sa = (s16)rdipu16(vm);
-			pop(sb);
-			goto impl_lt_si;
-		case 0x8A: // ge-ui
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_ge_ui;
-		case 0x8B: // ge-si
-			sa = (s16)rdipu16(vm);
-			pop(sb);
-			goto impl_ge_si;
-		case 0x8C: // and
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_and;
-		case 0x8D: // or
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_or;
-		case 0x8E: // xor
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_xor;
-		case 0x8F: // add
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_add;
-		case 0x90: // sub
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_sub;
-		case 0x91: // mul
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_mul;
+	return vm->err;
+}
 
-		case 0x92: // ld-u8
-			a = rdipu16(vm);
-			goto impl_ld_u8;
-		case 0x93: // ld-u16
-			a = rdipu16(vm);
-			goto impl_ld_u16;
-		case 0x94: // ld-u32
-			a = rdipu16(vm);
-			goto impl_u32;
-		case 0x95: // ld-u8-offs
-			pop(a);
-			b = rdipu16(vm);
-			goto impl_ld_u8_offs;
-		case 0x96: // ld-u16-offs
-			pop(a);
-			b = rdipu16(vm);
-			goto impl_ld_u16_offs;
-		case 0x97: // ld-u32-offs
-			pop(a);
-			b = rdipu16(vm);
-			goto impl_ld_u32_offs;
-		case 0x98: // ld-s8
-			a = rdipu16(vm);
-			goto impl_ld_s8;
-		case 0x99: // ld-s16
-			a = rdipu16(vm);
-			goto impl_ld_s16;
-		case 0x9A: // ld-s8-offs
-			pop(a);
-			b = rdipu16(vm);
-			goto impl_ld_s8_offs;
-		case 0x9B: // ld-s16-offs
-			pop(a);
-			b = rdipu16(vm);
-			goto impl_ld_s16_offs;
-		case 0x9C: // st-u8
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_st_u8;
-		case 0x9D: // st-u16
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_st_u16;
-		case 0x9E: // st-u32
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_st_u32;
-		case 0x9F: // st-u8-offs
-			pop(a);
-			b = rdipu16(vm);
-			pop(c);
-			goto impl_st_u8_offs;
-		case 0xA0: // st-u16-offs
-			pop(a);
-			b = rdipu16(vm);
-			pop(c);
-			goto impl_st_u16_offs;
-		case 0xA1: // st-u32-offs
-			pop(a);
-			b = rdipu16(vm);
-			pop(c);
-			goto impl_st_u32_offs;
-		case 0xA2: // st-u8--discard
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_st_u8_discard;
-		case 0xA3: // st-u16-discard
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_st_u16_discard;
-		case 0xA4: // st-u32-discard
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_st_u32_discard;
-		case 0xA5: // st-u8-offs-discard
-			pop(a);
-			b = rdipu16(vm);
-			pop(c);
-			goto impl_st_u8_offs_discard;
-		case 0xA6: // st-u16-offs-discard
-			pop(a);
-			b = rdipu16(vm);
-			pop(c);
-			goto impl_st_u16_offs_discard;
-		case 0xA7: // st-u32-offs-discard
-			pop(a);
-			b = rdipu16(vm);
-			pop(c);
-			goto impl_st_u32_offs_discard;
-		case 0xA8: // call
-			a = rdipu16(vm);
-			if (vm->cp == 0) {
-				vm->err = REXLANG_ERR_CALL_STACK_FULL;
-				goto error;
-			}
-			vm->cs[--vm->cp] = vm->ip;
-			vm->ip = a;
-			break;
-		case 0xA9: // return / jump-abs
-			a = rdipu16(vm);
-			goto impl_jump_abs;
-		case 0xAA: // jump-abs-if
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_jump_abs_if;
-		case 0xAB: // jump-abs-if-not
-			a = rdipu16(vm);
-			pop(b);
-			goto impl_jump_abs_if_not;
-		case 0xAC: // jump-rel
-			sa = (s16)rdipu16(vm);
-			goto impl_jump_rel;
-		case 0xAD: // jump-rel-if
-			sa = (s16)rdipu16(vm);
-			pop(b);
-			goto impl_jump_rel_if;
-		case 0xAE: // jump-rel-if-not
-			sa = (s16)rdipu16(vm);
-			pop(b);
-			goto impl_jump_rel_if_not;
-		case 0xAF: // syscall
-			a = rdipu16(vm);
-			goto impl_syscall;
+int32_t rexlang_vm_exec_cycles(struct rexlang_vm *vm, const uint8_t *cost, int32_t cycles)
+{
+	assert(vm->m);
+	assert(cost && "cost cannot be NULL");
 
-		// 0xC0..0xFF:
-		case 0xC0: // push-u32
-			push(rdipu32(vm));
-			break;
-		case 0xC1: // push-s32
-			push((s32)rdipu32(vm));
-			break;
+	// require an explicit error acknowledgement:
+	if (vm->err != REXLANG_ERR_SUCCESS) {
+		return cycles;
+	}
 
-		case 0xC2: // eq
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_eq;
-		case 0xC3: // ne
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_ne;
-		case 0xC4: // le-ui
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_le_ui;
-		case 0xC5: // le-si
-			sa = (s32)rdipu32(vm);
-			pop(sb);
-			goto impl_le_si;
-		case 0xC6: // gt-ui
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_gt_ui;
-		case 0xC7: // gt-si
-			sa = (s32)rdipu32(vm);
-			pop(sb);
-			goto impl_gt_si;
-		case 0xC8: // lt-ui
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_lt_ui;
-		case 0xC9: // lt-si
-			sa = (s32)rdipu32(vm);
-			pop(sb);
-			goto impl_lt_si;
-		case 0xCA: // ge-ui
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_ge_ui;
-		case 0xCB: // ge-si
-			sa = (s32)rdipu32(vm);
-			pop(sb);
-			goto impl_ge_si;
-		case 0xCC: // and
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_and;
-		case 0xCD: // or
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_or;
-		case 0xCE: // xor
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_xor;
-		case 0xCF: // add
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_add;
-		case 0xD0: // sub
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_sub;
-		case 0xD1: // mul
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_mul;
+	if (vm->unchecked) {
+		if (vm->x) {
+			return exec_loop_predecoded_verified_timed(vm, cycles, cost);
+		}
+		return exec_loop_verified_timed(vm, cycles, cost);
+	}
+	if (vm->x) {
+		return exec_loop_predecoded_timed(vm, cycles, cost);
+	}
+	return exec_loop_timed(vm, cycles, cost);
+}
 
-		case 0xD2: // ld-u8
-			a = rdipu32(vm);
-			goto impl_ld_u8;
-		case 0xD3: // ld-u16
-			a = rdipu32(vm);
-			goto impl_ld_u16;
-		case 0xD4: // ld-u32
-			a = rdipu32(vm);
-			goto impl_u32;
-		case 0xD5: // ld-u8-offs
-			pop(a);
-			b = rdipu32(vm);
-			goto impl_ld_u8_offs;
-		case 0xD6: // ld-u16-offs
-			pop(a);
-			b = rdipu32(vm);
-			goto impl_ld_u16_offs;
-		case 0xD7: // ld-u32-offs
-			pop(a);
-			b = rdipu32(vm);
-			goto impl_ld_u32_offs;
-		case 0xD8: // ld-s8
-			a = rdipu32(vm);
-			goto impl_ld_s8;
-		case 0xD9: // ld-s16
-			a = rdipu32(vm);
-			goto impl_ld_s16;
-		case 0xDA: // ld-s8-offs
-			pop(a);
-			b = rdipu32(vm);
-			goto impl_ld_s8_offs;
-		case 0xDB: // ld-s16-offs
-			pop(a);
-			b = rdipu32(vm);
-			goto impl_ld_s16_offs;
-		case 0xDC: // st-u8
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_st_u8;
-		case 0xDD: // st-u16
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_st_u16;
-		case 0xDE: // st-u32
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_st_u32;
-		case 0xDF: // st-u8-offs
-			pop(a);
-			b = rdipu32(vm);
-			pop(c);
-			goto impl_st_u8_offs;
-		case 0xE0: // st-u16-offs
-			pop(a);
-			b = rdipu32(vm);
-			pop(c);
-			goto impl_st_u16_offs;
-		case 0xE1: // st-u32-offs
-			pop(a);
-			b = rdipu32(vm);
-			pop(c);
-			goto impl_st_u32_offs;
-		case 0xE2: // st-u8--discard
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_st_u8_discard;
-		case 0xE3: // st-u16-discard
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_st_u16_discard;
-		case 0xE4: // st-u32-discard
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_st_u32_discard;
-		case 0xE5: // st-u8-offs-discard
-			pop(a);
-			b = rdipu32(vm);
-			pop(c);
-			goto impl_st_u8_offs_discard;
-		case 0xE6: // st-u16-offs-discard
-			pop(a);
-			b = rdipu32(vm);
-			pop(c);
-			goto impl_st_u16_offs_discard;
-		case 0xE7: // st-u32-offs-discard
-			pop(a);
-			b = rdipu32(vm);
-			pop(c);
-			goto impl_st_u32_offs_discard;
-		case 0xE8: // call
-			a = rdipu32(vm);
-			if (vm->cp == 0) {
-				vm->err = REXLANG_ERR_CALL_STACK_FULL;
-				goto error;
-			}
-			vm->cs[--vm->cp] = vm->ip;
-			vm->ip = a;
-			break;
-		case 0xE9: // return / jump-abs
-			a = rdipu32(vm);
-			goto impl_jump_abs;
-		case 0xEA: // jump-abs-if
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_jump_abs_if;
-		case 0xEB: // jump-abs-if-not
-			a = rdipu32(vm);
-			pop(b);
-			goto impl_jump_abs_if_not;
-		case 0xEC: // jump-rel
-			sa = (s32)rdipu32(vm);
-			goto impl_jump_rel;
-		case 0xED: // jump-rel-if
-			sa = (s32)rdipu32(vm);
-			pop(b);
-			goto impl_jump_rel_if;
-		case 0xEE: // jump-rel-if-not
-			sa = (s32)rdipu32(vm);
-			pop(b);
-			goto impl_jump_rel_if_not;
-		case 0xEF: // syscall
-			a = rdipu32(vm);
-			goto impl_syscall;
+enum rexlang_error rexlang_vm_call(struct rexlang_vm *vm, uint32_t entry_ip, const uint32_t *args, uint32_t nargs, uint32_t *results, uint32_t nresults, unsigned int budget)
+{
+	const rexlang_ip ip = vm->ip;
+	const rexlang_sp sp = vm->sp, cp = vm->cp;
+	const u32 ki_size = vm->ki_size, cs_size = vm->cs_size;
+	const enum rexlang_error err = vm->err;
+	const u32 wait_events = vm->wait_events, wait_cycles = vm->wait_cycles;
+	const bool unchecked = vm->unchecked;
+	enum rexlang_error ret;
+	u32 free_ki = sp;
 
-		default:
-			vm->err = REXLANG_ERR_BAD_OPCODE;
-			goto error;
+	assert(vm->m);
+	assert((args || nargs == 0) && "args cannot be NULL");
+	assert((results || nresults == 0) && "results cannot be NULL");
+
+#ifdef REXLANG_TOS_CACHE
+	// the cached top item's slot is found by masking sp, so the callee's stack must be a
+	// power of two in size:
+	while (free_ki & (free_ki - 1)) {
+		free_ki &= free_ki - 1;
+	}
+#endif
+	if (free_ki == 0 || nargs > free_ki) {
+		return REXLANG_ERR_DATA_STACK_FULL;
+	}
+	if (cp == 0) {
+		return REXLANG_ERR_CALL_STACK_FULL;
 	}
-	return;
-
-#undef pop
-#undef push
 
+	// the callee gets the free part of both stacks as stacks of its own, so that it cannot
+	// pop or overwrite the caller's items and return addresses:
+	vm->ki_size = free_ki;
+	vm->sp = free_ki;
+	vm->cs_size = cp;
+	for (u32 k = 0; k < nargs; k++) {
+		vm->ki[--vm->sp] = args[k];
+	}
+	vm->cs[--vm->cp] = REXLANG_IP_HOST;
+	vm->ip = entry_ip;
+	vm->err = REXLANG_ERR_SUCCESS;
+	vm->unchecked = false;
+
+	// the return to REXLANG_IP_HOST stops the loop as a halt there:
+	ret = rexlang_vm_exec(vm, budget);
+	if (ret == REXLANG_ERR_HALTED && vm->ip == REXLANG_IP_HOST) {
+		if (vm->sp + nresults > free_ki) {
+			ret = REXLANG_ERR_DATA_STACK_EMPTY;
+		} else {
+			for (u32 k = 0; k < nresults; k++) {
+				results[k] = vm->ki[vm->sp + nresults - 1 - k];
+			}
+			ret = REXLANG_ERR_SUCCESS;
+		}
+	} else if (ret == REXLANG_ERR_SUCCESS) {
+		ret = REXLANG_ERR_YIELDED;
+	}
 
-error_stack_empty:
-	vm->err = REXLANG_ERR_DATA_STACK_EMPTY;
-	goto error;
-error_stack_full:
-	vm->err = REXLANG_ERR_DATA_STACK_FULL;
+	vm->ip = ip;
+	vm->sp = sp;
+	vm->cp = cp;
+	vm->ki_size = ki_size;
+	vm->cs_size = cs_size;
+	vm->err = err;
+	vm->wait_events = wait_events;
+	vm->wait_cycles = wait_cycles;
+	vm->unchecked = unchecked;
+	return ret;
+}
 
-error:
-	longjmp(vm->j, vm->err);
+void rexlang_vm_syscall(struct rexlang_vm *vm, u32 fn)
+{
+#ifdef REXLANG_NO_SYSCALL_THROW
+	vm->syscall(vm, fn);
+#else
+	jmp_buf j;
+
+	vm->j = &j;
+	if (setjmp(j) == 0) {
+		vm->syscall(vm, fn);
+	}
+	// after a throw_error() vm->err is set and the interpreter stops as it would for a
+	// syscall that recorded the error and returned:
+	vm->j = NULL;
+#endif
 }
 
-enum rexlang_error rexlang_vm_exec(struct rexlang_vm *vm, unsigned int instruction_count)
+void rexlang_vm_predecode(struct rexlang_vm *vm, struct rexlang_insn *x, uint32_t x_size)
 {
-	assert(vm->m);
+	assert(x && "x cannot be NULL");
+	assert(x_size >= vm->m_size && "x must have an entry per program memory byte");
 
-	// require an explicit error acknowledgement:
-	if (vm->err != REXLANG_ERR_SUCCESS) {
-		return vm->err;
+	// decode at every offset so that jumps to any IP behave as with undecoded memory:
+	for (ui p = 0; p < vm->m_size; p++) {
+		predecode_at(vm->m, vm->m_size, x, p);
 	}
 
-	// mark longjmp destination for error handling:
-	if (setjmp(vm->j)) {
-		// we get here only if throw_error() (aka longjmp) is called
-		// return error code; additional details found in vm->err struct:
-		return vm->err;
+	vm->x = x;
+}
+
+uint32_t rexlang_vm_fuse(const uint8_t *m, uint32_t m_size, uint32_t code_size, uint8_t *out)
+{
+	uint32_t fused = 0;
+	ui p = 0;
+
+	assert(m && "m cannot be NULL");
+	assert(out && "out cannot be NULL");
+	assert(code_size <= m_size && "code cannot extend past program memory");
+
+	if (out != m) {
+		memcpy(out, m, m_size);
 	}
 
-	while ((vm->err == REXLANG_ERR_SUCCESS) && instruction_count--) {
-		// decode and execute the next opcode:
-		opcode(vm);
+	// follow the linear instruction stream from IP 0 through the code; read-only data after it
+	// is left alone:
+	while (p < code_size) {
+		ui len = 1 + imm_size(m[p]);
+		u8 f;
+
+		for (f = FUSED_BASE; f < FUSED_BASE + FUSED_COUNT; f++) {
+			const u8 *seq = fused_seq(f);
+			ui q = p;
+
+			for (; *seq; seq++) {
+				if (q >= code_size || m[q] != *seq) {
+					break;
+				}
+				q += 1 + imm_size(*seq);
+				if (q > code_size) {
+					break;
+				}
+			}
+			if (*seq == 0) {
+				out[p] = f;
+				fused++;
+				len = q - p;
+				break;
+			}
+		}
+
+		p += len;
 	}
 
-	return vm->err;
+	return fused;
 }
 
 void rexlang_vm_error_ack(struct rexlang_vm *vm)
 {
+	// execution may resume mid-instruction or past a halt, which the verifier did not cover.
+	// a yield leaves the VM between instructions in a state the verifier did cover:
+	if (vm->err != REXLANG_ERR_YIELDED) {
+		vm->unchecked = false;
+	}
 	// reset error state:
 	vm->err = REXLANG_ERR_SUCCESS;
+	vm->wait_events = 0;
+	vm->wait_cycles = 0;
 }
 
 void rexlang_vm_reset(struct rexlang_vm *vm)
 {
 	// reset IP and SP:
 	vm->ip = 0;
-	vm->sp = REXLANG_DATA_STACKSZ;
-	vm->cp = REXLANG_CALL_STACKSZ;
+	vm->sp = vm->ki_size;
+	vm->cp = vm->cs_size;
 	// we do not clear program memory nor data memory.
 	// clear stack:
-	memset(vm->ki, 0, sizeof(uint32_t)*REXLANG_DATA_STACKSZ);
-	memset(vm->cs, 0, sizeof(rexlang_ip)*REXLANG_CALL_STACKSZ);
+	memset(vm->ki, 0, sizeof(uint32_t)*vm->ki_size);
+	memset(vm->cs, 0, sizeof(rexlang_ip)*vm->cs_size);
 	// clear error status:
 	rexlang_vm_error_ack(vm);
+	// the initial state is the one the verifier started from:
+	vm->unchecked = vm->verified;
 }
 
 void rexlang_vm_init(
@@ -1088,18 +280,116 @@ void rexlang_vm_init(
 	const uint8_t* m,
 	uint32_t d_size,
 	uint8_t* d,
-	rexlang_call_f syscall
+	rexlang_call_f syscall,
+	uint32_t *ki,
+	uint32_t ki_size,
+	rexlang_ip *cs,
+	uint32_t cs_size
 ) {
 	assert(vm && "vm cannot be NULL");
 	assert(m && "m cannot be NULL");
 	assert(d && "d cannot be NULL");
-
+	assert(ki && ki_size > 0 && "data stack cannot be empty");
+	assert(cs && cs_size > 0 && "call stack cannot be empty");
 	vm->m = m;
 	vm->m_size = m_size;
+	vm->code_size = m_size;
+	vm->generation = 0;
 	vm->d = d;
 	vm->d_size = d_size;
+	vm->x = NULL;
+	vm->verified = false;
+	vm->j = NULL;
+#ifdef REXLANG_PROFILE
+	vm->profile = NULL;
+#endif
+	vm->dirty = NULL;
+	vm->dirty_shift = REXLANG_DIRTY_SHIFT;
+	vm->mmio = NULL;
 
 	vm->syscall = syscall;
+	vm->ctx = NULL;
+	vm->err = REXLANG_ERR_SUCCESS;
+
+	vm->ki = ki;
+	vm->ki_size = ki_size;
+	vm->cs = cs;
+	vm->cs_size = cs_size;
 
 	rexlang_vm_reset(vm);
+#ifdef REXLANG_TOS_CACHE
+	// the interpreter refuses other stack sizes on every run; say so from the start:
+	if (ki_size & (ki_size - 1)) {
+		vm->err = REXLANG_ERR_DATA_STACK_FULL;
+	}
+#endif
+}
+
+// a pool slot is the VM followed by its data stack and call stack:
+#define SLOT_ALIGN sizeof(void *)
+
+size_t rexlang_vm_pool_slot_size(uint32_t ki_size, uint32_t cs_size)
+{
+	size_t size = sizeof(struct rexlang_vm) + sizeof(uint32_t)*ki_size + sizeof(rexlang_ip)*cs_size;
+
+	return (size + SLOT_ALIGN - 1) & ~(SLOT_ALIGN - 1);
+}
+
+uint32_t rexlang_vm_pool_init(struct rexlang_vm_pool *pool, void *arena, size_t arena_size, uint32_t ki_size, uint32_t cs_size)
+{
+	size_t slot_size = rexlang_vm_pool_slot_size(ki_size, cs_size);
+
+	assert(pool && "pool cannot be NULL");
+	assert(arena && ((uintptr_t)arena & (SLOT_ALIGN - 1)) == 0 && "arena must be aligned for a pointer");
+
+	pool->arena = arena;
+	pool->capacity = arena_size / slot_size;
+	pool->used = 0;
+	pool->slot_size = slot_size;
+	pool->ki_size = ki_size;
+	pool->cs_size = cs_size;
+
+	// link the slots in address order:
+	pool->free = NULL;
+	for (uint32_t i = pool->capacity; i > 0; i--) {
+		void **slot = (void **)(pool->arena + (i - 1) * slot_size);
+		*slot = pool->free;
+		pool->free = slot;
+	}
+
+	return pool->capacity;
+}
+
+struct rexlang_vm *rexlang_vm_pool_alloc(
+	struct rexlang_vm_pool *pool,
+	uint32_t m_size,
+	const uint8_t* m,
+	uint32_t d_size,
+	uint8_t* d,
+	rexlang_call_f syscall
+) {
+	struct rexlang_vm *vm = pool->free;
+	uint32_t *ki;
+
+	if (!vm) {
+		return NULL;
+	}
+	pool->free = *(void **)vm;
+	pool->used++;
+
+	ki = (uint32_t *)(vm + 1);
+	rexlang_vm_init(vm, m_size, m, d_size, d, syscall, ki, pool->ki_size, (rexlang_ip *)(ki + pool->ki_size), pool->cs_size);
+
+	return vm;
+}
+
+void rexlang_vm_pool_free(struct rexlang_vm_pool *pool, struct rexlang_vm *vm)
+{
+	assert((uint8_t *)vm >= pool->arena && (uint8_t *)vm < pool->arena + pool->capacity * pool->slot_size
+		&& ((uint8_t *)vm - pool->arena) % pool->slot_size == 0 && "vm is not from this pool");
+	assert(pool->used > 0);
+
+	*(void **)vm = pool->free;
+	pool->free = vm;
+	pool->used--;
 }
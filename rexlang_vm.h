@@ -2,8 +2,13 @@
 #ifndef _REXLANG_VM_H_
 #define _REXLANG_VM_H_
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <setjmp.h>
+#ifdef REXLANG_PROFILE
+#  include <stdio.h>
+#endif
 
 struct rexlang_vm;
 
@@ -21,14 +26,27 @@ enum rexlang_error {
 	REXLANG_ERR_PRGM_ADDRESS_OUT_OF_BOUNDS,
 	REXLANG_ERR_BAD_SYSCALL,
 	REXLANG_ERR_CALL_ARG_OUT_OF_RANGE,
+	REXLANG_ERR_UNVERIFIABLE,
+	REXLANG_ERR_YIELDED,            // not a failure: yield or a syscall gave up the rest of the budget
 };
 
 typedef unsigned int rexlang_ip;
 typedef unsigned int rexlang_sp;
 
+// return address that hands control back to the host; see rexlang_vm_call():
+#define REXLANG_IP_HOST ((rexlang_ip)-1)
+
+// customary stack sizes; each VM gets its stacks at rexlang_vm_init():
 #define REXLANG_DATA_STACKSZ 64
 #define REXLANG_CALL_STACKSZ 16
 
+// pre-decoded form of the instruction starting at a given program memory offset:
+struct rexlang_insn {
+	uint32_t imm;           // immediate value, already zero- or sign-extended
+	uint8_t  op;            // opcode; selects the handler
+	uint8_t  len;           // encoded length in bytes; next IP is IP+len. 0 if truncated
+};
+
 struct rexlang_vm {
 	rexlang_ip ip;          // instruction pointer
 	rexlang_sp sp;          // data stack pointer to free position
@@ -38,34 +56,376 @@ struct rexlang_vm {
 	const uint8_t* m;       // program memory
 	uint8_t* d;             // data memory
 
+	const struct rexlang_insn* x;   // optional pre-decoded program memory
+
+	bool verified;          // program passed rexlang_vm_verify()
+	bool unchecked;         // current state is covered by the verifier; skip runtime checks
+
 	uint32_t m_size;
 	uint32_t d_size;
+	// program memory holds code below code_size and read-only data from there on. m_size unless
+	// the host lowers it after rexlang_vm_init(), e.g. to the code_size of a program image:
+	uint32_t code_size;
+	// generation of program memory: 0 from rexlang_vm_init(), and the host's counter for it as
+	// advanced by rexlang_vm_patch(). a host creating VMs for a patched program sets it like
+	// code_size. native code compiled for another generation is not used:
+	uint32_t generation;
 
-	// setjmp buffer
-	jmp_buf  j;
+	// longjmp destination for throw_error() while a syscall runs; see rexlang_vm_exec()
+	jmp_buf *j;
 
 	rexlang_call_f syscall;
+	void *ctx;              // host data for syscalls, e.g. struct rexlang_stdlib
+
+	// what a VM that yielded waits for: any of the host events in `wait_events` or `wait_cycles`
+	// cycles (0 for no limit). both are 0 for a plain yield. cleared by rexlang_vm_error_ack():
+	uint32_t wait_events;
+	uint32_t wait_cycles;
+
+#ifdef REXLANG_PROFILE
+	struct rexlang_profile *profile;    // optional execution counters; see rexlang_vm_profile()
+#endif
+
+	uint32_t *dirty;        // optional bitmap of data memory blocks written; see rexlang_vm_track_writes()
+	uint32_t dirty_shift;   // blocks are 1 << dirty_shift bytes
+
+	struct rexlang_mmio *mmio;  // optional windows beyond data memory; see rexlang_vm_mmio()
 
-	rexlang_ip cs[REXLANG_CALL_STACKSZ];    // call stack IPs
-	uint32_t ki[REXLANG_DATA_STACKSZ];      // data stack items
+	rexlang_ip *cs;         // call stack IPs
+	uint32_t *ki;           // data stack items
+	uint32_t cs_size;
+	uint32_t ki_size;
 };
 
+// `ki` and `cs` hold the data and call stacks of `ki_size` and `cs_size` entries. with
+// REXLANG_TOS_CACHE, ki_size must be a power of two; a VM with another size starts in, and
+// every run stops with, REXLANG_ERR_DATA_STACK_FULL:
 void rexlang_vm_init(
 	struct rexlang_vm *vm,
 	uint32_t m_size,
 	const uint8_t* m,
 	uint32_t d_size,
 	uint8_t* d,
+	rexlang_call_f syscall,
+	uint32_t *ki,
+	uint32_t ki_size,
+	rexlang_ip *cs,
+	uint32_t cs_size
+);
+
+// fixed set of VMs with stacks of one size, carved out of a caller-provided arena so that
+// VMs can be handed out and recycled without touching the heap. not thread-safe:
+struct rexlang_vm_pool {
+	uint8_t *arena;
+	uint32_t capacity;      // number of VMs
+	uint32_t used;          // number of VMs handed out
+	uint32_t slot_size;     // bytes per VM and its stacks
+	uint32_t ki_size;
+	uint32_t cs_size;
+	void *free;             // first free slot; each links to the next
+};
+
+// bytes of arena per VM with the given stack sizes:
+size_t rexlang_vm_pool_slot_size(uint32_t ki_size, uint32_t cs_size);
+
+// split `arena` (aligned for a pointer) into as many VMs as fit; returns the capacity:
+uint32_t rexlang_vm_pool_init(struct rexlang_vm_pool *pool, void *arena, size_t arena_size, uint32_t ki_size, uint32_t cs_size);
+
+// take a VM from the pool and rexlang_vm_init() it with the pool's stacks.
+// returns NULL if all are in use:
+struct rexlang_vm *rexlang_vm_pool_alloc(
+	struct rexlang_vm_pool *pool,
+	uint32_t m_size,
+	const uint8_t* m,
+	uint32_t d_size,
+	uint8_t* d,
 	rexlang_call_f syscall
 );
 
+// return a VM taken from `pool`:
+void rexlang_vm_pool_free(struct rexlang_vm_pool *pool, struct rexlang_vm *vm);
+
+// decode program memory once into `x` (which must hold m_size entries) so that
+// rexlang_vm_exec() no longer decodes immediates on every execution.
+// call after rexlang_vm_init() and again whenever program memory changes:
+void rexlang_vm_predecode(struct rexlang_vm *vm, struct rexlang_insn *x, uint32_t x_size);
+
+// copy program memory `m` to `out` (which may equal `m`), replacing the opcode byte of each
+// recognised instruction sequence in the first `code_size` bytes with a fused opcode that
+// executes the whole sequence in a single dispatch. read-only data after the code is copied as
+// is. instruction lengths and offsets are unchanged, so jumps into the middle of a sequence
+// still work. returns the number of sequences fused:
+uint32_t rexlang_vm_fuse(const uint8_t *m, uint32_t m_size, uint32_t code_size, uint8_t *out);
+
+// data stack effect of a syscall, declared by the host for rexlang_vm_verify():
+struct rexlang_syscall_sig {
+	uint32_t fn;            // syscall number
+	uint8_t  args;          // number of items popped
+	uint8_t  results;       // number of items pushed
+};
+
+// maximum number of distinct call targets tracked by rexlang_vm_verify():
+#define REXLANG_VERIFY_MAX_FUNCS 63
+
+// statically verify the program starting at IP 0 from the reset state. on success the VM
+// executes without stack, call stack, program bounds or constant-address checks until an
+// error is acknowledged or the program is replaced. `scratch` must hold m_size entries.
+// on failure returns the error the program could raise (or REXLANG_ERR_UNVERIFIABLE)
+// and stores the offending IP in `*fail_ip` if not NULL.
+enum rexlang_error rexlang_vm_verify(
+	struct rexlang_vm *vm,
+	const struct rexlang_syscall_sig *sigs,
+	unsigned int sig_count,
+	uint16_t *scratch,
+	uint32_t scratch_size,
+	rexlang_ip *fail_ip
+);
+
+#ifdef REXLANG_PROFILE
+// syscall numbers counted separately by the profiler; higher numbers share the last entry:
+#define REXLANG_PROFILE_SYSCALLS 64
+
+// execution counters. the per-IP arrays are provided by the host and hold `size` entries each.
+// fused opcodes are counted as the instructions they replace:
+struct rexlang_profile {
+	uint32_t *ip;           // executions per IP
+	uint32_t *taken;        // per IP of a conditional jump, times it jumped
+	uint32_t *not_taken;    // per IP of a conditional jump, times it fell through
+	uint32_t size;          // entries in each per-IP array; at least m_size
+
+	uint64_t op[256];                           // executions per opcode
+	uint64_t syscall[REXLANG_PROFILE_SYSCALLS]; // calls per syscall number
+};
+
+// longest instruction sequence reported by rexlang_vm_profile_ngrams():
+#define REXLANG_NGRAM_MAX 4
+
+struct rexlang_ngram {
+	uint64_t count;                     // times the whole sequence ran from its first instruction
+	uint8_t  ops[REXLANG_NGRAM_MAX];    // opcodes, in program order
+	uint8_t  n;                         // number of opcodes
+};
+
+// add executions to the counters of `prof` from now on; pass NULL to stop profiling.
+// counters are not cleared, so several runs or VMs may accumulate into one profile:
+void rexlang_vm_profile(struct rexlang_vm *vm, struct rexlang_profile *prof);
+
+// zero all counters of `prof`:
+void rexlang_vm_profile_reset(struct rexlang_profile *prof);
+
+// write a readable report of the VM's profile to `out`: opcodes and syscalls by count, then
+// every executed IP with its opcode, count and, for conditional jumps, how often each way went:
+void rexlang_vm_profile_dump(const struct rexlang_vm *vm, FILE *out);
+
+// aggregate the per-IP counts into the straight-line opcode sequences of length `n` found in
+// program memory, most frequent first. a sequence's count is the least count among its
+// instructions, which is exact unless control enters or leaves in the middle of it.
+// `out` must hold m_size entries; returns the number of distinct sequences written:
+uint32_t rexlang_vm_profile_ngrams(const struct rexlang_vm *vm, unsigned int n, struct rexlang_ngram *out, uint32_t out_size);
+#endif
+
+// native code backend for verified programs on x86-64 hosts; define REXLANG_NO_JIT to omit it:
+#if defined(__x86_64__) && defined(__unix__) && !defined(REXLANG_NO_JIT)
+#  define REXLANG_JIT
+
+struct rexlang_jit {
+	void *code;             // executable mapping
+	uint32_t code_size;
+	const void **table;     // native entry point per program memory offset
+	const uint8_t *m;       // program memory and its generation when compiled
+	uint32_t m_size;
+	uint32_t generation;
+};
+
+// translate the program of a VM that passed rexlang_vm_verify() into native code. the result
+// may be used with any VM sharing the same program memory and generation. returns false if the
+// program is not verified or memory could not be allocated:
+bool rexlang_vm_jit_compile(const struct rexlang_vm *vm, struct rexlang_jit *jit);
+
+// release the native code of `jit`:
+void rexlang_vm_jit_free(struct rexlang_jit *jit);
+
+// whether `jit` was compiled from the program `vm` runs, in its current generation:
+bool rexlang_vm_jit_current(const struct rexlang_vm *vm, const struct rexlang_jit *jit);
+
+// equivalent to rexlang_vm_exec(), running native code while the VM is in a verified state and
+// the interpreter otherwise. a `jit` that is not current for the VM is never run, so hosts
+// that may have patched the program check rexlang_vm_jit_current() to know which they get:
+enum rexlang_error rexlang_vm_jit_exec(struct rexlang_vm *vm, const struct rexlang_jit *jit, unsigned int instruction_count);
+#endif
+
+// block size of data memory in snapshots of VMs that do not track writes, as a shift:
+#define REXLANG_DIRTY_SHIFT 8
+
+// uint32_t words of a dirty bitmap for `d_size` bytes of data memory in blocks of 1 << `shift`:
+#define REXLANG_DIRTY_WORDS(d_size, shift) ((((uint32_t)(((uint64_t)(d_size) + (1u << (shift)) - 1) >> (shift))) + 31) / 32)
+
+// record the data memory blocks of 1 << `shift` bytes (e.g. 6 for 64 bytes) written from now on
+// in `bitmap`, which must hold REXLANG_DIRTY_WORDS(d_size, shift) words. every store, dcopy and
+// pcopy marks the blocks it writes, so hosts and rexlang_vm_save() only need to copy those.
+// every block starts out dirty. pass NULL to stop tracking. native code does not track writes,
+// so rexlang_vm_jit_exec() interprets a tracked VM:
+void rexlang_vm_track_writes(struct rexlang_vm *vm, uint32_t *bitmap, uint32_t shift);
+
+// mark data memory [p, p+len) as written by the host or a syscall; the VM's own stores are
+// tracked already:
+void rexlang_vm_mark_written(struct rexlang_vm *vm, uint32_t p, uint32_t len);
+
+// find the first run of dirty blocks that ends after `*p` and store its extent, clipped to data
+// memory, in `*p` and `*len`. returns false if there is none. visit every dirty range with:
+//   for (p = 0; rexlang_vm_dirty_next(vm, &p, &len); p += len)
+bool rexlang_vm_dirty_next(const struct rexlang_vm *vm, uint32_t *p, uint32_t *len);
+
+// mark every block that overlaps data memory [p, p+len) as clean:
+void rexlang_vm_dirty_clear(struct rexlang_vm *vm, uint32_t p, uint32_t len);
+
+// upper bound of the bytes rexlang_vm_save() writes for `vm`:
+size_t rexlang_vm_save_size(const struct rexlang_vm *vm);
+
+// write a snapshot of the VM to `buf`: IP, stack pointers, error and wait state, the live items
+// of both stacks and data memory. a full snapshot holds all of data memory; an `incremental`
+// one holds only the blocks written since the previous save or load, and is full if writes are
+// not tracked. clears the dirty blocks. returns the bytes written, or 0 if `size` is too small.
+// pointers (program memory, syscall, ctx, pre-decoded program) are not part of a snapshot:
+size_t rexlang_vm_save(struct rexlang_vm *vm, void *buf, size_t size, bool incremental);
+
+// restore a snapshot written by rexlang_vm_save() from a VM with the same data memory and stack
+// sizes and program. an incremental snapshot applies on top of the state it was taken after,
+// so rolling back means loading the last full snapshot before the target and then each
+// incremental one up to it. clears the dirty blocks. returns false and leaves the VM unchanged
+// if the snapshot is malformed, e.g. a runnable IP outside program memory, or does not fit the
+// VM. a restored VM runs with runtime checks until it is reset or verified again:
+bool rexlang_vm_load(struct rexlang_vm *vm, const void *buf, size_t size);
+
+// pages of the MMIO page table and windows it can hold:
+#define REXLANG_MMIO_PAGES   64
+#define REXLANG_MMIO_WINDOWS 8
+
+// device register access for callback windows. `offset` is relative to the window base and
+// `size` is 1, 2 or 4; stores pass the value truncated to `size` bytes:
+typedef uint32_t (*rexlang_mmio_read_f)(void *ctx, uint32_t offset, unsigned int size);
+typedef void (*rexlang_mmio_write_f)(void *ctx, uint32_t offset, uint32_t v, unsigned int size);
+
+// a range of data addresses beyond data memory that reaches host memory or a device:
+struct rexlang_mmio_window {
+	uint32_t base;          // first data address
+	uint32_t size;          // bytes
+	uint8_t *mem;           // host memory aliased by the window, or NULL to use the callbacks
+	rexlang_mmio_read_f read;       // NULL if loads fault
+	rexlang_mmio_write_f write;     // NULL if stores fault
+	void *ctx;              // passed to the callbacks
+};
+
+// windows looked up by page: data address p is in page p >> page_shift, which names at most
+// one window. pages cover the first REXLANG_MMIO_PAGES << page_shift bytes of the address space:
+struct rexlang_mmio {
+	uint32_t page_shift;
+	uint32_t count;                         // windows added
+	uint8_t page[REXLANG_MMIO_PAGES];       // window number + 1 per page, 0 if none
+	struct rexlang_mmio_window window[REXLANG_MMIO_WINDOWS];
+};
+
+// start an empty table with pages of 1 << `page_shift` bytes (e.g. 26 to cover all 4 GiB):
+void rexlang_mmio_init(struct rexlang_mmio *io, uint32_t page_shift);
+
+// add a copy of `w`. no page may be shared with another window, nor lie beyond the table.
+// returns false if it does not fit:
+bool rexlang_mmio_add(struct rexlang_mmio *io, const struct rexlang_mmio_window *w);
+
+// route loads and stores at addresses beyond the VM's data memory through the windows of `io`,
+// which may be shared by VMs; pass NULL to detach. the common case is still one bounds check,
+// as windows are only looked up once an address fails it. an access must lie wholly within a
+// window and fails as out of bounds otherwise. only ld-* and st-* reach windows: dcopy, pcopy
+// and syscalls see data memory alone, writes to windows are not tracked nor part of snapshots,
+// and REXLANG_NO_BOUNDS_CHECK leaves no way to them. the verifier does not accept constant
+// addresses beyond data memory, and native code interprets a VM with windows attached:
+void rexlang_vm_mmio(struct rexlang_vm *vm, struct rexlang_mmio *io);
+
+enum rexlang_patch_status {
+	REXLANG_PATCH_OK,
+	REXLANG_PATCH_BUSY,     // the IP or a return address is at an instruction in the range
+	REXLANG_PATCH_BAD,      // the range lies outside program memory, or the stream is malformed
+};
+
+// whether program memory [p, p+len) may be replaced while `vm` is stopped between slices:
+// neither the instruction at its IP nor one at a return address on its call stack may read
+// from the range. VMs sharing program memory must each pass:
+enum rexlang_patch_status rexlang_vm_patch_check(const struct rexlang_vm *vm, uint32_t p, uint32_t len);
+
+// replace program memory [p, p+len) of the `vm_count` VMs `vms` with `data`. `m` is the
+// writable program memory they all point to, and `vms` must hold every VM running it, since
+// each must pass rexlang_vm_patch_check(). fused opcodes whose sequence reaches into the range
+// are unfused, and pre-decoded programs are updated; the verifier's proof no longer holds, so
+// the VMs run checked until rexlang_vm_verify() passes again. `*generation` is the host's
+// counter for the program memory, starting at 0; it is advanced and given to every VM so that
+// native code compiled before no longer runs. returns REXLANG_PATCH_OK once applied, and
+// changes nothing otherwise:
+enum rexlang_patch_status rexlang_vm_patch(struct rexlang_vm *const *vms, unsigned int vm_count, uint8_t *m, uint32_t *generation, uint32_t p, const void *data, uint32_t len);
+
+// a patch stream is a sequence of records, each a u32 offset and u32 length (little endian)
+// followed by that many bytes for program memory at the offset. a record is applied once it
+// has arrived in full, so a record is staged in a buffer until then:
+struct rexlang_patch_stream {
+	uint8_t *buf;           // staging for the data of one record
+	uint32_t buf_size;      // longest record accepted
+	uint8_t head[8];        // offset and length of the current record, as received
+	uint32_t have;          // bytes of the current record received, head included
+	bool bad;               // a malformed record was met; the rest is ignored
+};
+
+void rexlang_patch_stream_init(struct rexlang_patch_stream *s, uint8_t *buf, uint32_t buf_size);
+
+// feed the next `len` bytes of a patch stream for `vms`, applying each record that completes
+// with rexlang_vm_patch(). stops at a record that gets REXLANG_PATCH_BUSY; it is retried
+// first on the next call, which may pass no new bytes. stores the bytes taken in `*used`:
+enum rexlang_patch_status rexlang_vm_patch_feed(struct rexlang_vm *const *vms, unsigned int vm_count, uint8_t *m, uint32_t *generation, struct rexlang_patch_stream *s, const void *data, size_t len, size_t *used);
+
+// write the patch stream that turns the `size` bytes of program memory `from` into `to` to `out`
+// if it fits in `out_size` bytes. differences closer than a record header are sent as one record
+// of at most `max_len` bytes. returns the bytes of the stream:
+size_t rexlang_patch_diff(const uint8_t *from, const uint8_t *to, uint32_t size, uint32_t max_len, uint8_t *out, size_t out_size);
+
 // explicitly reset the VM to initial state:
 void rexlang_vm_reset(struct rexlang_vm *vm);
 
-// this must be called after an error occurs to resume execution:
+// this must be called after an error occurs to resume execution. a yielded VM resumes with
+// the instruction after the syscall that yielded:
 void rexlang_vm_error_ack(struct rexlang_vm *vm);
 
 // execute the given number of instructions or until an error occurs
 enum rexlang_error rexlang_vm_exec(struct rexlang_vm *vm, unsigned int instruction_count);
 
+// execute instructions charging `cost[opcode]` cycles each until `cycles` are used up or an
+// error occurs. an instruction starts while any cycles remain and is charged in full, so the
+// budget may be overdrawn. returns the cycles left, negative if overdrawn; the error is in
+// vm->err. fused opcodes are charged as the instructions they replace:
+int32_t rexlang_vm_exec_cycles(struct rexlang_vm *vm, const uint8_t *cost, int32_t cycles);
+
+// call the function at `entry_ip` from the host: push `nargs` arguments (args[0] first) and a
+// REXLANG_IP_HOST return address, then execute at most `budget` instructions until it returns
+// and pop `nresults` results (results[nresults-1] from the top). the callee runs on the free
+// parts of the stacks, below the VM's sp and cp, and cannot reach the items and return
+// addresses above them; with REXLANG_TOS_CACHE its data stack is the largest power of two
+// that fits. data memory is left as the callee leaves it, and the VM's IP, stacks and error
+// state are restored whatever happens, so a program can serve as a library of functions
+// between or instead of rexlang_vm_exec() slices. returns REXLANG_ERR_SUCCESS once the callee
+// returned, the error it stopped with, or REXLANG_ERR_YIELDED if it yielded or ran out of
+// budget; either way the call is abandoned. callees run with runtime checks, as the verifier
+// only covers runs from IP 0:
+enum rexlang_error rexlang_vm_call(struct rexlang_vm *vm, uint32_t entry_ip, const uint32_t *args, uint32_t nargs, uint32_t *results, uint32_t nresults, unsigned int budget);
+
+// VMs executed side by side by rexlang_vm_exec_lockstep(); 8 suits 256-bit vectors:
+#ifndef REXLANG_LOCKSTEP_LANES
+#  define REXLANG_LOCKSTEP_LANES 8
+#endif
+
+// equivalent to rexlang_vm_exec() on each of `n` VMs, but groups of REXLANG_LOCKSTEP_LANES VMs
+// that run the same program from the same IP, stack depths and call stack share one
+// instruction stream, with their data stacks held as vectors of one item per lane. lanes leave
+// the group and continue on their own where they would branch, jump or call elsewhere than
+// most of the group or raise an error; the group falls back to stepping each lane for
+// syscalls and instructions it does not vectorise, and merges again afterwards.
+// `scratch` must hold ki_size * REXLANG_LOCKSTEP_LANES entries:
+void rexlang_vm_exec_lockstep(struct rexlang_vm *const *vms, unsigned int n, unsigned int instruction_count, uint32_t *scratch, uint32_t scratch_size);
+
 #endif
@@ -1,5 +1,6 @@
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "rexlang_vm.h"
 
 #define   likely(x) __builtin_expect((x), 1)
@@ -13,78 +14,154 @@ typedef int16_t     s16;
 typedef int32_t     s32;
 typedef unsigned int ui;
 
-#define throw_error(vm, e) { \
+// report an error from a syscall. by default this longjmps out of the syscall; with
+// REXLANG_NO_SYSCALL_THROW it records the error and returns from the calling function
+// instead (with `r` for raise_error()), so callers must check vm->err after helper calls:
+#ifdef REXLANG_NO_SYSCALL_THROW
+#  define throw_error(vm, e) { \
 	vm->err = e; \
-	longjmp(vm->j, vm->err); \
+	return; \
 }
+#  define raise_error(vm, e, r) { \
+	vm->err = e; \
+	return r; \
+}
+#else
+#  define throw_error(vm, e) { \
+	vm->err = e; \
+	longjmp(*vm->j, vm->err); \
+}
+#  define raise_error(vm, e, r) throw_error(vm, e)
+#endif
+
+// invoke vm->syscall(vm, fn) with a longjmp destination for throw_error() set up:
+void rexlang_vm_syscall(struct rexlang_vm *vm, u32 fn);
+
+// load or store `size` bytes at a data address beyond data memory through vm->mmio. an address
+// outside the windows records REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS in vm->err:
+u32 rexlang_vm_mmio_read(struct rexlang_vm *vm, u32 p, ui size);
+void rexlang_vm_mmio_write(struct rexlang_vm *vm, u32 p, u32 v, ui size);
 
 #ifdef REXLANG_NO_BOUNDS_CHECK
-#  define bounds_check_data(vm, p)
-#  define bounds_check_prgm(vm, p)
+#  define bounds_check_data(vm, p, r)
+#  define bounds_check_prgm(vm, p, r)
 #else
-#  define bounds_check_data(vm, p) \
+#  define bounds_check_data(vm, p, r) \
 	if (unlikely(p >= vm->d_size)) \
-		throw_error(vm, REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS)
-#  define bounds_check_prgm(vm, p) \
+		raise_error(vm, REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS, r)
+#  define bounds_check_prgm(vm, p, r) \
 	if (unlikely(p >= vm->m_size)) \
-		throw_error(vm, REXLANG_ERR_PRGM_ADDRESS_OUT_OF_BOUNDS)
+		raise_error(vm, REXLANG_ERR_PRGM_ADDRESS_OUT_OF_BOUNDS, r)
 #endif
 
+// record a write of `len` > 0 bytes at data memory address `p` in a dirty bitmap of blocks of
+// 1 << `shift` bytes:
+static inline void mark_dirty(u32 *dirty, ui shift, ui p, ui len)
+{
+	for (ui i = p >> shift; i <= (p + len - 1) >> shift; i++) {
+		dirty[i / 32] |= 1u << (i % 32);
+	}
+}
+
+#define dirty_data(vm, p, len) \
+	if (unlikely(vm->dirty != NULL)) \
+		mark_dirty(vm->dirty, vm->dirty_shift, p, len)
+
 // read u8 from data
 static inline u8 rddu8(struct rexlang_vm* vm, ui p)
 {
-	bounds_check_data(vm, p);
+	bounds_check_data(vm, p, 0);
 	return vm->d[p];
 }
 
 // read u16 from data
 static inline u16 rddu16(struct rexlang_vm* vm, ui p)
 {
-	bounds_check_data(vm, p);
+	bounds_check_data(vm, p, 0);
 	return *(u16*)(&vm->d[p]);
 }
 
 // read u16 from data
 static inline u32 rddu32(struct rexlang_vm* vm, ui p)
 {
-	bounds_check_data(vm, p);
+	bounds_check_data(vm, p, 0);
 	return *(u32*)(&vm->d[p]);
 }
 
 // write u8 to data
 static inline void wrdu8(struct rexlang_vm* vm, ui p, u8 v)
 {
-	bounds_check_data(vm, p);
+	bounds_check_data(vm, p, );
 	vm->d[p] = v;
+	dirty_data(vm, p, sizeof(u8));
 }
 
 // write u16 to data
 static inline void wrdu16(struct rexlang_vm* vm, ui p, u16 v)
 {
-	bounds_check_data(vm, p);
+	bounds_check_data(vm, p, );
 	*(u16*)(&vm->d[p]) = v;
+	dirty_data(vm, p, sizeof(u16));
 }
 
 // write u32 to data
 static inline void wrdu32(struct rexlang_vm* vm, ui p, u32 v)
 {
-	bounds_check_data(vm, p);
+	bounds_check_data(vm, p, );
 	*(u32*)(&vm->d[p]) = v;
+	dirty_data(vm, p, sizeof(u32));
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// read u16 from program memory
+static inline u16 rdmu16(const u8 *m, ui p)
+{
+	return *(u16*)(&m[p]);
 }
 
+// read u32 from program memory
+static inline u32 rdmu32(const u8 *m, ui p)
+{
+	return *(u32*)(&m[p]);
+}
+#elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+// read u16 from program memory
+static inline u16 rdmu16(const u8 *m, ui p)
+{
+	u16 lo = m[p+0];
+	u16 hi = m[p+1];
+	u16 val = (hi<<8) | (lo);
+	return val;
+}
+
+// read u32 from program memory
+static inline u32 rdmu32(const u8 *m, ui p)
+{
+	u32 b0 = m[p+0];
+	u32 b1 = m[p+1];
+	u32 b2 = m[p+2];
+	u32 b3 = m[p+3];
+	u32 val = (b3<<24) | (b2<<16) | (b1<<8) | (b0);
+	return val;
+}
+#else
+#  define VALUE_TO_STRING(x) #x
+#  define VALUE(x) VALUE_TO_STRING(x)
+#  pragma error("unknown __BYTE_ORDER__: " VALUE(__BYTE_ORDER__))
+#endif
+
 // read u8 from IP, advance IP
 static inline u8 rdipu8(struct rexlang_vm *vm)
 {
 	return vm->m[vm->ip++];
 }
 
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 // read u16 from IP, advance IP
 static inline u16 rdipu16(struct rexlang_vm *vm)
 {
 	rexlang_ip ip = vm->ip;
 	vm->ip += sizeof(u16);
-	return *(u16*)(&vm->m[ip]);
+	return rdmu16(vm->m, ip);
 }
 
 // read u32 from IP, advance IP
@@ -92,38 +169,99 @@ static inline u32 rdipu32(struct rexlang_vm *vm)
 {
 	rexlang_ip ip = vm->ip;
 	vm->ip += sizeof(u32);
-	return *(u32*)(&vm->m[ip]);
+	return rdmu32(vm->m, ip);
 }
-#elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-// read u16 from IP, advance IP
-static inline u16 rdipu16(struct rexlang_vm *vm)
+
+// immediate is sign-extended for push-s*, *-si and jump-rel* opcodes:
+static inline bool imm_is_signed(u8 o)
 {
-	u16 lo = vm->m[vm->ip++];
-	u16 hi = vm->m[vm->ip++];
-	u16 val = (hi<<8) | (lo);
-	return val;
+	switch (o & 0x3F) {
+		case 0x01: // push-s
+		case 0x05: // le-si
+		case 0x07: // gt-si
+		case 0x09: // lt-si
+		case 0x0B: // ge-si
+		case 0x2C: // jump-rel
+		case 0x2D: // jump-rel-if
+		case 0x2E: // jump-rel-if-not
+			return true;
+		default:
+			return false;
+	}
 }
 
-// read u32 from IP, advance IP
-static inline u32 rdipu32(struct rexlang_vm *vm)
+// size in bytes of the immediate following opcode `o`; given by its top two bits:
+static inline ui imm_size(u8 o)
 {
-	u32 b0 = vm->m[vm->ip++];
-	u32 b1 = vm->m[vm->ip++];
-	u32 b2 = vm->m[vm->ip++];
-	u32 b3 = vm->m[vm->ip++];
-	u32 val = (b3<<24) | (b2<<16) | (b1<<8) | (b0);
-	return val;
+	return (o >> 6) == 3 ? 4 : (o >> 6);
+}
+
+// read the zero- or sign-extended immediate of the instruction at p with opcode `o`:
+static inline u32 rdimm(const u8 *m, ui p, u8 o)
+{
+	switch (imm_size(o)) {
+		case 1:
+			return imm_is_signed(o) ? (u32)(s8)m[p+1] : m[p+1];
+		case 2:
+			return imm_is_signed(o) ? (u32)(s16)rdmu16(m, p+1) : rdmu16(m, p+1);
+		case 4:
+			return rdmu32(m, p+1);
+		default:
+			return 0;
+	}
+}
+
+// fused opcodes are written by rexlang_vm_fuse() over the opcode byte of the first
+// instruction of a sequence; the remaining instructions of the sequence stay in place:
+#define FUSED_BASE  0xF0
+#define FUSED_COUNT 3
+
+// instruction sequence executed by fused opcode `o`, terminated by 0; NULL if not fused:
+static inline const u8 *fused_seq(u8 o)
+{
+	static const u8 seqs[FUSED_COUNT][4] = {
+		{0x40, 0x6F},           // 0xF0: push-u8, syscall-imm8
+		{0x93, 0x42, 0x6E},     // 0xF1: ld-u16-imm16, eq-imm8, jump-rel-if-not-imm8
+		{0x72, 0x0F},           // 0xF2: ldsp-offs-imm8, add
+	};
+
+	if (o < FUSED_BASE || o >= FUSED_BASE + FUSED_COUNT) {
+		return NULL;
+	}
+	return seqs[o - FUSED_BASE];
+}
+
+// opcode of the first instruction of a fused sequence, or `o` itself if not fused:
+static inline u8 unfuse(u8 o)
+{
+	const u8 *seq = fused_seq(o);
+	return seq ? seq[0] : o;
+}
+
+// pre-decode the instruction at p into x[p]; see rexlang_vm_predecode():
+static inline void predecode_at(const u8 *m, u32 m_size, struct rexlang_insn *x, ui p)
+{
+	// fused opcodes keep their own handler but carry the first instruction's immediate:
+	u8 o = unfuse(m[p]);
+	ui n = imm_size(o);
+
+	x[p].op = m[p];
+	x[p].imm = 0;
+	if (p + 1 + n > m_size) {
+		// route to the bad opcode handler which reports a program address error:
+		x[p].op = 0xFF;
+		x[p].len = 0;
+		return;
+	}
+
+	x[p].len = 1 + n;
+	x[p].imm = rdimm(m, p, o);
 }
-#else
-#  define VALUE_TO_STRING(x) #x
-#  define VALUE(x) VALUE_TO_STRING(x)
-#  pragma error("unknown __BYTE_ORDER__: " VALUE(__BYTE_ORDER__))
-#endif
 
 static inline void push(struct rexlang_vm *vm, u32 v)
 {
 	if (unlikely(vm->sp == 0)) {
-		throw_error(vm, REXLANG_ERR_DATA_STACK_FULL);
+		raise_error(vm, REXLANG_ERR_DATA_STACK_FULL, );
 	}
 
 	// write the value into the stack:
@@ -132,8 +270,8 @@ static inline void push(struct rexlang_vm *vm, u32 v)
 
 static inline u32 pop(struct rexlang_vm *vm)
 {
-	if (unlikely(vm->sp >= REXLANG_DATA_STACKSZ)) {
-		throw_error(vm, REXLANG_ERR_DATA_STACK_EMPTY);
+	if (unlikely(vm->sp >= vm->ki_size)) {
+		raise_error(vm, REXLANG_ERR_DATA_STACK_EMPTY, 0);
 	}
 
 	// read the value from the stack and move the sp:
@@ -0,0 +1,906 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rexlang_vm_impl.h"
+
+#ifdef REXLANG_JIT
+
+#include <sys/mman.h>
+
+// template translation of verified bytecode into x86-64 (System V) machine code.
+//
+// every reachable instruction becomes a fixed sequence of native instructions, preceded by
+// the budget check the interpreter makes before fetching it. the verifier has proven the
+// stack depths, call depths, branch targets and constant addresses, so only dynamic data
+// addresses, dcopy/pcopy and syscalls can fail at run time. each failure site branches to
+// a stub at the end of the code that records the error, IP and SP as the interpreter would.
+//
+// register assignment while running native code:
+//   rbx  remaining instruction budget
+//   rbp  native entry point table, indexed by IP
+//   r12  struct rexlang_vm *
+//   r13  vm->ki
+//   r14  vm->d
+//   r15  SP
+//   eax, ecx, edx, esi, edi  scratch
+
+#define OFF(f)      ((u32)offsetof(struct rexlang_vm, f))
+
+// scratch register numbers:
+#define EAX 0
+#define ECX 1
+
+// x86 condition codes:
+#define CC_B    0x2
+#define CC_AE   0x3
+#define CC_E    0x4
+#define CC_NE   0x5
+#define CC_BE   0x6
+#define CC_A    0x7
+#define CC_L    0xC
+#define CC_GE   0xD
+#define CC_LE   0xE
+#define CC_G    0xF
+
+enum fix_kind {
+	FIX_INSN,       // native code of instruction `ip`
+	FIX_STUB,       // error stub recording `err` at `ip` after popping `adj` more items
+	FIX_BUDGET,     // budget exhausted before instruction `ip`
+	FIX_EXIT,       // common exit; esi holds the IP
+	FIX_EXIT_VM,    // common exit; vm->ip already holds the IP
+	FIX_DISPATCH,   // jump to the instruction whose IP is in ecx
+	FIX_BAIL,       // leave native code at the instruction whose IP is in ecx
+	FIX_DONE,       // resolved
+};
+
+struct fixup {
+	u32 pos;        // offset of the rel32 to patch
+	u8  kind;
+	u8  err;
+	u8  adj;
+	u32 ip;
+};
+
+struct jasm {
+	u8 *p;
+	u32 n;
+	u32 cap;
+	struct fixup *fix;
+	u32 nfix;
+	u32 capfix;
+	bool oom;
+	u32 label[FIX_BAIL + 1];
+};
+
+static void emit(struct jasm *a, const u8 *b, u32 n)
+{
+	if (a->n + n > a->cap) {
+		u32 cap = a->cap ? a->cap * 2 : 4096;
+		u8 *p;
+		while (a->n + n > cap) {
+			cap *= 2;
+		}
+		if (!(p = realloc(a->p, cap))) {
+			a->oom = true;
+			return;
+		}
+		a->p = p;
+		a->cap = cap;
+	}
+	memcpy(a->p + a->n, b, n);
+	a->n += n;
+}
+
+#define E(a, ...) { \
+	static const u8 b_[] = {__VA_ARGS__}; \
+	emit((a), b_, sizeof(b_)); \
+}
+
+static void emit8(struct jasm *a, u8 v)
+{
+	emit(a, &v, 1);
+}
+
+static void emit32(struct jasm *a, u32 v)
+{
+	u8 b[4] = {(u8)v, (u8)(v >> 8), (u8)(v >> 16), (u8)(v >> 24)};
+	emit(a, b, 4);
+}
+
+static void emit64(struct jasm *a, uint64_t v)
+{
+	emit32(a, (u32)v);
+	emit32(a, (u32)(v >> 32));
+}
+
+// rel32 operand to be resolved once all code is emitted:
+static void rel32(struct jasm *a, enum fix_kind kind, u32 ip, u8 err, u8 adj)
+{
+	if (a->nfix == a->capfix) {
+		u32 cap = a->capfix ? a->capfix * 2 : 256;
+		struct fixup *f = realloc(a->fix, cap * sizeof(struct fixup));
+		if (!f) {
+			a->oom = true;
+			return;
+		}
+		a->fix = f;
+		a->capfix = cap;
+	}
+	a->fix[a->nfix++] = (struct fixup){a->n, kind, err, adj, ip};
+	emit32(a, 0);
+}
+
+static void jmp(struct jasm *a, enum fix_kind kind, u32 ip)
+{
+	emit8(a, 0xE9);
+	rel32(a, kind, ip, 0, 0);
+}
+
+static void jcc(struct jasm *a, u8 cc, enum fix_kind kind, u32 ip)
+{
+	emit8(a, 0x0F);
+	emit8(a, 0x80 | cc);
+	rel32(a, kind, ip, 0, 0);
+}
+
+// jump on condition `cc` to a stub raising `err` at `ip`, `adj` items above the current SP:
+static void jcc_error(struct jasm *a, u8 cc, enum rexlang_error err, u32 ip, u8 adj)
+{
+	emit8(a, 0x0F);
+	emit8(a, 0x80 | cc);
+	rel32(a, FIX_STUB, ip, (u8)err, adj);
+}
+
+static void jmp_error(struct jasm *a, enum rexlang_error err, u32 ip)
+{
+	emit8(a, 0xE9);
+	rel32(a, FIX_STUB, ip, (u8)err, 0);
+}
+
+static void setcc_eax(struct jasm *a, u8 cc)
+{
+	emit8(a, 0x0F);
+	emit8(a, 0x90 | cc);            // setcc al
+	emit8(a, 0xC0);
+	E(a, 0x0F, 0xB6, 0xC0);         // movzx eax, al
+}
+
+// `opc reg, [r13 + r15*4 + n*4]`: operate on data stack item `n` counting from the top:
+static void slot(struct jasm *a, u8 opc, u8 reg, u32 n)
+{
+	emit8(a, 0x43);
+	emit8(a, opc);
+	if (n * 4 <= 127) {
+		emit8(a, 0x44 | (reg << 3));
+		emit8(a, 0xBD);
+		emit8(a, (u8)(n * 4));
+	} else {
+		emit8(a, 0x84 | (reg << 3));
+		emit8(a, 0xBD);
+		emit32(a, n * 4);
+	}
+}
+
+// `opc reg, [r12 + off]`: access a field of the vm struct:
+static void field(struct jasm *a, u8 opc, u8 reg, u32 off)
+{
+	emit8(a, 0x41);
+	emit8(a, opc);
+	emit8(a, 0x84 | (reg << 3));
+	emit8(a, 0x24);
+	emit32(a, off);
+}
+
+static void pop_ecx(struct jasm *a)
+{
+	slot(a, 0x8B, ECX, 0);  // mov ecx, [top]
+	E(a, 0x41, 0xFF, 0xC7); // inc r15d
+}
+
+static void push_eax(struct jasm *a)
+{
+	E(a, 0x41, 0xFF, 0xCF); // dec r15d
+	slot(a, 0x89, EAX, 0);  // mov [top], eax
+}
+
+static void push_imm(struct jasm *a, u32 v)
+{
+	E(a, 0x41, 0xFF, 0xCF); // dec r15d
+	slot(a, 0xC7, 0, 0);    // mov dword [top], imm32
+	emit32(a, v);
+}
+
+static void drop(struct jasm *a, u32 n)
+{
+	if (n == 1) {
+		E(a, 0x41, 0xFF, 0xC7);         // inc r15d
+	} else if (n) {
+		E(a, 0x41, 0x81, 0xC7);         // add r15d, imm32
+		emit32(a, n);
+	}
+}
+
+// data address in eax must be below vm->d_size:
+static void dcheck_eax(struct jasm *a, u32 ip, u8 adj)
+{
+#ifndef REXLANG_NO_BOUNDS_CHECK
+	field(a, 0x3B, EAX, OFF(d_size));   // cmp eax, [vm->d_size]
+	jcc_error(a, CC_AE, REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS, ip, adj);
+#else
+	(void)a;
+	(void)ip;
+	(void)adj;
+#endif
+}
+
+// load width `w` (1, 2, 4; negative if sign-extended) from d[eax] or d[disp] into eax:
+static void load(struct jasm *a, int w, bool constant, u32 disp)
+{
+	switch (w) {
+		case  1: E(a, 0x41, 0x0F, 0xB6); break;    // movzx eax, byte
+		case  2: E(a, 0x41, 0x0F, 0xB7); break;    // movzx eax, word
+		case  4: E(a, 0x41, 0x8B); break;          // mov eax, dword
+		case -1: E(a, 0x41, 0x0F, 0xBE); break;    // movsx eax, byte
+		case -2: E(a, 0x41, 0x0F, 0xBF); break;    // movsx eax, word
+	}
+	if (constant) {
+		E(a, 0x86);                 // [r14 + disp32]
+		emit32(a, disp);
+	} else {
+		E(a, 0x04, 0x06);           // [r14 + rax]
+	}
+}
+
+// store width `w` of ecx to d[eax] or d[disp]:
+static void store(struct jasm *a, int w, bool constant, u32 disp)
+{
+	switch (w) {
+		case 1: E(a, 0x41, 0x88); break;           // mov byte, cl
+		case 2: E(a, 0x66, 0x41, 0x89); break;     // mov word, cx
+		case 4: E(a, 0x41, 0x89); break;           // mov dword, ecx
+	}
+	if (constant) {
+		E(a, 0x8E);                 // [r14 + disp32]
+		emit32(a, disp);
+	} else {
+		E(a, 0x0C, 0x06);           // [r14 + rax]
+	}
+}
+
+// call a C function taking (vm, arg) with the VM state synced:
+static void call_c(struct jasm *a, const void *fn, u32 ip_next, u32 arg)
+{
+	E(a, 0x41, 0xC7, 0x84, 0x24);           // mov dword [vm->ip], imm32
+	emit32(a, OFF(ip));
+	emit32(a, ip_next);
+	E(a, 0x45, 0x89, 0xBC, 0x24);           // mov [vm->sp], r15d
+	emit32(a, OFF(sp));
+	E(a, 0x4C, 0x89, 0xE7);                 // mov rdi, r12
+	E(a, 0xBE);                             // mov esi, imm32
+	emit32(a, arg);
+	E(a, 0x48, 0xB8);                       // mov rax, imm64
+	emit64(a, (uint64_t)(uintptr_t)fn);
+	E(a, 0xFF, 0xD0);                       // call rax
+	E(a, 0x45, 0x8B, 0xBC, 0x24);           // mov r15d, [vm->sp]
+	emit32(a, OFF(sp));
+}
+
+// dcopy and pcopy, with the VM state synced:
+static enum rexlang_error jit_copy(struct rexlang_vm *vm, u32 prgm)
+{
+	u32 a = vm->ki[vm->sp++];
+	u32 b = vm->ki[vm->sp++];
+	u32 c = vm->ki[vm->sp++];
+
+#ifndef REXLANG_NO_BOUNDS_CHECK
+	if (c+a-1 >= vm->d_size) {
+		return vm->err = REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS;
+	}
+	if (prgm && b+a-1 >= vm->m_size) {
+		return vm->err = REXLANG_ERR_PRGM_ADDRESS_OUT_OF_BOUNDS;
+	}
+	if (!prgm && b+a-1 >= vm->d_size) {
+		return vm->err = REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS;
+	}
+#endif
+
+	memcpy(vm->d + c, (prgm ? vm->m : vm->d) + b, a);
+	vm->ki[--vm->sp] = c + a;
+
+	return REXLANG_ERR_SUCCESS;
+}
+
+// binary operators on the top item with operand a; register form, immediate /digit form:
+static const u8 alu_rm[] = {
+	[0x0C] = 0x21, [0x0D] = 0x09, [0x0E] = 0x31, [0x0F] = 0x01, [0x10] = 0x29,
+};
+static const u8 alu_imm[] = {
+	[0x0C] = 4, [0x0D] = 1, [0x0E] = 6, [0x0F] = 0, [0x10] = 5,
+};
+// condition for `b OP a` after `cmp b, a`:
+static const u8 cmp_cc[] = {
+	[0x02] = CC_E,  [0x03] = CC_NE,
+	[0x04] = CC_BE, [0x05] = CC_LE,
+	[0x06] = CC_A,  [0x07] = CC_G,
+	[0x08] = CC_B,  [0x09] = CC_L,
+	[0x0A] = CC_AE, [0x0B] = CC_GE,
+};
+// load widths of ld-* by base opcode:
+static const s8 ld_width[] = {
+	[0x12] = 1, [0x13] = 2, [0x14] = 4, [0x15] = 1, [0x16] = 2, [0x17] = 4,
+	[0x18] = -1, [0x19] = -2, [0x1A] = -1, [0x1B] = -2,
+};
+
+// emit the instruction with opcode `o` ending at `ip_next`; returns false for instructions
+// that verified programs cannot contain:
+static bool translate(struct jasm *a, u8 o, u32 imm, u32 ip_next)
+{
+	u8 base = o & 0x3F;
+	bool im = o >= 0x40;
+
+	if (o == 0x00) {
+		// halt:
+		jmp_error(a, REXLANG_ERR_HALTED, ip_next);
+		return true;
+	}
+	if (o == 0x01) {
+		return true;
+	}
+	if (o == 0x32) {
+		// yield; resumes at the next instruction:
+		jmp_error(a, REXLANG_ERR_YIELDED, ip_next);
+		return true;
+	}
+
+	switch (base) {
+		case 0x00 ... 0x01: // push-imm
+			push_imm(a, imm);
+			return true;
+
+		case 0x02 ... 0x0B: // comparisons
+			if (im) {
+				E(a, 0xB9);                     // mov ecx, imm32
+				emit32(a, imm);
+			} else {
+				pop_ecx(a);
+			}
+			slot(a, 0x39, ECX, 0);              // cmp [top], ecx
+			setcc_eax(a, cmp_cc[base]);
+			slot(a, 0x89, EAX, 0);              // mov [top], eax
+			return true;
+
+		case 0x0C ... 0x10: // and, or, xor, add, sub
+			if (im) {
+				slot(a, 0x81, alu_imm[base], 0);
+				emit32(a, imm);
+			} else {
+				pop_ecx(a);
+				slot(a, alu_rm[base], ECX, 0);
+			}
+			return true;
+
+		case 0x11: // mul
+			if (im) {
+				slot(a, 0x8B, EAX, 0);          // mov eax, [top]
+				E(a, 0x69, 0xC0);               // imul eax, eax, imm32
+				emit32(a, imm);
+			} else {
+				pop_ecx(a);
+				slot(a, 0x8B, EAX, 0);
+				E(a, 0x0F, 0xAF, 0xC1);         // imul eax, ecx
+			}
+			slot(a, 0x89, EAX, 0);
+			return true;
+
+		case 0x12 ... 0x14:
+		case 0x18 ... 0x19: // ld
+			if (im) {
+				load(a, ld_width[base], true, imm);
+				push_eax(a);
+			} else {
+				slot(a, 0x8B, EAX, 0);
+				dcheck_eax(a, ip_next, 1);
+				load(a, ld_width[base], false, 0);
+				slot(a, 0x89, EAX, 0);
+			}
+			return true;
+
+		case 0x15 ... 0x17:
+		case 0x1A ... 0x1B: // ld-offs
+			slot(a, 0x8B, EAX, 0);              // mov eax, [top]
+			if (im) {
+				E(a, 0x05);                     // add eax, imm32
+				emit32(a, imm);
+				dcheck_eax(a, ip_next, 1);
+			} else {
+				slot(a, 0x03, EAX, 1);          // add eax, [top+1]
+				dcheck_eax(a, ip_next, 2);
+				drop(a, 1);
+			}
+			load(a, ld_width[base], false, 0);
+			slot(a, 0x89, EAX, 0);
+			return true;
+
+		case 0x1C ... 0x1E:
+		case 0x22 ... 0x24: { // st, st-discard
+			int w = 1 << ((base - 0x1C) % 3);
+			bool discard = base >= 0x22;
+			if (im) {
+				slot(a, 0x8B, ECX, 0);          // mov ecx, [top]
+				store(a, w, true, imm);
+				if (discard) {
+					drop(a, 1);
+				}
+			} else {
+				slot(a, 0x8B, EAX, 0);          // mov eax, [top]     address
+				slot(a, 0x8B, ECX, 1);          // mov ecx, [top+1]   value
+				dcheck_eax(a, ip_next, 2);
+				store(a, w, false, 0);
+				drop(a, discard ? 2 : 1);
+			}
+			return true;
+		}
+
+		case 0x1F ... 0x21:
+		case 0x25 ... 0x27: { // st-offs, st-offs-discard
+			int w = 1 << ((base - 0x1F) % 3);
+			bool discard = base >= 0x25;
+			slot(a, 0x8B, EAX, 0);              // mov eax, [top]
+			if (im) {
+				E(a, 0x05);                     // add eax, imm32
+				emit32(a, imm);
+				slot(a, 0x8B, ECX, 1);          // mov ecx, [top+1]   value
+				dcheck_eax(a, ip_next, 2);
+				store(a, w, false, 0);
+				drop(a, discard ? 2 : 1);
+			} else {
+				slot(a, 0x03, EAX, 1);          // add eax, [top+1]
+				slot(a, 0x8B, ECX, 2);          // mov ecx, [top+2]   value
+				dcheck_eax(a, ip_next, 3);
+				store(a, w, false, 0);
+				drop(a, discard ? 3 : 2);
+			}
+			return true;
+		}
+
+		case 0x28: // call
+			if (!im) {
+				return false;
+			}
+			field(a, 0x8B, EAX, OFF(cp));       // mov eax, [vm->cp]
+			E(a, 0xFF, 0xC8);                   // dec eax
+			field(a, 0x89, EAX, OFF(cp));       // mov [vm->cp], eax
+			E(a, 0x49, 0x8B, 0x94, 0x24);       // mov rdx, [vm->cs]
+			emit32(a, OFF(cs));
+			E(a, 0xC7, 0x04, 0x82);             // mov dword [rdx + rax*4], imm32
+			emit32(a, ip_next);
+			jmp(a, FIX_INSN, imm);
+			return true;
+
+		case 0x29: // jump-abs
+			if (!im) {
+				return false;
+			}
+			jmp(a, FIX_INSN, imm);
+			return true;
+
+		case 0x2A ... 0x2B: // jump-abs-if, jump-abs-if-not
+		case 0x2D ... 0x2E: // jump-rel-if, jump-rel-if-not
+			if (!im) {
+				return false;
+			}
+			slot(a, 0x8B, EAX, 0);              // mov eax, [top]
+			drop(a, 1);
+			E(a, 0x85, 0xC0);                   // test eax, eax
+			jcc(a, (base == 0x2A || base == 0x2D) ? CC_NE : CC_E,
+				FIX_INSN, base >= 0x2D ? ip_next + imm : imm);
+			return true;
+
+		case 0x2C: // jump-rel pushes the IP following it:
+			if (!im) {
+				return false;
+			}
+			push_imm(a, ip_next);
+			jmp(a, FIX_INSN, ip_next + imm);
+			return true;
+
+		case 0x2F: // syscall
+			if (!im) {
+				return false;
+			}
+			E(a, 0x49, 0x83, 0xBC, 0x24);       // cmp qword [vm->syscall], 0
+			emit32(a, OFF(syscall));
+			emit8(a, 0);
+			jcc_error(a, CC_E, REXLANG_ERR_BAD_SYSCALL, ip_next, 0);
+			call_c(a, (const void *)rexlang_vm_syscall, ip_next, imm);
+			E(a, 0x41, 0x83, 0xBC, 0x24);       // cmp dword [vm->err], 0
+			emit32(a, OFF(err));
+			emit8(a, 0);
+			jcc(a, CC_NE, FIX_EXIT_VM, 0);
+			// the syscall may have moved the IP:
+			field(a, 0x8B, ECX, OFF(ip));       // mov ecx, [vm->ip]
+			E(a, 0x81, 0xF9);                   // cmp ecx, imm32
+			emit32(a, ip_next);
+			jcc(a, CC_NE, FIX_DISPATCH, 0);
+			return true;
+
+		case 0x30 ... 0x31: // shl, shr
+			if (im) {
+				if (o != 0x70 && o != 0x71) {
+					return false;
+				}
+				slot(a, 0xC1, base == 0x30 ? 4 : 5, 0);
+				emit8(a, (u8)imm);
+			} else {
+				pop_ecx(a);
+				slot(a, 0xD3, base == 0x30 ? 4 : 5, 0);
+			}
+			return true;
+
+		case 0x32: // ldsp-offs-imm8
+			if (o != 0x72) {
+				return false;
+			}
+			slot(a, 0x8B, EAX, imm);
+			push_eax(a);
+			return true;
+
+		case 0x33: // discard-imm8
+			if (o != 0x73) {
+				return false;
+			}
+			drop(a, imm);
+			return true;
+
+		default:
+			break;
+	}
+
+	if (im) {
+		return false;
+	}
+
+	switch (o) {
+		case 0x38: // return
+			field(a, 0x8B, EAX, OFF(cp));       // mov eax, [vm->cp]
+			E(a, 0x49, 0x8B, 0x94, 0x24);       // mov rdx, [vm->cs]
+			emit32(a, OFF(cs));
+			E(a, 0x8B, 0x0C, 0x82);             // mov ecx, [rdx + rax*4]
+			E(a, 0xFF, 0xC0);                   // inc eax
+			field(a, 0x89, EAX, OFF(cp));       // mov [vm->cp], eax
+			jmp(a, FIX_DISPATCH, 0);
+			return true;
+		case 0x39: // not
+			slot(a, 0x83, 7, 0);                // cmp dword [top], 0
+			emit8(a, 0);
+			setcc_eax(a, CC_E);
+			slot(a, 0x89, EAX, 0);
+			return true;
+		case 0x3A: // neg
+			slot(a, 0xF7, 3, 0);
+			return true;
+		case 0x3B: // discard
+			drop(a, 1);
+			return true;
+		case 0x3C: // swap
+			slot(a, 0x8B, EAX, 0);
+			slot(a, 0x8B, ECX, 1);
+			slot(a, 0x89, ECX, 0);
+			slot(a, 0x89, EAX, 1);
+			return true;
+		case 0x3D: // dup
+			slot(a, 0x8B, EAX, 0);
+			push_eax(a);
+			return true;
+		case 0x3E: // dcopy
+		case 0x3F: // pcopy
+			call_c(a, (const void *)jit_copy, ip_next, o == 0x3F);
+			E(a, 0x85, 0xC0);                   // test eax, eax
+			jcc(a, CC_NE, FIX_EXIT_VM, 0);
+			return true;
+		default:
+			return false;
+	}
+}
+
+// whether the native code of the translated instruction `o` runs on into that of the next:
+static bool continues(u8 o)
+{
+	u8 base = o & 0x3F;
+
+	// halt, return, call, jump-abs, jump-rel:
+	return o != 0x00 && o != 0x38 && base != 0x28 && base != 0x29 && base != 0x2C;
+}
+
+// mark every instruction reachable from IP 0; the verifier proved they decode consistently:
+static bool discover(const struct rexlang_vm *vm, u8 *seen, u32 *work)
+{
+	const u8 *m = vm->m;
+	u32 n = 0;
+
+	work[n++] = 0;
+	seen[0] = 1;
+	while (n) {
+		u32 ip = work[--n];
+		u8 o = unfuse(m[ip]);
+		u8 base = o & 0x3F;
+		u32 next = ip + 1 + imm_size(o);
+		u32 targets[2];
+		int nt = 0;
+
+		if (next > vm->m_size) {
+			return false;
+		}
+
+		if (o >= 0x40 && base >= 0x28 && base <= 0x2E) {
+			u32 imm = rdimm(m, ip, o);
+			targets[nt++] = (base >= 0x2C) ? next + imm : imm;
+			if (base != 0x29 && base != 0x2C) {
+				// conditional jumps and calls continue after the instruction:
+				targets[nt++] = next;
+			}
+		} else if (o != 0x00 && o != 0x38) {
+			targets[nt++] = next;
+		}
+
+		for (int t = 0; t < nt; t++) {
+			if (targets[t] < vm->m_size && !seen[targets[t]]) {
+				seen[targets[t]] = 1;
+				work[n++] = targets[t];
+			}
+		}
+	}
+
+	return true;
+}
+
+// stub bodies at the end of the code, reached from the fixups that refer to them:
+static void emit_stubs(struct jasm *a, u32 nfix)
+{
+	for (u32 i = 0; i < nfix && !a->oom; i++) {
+		struct fixup f = a->fix[i];
+		u32 at = a->n;
+
+		if (f.kind == FIX_STUB) {
+			if (f.err) {
+				E(a, 0x41, 0xC7, 0x84, 0x24);   // mov dword [vm->err], imm32
+				emit32(a, OFF(err));
+				emit32(a, f.err);
+			}
+			drop(a, f.adj);
+			E(a, 0xBE);                         // mov esi, imm32
+			emit32(a, f.ip);
+			jmp(a, FIX_EXIT, 0);
+		} else if (f.kind == FIX_BUDGET) {
+			E(a, 0xBE);                         // mov esi, imm32
+			emit32(a, f.ip);
+			jmp(a, FIX_EXIT, 0);
+		} else {
+			continue;
+		}
+
+		// retarget the fixup at the stub:
+		a->fix[i].kind = FIX_DONE;
+		*(u32 *)(a->p + f.pos) = at - (f.pos + 4);
+	}
+}
+
+bool rexlang_vm_jit_compile(const struct rexlang_vm *vm, struct rexlang_jit *jit)
+{
+	const u32 m_size = vm->m_size;
+	struct jasm a;
+	u8 *seen;
+	u32 *off;
+	u32 nfix;
+	u8 *code;
+	bool ok = false;
+
+	assert(jit && "jit cannot be NULL");
+	memset(jit, 0, sizeof(struct rexlang_jit));
+
+	if (!vm->verified || m_size == 0) {
+		return false;
+	}
+
+	memset(&a, 0, sizeof(a));
+	seen = calloc(m_size, 1);
+	off = malloc(m_size * sizeof(u32));
+	jit->table = malloc(m_size * sizeof(void *));
+	if (!seen || !off || !jit->table || !discover(vm, seen, off)) {
+		goto out;
+	}
+
+	// prologue: rexlang_jit_entry(vm, &count, table)
+	E(&a, 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57); // push rbx, rbp, r12-r15
+	E(&a, 0x48, 0x83, 0xEC, 0x08);             // sub rsp, 8
+	E(&a, 0x48, 0x89, 0x34, 0x24);             // mov [rsp], rsi
+	E(&a, 0x49, 0x89, 0xFC);                   // mov r12, rdi
+	E(&a, 0x8B, 0x1E);                         // mov ebx, [rsi]
+	E(&a, 0x48, 0x89, 0xD5);                   // mov rbp, rdx
+	E(&a, 0x4D, 0x8B, 0xAC, 0x24);             // mov r13, [vm->ki]
+	emit32(&a, OFF(ki));
+	E(&a, 0x4D, 0x8B, 0xB4, 0x24);             // mov r14, [vm->d]
+	emit32(&a, OFF(d));
+	E(&a, 0x45, 0x8B, 0xBC, 0x24);             // mov r15d, [vm->sp]
+	emit32(&a, OFF(sp));
+	field(&a, 0x8B, ECX, OFF(ip));             // mov ecx, [vm->ip]
+
+	// dispatch: enter the instruction at IP ecx
+	a.label[FIX_DISPATCH] = a.n;
+	E(&a, 0x81, 0xF9);                         // cmp ecx, m_size
+	emit32(&a, m_size);
+	jcc(&a, CC_AE, FIX_BAIL, 0);
+	E(&a, 0xFF, 0x64, 0xCD, 0x00);             // jmp [rbp + rcx*8]
+
+	// bail: return 1 to continue at IP ecx in the interpreter
+	a.label[FIX_BAIL] = a.n;
+	E(&a, 0x89, 0xCE);                         // mov esi, ecx
+	E(&a, 0xB8, 0x01, 0x00, 0x00, 0x00);       // mov eax, 1
+	E(&a, 0xEB, 10);                           // jmp over the exits
+
+	// exits: return 0
+	a.label[FIX_EXIT_VM] = a.n;
+	field(&a, 0x8B, 6, OFF(ip));               // mov esi, [vm->ip]
+	a.label[FIX_EXIT] = a.n;
+	E(&a, 0x31, 0xC0);                         // xor eax, eax
+
+	// epilogue: sync IP esi, SP and the remaining budget
+	field(&a, 0x89, 6, OFF(ip));               // mov [vm->ip], esi
+	E(&a, 0x45, 0x89, 0xBC, 0x24);             // mov [vm->sp], r15d
+	emit32(&a, OFF(sp));
+	E(&a, 0x48, 0x8B, 0x14, 0x24);             // mov rdx, [rsp]
+	E(&a, 0x89, 0x1A);                         // mov [rdx], ebx
+	E(&a, 0x48, 0x83, 0xC4, 0x08);             // add rsp, 8
+	E(&a, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3); // pop r15-r12, rbp, rbx; ret
+
+	for (u32 ip = 0; ip < m_size; ip++) {
+		u8 o;
+		u32 len;
+		u32 next;
+
+		if (!seen[ip]) {
+			off[ip] = UINT32_MAX;
+			continue;
+		}
+
+		o = unfuse(vm->m[ip]);
+		len = 1 + imm_size(o);
+		off[ip] = a.n;
+
+		// code is laid out in IP order; continue explicitly where the next instruction
+		// does not follow immediately:
+		for (next = ip + 1; next < m_size && !seen[next]; next++) {
+		}
+
+		// the interpreter's budget check before fetching:
+		E(&a, 0x83, 0xEB, 0x01);               // sub ebx, 1
+		emit8(&a, 0x0F);                       // jc budget stub
+		emit8(&a, 0x80 | CC_B);
+		rel32(&a, FIX_BUDGET, ip, 0, 0);
+
+		if (!translate(&a, o, rdimm(vm->m, ip, o), ip + len)) {
+			// not covered by the verifier; undo the budget check and leave native code:
+			E(&a, 0x83, 0xC3, 0x01);           // add ebx, 1
+			E(&a, 0xB9);                       // mov ecx, imm32
+			emit32(&a, ip);
+			jmp(&a, FIX_BAIL, 0);
+		} else if (next != ip + len && continues(o)) {
+			if (ip + len < m_size) {
+				jmp(&a, FIX_INSN, ip + len);
+			} else {
+				E(&a, 0xB9);                   // mov ecx, imm32
+				emit32(&a, ip + len);
+				jmp(&a, FIX_BAIL, 0);
+			}
+		}
+	}
+
+	nfix = a.nfix;
+	emit_stubs(&a, nfix);
+	if (a.oom) {
+		goto out;
+	}
+
+	for (u32 i = 0; i < a.nfix; i++) {
+		struct fixup *f = &a.fix[i];
+		u32 target;
+
+		if (f->kind == FIX_DONE) {
+			continue;
+		}
+		if (f->kind == FIX_INSN) {
+			if (f->ip >= m_size || off[f->ip] == UINT32_MAX) {
+				goto out;
+			}
+			target = off[f->ip];
+		} else {
+			target = a.label[f->kind];
+		}
+		*(u32 *)(a.p + f->pos) = target - (f->pos + 4);
+	}
+
+	code = mmap(NULL, a.n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED) {
+		goto out;
+	}
+	memcpy(code, a.p, a.n);
+	if (mprotect(code, a.n, PROT_READ | PROT_EXEC) != 0) {
+		munmap(code, a.n);
+		goto out;
+	}
+
+	for (u32 ip = 0; ip < m_size; ip++) {
+		jit->table[ip] = code + (off[ip] != UINT32_MAX ? off[ip] : a.label[FIX_BAIL]);
+	}
+	jit->code = code;
+	jit->code_size = a.n;
+	jit->m = vm->m;
+	jit->m_size = m_size;
+	jit->generation = vm->generation;
+	ok = true;
+
+out:
+	if (!ok) {
+		free(jit->table);
+		jit->table = NULL;
+	}
+	free(a.p);
+	free(a.fix);
+	free(off);
+	free(seen);
+	return ok;
+}
+
+void rexlang_vm_jit_free(struct rexlang_jit *jit)
+{
+	if (jit->code) {
+		munmap(jit->code, jit->code_size);
+	}
+	free(jit->table);
+	memset(jit, 0, sizeof(struct rexlang_jit));
+}
+
+bool rexlang_vm_jit_current(const struct rexlang_vm *vm, const struct rexlang_jit *jit)
+{
+	return vm->m == jit->m && vm->m_size == jit->m_size && vm->generation == jit->generation;
+}
+
+typedef int (*rexlang_jit_entry)(struct rexlang_vm *vm, unsigned int *count, const void **table);
+
+enum rexlang_error rexlang_vm_jit_exec(struct rexlang_vm *vm, const struct rexlang_jit *jit, unsigned int instruction_count)
+{
+	unsigned int count = instruction_count;
+
+	assert(vm->m);
+
+	// require an explicit error acknowledgement:
+	if (vm->err != REXLANG_ERR_SUCCESS) {
+		return vm->err;
+	}
+
+	// native code relies on the verifier's proof like the unchecked interpreter does, and on
+	// the program being the one it was compiled from:
+	if (!jit->code || !vm->unchecked || !rexlang_vm_jit_current(vm, jit)) {
+		return rexlang_vm_exec(vm, instruction_count);
+	}
+#ifdef REXLANG_PROFILE
+	// native code does not count executions:
+	if (vm->profile) {
+		return rexlang_vm_exec(vm, instruction_count);
+	}
+#endif
+	// nor track writes, nor reach MMIO windows:
+	if (vm->dirty || vm->mmio) {
+		return rexlang_vm_exec(vm, instruction_count);
+	}
+
+	if (((rexlang_jit_entry)jit->code)(vm, &count, jit->table)) {
+		// reached an instruction without native code:
+		return rexlang_vm_exec(vm, count);
+	}
+
+	return vm->err;
+}
+
+#endif
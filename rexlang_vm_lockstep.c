@@ -0,0 +1,640 @@
+#include <assert.h>
+#include <string.h>
+#include "rexlang_vm_impl.h"
+
+// lockstep execution runs up to REXLANG_LOCKSTEP_LANES VMs that follow the same instruction path
+// as one: the instruction is decoded once and applied to a vector holding one data stack item
+// of every lane. it relies on GCC's vector extensions, which the compiler maps onto SSE, AVX2
+// or NEON registers as available and lowers to scalar code otherwise; other compilers run
+// every VM on its own.
+//
+// the group only executes an instruction in lockstep when no lane can fail it. anything else,
+// including instructions that are not vectorised, is left to rexlang_vm_exec() on each lane, so
+// every VM ends in exactly the state that rexlang_vm_exec() alone would have left it in.
+
+#define LANES REXLANG_LOCKSTEP_LANES
+
+#if defined(__GNUC__)
+
+_Static_assert(LANES >= 1 && LANES <= 32 && (LANES & (LANES - 1)) == 0, "REXLANG_LOCKSTEP_LANES must be a power of two up to 32");
+
+typedef u32 vec __attribute__((vector_size(4 * LANES)));
+typedef s32 svec __attribute__((vector_size(4 * LANES)));
+// data stack items live in the caller's scratch, which is only aligned for u32:
+typedef u32 slot __attribute__((vector_size(4 * LANES), aligned(4)));
+
+// vectors are passed to helpers by address: passing them by value would make the calling
+// convention depend on which instruction sets are enabled:
+#define splat(x) ((vec){0} + (u32)(x))
+
+struct group {
+	struct rexlang_vm *vm[LANES];
+	u32 active;                 // bit per lane executing in lockstep
+	unsigned int count;         // instruction budget of every lane
+	unsigned int executed;      // instructions the group has executed so far
+
+	// shared state of the active lanes as of the start of the current instruction:
+	rexlang_ip ip;
+	rexlang_sp sp;
+	rexlang_sp cp;
+	slot *st;                   // data stack; item k of lane l is st[k][l]
+};
+
+enum stop {
+	STOP_BUDGET,                // the budget is used up
+	STOP_STEP,                  // the current instruction must be executed by each lane alone
+	STOP_EMPTY,                 // no lanes are left
+};
+
+// iterate `l` over the set bits of `mask`, lowest first:
+#define for_lanes(l, mask) \
+	for (u32 m_ = (mask), l = 0; m_ && ((l = __builtin_ctz(m_)), 1); m_ &= m_ - 1)
+
+// bit per lane in `active` whose element of `v` is nonzero:
+static inline u32 lanes_set(const vec *v, u32 active)
+{
+	u32 mask = 0;
+
+	for (unsigned int l = 0; l < LANES; l++) {
+		mask |= ((*v)[l] != 0) << l;
+	}
+	return mask & active;
+}
+
+static bool joins(const struct rexlang_vm *lead, const struct rexlang_vm *vm)
+{
+	return vm->err == REXLANG_ERR_SUCCESS
+		&& vm->m == lead->m
+		&& vm->m_size == lead->m_size
+		&& vm->ki_size == lead->ki_size
+		&& vm->cs_size == lead->cs_size
+		&& vm->ip == lead->ip
+		&& vm->sp == lead->sp
+		&& vm->cp == lead->cp
+		&& memcmp(vm->cs + vm->cp, lead->cs + lead->cp, sizeof(rexlang_ip) * (vm->cs_size - vm->cp)) == 0
+#ifdef REXLANG_PROFILE
+		// lockstep execution is not counted:
+		&& !vm->profile
+#endif
+		;
+}
+
+// write the group state back to lane `l`:
+static void scatter(struct group *g, unsigned int l)
+{
+	struct rexlang_vm *vm = g->vm[l];
+
+	vm->ip = g->ip;
+	vm->sp = g->sp;
+	vm->cp = g->cp;
+	for (u32 k = g->sp; k < vm->ki_size; k++) {
+		vm->ki[k] = g->st[k][l];
+	}
+}
+
+// take the lanes of `mask` out of the group and run them on their own for the rest of the budget:
+static void drop(struct group *g, u32 mask)
+{
+	mask &= g->active;
+	g->active &= ~mask;
+	for_lanes(l, mask) {
+		scatter(g, l);
+		rexlang_vm_exec(g->vm[l], g->count - g->executed);
+	}
+}
+
+// form a group of the lanes of `mask` that can join the first of them that has no pending
+// error. the others run on their own:
+static void regroup(struct group *g, u32 mask)
+{
+	const struct rexlang_vm *lead = NULL;
+
+	g->active = 0;
+	for_lanes(l, mask) {
+		struct rexlang_vm *vm = g->vm[l];
+
+		if (vm->err != REXLANG_ERR_SUCCESS) {
+			continue;
+		}
+		if (!lead) {
+			lead = vm;
+		}
+		if (joins(lead, vm)) {
+			g->active |= 1u << l;
+		} else {
+			rexlang_vm_exec(vm, g->count - g->executed);
+		}
+	}
+	if (!g->active) {
+		return;
+	}
+
+	g->ip = lead->ip;
+	g->sp = lead->sp;
+	g->cp = lead->cp;
+	for (u32 k = g->sp; k < lead->ki_size; k++) {
+		for_lanes(l, g->active) {
+			g->st[k][l] = g->vm[l]->ki[k];
+		}
+	}
+}
+
+// execute the current instruction on each lane alone and merge the lanes again:
+static void step(struct group *g)
+{
+	for_lanes(l, g->active) {
+		scatter(g, l);
+		rexlang_vm_exec(g->vm[l], 1);
+	}
+	g->executed++;
+	if (g->executed == g->count) {
+		g->active = 0;
+		return;
+	}
+	regroup(g, g->active);
+}
+
+// lanes of `active` that `addr` is out of bounds of:
+static inline u32 out_of_bounds(const struct group *g, u32 active, const vec *addr)
+{
+	u32 mask = 0;
+
+#ifndef REXLANG_NO_BOUNDS_CHECK
+	for_lanes(l, active) {
+		mask |= ((*addr)[l] >= g->vm[l]->d_size) << l;
+	}
+#else
+	(void)g;
+	(void)active;
+	(void)addr;
+#endif
+	return mask;
+}
+
+// load for ld-* opcode `base` from the data memory of every active lane into `*v`:
+static inline void load(const struct group *g, u32 active, u8 base, const vec *addr, vec *v)
+{
+	for_lanes(l, active) {
+		const u8 *d = g->vm[l]->d;
+		u32 p = (*addr)[l];
+
+		switch (base) {
+			case 0x12: case 0x15: (*v)[l] = d[p]; break;
+			case 0x13: case 0x16: (*v)[l] = *(u16*)(&d[p]); break;
+			case 0x14: case 0x17: (*v)[l] = *(u32*)(&d[p]); break;
+			case 0x18: case 0x1A: (*v)[l] = (s8)d[p]; break;
+			case 0x19: case 0x1B: (*v)[l] = (s16)*(u16*)(&d[p]); break;
+		}
+	}
+}
+
+// store for st-* opcode `base` to the data memory of every active lane:
+static inline void store(const struct group *g, u32 active, u8 base, const vec *addr, const vec *v)
+{
+	for_lanes(l, active) {
+		u8 *d = g->vm[l]->d;
+		u32 p = (*addr)[l];
+
+		switch ((base - 0x1C) % 3) {
+			case 0: d[p] = (*v)[l]; dirty_data(g->vm[l], p, 1); break;
+			case 1: *(u16*)(&d[p]) = (*v)[l]; dirty_data(g->vm[l], p, 2); break;
+			case 2: *(u32*)(&d[p]) = (*v)[l]; dirty_data(g->vm[l], p, 4); break;
+		}
+	}
+}
+
+// `*r = b op a` for binary opcode `base`; `r` may alias `b`:
+static inline void binary(u8 base, vec *r, const vec *pb, const vec *pa)
+{
+	vec b = *pb, a = *pa;
+
+	switch (base) {
+		case 0x02: *r = (vec)(b == a) & 1; break;
+		case 0x03: *r = (vec)(b != a) & 1; break;
+		case 0x04: *r = (vec)(b <= a) & 1; break;
+		case 0x05: *r = (vec)((svec)b <= (svec)a) & 1; break;
+		case 0x06: *r = (vec)(b > a) & 1; break;
+		case 0x07: *r = (vec)((svec)b > (svec)a) & 1; break;
+		case 0x08: *r = (vec)(b < a) & 1; break;
+		case 0x09: *r = (vec)((svec)b < (svec)a) & 1; break;
+		case 0x0A: *r = (vec)(b >= a) & 1; break;
+		case 0x0B: *r = (vec)((svec)b >= (svec)a) & 1; break;
+		case 0x0C: *r = b & a; break;
+		case 0x0D: *r = b | a; break;
+		case 0x0E: *r = b ^ a; break;
+		case 0x0F: *r = b + a; break;
+		case 0x10: *r = b - a; break;
+		case 0x11: *r = b * a; break;
+		// counts were checked to be below 32:
+		case 0x30: *r = b << a; break;
+		case 0x31: *r = b >> a; break;
+	}
+}
+
+// the lanes of `active` that do not continue at the IP in `dest` shared by most of them,
+// which is stored in `*to`:
+static u32 diverging(u32 active, const vec *dest, rexlang_ip *to)
+{
+	u32 best = 0;
+
+	for_lanes(l, active) {
+		vec eq = (vec)(*dest == (*dest)[l]);
+		u32 same = lanes_set(&eq, active);
+
+		if (__builtin_popcount(same) > __builtin_popcount(best)) {
+			best = same;
+			*to = (*dest)[l];
+		}
+		if (same == active) {
+			break;
+		}
+	}
+	return active & ~best;
+}
+
+// whether the instructions from `p` on are the rest of the sequence of fused opcode `f`:
+static bool fused_intact(const u8 *m, u32 m_size, u8 f, rexlang_ip p)
+{
+	for (const u8 *o = fused_seq(f) + 1; *o; o++) {
+		if (p >= m_size || m[p] != *o) {
+			return false;
+		}
+		p += 1 + imm_size(*o);
+	}
+	return true;
+}
+
+// run the group until the budget is used up, no lanes are left or an instruction needs
+// executing on each lane alone:
+static enum stop run(struct group *g)
+{
+	const struct rexlang_vm *lead = g->vm[__builtin_ctz(g->active)];
+	const u8 *const m = lead->m;
+	const u32 m_size = lead->m_size;
+	const u32 ki_size = lead->ki_size;
+	slot *const st = g->st;
+
+	rexlang_ip ip = g->ip;
+	rexlang_sp sp = g->sp;
+	rexlang_sp cp = g->cp;
+	u32 active = g->active;
+	unsigned int executed = g->executed;
+
+// write the local state back before lanes leave or the group stops:
+#define sync() { \
+	g->ip = ip; \
+	g->sp = sp; \
+	g->cp = cp; \
+	g->active = active; \
+	g->executed = executed; \
+}
+// lanes of `mask` leave the group at the start of the current instruction:
+#define leave(mask) { \
+	u32 mask_ = (mask); \
+	if (unlikely(mask_)) { \
+		sync(); \
+		drop(g, mask_); \
+		active = g->active; \
+		if (!active) { \
+			return STOP_EMPTY; \
+		} \
+	} \
+}
+// the instruction pops `pops` items and then pushes `pushes`; otherwise leave it to the lanes.
+// one that only pops has no room to check, which need_pop() leaves out:
+#define need(pops, pushes) \
+	if (unlikely(sp + (pops) > ki_size || sp + (pops) < (pushes))) \
+		goto step;
+#define need_pop(pops) \
+	if (unlikely(sp + (pops) > ki_size)) \
+		goto step;
+
+	for (;;) {
+		rexlang_ip next, to;
+		u8 o, base;
+		u32 imm;
+		vec a, b, c, dest;
+
+		if (executed == g->count) {
+			sync();
+			return STOP_BUDGET;
+		}
+		if (ip >= m_size) {
+			goto step;
+		}
+		// fused opcodes run as the first instruction of their sequence:
+		o = unfuse(m[ip]);
+		base = o & 0x3F;
+		next = ip + 1 + imm_size(o);
+		if (next > m_size) {
+			goto step;
+		}
+		if (o != m[ip] && !fused_intact(m, m_size, m[ip], next)) {
+			// how far the interpreter gets depends on the budget left, so no single step will do:
+			leave(active);
+		}
+		imm = rdimm(m, ip, o);
+
+		if (o >= 0x40 && base <= 0x01) {
+			// push-*:
+			need(0, 1);
+			st[--sp] = splat(imm);
+			ip = next;
+			executed++;
+			continue;
+		}
+		if (o >= 0x40 && base >= 0x30) {
+			switch (o) {
+				case 0x70: // shl-imm8
+				case 0x71: // shr-imm8
+					need(1, 1);
+					if (imm >= 32) {
+						goto step;
+					}
+					a = splat(imm);
+					b = st[sp];
+					binary(base, &c, &b, &a);
+					st[sp] = c;
+					break;
+				case 0x72: // ldsp-offs-imm8
+					if (sp + imm >= ki_size || sp == 0) {
+						goto step;
+					}
+					a = st[sp + imm];
+					st[--sp] = a;
+					break;
+				case 0x73: // discard-imm8
+					if (sp + imm >= ki_size) {
+						goto step;
+					}
+					sp += imm;
+					break;
+				default:
+					goto step;
+			}
+			ip = next;
+			executed++;
+			continue;
+		}
+
+		// stack forms and their immediate forms, which take `a` from the immediate:
+		switch (base) {
+			case 0x01: // nop
+				break;
+
+			case 0x02 ... 0x11:
+			case 0x30 ... 0x31:
+				if (o < 0x40) {
+					need(2, 1);
+					a = st[sp];
+					b = st[sp + 1];
+				} else {
+					need(1, 1);
+					a = splat(imm);
+					b = st[sp];
+				}
+				if (base >= 0x30) {
+					c = (vec)(a >= 32);
+					leave(lanes_set(&c, active));
+					a &= 31;
+				}
+				if (o < 0x40) {
+					sp++;
+				}
+				binary(base, &c, &b, &a);
+				st[sp] = c;
+				break;
+
+			case 0x12 ... 0x14: // ld-*
+			case 0x18 ... 0x19:
+				if (o < 0x40) {
+					need(1, 1);
+					a = st[sp];
+				} else {
+					need(0, 1);
+					a = splat(imm);
+				}
+				leave(out_of_bounds(g, active, &a));
+				if (o >= 0x40) {
+					sp--;
+				}
+				load(g, active, base, &a, &c);
+				st[sp] = c;
+				break;
+			case 0x15 ... 0x17: // ld-*-offs
+			case 0x1A ... 0x1B:
+				if (o < 0x40) {
+					need(2, 1);
+					a = st[sp] + st[sp + 1];
+				} else {
+					need(1, 1);
+					a = st[sp] + imm;
+				}
+				leave(out_of_bounds(g, active, &a));
+				if (o < 0x40) {
+					sp++;
+				}
+				load(g, active, base, &a, &c);
+				st[sp] = c;
+				break;
+
+			case 0x1C ... 0x1E: // st-*
+			case 0x22 ... 0x24: // st-*-discard
+				if (o < 0x40) {
+					need(2, base < 0x22);
+					a = st[sp];
+					b = st[sp + 1];
+				} else {
+					need(1, base < 0x22);
+					a = splat(imm);
+					b = st[sp];
+				}
+				leave(out_of_bounds(g, active, &a));
+				store(g, active, base, &a, &b);
+				sp += (o < 0x40) + (base >= 0x22);
+				break;
+			case 0x1F ... 0x21: // st-*-offs
+			case 0x25 ... 0x27: // st-*-offs-discard
+				if (o < 0x40) {
+					need(3, base < 0x25);
+					a = st[sp] + st[sp + 1];
+					c = st[sp + 2];
+				} else {
+					need(2, base < 0x25);
+					a = st[sp] + imm;
+					c = st[sp + 1];
+				}
+				leave(out_of_bounds(g, active, &a));
+				store(g, active, base, &a, &c);
+				sp += (o < 0x40 ? 2 : 1) + (base >= 0x25);
+				break;
+
+			case 0x28: // call
+				if (cp == 0) {
+					goto step;
+				}
+				if (o < 0x40) {
+					need_pop(1);
+					dest = st[sp];
+					leave(diverging(active, &dest, &to));
+					sp++;
+				} else {
+					to = imm;
+				}
+				cp--;
+				for_lanes(l, active) {
+					g->vm[l]->cs[cp] = next;
+				}
+				ip = to;
+				executed++;
+				continue;
+			case 0x29: // jump-abs
+				if (o < 0x40) {
+					need_pop(1);
+					dest = st[sp];
+					leave(diverging(active, &dest, &to));
+					sp++;
+				} else {
+					to = imm;
+				}
+				ip = to;
+				executed++;
+				continue;
+			case 0x2A: // jump-abs-if
+			case 0x2B: // jump-abs-if-not
+			case 0x2D: // jump-rel-if
+			case 0x2E: // jump-rel-if-not
+				if (o < 0x40) {
+					need_pop(2);
+					a = st[sp];
+					b = st[sp + 1];
+				} else {
+					need_pop(1);
+					a = splat(imm);
+					b = st[sp];
+				}
+				if (base >= 0x2D) {
+					a += next;
+				}
+				c = (vec)(b != 0);
+				if (base == 0x2B || base == 0x2E) {
+					c = ~c;
+				}
+				dest = (a & c) | (splat(next) & ~c);
+				leave(diverging(active, &dest, &to));
+				sp += o < 0x40 ? 2 : 1;
+				ip = to;
+				executed++;
+				continue;
+			case 0x2C: // jump-rel
+				if (o < 0x40) {
+					need(1, 1);
+					dest = st[sp] + next;
+					leave(diverging(active, &dest, &to));
+				} else {
+					need(0, 1);
+					to = next + imm;
+					sp--;
+				}
+				st[sp] = splat(next);
+				ip = to;
+				executed++;
+				continue;
+
+			case 0x38: // return
+				if (cp >= lead->cs_size) {
+					goto step;
+				}
+				ip = g->vm[__builtin_ctz(active)]->cs[cp++];
+				executed++;
+				continue;
+			case 0x39: // not
+				need(1, 1);
+				st[sp] = (vec)(st[sp] == 0) & 1;
+				break;
+			case 0x3A: // neg
+				need(1, 1);
+				st[sp] = -st[sp];
+				break;
+			case 0x3B: // discard
+				need_pop(1);
+				sp++;
+				break;
+			case 0x3C: // swap
+				need(2, 2);
+				a = st[sp];
+				st[sp] = st[sp + 1];
+				st[sp + 1] = a;
+				break;
+			case 0x3D: // dup
+				need(1, 2);
+				a = st[sp];
+				st[--sp] = a;
+				break;
+
+			default:
+				// halt, syscalls, yield, copies and invalid opcodes:
+				goto step;
+		}
+		ip = next;
+		executed++;
+	}
+
+step:
+	sync();
+	return STOP_STEP;
+
+#undef need
+#undef need_pop
+#undef leave
+#undef sync
+}
+
+void rexlang_vm_exec_lockstep(struct rexlang_vm *const *vms, unsigned int n, unsigned int instruction_count, uint32_t *scratch, uint32_t scratch_size)
+{
+	assert(vms && scratch);
+
+	for (unsigned int i = 0; i < n; i += LANES) {
+		unsigned int lanes = n - i < LANES ? n - i : LANES;
+		struct group g;
+
+		g.count = instruction_count;
+		g.executed = 0;
+		g.st = (slot *)scratch;
+		for (unsigned int l = 0; l < lanes; l++) {
+			g.vm[l] = vms[i + l];
+			assert(g.vm[l]->ki_size * LANES <= scratch_size && "scratch must hold ki_size * REXLANG_LOCKSTEP_LANES entries");
+		}
+
+		regroup(&g, lanes == 32 ? ~0u : (1u << lanes) - 1);
+		while (g.active) {
+			switch (run(&g)) {
+				case STOP_BUDGET:
+					for_lanes(l, g.active) {
+						scatter(&g, l);
+					}
+					g.active = 0;
+					break;
+				case STOP_STEP:
+					step(&g);
+					break;
+				case STOP_EMPTY:
+					break;
+			}
+		}
+	}
+}
+
+#else
+
+void rexlang_vm_exec_lockstep(struct rexlang_vm *const *vms, unsigned int n, unsigned int instruction_count, uint32_t *scratch, uint32_t scratch_size)
+{
+	(void)scratch;
+	(void)scratch_size;
+
+	for (unsigned int i = 0; i < n; i++) {
+		rexlang_vm_exec(vms[i], instruction_count);
+	}
+}
+
+#endif
@@ -0,0 +1,1616 @@
+// this file is directly #included in rexlang_vm.c to instantiate the interpreter loop.
+// define before including:
+//   LOOP_NAME        name of the generated function
+//   LOOP_PREDECODED  fetch instructions from vm->x (see rexlang_vm_predecode) instead of vm->m
+//   LOOP_VERIFIED    omit the checks that rexlang_vm_verify() proved cannot fail
+//   LOOP_TIMED       budget in cycles charged per opcode from `cost`; see rexlang_vm_exec_cycles()
+
+// executes up to `count` instructions with ip and sp held in locals.
+// vm->ip and vm->sp are written back before syscalls and on exit.
+// with REXLANG_TOS_CACHE the top data stack item is held in a local too and its slot in
+// vm->ki is only written at those points.
+// timed loops start instructions while `count` is positive and return what is left of it:
+#ifdef LOOP_TIMED
+static s32 LOOP_NAME(struct rexlang_vm *vm, s32 count, const u8 *cost)
+#else
+static void LOOP_NAME(struct rexlang_vm *vm, unsigned int count)
+#endif
+{
+	u32 a;
+	u32 b;
+	u32 c;
+	s32 sa;
+	s32 sb;
+
+	rexlang_ip ip = vm->ip;
+	rexlang_sp sp = vm->sp;
+	u32 *const ki = vm->ki;
+	const u32 ki_size = vm->ki_size;
+	const u8 *const m = vm->m;
+	u8 *const d = vm->d;
+#ifdef LOOP_PREDECODED
+	const struct rexlang_insn *const x = vm->x;
+	const struct rexlang_insn *xi;
+#endif
+	const u32 m_size = vm->m_size;
+	// instructions starting below m_tail end within program memory whatever their length:
+	const u32 m_tail = m_size > 4 ? m_size - 4 : 0;
+	const u32 d_size = vm->d_size;
+#ifdef REXLANG_PROFILE
+	struct rexlang_profile *const prof = vm->profile;
+	rexlang_ip prof_ip = 0;     // IP of the instruction last counted, for conditional jumps
+#endif
+	u32 *const dirty = vm->dirty;
+	const u32 dirty_shift = vm->dirty_shift;
+#ifdef REXLANG_TOS_CACHE
+	u32 tos;
+#endif
+
+	(void)m_size;
+	(void)m_tail;
+	(void)d_size;
+	(void)ki_size;
+
+#ifdef LOOP_VERIFIED
+// stack depths, call depths, branch targets and constant addresses were proven in range:
+#  define check(cond) if (0)
+#else
+#  define check(cond) if (unlikely(cond))
+#endif
+
+#ifdef REXLANG_TOS_CACHE
+// `tos` holds the top item and its ki[] slot is stale. an empty stack has no top slot, so
+// ki[0] (sp masked) stands in for it; that slot is dead whenever the stack is empty:
+#  define tos_slot() ki[sp & (ki_size - 1)]
+// write the top item back to ki[] before sp is changed other than by push/pop or exposed:
+#  define spill()   { tos_slot() = tos; }
+#  define reload()  { tos = tos_slot(); }
+#  define top       tos
+#  define peek(n)   ((n) == 0 ? tos : ki[sp+(n)])
+#else
+#  define spill()
+#  define reload()
+#  define top       ki[sp]
+#  define peek(n)   ki[sp+(n)]
+#endif
+
+// the `goto error` pattern significantly reduces redundant branch targets
+// compared with inlined push()/pop() calls, when using arm-none-eabi-gcc v13.3.1
+#ifdef REXLANG_TOS_CACHE
+#define push(v) { \
+	u32 v_ = (v); \
+	check(sp == 0) { \
+		goto error_stack_full; \
+	} \
+ \
+	spill(); \
+	--sp; \
+	tos = v_; \
+}
+
+#define pop(v) { \
+	check(sp >= ki_size) { \
+		goto error_stack_empty; \
+	} \
+ \
+	v = tos; \
+	sp++; \
+	reload(); \
+}
+#else
+#define push(v) { \
+	u32 v_ = (v); \
+	check(sp == 0) { \
+		goto error_stack_full; \
+	} \
+ \
+	ki[--sp] = v_; \
+}
+
+#define pop(v) { \
+	check(sp >= ki_size) { \
+		goto error_stack_empty; \
+	} \
+ \
+	v = ki[sp++]; \
+}
+#endif
+
+// pop an item and push a result in its place, for operations that cannot fail in between.
+// with the top item cached, a binary operation then loads only its second operand:
+#define take(v) { \
+	check(sp >= ki_size) { \
+		goto error_stack_empty; \
+	} \
+ \
+	v = top; \
+}
+
+#define replace(v) { \
+	top = (v); \
+}
+
+#ifdef LOOP_PREDECODED
+// immediates are already extended; only advance ip past them:
+#  define opcode(p) (x[p].op)
+#  define fetch()  (xi = &x[ip++], xi->op)
+#  define rdip8()  (ip += xi->len - 1, xi->imm)
+#  define rdip16() (ip += xi->len - 1, xi->imm)
+#  define rdip32() (ip += xi->len - 1, xi->imm)
+#else
+#  define opcode(p) (m[p])
+#  define fetch()  (m[ip++])
+#  define rdip8()  (m[ip++])
+#  define rdip16() (ip += sizeof(u16), rdmu16(m, ip - sizeof(u16)))
+#  define rdip32() (ip += sizeof(u32), rdmu32(m, ip - sizeof(u32)))
+#endif
+
+#ifdef REXLANG_NO_BOUNDS_CHECK
+#  define dcheck(p)
+#  define dcheck_io(p, io)
+#  define mcheck(p)
+#else
+#  define dcheck(p) \
+	if (unlikely((p) >= d_size)) \
+		goto error_data_address;
+// check of a load or store address; beyond data memory it continues at `io`, which tries the
+// MMIO windows:
+#  define dcheck_io(p, io) \
+	if (unlikely((p) >= d_size)) \
+		goto io;
+#  define mcheck(p) \
+	if (unlikely((p) >= m_size)) \
+		goto error_prgm_address;
+#endif
+
+#ifdef LOOP_VERIFIED
+#  define dcheck_const(p, io)
+#  define icheck(p)
+#else
+// check of an address taken from an immediate:
+#  define dcheck_const(p, io) dcheck_io(p, io)
+#  if defined(LOOP_PREDECODED) || defined(REXLANG_NO_BOUNDS_CHECK)
+// check of the IP of the next instruction. a truncated one was pre-decoded as a bad opcode:
+#    define icheck(p)     mcheck(p)
+#  else
+// check that the next instruction, immediate included, lies within program memory:
+#    define icheck(p) \
+	if (unlikely((p) >= m_tail)) { \
+		if ((p) >= m_size || m_size - (p) < 1 + imm_size(unfuse(m[p]))) \
+			goto error_prgm_address; \
+	}
+#  endif
+#endif
+
+#ifdef REXLANG_PROFILE
+#  define profile(p) if (prof) { \
+	prof_ip = (p); \
+	prof->ip[prof_ip]++; \
+	prof->op[unfuse(opcode(prof_ip))]++; \
+}
+#  define profile_branch(t) if (prof) { \
+	if (t) prof->taken[prof_ip]++; else prof->not_taken[prof_ip]++; \
+}
+#  define profile_syscall(n) if (prof) { \
+	prof->syscall[(n) < REXLANG_PROFILE_SYSCALLS ? (n) : REXLANG_PROFILE_SYSCALLS-1]++; \
+}
+#else
+#  define profile(p)
+#  define profile_branch(t)
+#  define profile_syscall(n)
+#endif
+
+// whether the `n` remaining instructions of a fused sequence would all start within the
+// budget, and take them. `c` is the cost of all but the last of them and `t` of all of them:
+#ifdef LOOP_TIMED
+// instructions are charged as they are fetched; fused opcodes as their first instruction:
+#  define budget_check()       if (unlikely(count <= 0)) goto done
+#  define charge(o)            (op_ = (o), count -= cost[unfuse(op_)], op_)
+#  define budget_left(n, c)    (count > (s32)(c))
+#  define budget_take(n, t)    count -= (t)
+	u8 op_;
+#else
+#  define budget_check()       if (unlikely(count-- == 0)) goto done
+#  define charge(o)            (o)
+#  define budget_left(n, c)    (count >= (n))
+#  define budget_take(n, t)    count -= (n)
+#endif
+
+// step onto the next instruction of a fused sequence, which must have opcode `o`.
+// the sequence was matched by rexlang_vm_fuse() or rexlang_vm_verify() unless checking:
+#define element(o) \
+	icheck(ip); \
+	check(opcode(ip) != (o)) { \
+		vm->err = REXLANG_ERR_BAD_OPCODE; \
+		goto error; \
+	} \
+	profile(ip); \
+	(void)fetch()
+
+// unchecked data memory access:
+#define rdd8(p)      (d[p])
+#define rdd16(p)     (*(u16*)(&d[p]))
+#define rdd32(p)     (*(u32*)(&d[p]))
+#define wrd8(p, v)   { d[p] = (v); dirtied(p, 1); }
+#define wrd16(p, v)  { *(u16*)(&d[p]) = (v); dirtied(p, 2); }
+#define wrd32(p, v)  { *(u32*)(&d[p]) = (v); dirtied(p, 4); }
+// record a data memory write for incremental snapshots:
+#define dirtied(p, n) if (unlikely(dirty != NULL)) mark_dirty(dirty, dirty_shift, p, n)
+
+// bounds checked data memory access. the address is left in `a`, and the stored value in
+// `b`, for the MMIO path at `io`:
+#define ldd8(p, io)      { a = (p); dcheck_io(a, io); a = rdd8(a); }
+#define ldd16(p, io)     { a = (p); dcheck_io(a, io); a = rdd16(a); }
+#define ldd32(p, io)     { a = (p); dcheck_io(a, io); a = rdd32(a); }
+#define std8(p, v, io)   { a = (p); b = (v); dcheck_io(a, io); wrd8(a, b); }
+#define std16(p, v, io)  { a = (p); b = (v); dcheck_io(a, io); wrd16(a, b); }
+#define std32(p, v, io)  { a = (p); b = (v); dcheck_io(a, io); wrd32(a, b); }
+
+// loads and stores beyond data memory, through the MMIO windows:
+#define io_read(p, n) { \
+	p = rexlang_vm_mmio_read(vm, p, n); \
+	if (unlikely(vm->err != REXLANG_ERR_SUCCESS)) \
+		goto error; \
+}
+#define io_write(p, v, n) { \
+	rexlang_vm_mmio_write(vm, p, v, n); \
+	if (unlikely(vm->err != REXLANG_ERR_SUCCESS)) \
+		goto error; \
+}
+
+#ifdef REXLANG_TOS_CACHE
+	// the top slot is found by masking sp, which takes a power of two ki_size. nothing is
+	// cached yet, so return without spilling:
+	if (unlikely(ki_size & (ki_size - 1))) {
+		vm->err = REXLANG_ERR_DATA_STACK_FULL;
+#  ifdef LOOP_TIMED
+		return count;
+#  else
+		return;
+#  endif
+	}
+#endif
+
+#ifdef REXLANG_COMPUTED_GOTO
+#  define CASE(n) op_##n
+#  define DEFAULT op_bad
+#  define NEXT \
+	budget_check(); \
+	icheck(ip); \
+	profile(ip); \
+	goto *dispatch[charge(fetch())]
+
+	reload();
+
+	static const void *const dispatch[256] = {
+		[0x00] = &&op_0x00, [0x01] = &&op_0x01, [0x02] = &&op_0x02, [0x03] = &&op_0x03,
+		[0x04] = &&op_0x04, [0x05] = &&op_0x05, [0x06] = &&op_0x06, [0x07] = &&op_0x07,
+		[0x08] = &&op_0x08, [0x09] = &&op_0x09, [0x0A] = &&op_0x0A, [0x0B] = &&op_0x0B,
+		[0x0C] = &&op_0x0C, [0x0D] = &&op_0x0D, [0x0E] = &&op_0x0E, [0x0F] = &&op_0x0F,
+		[0x10] = &&op_0x10, [0x11] = &&op_0x11, [0x12] = &&op_0x12, [0x13] = &&op_0x13,
+		[0x14] = &&op_0x14, [0x15] = &&op_0x15, [0x16] = &&op_0x16, [0x17] = &&op_0x17,
+		[0x18] = &&op_0x18, [0x19] = &&op_0x19, [0x1A] = &&op_0x1A, [0x1B] = &&op_0x1B,
+		[0x1C] = &&op_0x1C, [0x1D] = &&op_0x1D, [0x1E] = &&op_0x1E, [0x1F] = &&op_0x1F,
+		[0x20] = &&op_0x20, [0x21] = &&op_0x21, [0x22] = &&op_0x22, [0x23] = &&op_0x23,
+		[0x24] = &&op_0x24, [0x25] = &&op_0x25, [0x26] = &&op_0x26, [0x27] = &&op_0x27,
+		[0x28] = &&op_0x28, [0x29] = &&op_0x29, [0x2A] = &&op_0x2A, [0x2B] = &&op_0x2B,
+		[0x2C] = &&op_0x2C, [0x2D] = &&op_0x2D, [0x2E] = &&op_0x2E, [0x2F] = &&op_0x2F,
+		[0x30] = &&op_0x30, [0x31] = &&op_0x31, [0x32] = &&op_0x32, [0x33 ... 0x37] = &&op_bad,
+		[0x38] = &&op_0x38, [0x39] = &&op_0x39, [0x3A] = &&op_0x3A, [0x3B] = &&op_0x3B,
+		[0x3C] = &&op_0x3C, [0x3D] = &&op_0x3D, [0x3E] = &&op_0x3E, [0x3F] = &&op_0x3F,
+
+		[0x40] = &&op_0x40, [0x41] = &&op_0x41, [0x42] = &&op_0x42, [0x43] = &&op_0x43,
+		[0x44] = &&op_0x44, [0x45] = &&op_0x45, [0x46] = &&op_0x46, [0x47] = &&op_0x47,
+		[0x48] = &&op_0x48, [0x49] = &&op_0x49, [0x4A] = &&op_0x4A, [0x4B] = &&op_0x4B,
+		[0x4C] = &&op_0x4C, [0x4D] = &&op_0x4D, [0x4E] = &&op_0x4E, [0x4F] = &&op_0x4F,
+		[0x50] = &&op_0x50, [0x51] = &&op_0x51, [0x52] = &&op_0x52, [0x53] = &&op_0x53,
+		[0x54] = &&op_0x54, [0x55] = &&op_0x55, [0x56] = &&op_0x56, [0x57] = &&op_0x57,
+		[0x58] = &&op_0x58, [0x59] = &&op_0x59, [0x5A] = &&op_0x5A, [0x5B] = &&op_0x5B,
+		[0x5C] = &&op_0x5C, [0x5D] = &&op_0x5D, [0x5E] = &&op_0x5E, [0x5F] = &&op_0x5F,
+		[0x60] = &&op_0x60, [0x61] = &&op_0x61, [0x62] = &&op_0x62, [0x63] = &&op_0x63,
+		[0x64] = &&op_0x64, [0x65] = &&op_0x65, [0x66] = &&op_0x66, [0x67] = &&op_0x67,
+		[0x68] = &&op_0x68, [0x69] = &&op_0x69, [0x6A] = &&op_0x6A, [0x6B] = &&op_0x6B,
+		[0x6C] = &&op_0x6C, [0x6D] = &&op_0x6D, [0x6E] = &&op_0x6E, [0x6F] = &&op_0x6F,
+		[0x70] = &&op_0x70, [0x71] = &&op_0x71, [0x72] = &&op_0x72, [0x73] = &&op_0x73,
+		[0x74 ... 0x7F] = &&op_bad,
+
+		[0x80] = &&op_0x80, [0x81] = &&op_0x81, [0x82] = &&op_0x82, [0x83] = &&op_0x83,
+		[0x84] = &&op_0x84, [0x85] = &&op_0x85, [0x86] = &&op_0x86, [0x87] = &&op_0x87,
+		[0x88] = &&op_0x88, [0x89] = &&op_0x89, [0x8A] = &&op_0x8A, [0x8B] = &&op_0x8B,
+		[0x8C] = &&op_0x8C, [0x8D] = &&op_0x8D, [0x8E] = &&op_0x8E, [0x8F] = &&op_0x8F,
+		[0x90] = &&op_0x90, [0x91] = &&op_0x91, [0x92] = &&op_0x92, [0x93] = &&op_0x93,
+		[0x94] = &&op_0x94, [0x95] = &&op_0x95, [0x96] = &&op_0x96, [0x97] = &&op_0x97,
+		[0x98] = &&op_0x98, [0x99] = &&op_0x99, [0x9A] = &&op_0x9A, [0x9B] = &&op_0x9B,
+		[0x9C] = &&op_0x9C, [0x9D] = &&op_0x9D, [0x9E] = &&op_0x9E, [0x9F] = &&op_0x9F,
+		[0xA0] = &&op_0xA0, [0xA1] = &&op_0xA1, [0xA2] = &&op_0xA2, [0xA3] = &&op_0xA3,
+		[0xA4] = &&op_0xA4, [0xA5] = &&op_0xA5, [0xA6] = &&op_0xA6, [0xA7] = &&op_0xA7,
+		[0xA8] = &&op_0xA8, [0xA9] = &&op_0xA9, [0xAA] = &&op_0xAA, [0xAB] = &&op_0xAB,
+		[0xAC] = &&op_0xAC, [0xAD] = &&op_0xAD, [0xAE] = &&op_0xAE, [0xAF] = &&op_0xAF,
+		[0xB0 ... 0xBF] = &&op_bad,
+
+		[0xC0] = &&op_0xC0, [0xC1] = &&op_0xC1, [0xC2] = &&op_0xC2, [0xC3] = &&op_0xC3,
+		[0xC4] = &&op_0xC4, [0xC5] = &&op_0xC5, [0xC6] = &&op_0xC6, [0xC7] = &&op_0xC7,
+		[0xC8] = &&op_0xC8, [0xC9] = &&op_0xC9, [0xCA] = &&op_0xCA, [0xCB] = &&op_0xCB,
+		[0xCC] = &&op_0xCC, [0xCD] = &&op_0xCD, [0xCE] = &&op_0xCE, [0xCF] = &&op_0xCF,
+		[0xD0] = &&op_0xD0, [0xD1] = &&op_0xD1, [0xD2] = &&op_0xD2, [0xD3] = &&op_0xD3,
+		[0xD4] = &&op_0xD4, [0xD5] = &&op_0xD5, [0xD6] = &&op_0xD6, [0xD7] = &&op_0xD7,
+		[0xD8] = &&op_0xD8, [0xD9] = &&op_0xD9, [0xDA] = &&op_0xDA, [0xDB] = &&op_0xDB,
+		[0xDC] = &&op_0xDC, [0xDD] = &&op_0xDD, [0xDE] = &&op_0xDE, [0xDF] = &&op_0xDF,
+		[0xE0] = &&op_0xE0, [0xE1] = &&op_0xE1, [0xE2] = &&op_0xE2, [0xE3] = &&op_0xE3,
+		[0xE4] = &&op_0xE4, [0xE5] = &&op_0xE5, [0xE6] = &&op_0xE6, [0xE7] = &&op_0xE7,
+		[0xE8] = &&op_0xE8, [0xE9] = &&op_0xE9, [0xEA] = &&op_0xEA, [0xEB] = &&op_0xEB,
+		[0xEC] = &&op_0xEC, [0xED] = &&op_0xED, [0xEE] = &&op_0xEE, [0xEF] = &&op_0xEF,
+		[0xF0] = &&op_0xF0, [0xF1] = &&op_0xF1, [0xF2] = &&op_0xF2,
+		[0xF3 ... 0xFF] = &&op_bad,
+	};
+
+	NEXT;
+#else
+#  define CASE(n) case n
+#  define DEFAULT default
+#  define NEXT continue
+
+	reload();
+
+	for (;;) {
+		budget_check();
+
+		icheck(ip);
+		profile(ip);
+		switch (charge(fetch()))
+#endif
+	{
+		// no immediates; stack-only operations:
+		CASE(0x00): // halt
+			vm->err = REXLANG_ERR_HALTED;
+			goto done;
+		CASE(0x01): // nop
+			NEXT;
+
+		CASE(0x02): // eq
+			pop(a);
+			take(b);
+		impl_eq:
+			replace(b == a);
+			NEXT;
+		CASE(0x03): // ne
+			pop(a);
+			take(b);
+		impl_ne:
+			replace(b != a);
+			NEXT;
+		CASE(0x04): // le-ui
+			pop(a);
+			take(b);
+		impl_le_ui:
+			replace(b <= a);
+			NEXT;
+		CASE(0x05): // le-si
+			pop(sa);
+			take(sb);
+		impl_le_si:
+			replace(sb <= sa);
+			NEXT;
+		CASE(0x06): // gt-ui
+			pop(a);
+			take(b);
+		impl_gt_ui:
+			replace(b > a);
+			NEXT;
+		CASE(0x07): // gt-si
+			pop(sa);
+			take(sb);
+		impl_gt_si:
+			replace(sb > sa);
+			NEXT;
+		CASE(0x08): // lt-ui
+			pop(a);
+			take(b);
+		impl_lt_ui:
+			replace(b < a);
+			NEXT;
+		CASE(0x09): // lt-si
+			pop(sa);
+			take(sb);
+		impl_lt_si:
+			replace(sb < sa);
+			NEXT;
+		CASE(0x0A): // ge-ui
+			pop(a);
+			take(b);
+		impl_ge_ui:
+			replace(b >= a);
+			NEXT;
+		CASE(0x0B): // ge-si
+			pop(sa);
+			take(sb);
+		impl_ge_si:
+			replace(sb >= sa);
+			NEXT;
+		CASE(0x0C): // and
+			pop(a);
+			take(b);
+		impl_and:
+			replace(b & a);
+			NEXT;
+		CASE(0x0D): // or
+			pop(a);
+			take(b);
+		impl_or:
+			replace(b | a);
+			NEXT;
+		CASE(0x0E): // xor
+			pop(a);
+			take(b);
+		impl_xor:
+			replace(b ^ a);
+			NEXT;
+		CASE(0x0F): // add
+			pop(a);
+			take(b);
+		impl_add:
+			replace(b + a);
+			NEXT;
+		CASE(0x10): // sub
+			pop(a);
+			take(b);
+		impl_sub:
+			replace(b - a);
+			NEXT;
+		CASE(0x11): // mul
+			pop(a);
+			take(b);
+		impl_mul:
+			replace(b * a);
+			NEXT;
+
+		CASE(0x12): // ld-u8
+			pop(a);
+			dcheck_io(a, io_ld_u8);
+		impl_ld_u8:
+			a = rdd8(a);
+			push(a);
+			NEXT;
+		CASE(0x13): // ld-u16
+			pop(a);
+			dcheck_io(a, io_ld_u16);
+		impl_ld_u16:
+			a = rdd16(a);
+			push(a);
+			NEXT;
+		CASE(0x14): // ld-u32
+			pop(a);
+			dcheck_io(a, io_ld_u32);
+		impl_u32:
+			a = rdd32(a);
+			push(a);
+			NEXT;
+		CASE(0x15): // ld-u8-offs
+			pop(a);
+			pop(b);
+		impl_ld_u8_offs:
+			ldd8(b+a, io_ld_u8);
+			push(a);
+			NEXT;
+		CASE(0x16): // ld-u16-offs
+			pop(a);
+			pop(b);
+		impl_ld_u16_offs:
+			ldd16(b+a, io_ld_u16);
+			push(a);
+			NEXT;
+		CASE(0x17): // ld-u32-offs
+			pop(a);
+			pop(b);
+		impl_ld_u32_offs:
+			ldd32(b+a, io_ld_u32);
+			push(a);
+			NEXT;
+		CASE(0x18): // ld-s8
+			pop(a);
+			dcheck_io(a, io_ld_s8);
+		impl_ld_s8:
+			a = rdd8(a);
+			push((s8)a);
+			NEXT;
+		CASE(0x19): // ld-s16
+			pop(a);
+			dcheck_io(a, io_ld_s16);
+		impl_ld_s16:
+			a = rdd16(a);
+			push((s16)a);
+			NEXT;
+		CASE(0x1A): // ld-s8-offs
+			pop(a);
+			pop(b);
+		impl_ld_s8_offs:
+			ldd8(b+a, io_ld_s8);
+			push((s8)a);
+			NEXT;
+		CASE(0x1B): // ld-s16-offs
+			pop(a);
+			pop(b);
+		impl_ld_s16_offs:
+			ldd16(b+a, io_ld_s16);
+			push((s16)a);
+			NEXT;
+		CASE(0x1C): // st-u8
+			pop(a);
+			pop(b);
+			dcheck_io(a, io_st_u8);
+		impl_st_u8:
+			wrd8(a, b);
+			push(b);
+			NEXT;
+		CASE(0x1D): // st-u16
+			pop(a);
+			pop(b);
+			dcheck_io(a, io_st_u16);
+		impl_st_u16:
+			wrd16(a, b);
+			push(b);
+			NEXT;
+		CASE(0x1E): // st-u32
+			pop(a);
+			pop(b);
+			dcheck_io(a, io_st_u32);
+		impl_st_u32:
+			wrd32(a, b);
+			push(b);
+			NEXT;
+		CASE(0x1F): // st-u8-offs
+			pop(a);
+			pop(b);
+			pop(c);
+		impl_st_u8_offs:
+			std8(b+a, c, io_st_u8);
+			push(c);
+			NEXT;
+		CASE(0x20): // st-u16-offs
+			pop(a);
+			pop(b);
+			pop(c);
+		impl_st_u16_offs:
+			std16(b+a, c, io_st_u16);
+			push(c);
+			NEXT;
+		CASE(0x21): // st-u32-offs
+			pop(a);
+			pop(b);
+			pop(c);
+		impl_st_u32_offs:
+			std32(b+a, c, io_st_u32);
+			push(c);
+			NEXT;
+		CASE(0x22): // st-u8--discard
+			pop(a);
+			pop(b);
+			dcheck_io(a, io_st_u8_discard);
+		impl_st_u8_discard:
+			wrd8(a, b);
+			NEXT;
+		CASE(0x23): // st-u16-discard
+			pop(a);
+			pop(b);
+			dcheck_io(a, io_st_u16_discard);
+		impl_st_u16_discard:
+			wrd16(a, b);
+			NEXT;
+		CASE(0x24): // st-u32-discard
+			pop(a);
+			pop(b);
+			dcheck_io(a, io_st_u32_discard);
+		impl_st_u32_discard:
+			wrd32(a, b);
+			NEXT;
+		CASE(0x25): // st-u8-offs-discard
+			pop(a);
+			pop(b);
+			pop(c);
+		impl_st_u8_offs_discard:
+			std8(b+a, c, io_st_u8_discard);
+			NEXT;
+		CASE(0x26): // st-u16-offs-discard
+			pop(a);
+			pop(b);
+			pop(c);
+		impl_st_u16_offs_discard:
+			std16(b+a, c, io_st_u16_discard);
+			NEXT;
+		CASE(0x27): // st-u32-offs-discard
+			pop(a);
+			pop(b);
+			pop(c);
+		impl_st_u32_offs_discard:
+			std32(b+a, c, io_st_u32_discard);
+			NEXT;
+		CASE(0x28): // call
+			pop(a);
+			check(vm->cp == 0) {
+				vm->err = REXLANG_ERR_CALL_STACK_FULL;
+				goto error;
+			}
+			vm->cs[--vm->cp] = ip;
+			ip = a;
+			NEXT;
+		CASE(0x29): // jump-abs
+			pop(a);
+		impl_jump_abs:
+			ip = a;
+			NEXT;
+		CASE(0x2A): // jump-abs-if
+			pop(a);
+			pop(b);
+		impl_jump_abs_if:
+			profile_branch(b != 0);
+			if (b != 0) {
+				ip = a;
+			}
+			NEXT;
+		CASE(0x2B): // jump-abs-if-not
+			pop(a);
+			pop(b);
+		impl_jump_abs_if_not:
+			profile_branch(b == 0);
+			if (b == 0) {
+				ip = a;
+			}
+			NEXT;
+		CASE(0x2C): // jump-rel
+			pop(sa);
+		impl_jump_rel:
+			push(ip);
+			ip += sa;
+			NEXT;
+		CASE(0x2D): // jump-rel-if
+			pop(sa);
+			pop(b);
+		impl_jump_rel_if:
+			profile_branch(b != 0);
+			if (b != 0) {
+				ip += sa;
+			}
+			NEXT;
+		CASE(0x2E): // jump-rel-if-not
+			pop(sa);
+			pop(b);
+		impl_jump_rel_if_not:
+			profile_branch(b == 0);
+			if (b == 0) {
+				ip += sa;
+			}
+			NEXT;
+		CASE(0x2F): // syscall
+			pop(a);
+		impl_syscall:
+			profile_syscall(a);
+			if (!vm->syscall) {
+				vm->err = REXLANG_ERR_BAD_SYSCALL;
+				goto error;
+			}
+			// syscalls operate on the vm struct directly:
+			spill();
+			vm->ip = ip;
+			vm->sp = sp;
+			rexlang_vm_syscall(vm, a);
+			ip = vm->ip;
+			sp = vm->sp;
+			reload();
+			if (vm->err != REXLANG_ERR_SUCCESS) {
+				goto done;
+			}
+			NEXT;
+
+		CASE(0x30): // shl
+			pop(a);
+			take(b);
+		impl_shl:
+			replace(b << a);
+			NEXT;
+		CASE(0x31): // shr
+			pop(a);
+			take(b);
+		impl_shr:
+			replace(b >> a);
+			NEXT;
+		CASE(0x32): // yield
+			vm->err = REXLANG_ERR_YIELDED;
+			goto done;
+
+		CASE(0x38): // return
+			check(vm->cp >= vm->cs_size) {
+				vm->err = REXLANG_ERR_CALL_STACK_EMPTY;
+				goto error;
+			}
+			ip = vm->cs[vm->cp++];
+			// back to the host; see rexlang_vm_call():
+			check(ip == REXLANG_IP_HOST) {
+				vm->err = REXLANG_ERR_HALTED;
+				goto done;
+			}
+			NEXT;
+		CASE(0x39): // not
+			take(a);
+			replace(!a);
+			NEXT;
+		CASE(0x3A): // neg
+			take(a);
+			replace(-a);
+			NEXT;
+		CASE(0x3B): // discard
+			pop(a);
+			NEXT;
+		CASE(0x3C): // swap
+			pop(a);
+			pop(b);
+			push(a);
+			push(b);
+			NEXT;
+		CASE(0x3D): // dup
+			pop(a);
+			push(a);
+			push(a);
+			NEXT;
+		CASE(0x3E): // dcopy
+			pop(a);
+			pop(b);
+			pop(c);
+			dcheck(c+a-1);
+			dcheck(b+a-1);
+			memcpy(d + c, d + b, a);
+			if (a) {
+				dirtied(c, a);
+			}
+			push(c + a);
+			NEXT;
+		CASE(0x3F): // pcopy
+			pop(a);
+			pop(b);
+			pop(c);
+			dcheck(c+a-1);
+			mcheck(b+a-1);
+			memcpy(d + c, m + b, a);
+			if (a) {
+				dirtied(c, a);
+			}
+			push(c + a);
+			NEXT;
+
+		// 0x40..0x7F:
+		CASE(0x40): // push-u8
+			push(rdip8());
+			NEXT;
+		CASE(0x41): // push-s8
+			push((s8)rdip8());
+			NEXT;
+
+		CASE(0x42): // eq
+			a = rdip8();
+			take(b);
+			goto impl_eq;
+		CASE(0x43): // ne
+			a = rdip8();
+			take(b);
+			goto impl_ne;
+		CASE(0x44): // le-ui
+			a = rdip8();
+			take(b);
+			goto impl_le_ui;
+		CASE(0x45): // le-si
+			sa = (s8)rdip8();
+			take(sb);
+			goto impl_le_si;
+		CASE(0x46): // gt-ui
+			a = rdip8();
+			take(b);
+			goto impl_gt_ui;
+		CASE(0x47): // gt-si
+			sa = (s8)rdip8();
+			take(sb);
+			goto impl_gt_si;
+		CASE(0x48): // lt-ui
+			a = rdip8();
+			take(b);
+			goto impl_lt_ui;
+		CASE(0x49): // lt-si
+			sa = (s8)rdip8();
+			take(sb);
+			goto impl_lt_si;
+		CASE(0x4A): // ge-ui
+			a = rdip8();
+			take(b);
+			goto impl_ge_ui;
+		CASE(0x4B): // ge-si
+			sa = (s8)rdip8();
+			take(sb);
+			goto impl_ge_si;
+		CASE(0x4C): // and
+			a = rdip8();
+			take(b);
+			goto impl_and;
+		CASE(0x4D): // or
+			a = rdip8();
+			take(b);
+			goto impl_or;
+		CASE(0x4E): // xor
+			a = rdip8();
+			take(b);
+			goto impl_xor;
+		CASE(0x4F): // add
+			a = rdip8();
+			take(b);
+			goto impl_add;
+		CASE(0x50): // sub
+			a = rdip8();
+			take(b);
+			goto impl_sub;
+		CASE(0x51): // mul
+			a = rdip8();
+			take(b);
+			goto impl_mul;
+
+		CASE(0x52): // ld-u8
+			a = rdip8();
+			dcheck_const(a, io_ld_u8);
+			goto impl_ld_u8;
+		CASE(0x53): // ld-u16
+			a = rdip8();
+			dcheck_const(a, io_ld_u16);
+			goto impl_ld_u16;
+		CASE(0x54): // ld-u32
+			a = rdip8();
+			dcheck_const(a, io_ld_u32);
+			goto impl_u32;
+		CASE(0x55): // ld-u8-offs
+			pop(a);
+			b = rdip8();
+			goto impl_ld_u8_offs;
+		CASE(0x56): // ld-u16-offs
+			pop(a);
+			b = rdip8();
+			goto impl_ld_u16_offs;
+		CASE(0x57): // ld-u32-offs
+			pop(a);
+			b = rdip8();
+			goto impl_ld_u32_offs;
+		CASE(0x58): // ld-s8
+			a = rdip8();
+			dcheck_const(a, io_ld_s8);
+			goto impl_ld_s8;
+		CASE(0x59): // ld-s16
+			a = rdip8();
+			dcheck_const(a, io_ld_s16);
+			goto impl_ld_s16;
+		CASE(0x5A): // ld-s8-offs
+			pop(a);
+			b = rdip8();
+			goto impl_ld_s8_offs;
+		CASE(0x5B): // ld-s16-offs
+			pop(a);
+			b = rdip8();
+			goto impl_ld_s16_offs;
+		CASE(0x5C): // st-u8
+			a = rdip8();
+			pop(b);
+			dcheck_const(a, io_st_u8);
+			goto impl_st_u8;
+		CASE(0x5D): // st-u16
+			a = rdip8();
+			pop(b);
+			dcheck_const(a, io_st_u16);
+			goto impl_st_u16;
+		CASE(0x5E): // st-u32
+			a = rdip8();
+			pop(b);
+			dcheck_const(a, io_st_u32);
+			goto impl_st_u32;
+		CASE(0x5F): // st-u8-offs
+			pop(a);
+			b = rdip8();
+			pop(c);
+			goto impl_st_u8_offs;
+		CASE(0x60): // st-u16-offs
+			pop(a);
+			b = rdip8();
+			pop(c);
+			goto impl_st_u16_offs;
+		CASE(0x61): // st-u32-offs
+			pop(a);
+			b = rdip8();
+			pop(c);
+			goto impl_st_u32_offs;
+		CASE(0x62): // st-u8--discard
+			a = rdip8();
+			pop(b);
+			dcheck_const(a, io_st_u8_discard);
+			goto impl_st_u8_discard;
+		CASE(0x63): // st-u16-discard
+			a = rdip8();
+			pop(b);
+			dcheck_const(a, io_st_u16_discard);
+			goto impl_st_u16_discard;
+		CASE(0x64): // st-u32-discard
+			a = rdip8();
+			pop(b);
+			dcheck_const(a, io_st_u32_discard);
+			goto impl_st_u32_discard;
+		CASE(0x65): // st-u8-offs-discard
+			pop(a);
+			b = rdip8();
+			pop(c);
+			goto impl_st_u8_offs_discard;
+		CASE(0x66): // st-u16-offs-discard
+			pop(a);
+			b = rdip8();
+			pop(c);
+			goto impl_st_u16_offs_discard;
+		CASE(0x67): // st-u32-offs-discard
+			pop(a);
+			b = rdip8();
+			pop(c);
+			goto impl_st_u32_offs_discard;
+		CASE(0x68): // call
+			a = rdip8();
+			check(vm->cp == 0) {
+				vm->err = REXLANG_ERR_CALL_STACK_FULL;
+				goto error;
+			}
+			vm->cs[--vm->cp] = ip;
+			ip = a;
+			NEXT;
+		CASE(0x69): // return / jump-abs
+			a = rdip8();
+			goto impl_jump_abs;
+		CASE(0x6A): // jump-abs-if
+			a = rdip8();
+			pop(b);
+			goto impl_jump_abs_if;
+		CASE(0x6B): // jump-abs-if-not
+			a = rdip8();
+			pop(b);
+			goto impl_jump_abs_if_not;
+		CASE(0x6C): // jump-rel
+			sa = (s8)rdip8();
+			goto impl_jump_rel;
+		CASE(0x6D): // jump-rel-if
+			sa = (s8)rdip8();
+			pop(b);
+			goto impl_jump_rel_if;
+		CASE(0x6E): // jump-rel-if-not
+			sa = (s8)rdip8();
+			pop(b);
+			goto impl_jump_rel_if_not;
+		CASE(0x6F): // syscall
+			a = rdip8();
+			goto impl_syscall;
+		CASE(0x70): // shl
+			a = rdip8();
+			take(b);
+			replace(b << a);
+			NEXT;
+		CASE(0x71): // shr
+			a = rdip8();
+			take(b);
+			replace(b >> a);
+			NEXT;
+		CASE(0x72): // ldsp-offs-imm8
+			a = rdip8();
+		impl_ldsp_offs:
+			check(sp+a >= ki_size) {
+				vm->err = REXLANG_ERR_DATA_STACK_EMPTY;
+				goto error;
+			}
+			push(peek(a));
+			NEXT;
+		CASE(0x73): // discard-imm8
+			a = rdip8();
+			spill();
+			sp += a;
+			check(sp >= ki_size) {
+				vm->err = REXLANG_ERR_DATA_STACK_EMPTY;
+				goto error;
+			}
+			reload();
+			NEXT;
+
+		// 0x80..0xBF:
+		CASE(0x80): // push-u16
+			push(rdip16());
+			NEXT;
+		CASE(0x81): // push-s16
+			push((s16)rdip16());
+			NEXT;
+
+		CASE(0x82): // eq
+			a = rdip16();
+			take(b);
+			goto impl_eq;
+		CASE(0x83): // ne
+			a = rdip16();
+			take(b);
+			goto impl_ne;
+		CASE(0x84): // le-ui
+			a = rdip16();
+			take(b);
+			goto impl_le_ui;
+		CASE(0x85): // le-si
+			sa = (s16)rdip16();
+			take(sb);
+			goto impl_le_si;
+		CASE(0x86): // gt-ui
+			a = rdip16();
+			take(b);
+			goto impl_gt_ui;
+		CASE(0x87): // gt-si
+			sa = (s16)rdip16();
+			take(sb);
+			goto impl_gt_si;
+		CASE(0x88): // lt-ui
+			a = rdip16();
+			take(b);
+			goto impl_lt_ui;
+		CASE(0x89): // lt-si
+			sa = (s16)rdip16();
+			take(sb);
+			goto impl_lt_si;
+		CASE(0x8A): // ge-ui
+			a = rdip16();
+			take(b);
+			goto impl_ge_ui;
+		CASE(0x8B): // ge-si
+			sa = (s16)rdip16();
+			take(sb);
+			goto impl_ge_si;
+		CASE(0x8C): // and
+			a = rdip16();
+			take(b);
+			goto impl_and;
+		CASE(0x8D): // or
+			a = rdip16();
+			take(b);
+			goto impl_or;
+		CASE(0x8E): // xor
+			a = rdip16();
+			take(b);
+			goto impl_xor;
+		CASE(0x8F): // add
+			a = rdip16();
+			take(b);
+			goto impl_add;
+		CASE(0x90): // sub
+			a = rdip16();
+			take(b);
+			goto impl_sub;
+		CASE(0x91): // mul
+			a = rdip16();
+			take(b);
+			goto impl_mul;
+
+		CASE(0x92): // ld-u8
+			a = rdip16();
+			dcheck_const(a, io_ld_u8);
+			goto impl_ld_u8;
+		CASE(0x93): // ld-u16
+			a = rdip16();
+			dcheck_const(a, io_ld_u16);
+			goto impl_ld_u16;
+		CASE(0x94): // ld-u32
+			a = rdip16();
+			dcheck_const(a, io_ld_u32);
+			goto impl_u32;
+		CASE(0x95): // ld-u8-offs
+			pop(a);
+			b = rdip16();
+			goto impl_ld_u8_offs;
+		CASE(0x96): // ld-u16-offs
+			pop(a);
+			b = rdip16();
+			goto impl_ld_u16_offs;
+		CASE(0x97): // ld-u32-offs
+			pop(a);
+			b = rdip16();
+			goto impl_ld_u32_offs;
+		CASE(0x98): // ld-s8
+			a = rdip16();
+			dcheck_const(a, io_ld_s8);
+			goto impl_ld_s8;
+		CASE(0x99): // ld-s16
+			a = rdip16();
+			dcheck_const(a, io_ld_s16);
+			goto impl_ld_s16;
+		CASE(0x9A): // ld-s8-offs
+			pop(a);
+			b = rdip16();
+			goto impl_ld_s8_offs;
+		CASE(0x9B): // ld-s16-offs
+			pop(a);
+			b = rdip16();
+			goto impl_ld_s16_offs;
+		CASE(0x9C): // st-u8
+			a = rdip16();
+			pop(b);
+			dcheck_const(a, io_st_u8);
+			goto impl_st_u8;
+		CASE(0x9D): // st-u16
+			a = rdip16();
+			pop(b);
+			dcheck_const(a, io_st_u16);
+			goto impl_st_u16;
+		CASE(0x9E): // st-u32
+			a = rdip16();
+			pop(b);
+			dcheck_const(a, io_st_u32);
+			goto impl_st_u32;
+		CASE(0x9F): // st-u8-offs
+			pop(a);
+			b = rdip16();
+			pop(c);
+			goto impl_st_u8_offs;
+		CASE(0xA0): // st-u16-offs
+			pop(a);
+			b = rdip16();
+			pop(c);
+			goto impl_st_u16_offs;
+		CASE(0xA1): // st-u32-offs
+			pop(a);
+			b = rdip16();
+			pop(c);
+			goto impl_st_u32_offs;
+		CASE(0xA2): // st-u8--discard
+			a = rdip16();
+			pop(b);
+			dcheck_const(a, io_st_u8_discard);
+			goto impl_st_u8_discard;
+		CASE(0xA3): // st-u16-discard
+			a = rdip16();
+			pop(b);
+			dcheck_const(a, io_st_u16_discard);
+			goto impl_st_u16_discard;
+		CASE(0xA4): // st-u32-discard
+			a = rdip16();
+			pop(b);
+			dcheck_const(a, io_st_u32_discard);
+			goto impl_st_u32_discard;
+		CASE(0xA5): // st-u8-offs-discard
+			pop(a);
+			b = rdip16();
+			pop(c);
+			goto impl_st_u8_offs_discard;
+		CASE(0xA6): // st-u16-offs-discard
+			pop(a);
+			b = rdip16();
+			pop(c);
+			goto impl_st_u16_offs_discard;
+		CASE(0xA7): // st-u32-offs-discard
+			pop(a);
+			b = rdip16();
+			pop(c);
+			goto impl_st_u32_offs_discard;
+		CASE(0xA8): // call
+			a = rdip16();
+			check(vm->cp == 0) {
+				vm->err = REXLANG_ERR_CALL_STACK_FULL;
+				goto error;
+			}
+			vm->cs[--vm->cp] = ip;
+			ip = a;
+			NEXT;
+		CASE(0xA9): // return / jump-abs
+			a = rdip16();
+			goto impl_jump_abs;
+		CASE(0xAA): // jump-abs-if
+			a = rdip16();
+			pop(b);
+			goto impl_jump_abs_if;
+		CASE(0xAB): // jump-abs-if-not
+			a = rdip16();
+			pop(b);
+			goto impl_jump_abs_if_not;
+		CASE(0xAC): // jump-rel
+			sa = (s16)rdip16();
+			goto impl_jump_rel;
+		CASE(0xAD): // jump-rel-if
+			sa = (s16)rdip16();
+			pop(b);
+			goto impl_jump_rel_if;
+		CASE(0xAE): // jump-rel-if-not
+			sa = (s16)rdip16();
+			pop(b);
+			goto impl_jump_rel_if_not;
+		CASE(0xAF): // syscall
+			a = rdip16();
+			goto impl_syscall;
+
+		// 0xC0..0xFF:
+		CASE(0xC0): // push-u32
+			push(rdip32());
+			NEXT;
+		CASE(0xC1): // push-s32
+			push((s32)rdip32());
+			NEXT;
+
+		CASE(0xC2): // eq
+			a = rdip32();
+			take(b);
+			goto impl_eq;
+		CASE(0xC3): // ne
+			a = rdip32();
+			take(b);
+			goto impl_ne;
+		CASE(0xC4): // le-ui
+			a = rdip32();
+			take(b);
+			goto impl_le_ui;
+		CASE(0xC5): // le-si
+			sa = (s32)rdip32();
+			take(sb);
+			goto impl_le_si;
+		CASE(0xC6): // gt-ui
+			a = rdip32();
+			take(b);
+			goto impl_gt_ui;
+		CASE(0xC7): // gt-si
+			sa = (s32)rdip32();
+			take(sb);
+			goto impl_gt_si;
+		CASE(0xC8): // lt-ui
+			a = rdip32();
+			take(b);
+			goto impl_lt_ui;
+		CASE(0xC9): // lt-si
+			sa = (s32)rdip32();
+			take(sb);
+			goto impl_lt_si;
+		CASE(0xCA): // ge-ui
+			a = rdip32();
+			take(b);
+			goto impl_ge_ui;
+		CASE(0xCB): // ge-si
+			sa = (s32)rdip32();
+			take(sb);
+			goto impl_ge_si;
+		CASE(0xCC): // and
+			a = rdip32();
+			take(b);
+			goto impl_and;
+		CASE(0xCD): // or
+			a = rdip32();
+			take(b);
+			goto impl_or;
+		CASE(0xCE): // xor
+			a = rdip32();
+			take(b);
+			goto impl_xor;
+		CASE(0xCF): // add
+			a = rdip32();
+			take(b);
+			goto impl_add;
+		CASE(0xD0): // sub
+			a = rdip32();
+			take(b);
+			goto impl_sub;
+		CASE(0xD1): // mul
+			a = rdip32();
+			take(b);
+			goto impl_mul;
+
+		CASE(0xD2): // ld-u8
+			a = rdip32();
+			dcheck_const(a, io_ld_u8);
+			goto impl_ld_u8;
+		CASE(0xD3): // ld-u16
+			a = rdip32();
+			dcheck_const(a, io_ld_u16);
+			goto impl_ld_u16;
+		CASE(0xD4): // ld-u32
+			a = rdip32();
+			dcheck_const(a, io_ld_u32);
+			goto impl_u32;
+		CASE(0xD5): // ld-u8-offs
+			pop(a);
+			b = rdip32();
+			goto impl_ld_u8_offs;
+		CASE(0xD6): // ld-u16-offs
+			pop(a);
+			b = rdip32();
+			goto impl_ld_u16_offs;
+		CASE(0xD7): // ld-u32-offs
+			pop(a);
+			b = rdip32();
+			goto impl_ld_u32_offs;
+		CASE(0xD8): // ld-s8
+			a = rdip32();
+			dcheck_const(a, io_ld_s8);
+			goto impl_ld_s8;
+		CASE(0xD9): // ld-s16
+			a = rdip32();
+			dcheck_const(a, io_ld_s16);
+			goto impl_ld_s16;
+		CASE(0xDA): // ld-s8-offs
+			pop(a);
+			b = rdip32();
+			goto impl_ld_s8_offs;
+		CASE(0xDB): // ld-s16-offs
+			pop(a);
+			b = rdip32();
+			goto impl_ld_s16_offs;
+		CASE(0xDC): // st-u8
+			a = rdip32();
+			pop(b);
+			dcheck_const(a, io_st_u8);
+			goto impl_st_u8;
+		CASE(0xDD): // st-u16
+			a = rdip32();
+			pop(b);
+			dcheck_const(a, io_st_u16);
+			goto impl_st_u16;
+		CASE(0xDE): // st-u32
+			a = rdip32();
+			pop(b);
+			dcheck_const(a, io_st_u32);
+			goto impl_st_u32;
+		CASE(0xDF): // st-u8-offs
+			pop(a);
+			b = rdip32();
+			pop(c);
+			goto impl_st_u8_offs;
+		CASE(0xE0): // st-u16-offs
+			pop(a);
+			b = rdip32();
+			pop(c);
+			goto impl_st_u16_offs;
+		CASE(0xE1): // st-u32-offs
+			pop(a);
+			b = rdip32();
+			pop(c);
+			goto impl_st_u32_offs;
+		CASE(0xE2): // st-u8--discard
+			a = rdip32();
+			pop(b);
+			dcheck_const(a, io_st_u8_discard);
+			goto impl_st_u8_discard;
+		CASE(0xE3): // st-u16-discard
+			a = rdip32();
+			pop(b);
+			dcheck_const(a, io_st_u16_discard);
+			goto impl_st_u16_discard;
+		CASE(0xE4): // st-u32-discard
+			a = rdip32();
+			pop(b);
+			dcheck_const(a, io_st_u32_discard);
+			goto impl_st_u32_discard;
+		CASE(0xE5): // st-u8-offs-discard
+			pop(a);
+			b = rdip32();
+			pop(c);
+			goto impl_st_u8_offs_discard;
+		CASE(0xE6): // st-u16-offs-discard
+			pop(a);
+			b = rdip32();
+			pop(c);
+			goto impl_st_u16_offs_discard;
+		CASE(0xE7): // st-u32-offs-discard
+			pop(a);
+			b = rdip32();
+			pop(c);
+			goto impl_st_u32_offs_discard;
+		CASE(0xE8): // call
+			a = rdip32();
+			check(vm->cp == 0) {
+				vm->err = REXLANG_ERR_CALL_STACK_FULL;
+				goto error;
+			}
+			vm->cs[--vm->cp] = ip;
+			ip = a;
+			NEXT;
+		CASE(0xE9): // return / jump-abs
+			a = rdip32();
+			goto impl_jump_abs;
+		CASE(0xEA): // jump-abs-if
+			a = rdip32();
+			pop(b);
+			goto impl_jump_abs_if;
+		CASE(0xEB): // jump-abs-if-not
+			a = rdip32();
+			pop(b);
+			goto impl_jump_abs_if_not;
+		CASE(0xEC): // jump-rel
+			sa = (s32)rdip32();
+			goto impl_jump_rel;
+		CASE(0xED): // jump-rel-if
+			sa = (s32)rdip32();
+			pop(b);
+			goto impl_jump_rel_if;
+		CASE(0xEE): // jump-rel-if-not
+			sa = (s32)rdip32();
+			pop(b);
+			goto impl_jump_rel_if_not;
+		CASE(0xEF): // syscall
+			a = rdip32();
+			goto impl_syscall;
+
+		// fused sequences (see rexlang_vm_fuse); each runs the first instruction alone when
+		// the budget would end inside the sequence:
+		CASE(0xF0): // push-u8, syscall-imm8
+			if (!budget_left(1, 0)) {
+				push(rdip8());
+				NEXT;
+			}
+			budget_take(1, cost[0x6F]);
+			push(rdip8());
+			element(0x6F);
+			a = rdip8();
+			goto impl_syscall;
+		CASE(0xF1): // ld-u16-imm16, eq-imm8, jump-rel-if-not-imm8
+			a = rdip16();
+			dcheck_const(a, io_ld_u16);
+			if (!budget_left(2, cost[0x42])) {
+				goto impl_ld_u16;
+			}
+			budget_take(2, cost[0x42] + cost[0x6E]);
+			// the loaded and compared values are pushed and popped again; only check for room:
+			a = rdd16(a);
+			check(sp == 0) {
+				goto error_stack_full;
+			}
+			element(0x42);
+			b = rdip8();
+			element(0x6E);
+			sa = (s8)rdip8();
+			profile_branch(a != b);
+			if (a != b) {
+				ip += sa;
+			}
+			NEXT;
+		CASE(0xF2): // ldsp-offs-imm8, add
+			a = rdip8();
+			if (!budget_left(1, 0)) {
+				goto impl_ldsp_offs;
+			}
+			budget_take(1, cost[0x0F]);
+			check(sp+a >= ki_size) {
+				vm->err = REXLANG_ERR_DATA_STACK_EMPTY;
+				goto error;
+			}
+			check(sp == 0) {
+				goto error_stack_full;
+			}
+			b = peek(a);
+			element(0x0F);
+			// the item below the one pushed by ldsp exists since ldsp read at or below it:
+			top += b;
+			NEXT;
+
+#ifndef REXLANG_NO_BOUNDS_CHECK
+		// addresses beyond data memory; `a` holds the address and `b` the value stored:
+		io_ld_u8:
+			io_read(a, 1);
+			push(a);
+			NEXT;
+		io_ld_u16:
+			io_read(a, 2);
+			push(a);
+			NEXT;
+		io_ld_u32:
+			io_read(a, 4);
+			push(a);
+			NEXT;
+		io_ld_s8:
+			io_read(a, 1);
+			push((s8)a);
+			NEXT;
+		io_ld_s16:
+			io_read(a, 2);
+			push((s16)a);
+			NEXT;
+		io_st_u8:
+			io_write(a, b, 1);
+			push(b);
+			NEXT;
+		io_st_u16:
+			io_write(a, b, 2);
+			push(b);
+			NEXT;
+		io_st_u32:
+			io_write(a, b, 4);
+			push(b);
+			NEXT;
+		io_st_u8_discard:
+			io_write(a, b, 1);
+			NEXT;
+		io_st_u16_discard:
+			io_write(a, b, 2);
+			NEXT;
+		io_st_u32_discard:
+			io_write(a, b, 4);
+			NEXT;
+#endif
+
+		DEFAULT:
+#ifdef LOOP_PREDECODED
+			if (xi->len == 0) {
+				// instruction was truncated by the end of program memory:
+				goto error_prgm_address;
+			}
+#endif
+			vm->err = REXLANG_ERR_BAD_OPCODE;
+			goto error;
+	}
+#ifndef REXLANG_COMPUTED_GOTO
+	}
+#endif
+
+#undef NEXT
+#undef DEFAULT
+#undef CASE
+#undef element
+#undef budget_take
+#undef budget_left
+#undef charge
+#undef budget_check
+#undef profile_syscall
+#undef profile_branch
+#undef profile
+#undef dirtied
+#undef wrd32
+#undef wrd16
+#undef wrd8
+#undef io_write
+#undef io_read
+#undef std32
+#undef std16
+#undef std8
+#undef ldd32
+#undef ldd16
+#undef ldd8
+#undef rdd32
+#undef rdd16
+#undef rdd8
+#undef icheck
+#undef dcheck_const
+#undef mcheck
+#undef dcheck_io
+#undef dcheck
+#undef rdip32
+#undef rdip16
+#undef rdip8
+#undef fetch
+#undef opcode
+#undef replace
+#undef take
+#undef pop
+#undef push
+#undef check
+
+error_data_address:
+	vm->err = REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS;
+	goto error;
+error_prgm_address:
+	vm->err = REXLANG_ERR_PRGM_ADDRESS_OUT_OF_BOUNDS;
+	goto error;
+error_stack_empty:
+	vm->err = REXLANG_ERR_DATA_STACK_EMPTY;
+	goto error;
+error_stack_full:
+	vm->err = REXLANG_ERR_DATA_STACK_FULL;
+
+error:
+done:
+	spill();
+	vm->ip = ip;
+	vm->sp = sp;
+#ifdef LOOP_TIMED
+	return count;
+#endif
+}
+
+#undef peek
+#undef top
+#undef reload
+#undef spill
+#undef tos_slot
+
+#undef LOOP_TIMED
+#undef LOOP_VERIFIED
+#undef LOOP_PREDECODED
+#undef LOOP_NAME
@@ -0,0 +1,101 @@
+#include <assert.h>
+#include <string.h>
+#include "rexlang_vm_impl.h"
+
+void rexlang_mmio_init(struct rexlang_mmio *io, uint32_t page_shift)
+{
+	assert(io && "io cannot be NULL");
+	assert(page_shift < 32 && "pages must be smaller than the address space");
+
+	io->page_shift = page_shift;
+	io->count = 0;
+	memset(io->page, 0, sizeof(io->page));
+}
+
+bool rexlang_mmio_add(struct rexlang_mmio *io, const struct rexlang_mmio_window *w)
+{
+	uint64_t first, last;
+
+	assert(w && "w cannot be NULL");
+
+	if (w->size == 0 || (uint64_t)w->base + w->size > (uint64_t)UINT32_MAX + 1 || io->count == REXLANG_MMIO_WINDOWS) {
+		return false;
+	}
+	first = w->base >> io->page_shift;
+	last = ((uint64_t)w->base + w->size - 1) >> io->page_shift;
+	if (last >= REXLANG_MMIO_PAGES) {
+		return false;
+	}
+	for (uint64_t k = first; k <= last; k++) {
+		if (io->page[k]) {
+			return false;
+		}
+	}
+
+	io->window[io->count++] = *w;
+	for (uint64_t k = first; k <= last; k++) {
+		io->page[k] = io->count;
+	}
+	return true;
+}
+
+void rexlang_vm_mmio(struct rexlang_vm *vm, struct rexlang_mmio *io)
+{
+	vm->mmio = io;
+}
+
+// window holding all `size` bytes at data address `p`, or NULL:
+static const struct rexlang_mmio_window *window_at(const struct rexlang_vm *vm, u32 p, ui size)
+{
+	const struct rexlang_mmio *io = vm->mmio;
+	const struct rexlang_mmio_window *w;
+	u32 k;
+
+	if (!io || (k = p >> io->page_shift) >= REXLANG_MMIO_PAGES || io->page[k] == 0) {
+		return NULL;
+	}
+	w = &io->window[io->page[k] - 1];
+	if (p < w->base || size > w->size || p - w->base > w->size - size) {
+		return NULL;
+	}
+	return w;
+}
+
+u32 rexlang_vm_mmio_read(struct rexlang_vm *vm, u32 p, ui size)
+{
+	const struct rexlang_mmio_window *w = window_at(vm, p, size);
+	u32 off = w ? p - w->base : 0;
+
+	if (w && w->mem) {
+		switch (size) {
+			case 1: return w->mem[off];
+			case 2: { u16 v; memcpy(&v, w->mem + off, 2); return v; }
+			default: { u32 v; memcpy(&v, w->mem + off, 4); return v; }
+		}
+	}
+	if (!w || !w->read) {
+		vm->err = REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS;
+		return 0;
+	}
+	return w->read(w->ctx, off, size);
+}
+
+void rexlang_vm_mmio_write(struct rexlang_vm *vm, u32 p, u32 v, ui size)
+{
+	const struct rexlang_mmio_window *w = window_at(vm, p, size);
+	u32 off = w ? p - w->base : 0;
+
+	if (w && w->mem) {
+		switch (size) {
+			case 1: w->mem[off] = v; break;
+			case 2: { u16 h = v; memcpy(w->mem + off, &h, 2); break; }
+			default: memcpy(w->mem + off, &v, 4); break;
+		}
+		return;
+	}
+	if (!w || !w->write) {
+		vm->err = REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS;
+		return;
+	}
+	w->write(w->ctx, off, size == 4 ? v : v & ((1u << (8*size)) - 1), size);
+}
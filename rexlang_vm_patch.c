@@ -0,0 +1,202 @@
+#include <assert.h>
+#include <string.h>
+#include "rexlang_vm_impl.h"
+
+#define RECORD_HEAD 8
+
+// bytes from `p` that the instruction there reads when it executes, fused sequence included:
+static uint64_t insn_span(const u8 *m, ui p)
+{
+	const u8 *seq = fused_seq(m[p]);
+	uint64_t q = p + 1 + imm_size(unfuse(m[p]));
+
+	if (seq) {
+		for (seq++; *seq; seq++) {
+			q += 1 + imm_size(*seq);
+		}
+	}
+	return q - p;
+}
+
+// the instruction at `ip` reads from [p, p+len):
+static inline bool reads(const struct rexlang_vm *vm, rexlang_ip ip, u32 p, u32 len)
+{
+	return ip < vm->m_size && ip < (uint64_t)p + len && ip + insn_span(vm->m, ip) > p;
+}
+
+enum rexlang_patch_status rexlang_vm_patch_check(const struct rexlang_vm *vm, uint32_t p, uint32_t len)
+{
+	if (len > vm->m_size || p > vm->m_size - len) {
+		return REXLANG_PATCH_BAD;
+	}
+	if (len == 0) {
+		return REXLANG_PATCH_OK;
+	}
+
+	if (reads(vm, vm->ip, p, len)) {
+		return REXLANG_PATCH_BUSY;
+	}
+	for (u32 i = vm->cp; i < vm->cs_size; i++) {
+		if (reads(vm, vm->cs[i], p, len)) {
+			return REXLANG_PATCH_BUSY;
+		}
+	}
+	return REXLANG_PATCH_OK;
+}
+
+enum rexlang_patch_status rexlang_vm_patch(struct rexlang_vm *const *vms, unsigned int vm_count, uint8_t *m, uint32_t *generation, uint32_t p, const void *data, uint32_t len)
+{
+	const struct rexlang_vm *vm;
+	enum rexlang_patch_status st;
+	ui from = p, q = 0;
+
+	assert(vm_count > 0 && "vms cannot be empty");
+	assert(generation && "generation cannot be NULL");
+	assert((data || len == 0) && "data cannot be NULL");
+	vm = vms[0];
+
+	for (ui k = 0; k < vm_count; k++) {
+		assert(m == vms[k]->m && vms[k]->m_size == vm->m_size && "m must be each VM's program memory");
+		if ((st = rexlang_vm_patch_check(vms[k], p, len)) != REXLANG_PATCH_OK) {
+			return st;
+		}
+	}
+	if (len == 0) {
+		return REXLANG_PATCH_OK;
+	}
+
+	// rexlang_vm_fuse() follows the instruction stream from IP 0 through the code, so do the same
+	// to find fused opcodes before the range. one that reaches into it stands for instructions
+	// it no longer has, but its first instruction is still there:
+	while (q < p && q < vm->code_size) {
+		if (fused_seq(m[q]) && q + insn_span(m, q) > p) {
+			m[q] = unfuse(m[q]);
+			if (q < from) {
+				from = q;
+			}
+		}
+		q += 1 + imm_size(unfuse(m[q]));
+	}
+
+	memcpy(m + p, data, len);
+
+	// every VM running the program has its pre-decoded entries refreshed and loses the
+	// verifier's proof and native code. instructions up to 4 bytes before the change may read
+	// immediates from it:
+	++*generation;
+	for (ui k = 0; k < vm_count; k++) {
+		if (vms[k]->x) {
+			struct rexlang_insn *x = (struct rexlang_insn *)vms[k]->x;
+
+			for (q = from > 4 ? from - 4 : 0; q < p + len; q++) {
+				predecode_at(m, vm->m_size, x, q);
+			}
+		}
+		vms[k]->verified = false;
+		vms[k]->unchecked = false;
+		vms[k]->generation = *generation;
+	}
+	return REXLANG_PATCH_OK;
+}
+
+void rexlang_patch_stream_init(struct rexlang_patch_stream *s, uint8_t *buf, uint32_t buf_size)
+{
+	assert(s && "s cannot be NULL");
+	assert((buf || buf_size == 0) && "buf cannot be NULL");
+
+	s->buf = buf;
+	s->buf_size = buf_size;
+	s->have = 0;
+	s->bad = false;
+}
+
+enum rexlang_patch_status rexlang_vm_patch_feed(struct rexlang_vm *const *vms, unsigned int vm_count, uint8_t *m, uint32_t *generation, struct rexlang_patch_stream *s, const void *data, size_t len, size_t *used)
+{
+	enum rexlang_patch_status st = REXLANG_PATCH_OK;
+	const u8 *const in = data;
+	size_t n = 0;
+	u32 m_size;
+
+	assert(vm_count > 0 && "vms cannot be empty");
+	assert((data || len == 0) && "data cannot be NULL");
+	assert(used && "used cannot be NULL");
+	m_size = vms[0]->m_size;
+
+	while (!s->bad) {
+		u32 p, size, k;
+
+		if (s->have < RECORD_HEAD) {
+			k = len - n < RECORD_HEAD - s->have ? len - n : RECORD_HEAD - s->have;
+			memcpy(s->head + s->have, in + n, k);
+			s->have += k;
+			n += k;
+			if (s->have < RECORD_HEAD) {
+				break;
+			}
+		}
+
+		p = rdmu32(s->head, 0);
+		size = rdmu32(s->head, 4);
+		if (size > s->buf_size || size > m_size || p > m_size - size) {
+			s->bad = true;
+			break;
+		}
+
+		if (s->have < RECORD_HEAD + size) {
+			k = len - n < RECORD_HEAD + size - s->have ? len - n : RECORD_HEAD + size - s->have;
+			memcpy(s->buf + (s->have - RECORD_HEAD), in + n, k);
+			s->have += k;
+			n += k;
+			if (s->have < RECORD_HEAD + size) {
+				break;
+			}
+		}
+
+		if ((st = rexlang_vm_patch(vms, vm_count, m, generation, p, s->buf, size)) != REXLANG_PATCH_OK) {
+			break;
+		}
+		s->have = 0;
+	}
+
+	*used = n;
+	return s->bad ? REXLANG_PATCH_BAD : st;
+}
+
+size_t rexlang_patch_diff(const uint8_t *from, const uint8_t *to, uint32_t size, uint32_t max_len, uint8_t *out, size_t out_size)
+{
+	size_t n = 0;
+	u32 p = 0;
+
+	assert(max_len > 0 && "records must hold at least a byte");
+
+	while (p < size) {
+		u32 end = p + 1, q;
+
+		if (from[p] == to[p]) {
+			p++;
+			continue;
+		}
+
+		// a run of equal bytes shorter than a record header is cheaper to send along:
+		for (q = p + 1; q < size && q - p < max_len; q++) {
+			if (from[q] != to[q]) {
+				end = q + 1;
+			} else if (q - end + 1 >= RECORD_HEAD) {
+				break;
+			}
+		}
+
+		if (n + RECORD_HEAD + (end - p) <= out_size) {
+			u8 *o = out + n;
+
+			for (ui k = 0; k < 4; k++) {
+				o[k] = p >> (8*k);
+				o[4 + k] = (end - p) >> (8*k);
+			}
+			memcpy(o + RECORD_HEAD, to + p, end - p);
+		}
+		n += RECORD_HEAD + (end - p);
+		p = end;
+	}
+	return n;
+}
@@ -0,0 +1,210 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rexlang_vm_impl.h"
+
+#ifdef REXLANG_PROFILE
+
+void rexlang_vm_profile(struct rexlang_vm *vm, struct rexlang_profile *prof)
+{
+	assert((!prof || (prof->ip && prof->taken && prof->not_taken)) && "per-IP arrays cannot be NULL");
+	assert((!prof || prof->size >= vm->m_size) && "per-IP arrays must have an entry per program memory byte");
+
+	vm->profile = prof;
+}
+
+void rexlang_vm_profile_reset(struct rexlang_profile *prof)
+{
+	assert(prof && "prof cannot be NULL");
+
+	memset(prof->ip, 0, prof->size * sizeof(uint32_t));
+	memset(prof->taken, 0, prof->size * sizeof(uint32_t));
+	memset(prof->not_taken, 0, prof->size * sizeof(uint32_t));
+	memset(prof->op, 0, sizeof(prof->op));
+	memset(prof->syscall, 0, sizeof(prof->syscall));
+}
+
+// whether execution continues with the next instruction in program memory, barring errors:
+static bool falls_through(u8 o)
+{
+	u8 base = o & 0x3F;
+
+	if (o == 0x00 || o == 0x38) {
+		// halt, return:
+		return false;
+	}
+	// calls and jumps:
+	return base < 0x28 || base > 0x2E;
+}
+
+static int compare_ops(const void *l, const void *r)
+{
+	return memcmp(((const struct rexlang_ngram *)l)->ops, ((const struct rexlang_ngram *)r)->ops, REXLANG_NGRAM_MAX);
+}
+
+static int compare_count(const void *l, const void *r)
+{
+	uint64_t lc = ((const struct rexlang_ngram *)l)->count;
+	uint64_t rc = ((const struct rexlang_ngram *)r)->count;
+
+	if (lc != rc) {
+		return lc > rc ? -1 : 1;
+	}
+	return compare_ops(l, r);
+}
+
+uint32_t rexlang_vm_profile_ngrams(const struct rexlang_vm *vm, unsigned int n, struct rexlang_ngram *out, uint32_t out_size)
+{
+	const u32 *counts;
+	u32 found = 0;
+	u32 distinct = 0;
+
+	assert(out && "out cannot be NULL");
+	assert(out_size >= vm->m_size && "out must have an entry per program memory byte");
+	assert(n >= 1 && n <= REXLANG_NGRAM_MAX);
+
+	if (!vm->profile) {
+		return 0;
+	}
+	counts = vm->profile->ip;
+
+	// collect the sequence starting at every executed IP:
+	for (ui p = 0; p < vm->m_size; p++) {
+		struct rexlang_ngram g;
+		ui q = p;
+		unsigned int k;
+
+		if (counts[p] == 0) {
+			continue;
+		}
+
+		memset(&g, 0, sizeof(g));
+		g.count = counts[p];
+		g.n = n;
+		for (k = 0; k < n; k++) {
+			u8 o;
+
+			if (q >= vm->m_size || (k > 0 && !falls_through(g.ops[k-1]))) {
+				break;
+			}
+			// report fused opcodes as the instruction they start with:
+			o = unfuse(vm->m[q]);
+			g.ops[k] = o;
+			if (counts[q] < g.count) {
+				g.count = counts[q];
+			}
+			q += 1 + imm_size(o);
+		}
+		if (k < n || g.count == 0) {
+			continue;
+		}
+
+		out[found++] = g;
+	}
+
+	// merge sequences found at several IPs:
+	qsort(out, found, sizeof(struct rexlang_ngram), compare_ops);
+	for (u32 i = 0; i < found; i++) {
+		if (distinct > 0 && compare_ops(&out[distinct-1], &out[i]) == 0) {
+			out[distinct-1].count += out[i].count;
+		} else {
+			out[distinct++] = out[i];
+		}
+	}
+
+	qsort(out, distinct, sizeof(struct rexlang_ngram), compare_count);
+
+	return distinct;
+}
+
+// an opcode or syscall number and its count:
+struct counted {
+	uint64_t count;
+	u32 n;
+};
+
+static int compare_counted(const void *l, const void *r)
+{
+	const struct counted *lc = l;
+	const struct counted *rc = r;
+
+	if (lc->count != rc->count) {
+		return lc->count > rc->count ? -1 : 1;
+	}
+	return lc->n < rc->n ? -1 : 1;
+}
+
+// the non-zero entries of `counts`, highest first:
+static void dump_counts(FILE *out, const char *title, const char *fmt, const uint64_t *counts, ui size, uint64_t total)
+{
+	struct counted sorted[256];
+	ui k = 0;
+
+	assert(size <= 256);
+
+	for (ui i = 0; i < size; i++) {
+		if (counts[i]) {
+			sorted[k].count = counts[i];
+			sorted[k].n = i;
+			k++;
+		}
+	}
+	qsort(sorted, k, sizeof(struct counted), compare_counted);
+
+	fprintf(out, "%s\n", title);
+	for (ui i = 0; i < k; i++) {
+		fprintf(out, fmt, sorted[i].n);
+		fprintf(out, " %12llu %6.2f%%\n", (unsigned long long)sorted[i].count, 100.0 * sorted[i].count / total);
+	}
+}
+
+void rexlang_vm_profile_dump(const struct rexlang_vm *vm, FILE *out)
+{
+	const struct rexlang_profile *prof = vm->profile;
+	uint64_t total = 0;
+	uint64_t calls = 0;
+
+	assert(out && "out cannot be NULL");
+
+	if (!prof) {
+		fprintf(out, "no profile\n");
+		return;
+	}
+
+	for (ui i = 0; i < 256; i++) {
+		total += prof->op[i];
+	}
+	for (ui i = 0; i < REXLANG_PROFILE_SYSCALLS; i++) {
+		calls += prof->syscall[i];
+	}
+	fprintf(out, "%llu instructions, %llu syscalls\n", (unsigned long long)total, (unsigned long long)calls);
+	if (total == 0) {
+		return;
+	}
+
+	dump_counts(out, "opcode        count  share", "  0x%02X", prof->op, 256, total);
+	if (calls) {
+		dump_counts(out, "syscall       count  share", "  %4u", prof->syscall, REXLANG_PROFILE_SYSCALLS, calls);
+		if (prof->syscall[REXLANG_PROFILE_SYSCALLS-1]) {
+			fprintf(out, "  (syscall %u counts all higher numbers)\n", REXLANG_PROFILE_SYSCALLS-1);
+		}
+	}
+
+	fprintf(out, "ip      op        count  share      taken  not-taken\n");
+	for (ui p = 0; p < vm->m_size; p++) {
+		u8 o;
+
+		if (prof->ip[p] == 0) {
+			continue;
+		}
+		o = unfuse(vm->m[p]);
+		fprintf(out, "0x%04X  0x%02X %12lu %6.2f%%", p, o, (unsigned long)prof->ip[p], 100.0 * prof->ip[p] / total);
+		if (prof->taken[p] || prof->not_taken[p]) {
+			fprintf(out, " %10lu %10lu", (unsigned long)prof->taken[p], (unsigned long)prof->not_taken[p]);
+		}
+		fprintf(out, "\n");
+	}
+}
+
+#endif
@@ -0,0 +1,290 @@
+#include <assert.h>
+#include <string.h>
+#include "rexlang_vm_impl.h"
+
+// a snapshot is a header of u32 fields in host byte order, the live data stack items
+// ki[sp..ki_size), the live call stack entries cs[cp..cs_size) and then runs of data memory
+// blocks, each a u32 first block and u32 block count followed by their bytes. blocks are those
+// of the dirty bitmap; the last block of data memory may be short.
+
+#define SNAPSHOT_MAGIC  0x53584552u     // "REXS"
+
+enum {
+	H_MAGIC,
+	H_FLAGS,
+	H_IP,
+	H_SP,
+	H_CP,
+	H_ERR,
+	H_WAIT_EVENTS,
+	H_WAIT_CYCLES,
+	H_D_SIZE,
+	H_KI_SIZE,
+	H_CS_SIZE,
+	H_SHIFT,        // data memory blocks are 1 << shift bytes
+	H_RUNS,         // number of block runs
+	H_COUNT,
+};
+
+#define FLAG_INCREMENTAL    1u
+
+static inline u32 block_count(u32 d_size, ui shift)
+{
+	return (u32)(((uint64_t)d_size + (1u << shift) - 1) >> shift);
+}
+
+// bytes of data memory in blocks [first, first+count):
+static inline u32 run_bytes(u32 d_size, ui shift, u32 first, u32 count)
+{
+	uint64_t end = (uint64_t)(first + count) << shift;
+
+	return (u32)((end < d_size ? end : d_size) - ((uint64_t)first << shift));
+}
+
+static inline bool block_dirty(const u32 *dirty, u32 i)
+{
+	return !dirty || (dirty[i / 32] >> (i % 32)) & 1;
+}
+
+// block size in snapshots of `vm`:
+static inline ui snapshot_shift(const struct rexlang_vm *vm)
+{
+	return vm->dirty ? vm->dirty_shift : REXLANG_DIRTY_SHIFT;
+}
+
+void rexlang_vm_track_writes(struct rexlang_vm *vm, uint32_t *bitmap, uint32_t shift)
+{
+	assert(shift < 32 && "blocks cannot exceed the address space");
+
+	vm->dirty = bitmap;
+	vm->dirty_shift = shift;
+	if (bitmap) {
+		memset(bitmap, 0xFF, sizeof(uint32_t) * REXLANG_DIRTY_WORDS(vm->d_size, shift));
+	}
+}
+
+void rexlang_vm_mark_written(struct rexlang_vm *vm, uint32_t p, uint32_t len)
+{
+	assert(len <= vm->d_size && p <= vm->d_size - len && "range must lie within data memory");
+
+	if (len) {
+		dirty_data(vm, p, len);
+	}
+}
+
+bool rexlang_vm_dirty_next(const struct rexlang_vm *vm, uint32_t *p, uint32_t *len)
+{
+	const u32 *const dirty = vm->dirty;
+	const ui shift = vm->dirty_shift;
+	const u32 blocks = block_count(vm->d_size, shift);
+	u32 i = *p >> shift, end;
+
+	assert(dirty && "writes are not tracked");
+
+	if (*p >= vm->d_size) {
+		return false;
+	}
+	// skip clean blocks a word at a time:
+	for (;;) {
+		u32 w;
+
+		if (i >= blocks) {
+			return false;
+		}
+		w = dirty[i / 32] >> (i % 32);
+		if (w) {
+			i += __builtin_ctz(w);
+			break;
+		}
+		i = (i | 31) + 1;
+	}
+	if (i >= blocks) {
+		return false;
+	}
+
+	// and dirty ones likewise:
+	end = i;
+	while (end < blocks) {
+		u32 w = ~dirty[end / 32] >> (end % 32);
+
+		if (w) {
+			end += __builtin_ctz(w);
+			break;
+		}
+		end = (end | 31) + 1;
+	}
+	if (end > blocks) {
+		end = blocks;
+	}
+
+	*p = i << shift;
+	*len = run_bytes(vm->d_size, shift, i, end - i);
+	return true;
+}
+
+void rexlang_vm_dirty_clear(struct rexlang_vm *vm, uint32_t p, uint32_t len)
+{
+	u32 *const dirty = vm->dirty;
+	const ui shift = vm->dirty_shift;
+
+	assert(dirty && "writes are not tracked");
+	assert(len <= vm->d_size && p <= vm->d_size - len && "range must lie within data memory");
+
+	if (len == 0) {
+		return;
+	}
+	for (u32 i = p >> shift; i <= (p + len - 1) >> shift; i++) {
+		dirty[i / 32] &= ~(1u << (i % 32));
+	}
+}
+
+static inline void clear_dirty(struct rexlang_vm *vm)
+{
+	if (vm->dirty) {
+		memset(vm->dirty, 0, sizeof(uint32_t) * REXLANG_DIRTY_WORDS(vm->d_size, vm->dirty_shift));
+	}
+}
+
+size_t rexlang_vm_save_size(const struct rexlang_vm *vm)
+{
+	// runs alternate with clean blocks, so there are at most half as many as blocks, rounded up:
+	return sizeof(u32) * H_COUNT
+		+ sizeof(u32) * vm->ki_size
+		+ sizeof(rexlang_ip) * vm->cs_size
+		+ sizeof(u32) * 2 * (((size_t)block_count(vm->d_size, snapshot_shift(vm)) + 1) / 2)
+		+ vm->d_size;
+}
+
+size_t rexlang_vm_save(struct rexlang_vm *vm, void *buf, size_t size, bool incremental)
+{
+	const u32 *dirty = incremental ? vm->dirty : NULL;
+	const ui shift = snapshot_shift(vm);
+	const u32 blocks = block_count(vm->d_size, shift);
+	u32 h[H_COUNT];
+	u8 *const out = buf;
+	size_t n;
+
+	assert(buf && "buf cannot be NULL");
+
+	h[H_MAGIC] = SNAPSHOT_MAGIC;
+	h[H_FLAGS] = dirty ? FLAG_INCREMENTAL : 0;
+	h[H_IP] = vm->ip;
+	h[H_SP] = vm->sp;
+	h[H_CP] = vm->cp;
+	h[H_ERR] = vm->err;
+	h[H_WAIT_EVENTS] = vm->wait_events;
+	h[H_WAIT_CYCLES] = vm->wait_cycles;
+	h[H_D_SIZE] = vm->d_size;
+	h[H_KI_SIZE] = vm->ki_size;
+	h[H_CS_SIZE] = vm->cs_size;
+	h[H_SHIFT] = shift;
+	h[H_RUNS] = 0;
+
+	n = sizeof(h) + sizeof(u32) * (vm->ki_size - vm->sp) + sizeof(rexlang_ip) * (vm->cs_size - vm->cp);
+	if (size < n) {
+		return 0;
+	}
+	memcpy(out + sizeof(h), vm->ki + vm->sp, sizeof(u32) * (vm->ki_size - vm->sp));
+	memcpy(out + sizeof(h) + sizeof(u32) * (vm->ki_size - vm->sp), vm->cs + vm->cp, sizeof(rexlang_ip) * (vm->cs_size - vm->cp));
+
+	for (u32 i = 0; i < blocks; i++) {
+		u32 run[2], bytes;
+
+		if (!block_dirty(dirty, i)) {
+			continue;
+		}
+		run[0] = i;
+		while (i < blocks && block_dirty(dirty, i)) {
+			i++;
+		}
+		run[1] = i - run[0];
+		bytes = run_bytes(vm->d_size, shift, run[0], run[1]);
+		if (size - n < sizeof(run) + bytes) {
+			return 0;
+		}
+		memcpy(out + n, run, sizeof(run));
+		memcpy(out + n + sizeof(run), vm->d + (run[0] << shift), bytes);
+		n += sizeof(run) + bytes;
+		h[H_RUNS]++;
+	}
+
+	memcpy(out, h, sizeof(h));
+	clear_dirty(vm);
+	return n;
+}
+
+bool rexlang_vm_load(struct rexlang_vm *vm, const void *buf, size_t size)
+{
+	const u8 *const in = buf;
+	u32 h[H_COUNT], blocks;
+	size_t n, p;
+
+	assert(buf && "buf cannot be NULL");
+
+	if (size < sizeof(h)) {
+		return false;
+	}
+	memcpy(h, in, sizeof(h));
+	if (h[H_MAGIC] != SNAPSHOT_MAGIC
+		|| h[H_D_SIZE] != vm->d_size
+		|| h[H_KI_SIZE] != vm->ki_size
+		|| h[H_CS_SIZE] != vm->cs_size
+		|| h[H_SP] > vm->ki_size
+		|| h[H_CP] > vm->cs_size
+		|| h[H_ERR] > REXLANG_ERR_YIELDED
+		|| h[H_SHIFT] >= 32) {
+		return false;
+	}
+	// a VM that can resume sits at an instruction. one stopped by a halt or an error may not,
+	// and resumes checked after rexlang_vm_error_ack():
+	if ((h[H_ERR] == REXLANG_ERR_SUCCESS || h[H_ERR] == REXLANG_ERR_YIELDED) && h[H_IP] >= vm->m_size) {
+		return false;
+	}
+	blocks = block_count(vm->d_size, h[H_SHIFT]);
+
+	// check the whole snapshot before changing anything:
+	n = sizeof(h) + sizeof(u32) * (vm->ki_size - h[H_SP]) + sizeof(rexlang_ip) * (vm->cs_size - h[H_CP]);
+	if (size < n) {
+		return false;
+	}
+	p = n;
+	for (u32 r = 0; r < h[H_RUNS]; r++) {
+		u32 run[2];
+
+		if (size - p < sizeof(run)) {
+			return false;
+		}
+		memcpy(run, in + p, sizeof(run));
+		if (run[1] == 0 || run[0] >= blocks || run[1] > blocks - run[0]) {
+			return false;
+		}
+		p += sizeof(run);
+		if (size - p < run_bytes(vm->d_size, h[H_SHIFT], run[0], run[1])) {
+			return false;
+		}
+		p += run_bytes(vm->d_size, h[H_SHIFT], run[0], run[1]);
+	}
+
+	vm->ip = h[H_IP];
+	vm->sp = h[H_SP];
+	vm->cp = h[H_CP];
+	vm->err = h[H_ERR];
+	vm->wait_events = h[H_WAIT_EVENTS];
+	vm->wait_cycles = h[H_WAIT_CYCLES];
+	// nothing in a snapshot can be trusted to lie within the verifier's proof, so run checked:
+	vm->unchecked = false;
+	memcpy(vm->ki + vm->sp, in + sizeof(h), sizeof(u32) * (vm->ki_size - vm->sp));
+	memcpy(vm->cs + vm->cp, in + sizeof(h) + sizeof(u32) * (vm->ki_size - vm->sp), sizeof(rexlang_ip) * (vm->cs_size - vm->cp));
+
+	for (u32 r = 0; r < h[H_RUNS]; r++) {
+		u32 run[2], bytes;
+
+		memcpy(run, in + n, sizeof(run));
+		bytes = run_bytes(vm->d_size, h[H_SHIFT], run[0], run[1]);
+		memcpy(vm->d + ((size_t)run[0] << h[H_SHIFT]), in + n + sizeof(run), bytes);
+		n += sizeof(run) + bytes;
+	}
+
+	clear_dirty(vm);
+	return true;
+}
@@ -0,0 +1,483 @@
+#include <assert.h>
+#include <string.h>
+#include "rexlang_vm_impl.h"
+
+// the verifier performs abstract interpretation of the data stack depth over every
+// instruction reachable from IP 0. each call target is analyzed once as a function with
+// depths relative to its entry; call sites then apply the function's summary.
+
+// scratch slot layout, one slot per program memory byte:
+#define SLOT_DEPTH_MASK     0x00FF  // relative data stack depth at instruction start, biased by 128
+#define SLOT_FN_SHIFT       8
+#define SLOT_FN_MASK        0x3F00  // 1-based index of the function owning the instruction; 0 if unvisited
+#define SLOT_INTERIOR       0x4000  // byte belongs to the immediate of an instruction
+#define SLOT_DONE           0x8000  // instruction has been processed
+
+enum kind {
+	K_NORMAL,
+	K_HALT,
+	K_JUMP,
+	K_BRANCH,
+	K_CALL,
+	K_RETURN,
+	K_SYSCALL,
+	K_BAD,
+	K_DYNAMIC,
+};
+
+struct insn {
+	enum kind kind;
+	ui  len;        // encoded length
+	u32 imm;        // extended immediate
+	int need;       // items that must be on the stack
+	int pops;
+	int pushes;
+	ui  width;      // size of a constant-address data access; 0 if none
+	bool rel;       // jump target is relative to the next IP
+};
+
+struct func {
+	rexlang_ip entry;
+	int  lo;        // lowest relative depth reached, including callees
+	int  hi;        // highest relative depth reached, including callees
+	rexlang_ip lo_ip;
+	rexlang_ip hi_ip;
+	int  delta;     // relative depth at return
+	int  calls;     // deepest nesting of calls made
+	bool returns;
+	bool busy;
+	bool done;
+};
+
+struct verifier {
+	const struct rexlang_vm *vm;
+	const struct rexlang_syscall_sig *sigs;
+	unsigned int sig_count;
+	u16 *s;
+	struct func f[REXLANG_VERIFY_MAX_FUNCS];
+	unsigned int nf;
+	rexlang_ip fail_ip;
+};
+
+#define fail(v, at, e) { \
+	(v)->fail_ip = (at); \
+	return (e); \
+}
+
+static void decode(const u8 *m, u32 m_size, ui ip, struct insn *i)
+{
+	u8 o = m[ip];
+	const u8 *seq = fused_seq(o);
+	u8 base;
+
+	if (seq) {
+		// a fused opcode stands for its first instruction; the rest follow unchanged but
+		// must be the ones its handler assumes:
+		ui q = ip + 1 + imm_size(seq[0]);
+		for (const u8 *e = seq + 1; *e; e++) {
+			if (q >= m_size || m[q] != *e) {
+				// decode as a reserved opcode:
+				seq = NULL;
+				break;
+			}
+			q += 1 + imm_size(*e);
+		}
+		o = seq ? seq[0] : 0x33;
+	}
+	base = o & 0x3F;
+
+	i->kind = K_NORMAL;
+	i->len = 1 + imm_size(o);
+	i->imm = 0;
+	i->need = 0;
+	i->pops = 0;
+	i->pushes = 0;
+	i->width = 0;
+	i->rel = false;
+
+	if (o < 0x40) {
+		switch (base) {
+			case 0x00: i->kind = K_HALT; break;
+			case 0x01: break;
+			case 0x02 ... 0x11: i->pops = 2; i->pushes = 1; break;
+			case 0x12 ... 0x14: i->pops = 1; i->pushes = 1; break;
+			case 0x15 ... 0x17: i->pops = 2; i->pushes = 1; break;
+			case 0x18 ... 0x19: i->pops = 1; i->pushes = 1; break;
+			case 0x1A ... 0x1B: i->pops = 2; i->pushes = 1; break;
+			case 0x1C ... 0x1E: i->pops = 2; i->pushes = 1; break;
+			case 0x1F ... 0x21: i->pops = 3; i->pushes = 1; break;
+			case 0x22 ... 0x24: i->pops = 2; break;
+			case 0x25 ... 0x27: i->pops = 3; break;
+			case 0x28 ... 0x2F: i->kind = K_DYNAMIC; break;
+			case 0x30 ... 0x31: i->pops = 2; i->pushes = 1; break;
+			case 0x32: break;
+			case 0x38: i->kind = K_RETURN; break;
+			case 0x39 ... 0x3A: i->pops = 1; i->pushes = 1; break;
+			case 0x3B: i->pops = 1; break;
+			case 0x3C: i->pops = 2; i->pushes = 2; break;
+			case 0x3D: i->pops = 1; i->pushes = 2; break;
+			case 0x3E ... 0x3F: i->pops = 3; i->pushes = 1; break;
+			default: i->kind = K_BAD; break;
+		}
+		i->need = i->pops;
+		return;
+	}
+
+	if (ip + i->len > m_size) {
+		// truncated; the caller reports it:
+		return;
+	}
+
+	i->imm = rdimm(m, ip, o);
+	switch (base) {
+		case 0x00 ... 0x01: i->pushes = 1; break;
+		case 0x02 ... 0x11: i->pops = 1; i->pushes = 1; break;
+		case 0x12: i->pushes = 1; i->width = 1; break;
+		case 0x13: i->pushes = 1; i->width = 2; break;
+		case 0x14: i->pushes = 1; i->width = 4; break;
+		case 0x15 ... 0x17: i->pops = 1; i->pushes = 1; break;
+		case 0x18: i->pushes = 1; i->width = 1; break;
+		case 0x19: i->pushes = 1; i->width = 2; break;
+		case 0x1A ... 0x1B: i->pops = 1; i->pushes = 1; break;
+		case 0x1C: i->pops = 1; i->pushes = 1; i->width = 1; break;
+		case 0x1D: i->pops = 1; i->pushes = 1; i->width = 2; break;
+		case 0x1E: i->pops = 1; i->pushes = 1; i->width = 4; break;
+		case 0x1F ... 0x21: i->pops = 2; i->pushes = 1; break;
+		case 0x22: i->pops = 1; i->width = 1; break;
+		case 0x23: i->pops = 1; i->width = 2; break;
+		case 0x24: i->pops = 1; i->width = 4; break;
+		case 0x25 ... 0x27: i->pops = 2; break;
+		case 0x28: i->kind = K_CALL; break;
+		case 0x29: i->kind = K_JUMP; break;
+		case 0x2A ... 0x2B: i->kind = K_BRANCH; i->pops = 1; break;
+		// jump-rel pushes the IP following it:
+		case 0x2C: i->kind = K_JUMP; i->rel = true; i->pushes = 1; break;
+		case 0x2D ... 0x2E: i->kind = K_BRANCH; i->rel = true; i->pops = 1; break;
+		case 0x2F: i->kind = K_SYSCALL; break;
+		default:
+			if (o == 0x70 || o == 0x71) {
+				// shl-imm8, shr-imm8:
+				i->pops = 1;
+				i->pushes = 1;
+			} else if (o == 0x72) {
+				// ldsp-offs-imm8 reads the item x below the top:
+				i->need = i->imm + 1;
+				i->pushes = 1;
+				return;
+			} else if (o == 0x73) {
+				// discard-imm8 must leave at least one item:
+				i->need = i->imm + 1;
+				i->pops = i->imm;
+				return;
+			} else {
+				i->kind = K_BAD;
+			}
+			break;
+	}
+	i->need = i->pops;
+}
+
+static inline int slot_fn(u16 slot)
+{
+	return (slot & SLOT_FN_MASK) >> SLOT_FN_SHIFT;
+}
+
+static inline int slot_depth(u16 slot)
+{
+	return (int)(slot & SLOT_DEPTH_MASK) - 128;
+}
+
+// record that instruction `ip` of function `fi` is reached with relative depth `rel`:
+static enum rexlang_error visit(struct verifier *v, unsigned int fi, rexlang_ip from, u32 ip, int rel)
+{
+	u16 slot;
+
+	if (ip >= v->vm->m_size) {
+		fail(v, from, REXLANG_ERR_PRGM_ADDRESS_OUT_OF_BOUNDS);
+	}
+
+	if (rel < -128 || rel > 127) {
+		// deeper than a slot records; only possible with large stacks:
+		fail(v, from, REXLANG_ERR_UNVERIFIABLE);
+	}
+
+	slot = v->s[ip];
+	if (slot & SLOT_INTERIOR) {
+		// target is in the middle of another instruction:
+		fail(v, from, REXLANG_ERR_UNVERIFIABLE);
+	}
+	if (slot_fn(slot) == 0) {
+		v->s[ip] = ((fi + 1) << SLOT_FN_SHIFT) | (u16)(rel + 128);
+		return REXLANG_ERR_SUCCESS;
+	}
+	if (slot_fn(slot) != (int)fi + 1 || slot_depth(slot) != rel) {
+		// shared between functions or reached with differing stack depths:
+		fail(v, from, REXLANG_ERR_UNVERIFIABLE);
+	}
+
+	return REXLANG_ERR_SUCCESS;
+}
+
+static enum rexlang_error analyze(struct verifier *v, unsigned int fi, int nest);
+
+static enum rexlang_error call(struct verifier *v, unsigned int fi, rexlang_ip ip, const struct insn *i, int rel, int nest)
+{
+	struct func *f = &v->f[fi];
+	struct func *g;
+	unsigned int gi;
+	enum rexlang_error e;
+
+	if (i->imm >= v->vm->m_size) {
+		fail(v, ip, REXLANG_ERR_PRGM_ADDRESS_OUT_OF_BOUNDS);
+	}
+
+	for (gi = 0; gi < v->nf; gi++) {
+		if (v->f[gi].entry == i->imm) {
+			break;
+		}
+	}
+
+	if (gi == v->nf) {
+		if (v->nf >= REXLANG_VERIFY_MAX_FUNCS) {
+			fail(v, ip, REXLANG_ERR_UNVERIFIABLE);
+		}
+		v->nf++;
+		memset(&v->f[gi], 0, sizeof(struct func));
+		v->f[gi].entry = i->imm;
+		if ((e = visit(v, gi, ip, i->imm, 0)) != REXLANG_ERR_SUCCESS) {
+			return e;
+		}
+	}
+
+	g = &v->f[gi];
+	if (g->busy) {
+		// recursion cannot be bounded:
+		fail(v, ip, REXLANG_ERR_UNVERIFIABLE);
+	}
+	if (!g->done) {
+		if (nest + 1 > (int)v->vm->cs_size) {
+			fail(v, ip, REXLANG_ERR_CALL_STACK_FULL);
+		}
+		if ((e = analyze(v, gi, nest + 1)) != REXLANG_ERR_SUCCESS) {
+			return e;
+		}
+	}
+
+	// apply the callee's summary at this call site:
+	if (rel + g->lo < f->lo) {
+		f->lo = rel + g->lo;
+		f->lo_ip = ip;
+	}
+	if (rel + g->hi > f->hi) {
+		f->hi = rel + g->hi;
+		f->hi_ip = ip;
+	}
+	if (g->calls + 1 > f->calls) {
+		f->calls = g->calls + 1;
+	}
+	if (f->lo < -(int)v->vm->ki_size) {
+		fail(v, ip, REXLANG_ERR_DATA_STACK_EMPTY);
+	}
+	if (f->hi > (int)v->vm->ki_size) {
+		fail(v, ip, REXLANG_ERR_DATA_STACK_FULL);
+	}
+
+	if (!g->returns) {
+		return REXLANG_ERR_SUCCESS;
+	}
+
+	return visit(v, fi, ip, ip + i->len, rel + g->delta);
+}
+
+static enum rexlang_error step(struct verifier *v, unsigned int fi, rexlang_ip ip, int rel, int nest)
+{
+	const struct rexlang_vm *vm = v->vm;
+	struct func *f = &v->f[fi];
+	struct insn i;
+	int post;
+	u32 target;
+	unsigned int n;
+
+	decode(vm->m, vm->m_size, ip, &i);
+	if (ip + i.len > vm->m_size) {
+		fail(v, ip, REXLANG_ERR_PRGM_ADDRESS_OUT_OF_BOUNDS);
+	}
+
+	// claim the immediate bytes:
+	for (ui p = ip + 1; p < ip + i.len; p++) {
+		if (slot_fn(v->s[p]) != 0) {
+			// another instruction starts inside this one:
+			fail(v, ip, REXLANG_ERR_UNVERIFIABLE);
+		}
+		v->s[p] |= SLOT_INTERIOR;
+	}
+
+	switch (i.kind) {
+		case K_BAD:
+			fail(v, ip, REXLANG_ERR_BAD_OPCODE);
+		case K_DYNAMIC:
+			// computed jump, call and syscall targets are not tracked:
+			fail(v, ip, REXLANG_ERR_UNVERIFIABLE);
+		case K_HALT:
+			return REXLANG_ERR_SUCCESS;
+		case K_RETURN:
+			if (fi == 0) {
+				fail(v, ip, REXLANG_ERR_CALL_STACK_EMPTY);
+			}
+			if (f->returns && f->delta != rel) {
+				fail(v, ip, REXLANG_ERR_UNVERIFIABLE);
+			}
+			f->returns = true;
+			f->delta = rel;
+			return REXLANG_ERR_SUCCESS;
+		case K_CALL:
+			return call(v, fi, ip, &i, rel, nest);
+		case K_SYSCALL:
+			for (n = 0; n < v->sig_count; n++) {
+				if (v->sigs[n].fn == i.imm) {
+					break;
+				}
+			}
+			if (n == v->sig_count) {
+				fail(v, ip, REXLANG_ERR_BAD_SYSCALL);
+			}
+			i.pops = i.need = v->sigs[n].args;
+			i.pushes = v->sigs[n].results;
+			break;
+		default:
+			break;
+	}
+
+	if (i.width && (i.imm >= vm->d_size || i.width > vm->d_size - i.imm)) {
+		fail(v, ip, REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS);
+	}
+
+	post = rel - i.pops + i.pushes;
+	if (rel - i.need < f->lo) {
+		f->lo = rel - i.need;
+		f->lo_ip = ip;
+	}
+	if (post > f->hi) {
+		f->hi = post;
+		f->hi_ip = ip;
+	}
+	// no caller depth can make these valid:
+	if (f->lo < -(int)v->vm->ki_size) {
+		fail(v, ip, REXLANG_ERR_DATA_STACK_EMPTY);
+	}
+	if (f->hi > (int)v->vm->ki_size) {
+		fail(v, ip, REXLANG_ERR_DATA_STACK_FULL);
+	}
+
+	target = i.rel ? ip + i.len + i.imm : i.imm;
+	switch (i.kind) {
+		case K_JUMP:
+			return visit(v, fi, ip, target, post);
+		case K_BRANCH: {
+			enum rexlang_error e = visit(v, fi, ip, target, post);
+			if (e != REXLANG_ERR_SUCCESS) {
+				return e;
+			}
+			return visit(v, fi, ip, ip + i.len, post);
+		}
+		default:
+			return visit(v, fi, ip, ip + i.len, post);
+	}
+}
+
+static enum rexlang_error analyze(struct verifier *v, unsigned int fi, int nest)
+{
+	const u32 m_size = v->vm->m_size;
+	bool changed = true;
+	enum rexlang_error e;
+
+	v->f[fi].busy = true;
+
+	// sweep until every instruction reachable within the function has been processed:
+	while (changed) {
+		changed = false;
+		for (ui ip = 0; ip < m_size; ip++) {
+			u16 slot = v->s[ip];
+			if ((slot & SLOT_DONE) || slot_fn(slot) != (int)fi + 1) {
+				continue;
+			}
+
+			v->s[ip] |= SLOT_DONE;
+			changed = true;
+			if ((e = step(v, fi, ip, slot_depth(slot), nest)) != REXLANG_ERR_SUCCESS) {
+				return e;
+			}
+		}
+	}
+
+	v->f[fi].busy = false;
+	v->f[fi].done = true;
+
+	return REXLANG_ERR_SUCCESS;
+}
+
+enum rexlang_error rexlang_vm_verify(
+	struct rexlang_vm *vm,
+	const struct rexlang_syscall_sig *sigs,
+	unsigned int sig_count,
+	uint16_t *scratch,
+	uint32_t scratch_size,
+	rexlang_ip *fail_ip
+) {
+	struct verifier v;
+	struct func *entry;
+	enum rexlang_error e;
+
+	assert(vm && "vm cannot be NULL");
+	assert(scratch && "scratch cannot be NULL");
+	assert(scratch_size >= vm->m_size && "scratch must have an entry per program memory byte");
+
+	vm->verified = false;
+	vm->unchecked = false;
+
+	v.vm = vm;
+	v.sigs = sigs;
+	v.sig_count = sigs ? sig_count : 0;
+	v.s = scratch;
+	v.nf = 1;
+	v.fail_ip = 0;
+	memset(scratch, 0, sizeof(uint16_t) * vm->m_size);
+
+	entry = &v.f[0];
+	memset(entry, 0, sizeof(struct func));
+	if ((e = visit(&v, 0, 0, 0, 0)) != REXLANG_ERR_SUCCESS) {
+		goto out;
+	}
+	if ((e = analyze(&v, 0, 0)) != REXLANG_ERR_SUCCESS) {
+		goto out;
+	}
+
+	// the program starts with empty stacks:
+	if (entry->lo < 0) {
+		v.fail_ip = entry->lo_ip;
+		e = REXLANG_ERR_DATA_STACK_EMPTY;
+		goto out;
+	}
+	if (entry->hi > (int)vm->ki_size) {
+		v.fail_ip = entry->hi_ip;
+		e = REXLANG_ERR_DATA_STACK_FULL;
+		goto out;
+	}
+	if (entry->calls > (int)vm->cs_size) {
+		e = REXLANG_ERR_CALL_STACK_FULL;
+		goto out;
+	}
+
+	vm->verified = true;
+	// the proof only holds when starting from the reset state:
+	vm->unchecked = vm->ip == 0
+		&& vm->sp == vm->ki_size
+		&& vm->cp == vm->cs_size
+		&& vm->err == REXLANG_ERR_SUCCESS;
+
+out:
+	if (e != REXLANG_ERR_SUCCESS && fail_ip) {
+		*fail_ip = v.fail_ip;
+	}
+	return e;
+}
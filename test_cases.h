@@ -7,6 +7,31 @@ int test_chip_set_addr(struct rexlang_vm* vm, char* msg) {
     return 0;
 }
 
+int test_syscall_error(struct rexlang_vm* vm, char* msg) {
+    // the syscall is left with IP past it and its arguments popped:
+    int i = sprintf(msg, "ip");
+    expect(7, vm->ip, msg+i);
+    i = sprintf(msg, "sp");
+    expect(REXLANG_DATA_STACKSZ, vm->sp, msg+i);
+
+    return 0;
+}
+
+int test_yield(struct rexlang_vm* vm, char* msg) {
+    // execution resumes after the yield:
+    int i = sprintf(msg, "ip");
+    expect(3, vm->ip, msg+i);
+
+    return 0;
+}
+
+int test_counter_5(struct rexlang_vm* vm, char* msg) {
+    int i = sprintf(msg, "d[0]");
+    expect(5, *(uint16_t*)&vm->d[0], msg+i);
+
+    return 0;
+}
+
 const struct test_t tests[] = {
     {
         "halt",
@@ -108,4 +133,289 @@ const struct test_t tests[] = {
         { 0 },
         test_chip_set_addr,
     },
+    {
+        "chip-set-addr argument out of range",
+        {
+            0b01000000, 0x40,                   // push-u8    chip=0x40
+            0b10000000, 0x00, 0x2C,             // push-u16   addr=0x2C00
+            0b01101111, 0x00,                   // syscall-u8 0 (chip-set-addr)
+            0,                                  // halt
+        },
+        REXLANG_ERR_CALL_ARG_OUT_OF_RANGE,
+        0,
+        { 0 },
+        test_syscall_error,
+    },
+    {
+        "yield",
+        {
+            0b01000000, 0x07,                   // push-u8    7
+            0b00110010,                         // yield
+            0,                                  // halt
+        },
+        REXLANG_ERR_YIELDED,
+        1,
+        { 7 },
+        test_yield,
+    },
+    {
+        "bad opcode",
+        {
+            0b00110011,                         // RESERVED
+            0,                                  // halt
+        },
+        REXLANG_ERR_BAD_OPCODE,
+        0,
+        { 0 },
+        NULL,
+    },
+    {
+        "data stack overflow in loop",
+        {
+            0b01000000, 0x01,                   // push-u8    1
+            0b01101001, 0x00,                   // jump-abs-imm8 0
+        },
+        REXLANG_ERR_DATA_STACK_FULL,
+        0,
+        { 0 },
+        NULL,
+    },
+    {
+        "loop runs out of instructions",
+        {
+            0b01101001, 0x00,                   // jump-abs-imm8 0
+        },
+        REXLANG_ERR_SUCCESS,
+        0,
+        { 0 },
+        NULL,
+    },
+#ifndef REXLANG_NO_BOUNDS_CHECK
+    // without bounds checks the immediate would be read past program memory:
+    {
+        "truncated instruction at end of program",
+        {
+            0b01101001, 63,                     // jump-abs-imm8 63
+            [63] = 0b01000000,                  // push-u8    (missing immediate)
+        },
+        REXLANG_ERR_PRGM_ADDRESS_OUT_OF_BOUNDS,
+        0,
+        { 0 },
+        NULL,
+    },
+#endif
+    {
+        "count to 5 via ld-u16/eq/jump-rel-if-not",
+        {
+            0b10010011, 0x00, 0x00,             // ld-u16-imm16 0x0000
+            0b01000010, 5,                      // eq-imm8    5
+            0b01101110, 1,                      // jump-rel-if-not-imm8 +1
+            0,                                  // halt
+            0b10010011, 0x00, 0x00,             // ld-u16-imm16 0x0000
+            0b01001111, 1,                      // add-imm8   1
+            0b01100011, 0x00,                   // st-u16-discard-imm8 0x00
+            0b01101001, 0,                      // jump-abs-imm8 0
+        },
+        REXLANG_ERR_HALTED,
+        0,
+        { 0 },
+        test_counter_5,
+    },
+    {
+        "ldsp-offs/add",
+        {
+            0b01000000, 3,                      // push-u8    3
+            0b01000000, 4,                      // push-u8    4
+            0b01110010, 1,                      // ldsp-offs-imm8 1
+            0x0F,                               // add
+            0,                                  // halt
+        },
+        REXLANG_ERR_HALTED,
+        2,
+        { 3, 7 },
+        NULL,
+    },
+    {
+        "ldsp-offs/add on empty stack",
+        {
+            0b01110010, 0,                      // ldsp-offs-imm8 0
+            0x0F,                               // add
+            0,                                  // halt
+        },
+        REXLANG_ERR_DATA_STACK_EMPTY,
+        0,
+        { 0 },
+        NULL,
+    },
+    {
+        "jump into the middle of ld-u16/eq/jump-rel-if-not",
+        {
+            0b01000000, 4,                      // push-u8    4
+            0b01101001, 7,                      // jump-abs-imm8 7
+            0b10010011, 0x00, 0x00,             // ld-u16-imm16 0x0000
+            0b01000010, 0,                      // eq-imm8    0
+            0b01101110, 1,                      // jump-rel-if-not-imm8 +1
+            0,                                  // halt
+            0b01000000, 9,                      // push-u8    9
+            0,                                  // halt
+        },
+        REXLANG_ERR_HALTED,
+        1,
+        { 9 },
+        NULL,
+    },
+    {
+        "fused opcode outside its sequence",
+        {
+            0xF0, 1,                            // push-u8, syscall-imm8 (fused)
+            1,                                  // nop
+            0,                                  // halt
+        },
+        REXLANG_ERR_BAD_OPCODE,
+        0,
+        { 0 },
+        NULL,
+    },
+};
+
+const struct verify_test_t verify_tests[] = {
+    {
+        "straight line",
+        {
+            0b01000000, 1,                      // push-u8    1
+            0b01000000, 2,                      // push-u8    2
+            0x0F,                               // add
+            0,                                  // halt
+        },
+        REXLANG_ERR_SUCCESS, 0,
+    },
+    {
+        "data stack underflow",
+        {
+            0x0F,                               // add
+            0,                                  // halt
+        },
+        REXLANG_ERR_DATA_STACK_EMPTY, 0,
+    },
+    {
+        "stack depth differs at loop head",
+        {
+            0b01000000, 1,                      // push-u8    1
+            0b01101001, 0,                      // jump-abs-imm8 0
+        },
+        REXLANG_ERR_UNVERIFIABLE, 2,
+    },
+    {
+        "call and return",
+        {
+            0b01000000, 5,                      // push-u8    5
+            0b01101000, 5,                      // call-imm8  5
+            0,                                  // halt
+            0b01001111, 1,                      // add-imm8   1
+            0x38,                               // return
+        },
+        REXLANG_ERR_SUCCESS, 0,
+    },
+    {
+        "callee consumes missing argument",
+        {
+            0b01101000, 3,                      // call-imm8  3
+            0,                                  // halt
+            0b01001111, 1,                      // add-imm8   1
+            0x38,                               // return
+        },
+        REXLANG_ERR_DATA_STACK_EMPTY, 0,
+    },
+    {
+        "return from entry",
+        {
+            0x38,                               // return
+        },
+        REXLANG_ERR_CALL_STACK_EMPTY, 0,
+    },
+    {
+        "recursion",
+        {
+            0b01101000, 3,                      // call-imm8  3
+            0,                                  // halt
+            0b01101000, 3,                      // call-imm8  3
+            0x38,                               // return
+        },
+        REXLANG_ERR_UNVERIFIABLE, 3,
+    },
+    {
+        "computed jump",
+        {
+            0b01000000, 0,                      // push-u8    0
+            0x29,                               // jump-abs
+        },
+        REXLANG_ERR_UNVERIFIABLE, 2,
+    },
+    {
+        "jump into immediate",
+        {
+            0b01000000, 0,                      // push-u8    0
+            0b01101001, 1,                      // jump-abs-imm8 1
+        },
+        REXLANG_ERR_UNVERIFIABLE, 2,
+    },
+    {
+        "constant address out of bounds",
+        {
+            0b10010100, 0xFD, 0x00,             // ld-u32-imm16 0x00FD
+            0,                                  // halt
+        },
+        REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS, 0,
+    },
+    {
+        "undeclared syscall",
+        {
+            0b01101111, 0x05,                   // syscall-imm8 5
+            0,                                  // halt
+        },
+        REXLANG_ERR_BAD_SYSCALL, 0,
+    },
+    {
+        "declared syscall",
+        {
+            0b01000000, 0x3F,                   // push-u8    chip=0x3F
+            0b01101111, 0x01,                   // syscall-imm8 1 (chip-rdn-u8)
+            0,                                  // halt
+        },
+        REXLANG_ERR_SUCCESS, 0,
+    },
+    {
+        "falls off the end of program memory",
+        {
+            0b01101001, 63,                     // jump-abs-imm8 63
+            [63] = 1,                           // nop
+        },
+        REXLANG_ERR_PRGM_ADDRESS_OUT_OF_BOUNDS, 63,
+    },
+    {
+        "fused sequence",
+        {
+            0xF1, 0x00, 0x00,                   // ld-u16-imm16, eq-imm8, jump-rel-if-not-imm8 (fused)
+            0b01000010, 5,                      // eq-imm8    5
+            0b01101110, 0,                      // jump-rel-if-not-imm8 +0
+            0,                                  // halt
+        },
+        REXLANG_ERR_SUCCESS, 0,
+    },
+    {
+        "fused opcode outside its sequence",
+        {
+            0xF0, 1,                            // push-u8, syscall-imm8 (fused)
+            1,                                  // nop
+            0,                                  // halt
+        },
+        REXLANG_ERR_BAD_OPCODE, 0,
+    },
+    {
+        "reserved opcode",
+        {
+            0b00110011,                         // RESERVED
+        },
+        REXLANG_ERR_BAD_OPCODE, 0,
+    },
 };
@@ -5,9 +5,20 @@
 #include <string.h>
 #include "rexlang_vm.h"
 #include "rexlang_vm_impl.h"
+#include "rex.h"
+#include "rexlang_stdlib.h"
+#include "rexlang_channel.h"
+#include "rexlang_batch.h"
+#include "rexlang_asm.h"
+#include "rexlang_image.h"
 
 uint32_t chip_addr[0x40];
 
+const struct rexlang_syscall_sig syscall_sigs[] = {
+    {0x0000, 2, 0}, // chip-set-addr
+    {0x0001, 1, 1}, // chip-rdn-u8
+};
+
 void syscall(struct rexlang_vm* vm, uint32_t fn) {
     switch (fn) {
     case 0x0000: { // chip-set-addr
@@ -42,6 +53,14 @@ struct test_t {
     int (*check_fn)(struct rexlang_vm* vm, char* msg);
 };
 
+struct verify_test_t {
+    const char *name;   // name of test
+    uint8_t prgm[64];   // test rexlang program
+
+    enum rexlang_error check_error; // expected rexlang_vm_verify() result
+    rexlang_ip check_ip;            // expected failing IP
+};
+
 #define VALUE_TO_STRING(x) #x
 #define VALUE(x) VALUE_TO_STRING(x)
 #define expect(expected_expr, actual_expr, msg_out) { \
@@ -53,15 +72,60 @@ struct test_t {
     } \
 }
 
+// data and call stacks of the (at most two) VMs a test runs at once:
+static uint32_t test_ki[2][REXLANG_DATA_STACKSZ];
+static rexlang_ip test_cs[2][REXLANG_CALL_STACKSZ];
+#define STACKS(n) test_ki[n], REXLANG_DATA_STACKSZ, test_cs[n], REXLANG_CALL_STACKSZ
+
 #include "test_cases.h"
 
-int exec_test(const struct test_t *t, char* msg) {
+enum test_mode {
+    MODE_PREDECODED = 1,
+    MODE_VERIFIED   = 2,
+    MODE_FUSED      = 4,
+    MODE_JIT        = 8,
+    MODE_TIMED      = 16,
+};
+
+static uint8_t unit_cost[256];
+
+int exec_test_mode(const struct test_t *t, char* msg, int mode) {
     enum rexlang_error err;
     struct rexlang_vm vm;
+    struct rexlang_insn x[64];
+    uint16_t scratch[64];
     uint8_t data[256] = {0};
+    uint8_t fused[64];
+#ifdef REXLANG_JIT
+    struct rexlang_jit jit = {0};
+#endif
 
-    rexlang_vm_init(&vm, 64, t->prgm, 256, data, syscall);
-    err = rexlang_vm_exec(&vm, 1024);
+    rexlang_vm_init(&vm, 64, t->prgm, 256, data, syscall, STACKS(0));
+    if (mode & MODE_FUSED) {
+        rexlang_vm_fuse(t->prgm, 64, 64, fused);
+        rexlang_vm_init(&vm, 64, fused, 256, data, syscall, STACKS(0));
+    }
+    if (mode & MODE_PREDECODED) {
+        rexlang_vm_predecode(&vm, x, 64);
+    }
+    if (mode & MODE_VERIFIED) {
+        // programs that fail verification run with runtime checks:
+        rexlang_vm_verify(&vm, syscall_sigs, 2, scratch, 64, NULL);
+    }
+#ifdef REXLANG_JIT
+    if (mode & MODE_JIT) {
+        // unverified programs are not compiled and run in the interpreter:
+        rexlang_vm_jit_compile(&vm, &jit);
+        err = rexlang_vm_jit_exec(&vm, &jit, 1024);
+        rexlang_vm_jit_free(&jit);
+    } else
+#endif
+    if (mode & MODE_TIMED) {
+        rexlang_vm_exec_cycles(&vm, unit_cost, 1024);
+        err = vm.err;
+    } else {
+        err = rexlang_vm_exec(&vm, 1024);
+    }
 
     if (err != t->check_error) {
         sprintf(msg, "error expected %d, got %d", t->check_error, err);
@@ -83,6 +147,1962 @@ int exec_test(const struct test_t *t, char* msg) {
     return 0;
 }
 
+int exec_test(const struct test_t *t, char* msg) {
+    static const char *mode_names[] = {
+        "", " (predecoded)", " (verified)", " (predecoded, verified)",
+        " (fused)", " (fused, predecoded)", " (fused, verified)", " (fused, predecoded, verified)",
+    };
+    int ret;
+
+    for (int mode = 0; mode < 8; mode++) {
+        if ((ret = exec_test_mode(t, msg, mode)) != 0) {
+            strcat(msg, mode_names[mode]);
+            return ret;
+        }
+    }
+    if ((ret = exec_test_mode(t, msg, MODE_TIMED)) != 0) {
+        strcat(msg, " (timed)");
+        return ret;
+    }
+    if ((ret = exec_test_mode(t, msg, MODE_TIMED | MODE_FUSED | MODE_PREDECODED | MODE_VERIFIED)) != 0) {
+        strcat(msg, " (timed, fused, predecoded, verified)");
+        return ret;
+    }
+#ifdef REXLANG_JIT
+    if ((ret = exec_test_mode(t, msg, MODE_JIT | MODE_VERIFIED)) != 0) {
+        strcat(msg, " (jit)");
+        return ret;
+    }
+    if ((ret = exec_test_mode(t, msg, MODE_JIT | MODE_VERIFIED | MODE_FUSED)) != 0) {
+        strcat(msg, " (fused, jit)");
+        return ret;
+    }
+#endif
+
+    return 0;
+}
+
+// runs a program in the plain interpreter and in the given mode side by side in small slices,
+// which must end in the same state, so that fused sequences and native code cut short by the
+// instruction budget are covered:
+int lockstep_test(const struct test_t *t, char* msg, int mode) {
+    struct rexlang_vm vm[2];
+    uint16_t scratch[64];
+#ifdef REXLANG_JIT
+    struct rexlang_jit jit = {0};
+#endif
+    uint8_t data[2][256] = {{0}};
+    uint8_t prgm[2][64];
+
+    memcpy(prgm[0], t->prgm, 64);
+    if (mode & MODE_FUSED) {
+        rexlang_vm_fuse(t->prgm, 64, 64, prgm[1]);
+    } else {
+        memcpy(prgm[1], t->prgm, 64);
+    }
+
+    for (unsigned int budget = 1; budget <= 4; budget++) {
+        memset(data, 0, sizeof(data));
+        rexlang_vm_init(&vm[0], 64, prgm[0], 256, data[0], syscall, STACKS(0));
+        rexlang_vm_init(&vm[1], 64, prgm[1], 256, data[1], syscall, STACKS(1));
+        if (mode & MODE_VERIFIED) {
+            rexlang_vm_verify(&vm[1], syscall_sigs, 2, scratch, 64, NULL);
+        }
+#ifdef REXLANG_JIT
+        if (mode & MODE_JIT) {
+            rexlang_vm_jit_compile(&vm[1], &jit);
+        }
+#endif
+
+        for (unsigned int n = 0; n < 1024 / budget; n++) {
+            enum rexlang_error err0 = rexlang_vm_exec(&vm[0], budget);
+            enum rexlang_error err1;
+#ifdef REXLANG_JIT
+            if (mode & MODE_JIT) {
+                err1 = rexlang_vm_jit_exec(&vm[1], &jit, budget);
+            } else
+#endif
+            if (mode & MODE_TIMED) {
+                // cycles left over can only be overdrawn with a cost above one:
+                int32_t left = rexlang_vm_exec_cycles(&vm[1], unit_cost, budget);
+                if (left != 0 && vm[1].err == REXLANG_ERR_SUCCESS) {
+                    sprintf(msg, "budget %u slice %d: %d cycles left", budget, n, left);
+                    return 1;
+                }
+                err1 = vm[1].err;
+            } else {
+                err1 = rexlang_vm_exec(&vm[1], budget);
+            }
+
+            if (err0 != err1 || vm[0].ip != vm[1].ip || vm[0].sp != vm[1].sp || vm[0].cp != vm[1].cp) {
+                sprintf(msg, "budget %u slice %d: err %d ip %u sp %u, expected err %d ip %u sp %u",
+                    budget, n, err1, vm[1].ip, vm[1].sp, err0, vm[0].ip, vm[0].sp);
+                return 1;
+            }
+            // slots below sp are dead and may hold different intermediates:
+            if (memcmp(&vm[0].ki[vm[0].sp], &vm[1].ki[vm[1].sp], sizeof(uint32_t) * (REXLANG_DATA_STACKSZ - vm[0].sp))
+                || memcmp(data[0], data[1], 256)) {
+                sprintf(msg, "budget %u slice %d: stack or data memory differs", budget, n);
+                return 1;
+            }
+            if (err0 != REXLANG_ERR_SUCCESS) {
+                break;
+            }
+        }
+#ifdef REXLANG_JIT
+        rexlang_vm_jit_free(&jit);
+#endif
+    }
+
+    return 0;
+}
+
+#define LANES_VMS (REXLANG_LOCKSTEP_LANES + 3)
+
+static uint32_t lanes_ki[2][LANES_VMS][REXLANG_DATA_STACKSZ];
+static rexlang_ip lanes_cs[2][LANES_VMS][REXLANG_CALL_STACKSZ];
+static uint8_t lanes_data[2][LANES_VMS][256];
+static uint32_t lanes_scratch[REXLANG_DATA_STACKSZ * REXLANG_LOCKSTEP_LANES];
+
+// programs whose paths depend on data memory, so that lanes diverge and rejoin:
+static const uint8_t lanes_prgms[][64] = {
+    {
+        0b01010010, 0,                      // ld-u8-imm8 0
+        0b01001100, 7,                      // and-imm8   7                 n = d[0] & 7
+        0b00111101,                         // loop: dup
+        0b01101011, 30,                     // jump-abs-if-not-imm8 done
+        0b00111101,                         // dup
+        0b01001100, 1,                      // and-imm8   1
+        0b01101101, 8,                      // jump-rel-if-imm8 odd
+        0b00111101,                         // dup
+        0b01010100, 8,                      // ld-u32-imm8 8
+        0b00001110,                         // xor
+        0b01100100, 8,                      // st-u32-discard-imm8 8        d[8] ^= n
+        0b01101001, 26,                     // jump-abs-imm8 next
+        0b00111101,                         // odd: dup
+        0b01010100, 4,                      // ld-u32-imm8 4
+        0b00001111,                         // add
+        0b01100100, 4,                      // st-u32-discard-imm8 4        d[4] += n
+        0b01010000, 1,                      // next: sub-imm8 1
+        0b01101001, 4,                      // jump-abs-imm8 loop
+        0,                                  // done: halt
+    },
+    {
+        0b01010010, 1,                      // ld-u8-imm8 1                 x = d[1]
+        0b01101000, 8,                      // call-imm8  f
+        0b01100100, 12,                     // st-u32-discard-imm8 12
+        0,                                  // halt
+        1,                                  // nop
+        0b00111101,                         // f: dup
+        0b01110000, 3,                      // shl-imm8   3
+        0b00111100,                         // swap
+        0b00110001,                         // shr                          counts past 31 leave
+        0b01010101, 0x10,                   // ld-u8-offs-imm8 0x10         some lanes out of bounds
+        0b00111000,                         // return
+    },
+};
+
+// runs a program on groups of VMs with different data memory in lockstep and on each VM alone,
+// in slices of several sizes, which must end in the same states:
+int lanes_test(const uint8_t *prgm, char* msg) {
+    struct rexlang_vm vm[2][LANES_VMS];
+    struct rexlang_vm *lanes[LANES_VMS];
+
+    for (unsigned int budget = 1; budget <= 1024; budget *= 4) {
+        for (int v = 0; v < LANES_VMS; v++) {
+            for (int k = 0; k < 256; k++) {
+                lanes_data[0][v][k] = (k + 1) * (v + 3) * 29;
+            }
+            memcpy(lanes_data[1][v], lanes_data[0][v], 256);
+            for (int r = 0; r < 2; r++) {
+                rexlang_vm_init(&vm[r][v], 64, prgm, 256, lanes_data[r][v], syscall,
+                    lanes_ki[r][v], REXLANG_DATA_STACKSZ, lanes_cs[r][v], REXLANG_CALL_STACKSZ);
+            }
+            lanes[v] = &vm[1][v];
+        }
+
+        for (unsigned int n = 0; n < 1024 / budget; n++) {
+            bool running = false;
+
+            for (int v = 0; v < LANES_VMS; v++) {
+                rexlang_vm_exec(&vm[0][v], budget);
+            }
+            rexlang_vm_exec_lockstep(lanes, LANES_VMS, budget, lanes_scratch, sizeof(lanes_scratch) / sizeof(uint32_t));
+
+            for (int v = 0; v < LANES_VMS; v++) {
+                struct rexlang_vm *e = &vm[0][v], *a = &vm[1][v];
+
+                if (e->err != a->err || e->ip != a->ip || e->sp != a->sp || e->cp != a->cp) {
+                    sprintf(msg, "budget %u slice %d lane %d: err %d ip %u sp %u cp %u, expected err %d ip %u sp %u cp %u",
+                        budget, n, v, a->err, a->ip, a->sp, a->cp, e->err, e->ip, e->sp, e->cp);
+                    return 1;
+                }
+                if (memcmp(&e->ki[e->sp], &a->ki[a->sp], sizeof(uint32_t) * (REXLANG_DATA_STACKSZ - e->sp))
+                    || memcmp(&e->cs[e->cp], &a->cs[a->cp], sizeof(rexlang_ip) * (REXLANG_CALL_STACKSZ - e->cp))
+                    || memcmp(lanes_data[0][v], lanes_data[1][v], 256)) {
+                    sprintf(msg, "budget %u slice %d lane %d: stacks or data memory differ", budget, n, v);
+                    return 1;
+                }
+                running |= e->err == REXLANG_ERR_SUCCESS;
+            }
+            if (!running) {
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+#ifdef REXLANG_PROFILE
+int profile_test(char* msg) {
+    static const uint8_t prgm[64] = {
+        0b10010011, 0x00, 0x00,             // ld-u16-imm16 0x0000
+        0b01000010, 5,                      // eq-imm8    5
+        0b01101110, 1,                      // jump-rel-if-not-imm8 +1
+        0,                                  // halt
+        0b10010011, 0x00, 0x00,             // ld-u16-imm16 0x0000
+        0b01001111, 1,                      // add-imm8   1
+        0b01100011, 0x00,                   // st-u16-discard-imm8 0x00
+        0b01101001, 0,                      // jump-abs-imm8 0
+    };
+    static const uint8_t calls[64] = {
+        0b01000000, 0,                      // push-u8    0
+        0b01101111, 0x01,                   // syscall-u8 1 (chip-rdn-u8)
+        0b00111011,                         // discard
+        0b01101111, 0x50,                   // syscall-u8 0x50
+    };
+    uint8_t fused[64];
+    struct rexlang_vm vm;
+    uint8_t data[256] = {0};
+    uint32_t counts[64] = {0};
+    uint32_t taken[64], not_taken[64];
+    struct rexlang_profile prof = {counts, taken, not_taken, 64};
+    struct rexlang_ngram ngrams[64];
+    uint32_t n;
+
+    rexlang_vm_profile_reset(&prof);
+    rexlang_vm_init(&vm, 64, prgm, 256, data, syscall, STACKS(0));
+    rexlang_vm_profile(&vm, &prof);
+    rexlang_vm_exec(&vm, 1024);
+
+    int i = sprintf(msg, "counts[0]");
+    expect(6, counts[0], msg+i);
+
+    // the loop test runs once more than the loop body:
+    n = rexlang_vm_profile_ngrams(&vm, 3, ngrams, 64);
+    i = sprintf(msg, "ngram count");
+    expect(3, n, msg+i);
+    i = sprintf(msg, "ngrams[0]");
+    expect(6, ngrams[0].count, msg+i);
+    expect(0x93, ngrams[0].ops[0], msg+i);
+    expect(0x42, ngrams[0].ops[1], msg+i);
+    expect(0x6E, ngrams[0].ops[2], msg+i);
+
+    // fused sequences count as the instructions they replace, branches included:
+    rexlang_vm_fuse(prgm, 64, 64, fused);
+    for (int f = 0; f < 2; f++) {
+        memset(data, 0, sizeof(data));
+        rexlang_vm_profile_reset(&prof);
+        rexlang_vm_init(&vm, 64, f ? fused : prgm, 256, data, syscall, STACKS(0));
+        rexlang_vm_profile(&vm, &prof);
+        rexlang_vm_exec(&vm, 1024);
+
+        i = sprintf(msg, "%s op counts", f ? "fused" : "plain");
+        expect(11, prof.op[0x93], msg+i);
+        expect(6, prof.op[0x6E], msg+i);
+        expect(1, prof.op[0x00], msg+i);
+        expect(0, prof.op[0xF1], msg+i);
+        i = sprintf(msg, "%s branch counts", f ? "fused" : "plain");
+        expect(5, taken[5], msg+i);
+        expect(1, not_taken[5], msg+i);
+        expect(0, taken[15] + not_taken[15], msg+i);
+    }
+
+    // syscall numbers past the table share its last entry:
+    rexlang_vm_profile_reset(&prof);
+    rexlang_vm_init(&vm, 64, calls, 256, data, syscall, STACKS(0));
+    rexlang_vm_profile(&vm, &prof);
+    rexlang_vm_exec(&vm, 1024);
+    i = sprintf(msg, "syscall counts");
+    expect(REXLANG_ERR_BAD_SYSCALL, vm.err, msg+i);
+    expect(1, prof.syscall[1], msg+i);
+    expect(1, prof.syscall[REXLANG_PROFILE_SYSCALLS-1], msg+i);
+    expect(4, counts[0] + counts[2] + counts[4] + counts[5], msg+i);
+
+    FILE *out = tmpfile();
+    rexlang_vm_profile_dump(&vm, out);
+    i = sprintf(msg, "dump");
+    expect(1, out && ftell(out) > 0, msg+i);
+    fclose(out);
+
+    rexlang_vm_profile_reset(&prof);
+    i = sprintf(msg, "reset");
+    expect(0, prof.syscall[1] + prof.op[0x6F] + counts[2], msg+i);
+
+    return 0;
+}
+#endif
+
+int scheduler_test(char* msg) {
+    // one iteration costs 6 cycles: ld-u16 3, the rest 1 each
+    static const uint8_t counter[64] = {
+        0b10010011, 0x00, 0x00,             // ld-u16-imm16 0x0000
+        0b01001111, 1,                      // add-imm8   1
+        0b01100011, 0x00,                   // st-u16-discard-imm8 0x00
+        0b01101001, 0,                      // jump-abs-imm8 0
+    };
+    static const uint8_t halt[64] = {
+        0,                                  // halt
+    };
+    static const uint8_t spin[64] = {
+        0b00110010,                         // yield
+        0b01101001, 0,                      // jump-abs-imm8 0
+    };
+    static const uint8_t wait_event[64] = {
+        0b01000000, 0x05,                   // push-u8    events=5
+        0b01000000, 0x00,                   // push-u8    cycles=0
+        0b01101111, 0x11,                   // syscall-u8 17 (wait-event)
+        0,                                  // halt
+    };
+    static const uint8_t wait_cycles[64] = {
+        0b01000000, 0x00,                   // push-u8    events=0
+        0b01000000, 20,                     // push-u8    cycles=20
+        0b01101111, 0x11,                   // syscall-u8 17 (wait-event)
+        0,                                  // halt
+    };
+    struct rexlang_stdlib lib;
+    uint8_t cost[256];
+    uint8_t data[2][256];
+    int i;
+
+    memset(cost, 1, sizeof(cost));
+    cost[0x93] = 3;
+
+    // priority: VM 0 takes the whole budget, ending exactly at the start of an iteration
+    memset(data, 0, sizeof(data));
+    rex_init(REX_PRIORITY);
+    rexlang_vm_init(&rex.vm[0], 64, counter, 256, data[0], syscall, STACKS(0));
+    rexlang_vm_init(&rex.vm[1], 64, counter, 256, data[1], syscall, STACKS(1));
+    rex_start(0, cost);
+    rex_start(1, cost);
+    rex_advance_clock(600);
+    i = sprintf(msg, "priority d[0]");
+    expect(100, data[0][0], msg+i);
+    i = sprintf(msg, "priority d[1]");
+    expect(0, data[1][0], msg+i);
+
+    // round-robin: turns of 64 cycles alternate, each overdrawing by less than an instruction
+    memset(data, 0, sizeof(data));
+    rex_init(REX_ROUND_ROBIN);
+    rexlang_vm_init(&rex.vm[0], 64, counter, 256, data[0], syscall, STACKS(0));
+    rexlang_vm_init(&rex.vm[1], 64, counter, 256, data[1], syscall, STACKS(1));
+    rex_start(0, cost);
+    rex_start(1, cost);
+    rex_advance_clock(600);
+    // only the iterations cut by the turns are incomplete:
+    i = sprintf(msg, "round-robin d[0] + d[1]");
+    expect(1, data[0][0] + data[1][0] >= 95 && data[0][0] + data[1][0] <= 100, msg+i);
+    i = sprintf(msg, "round-robin balance");
+    expect(1, data[0][0] > 40 && data[1][0] > 40, msg+i);
+    i = sprintf(msg, "round-robin debt");
+    expect(1, rex.next_exec_cycle - rex.cycles < 3, msg+i);
+
+    // a halted VM is skipped; the rest of the budget goes to the other
+    memset(data, 0, sizeof(data));
+    rex_init(REX_PRIORITY);
+    rexlang_vm_init(&rex.vm[0], 64, halt, 256, data[0], syscall, STACKS(0));
+    rexlang_vm_init(&rex.vm[1], 64, counter, 256, data[1], syscall, STACKS(1));
+    rex_start(0, cost);
+    rex_start(1, cost);
+    rex_advance_clock(600);
+    i = sprintf(msg, "halted runnable");
+    expect(0x2, rex.runnable, msg+i);
+    i = sprintf(msg, "halted d[1]");
+    expect(100, data[1][0], msg+i);
+
+    // debt: the 3 cycle ld-u16 started with 1 cycle left is repaid before the add runs
+    memset(data, 0, sizeof(data));
+    rex_init(REX_PRIORITY);
+    rexlang_vm_init(&rex.vm[0], 64, counter, 256, data[0], syscall, STACKS(0));
+    rex_start(0, cost);
+    rex_advance_clock(1);
+    i = sprintf(msg, "debt");
+    expect(2, rex.next_exec_cycle - rex.cycles, msg+i);
+    rex_advance_clock(2);
+    i = sprintf(msg, "debt repaid ip");
+    expect(3, rex.vm[0].ip, msg+i);
+    rex_advance_clock(1);
+    rex_advance_clock(1);
+    i = sprintf(msg, "debt d[0]");
+    expect(1, data[0][0], msg+i);
+
+    // yield: VM 0 gives up the rest of each advance to the lower priority VM 1
+    memset(data, 0, sizeof(data));
+    rex_init(REX_PRIORITY);
+    rexlang_vm_init(&rex.vm[0], 64, spin, 256, data[0], syscall, STACKS(0));
+    rexlang_vm_init(&rex.vm[1], 64, counter, 256, data[1], syscall, STACKS(1));
+    rex_start(0, cost);
+    rex_start(1, cost);
+    rex_advance_clock(61);
+    i = sprintf(msg, "yield d[1]");
+    expect(10, data[1][0], msg+i);
+    expect(3, rex.runnable, msg+i);
+    rex_advance_clock(2);
+    i = sprintf(msg, "yield again ip");
+    expect(1, rex.vm[0].ip, msg+i);
+
+    // wait-event: parked until one of its events is signalled
+    rexlang_stdlib_init(&lib);
+    rex_init(REX_PRIORITY);
+    rexlang_vm_init(&rex.vm[0], 64, wait_event, 256, data[0], rexlang_stdlib_syscall, STACKS(0));
+    rex.vm[0].ctx = &lib;
+    rex_start(0, NULL);
+    rex_advance_clock(10);
+    i = sprintf(msg, "wait-event parked");
+    expect(6, rex.vm[0].ip, msg+i);
+    expect(1, rex.parked, msg+i);
+    rex_signal(2);
+    rex_advance_clock(10);
+    expect(6, rex.vm[0].ip, msg+i);
+    rex_signal(4);
+    rex_advance_clock(10);
+    i = sprintf(msg, "wait-event woken");
+    expect(REXLANG_ERR_HALTED, rex.vm[0].err, msg+i);
+    expect(0, rex.parked | rex.runnable, msg+i);
+
+    // wait-event: parked until 20 cycles after it started waiting at cycle 3
+    rex_init(REX_PRIORITY);
+    rexlang_vm_init(&rex.vm[0], 64, wait_cycles, 256, data[0], rexlang_stdlib_syscall, STACKS(0));
+    rex.vm[0].ctx = &lib;
+    rex_start(0, NULL);
+    rex_advance_clock(22);
+    i = sprintf(msg, "wait-cycles parked");
+    expect(1, rex.parked, msg+i);
+    expect(23, rex.wake_cycle[0], msg+i);
+    rex_advance_clock(2);
+    i = sprintf(msg, "wait-cycles woken");
+    expect(REXLANG_ERR_HALTED, rex.vm[0].err, msg+i);
+    expect(0, rex.parked | rex.timed, msg+i);
+
+    return 0;
+}
+
+static uint8_t wram[0x20000];
+
+// chip without plain memory reading back the low byte of the address:
+static bool echo_read(void *ctx, uint32_t addr, uint8_t *dst, uint32_t len) {
+    (void)ctx;
+    for (uint32_t i = 0; i < len; i++) {
+        dst[i] = (uint8_t)(addr + i);
+    }
+    return addr < 0x100;
+}
+
+static uint8_t out_buf[64];
+static struct rexlang_channel out;
+static struct rexlang_channel in;
+
+static enum rexlang_error stdlib_run(struct rexlang_vm *vm, struct rexlang_stdlib *lib, const uint8_t *prgm, uint8_t *data) {
+    static const struct rexlang_chip wram_chip = {wram, sizeof(wram), NULL, NULL, NULL};
+    static const struct rexlang_chip echo_chip = {NULL, 0, echo_read, NULL, NULL};
+    uint16_t scratch[64];
+    enum rexlang_error err;
+
+    rexlang_stdlib_init(lib);
+    rexlang_stdlib_set_chip(lib, 0x00, &wram_chip);
+    rexlang_stdlib_set_chip(lib, 0x01, &echo_chip);
+    rexlang_channel_init(&out, out_buf, sizeof(out_buf));
+    rexlang_stdlib_set_output(lib, 0x00, &out);
+    // the input queue takes the top quarter of data memory:
+    rexlang_channel_init(&in, data + 0xC0, 0x40);
+    rexlang_stdlib_set_input(lib, &in);
+    rexlang_vm_init(vm, 64, prgm, 256, data, rexlang_stdlib_syscall, STACKS(0));
+    vm->ctx = lib;
+
+    err = rexlang_vm_verify(vm, rexlang_stdlib_sigs, REXLANG_STDLIB_SIG_COUNT, scratch, 64, NULL);
+    if (err != REXLANG_ERR_SUCCESS) {
+        return err;
+    }
+    return rexlang_vm_exec(vm, 1024);
+}
+
+int stdlib_test(char* msg) {
+    static const uint8_t blk[64] = {
+        0b01000000, 0x00,                   // push-u8    chip=0 (wram)
+        0b10000000, 0x00, 0x01,             // push-u16   addr=0x0100
+        0b01101111, 0x00,                   // syscall-u8 0 (chip-set-addr)
+        0b01000000, 0x00,                   // push-u8    chip=0
+        0b01000000, 0x10,                   // push-u8    len=16
+        0b01000000, 0x10,                   // push-u8    dest=0x10
+        0b01101111, 0x07,                   // syscall-u8 7 (chip-rda-blk)
+        0b01000000, 0x00,                   // push-u8    chip=0
+        0b01101111, 0x04,                   // syscall-u8 4 (chip-rda-u16)
+        0,                                  // halt
+    };
+    static const uint8_t gather_scatter[64] = {
+        0b01000000, 0x00,                   // push-u8    chip=0 (wram)
+        0b01000000, 0x02,                   // push-u8    n=2
+        0b01000000, 0x40,                   // push-u8    list=0x40
+        0b01000000, 0x80,                   // push-u8    dest=0x80
+        0b01101111, 0x09,                   // syscall-u8 9 (chip-rda-gather)
+        0b01000000, 0x00,                   // push-u8    chip=0
+        0b01000000, 0x02,                   // push-u8    n=2
+        0b01000000, 0x50,                   // push-u8    list=0x50
+        0b01000000, 0x80,                   // push-u8    src=0x80
+        0b01101111, 0x0A,                   // syscall-u8 10 (chip-wra-scatter)
+        0,                                  // halt
+    };
+    static const uint8_t echo[64] = {
+        0b01000000, 0x01,                   // push-u8    chip=1 (echo)
+        0b01000000, 0x42,                   // push-u8    addr=0x42
+        0b01101111, 0x00,                   // syscall-u8 0 (chip-set-addr)
+        0b01000000, 0x01,                   // push-u8    chip=1
+        0b01101111, 0x03,                   // syscall-u8 3 (chip-rda-u8)
+        0b01000000, 0x01,                   // push-u8    chip=1
+        0b01101111, 0x01,                   // syscall-u8 1 (chip-rdn-u8)
+        0,                                  // halt
+    };
+    static const uint8_t bad_dest[64] = {
+        0b01000000, 0x00,                   // push-u8    chip=0
+        0b01000000, 0x10,                   // push-u8    len=16
+        0b01000000, 0xF8,                   // push-u8    dest=0xF8
+        0b01101111, 0x07,                   // syscall-u8 7 (chip-rda-blk)
+        0,                                  // halt
+    };
+    static const uint8_t no_chip[64] = {
+        0b01000000, 0x05,                   // push-u8    chip=5
+        0b01101111, 0x03,                   // syscall-u8 3 (chip-rda-u8)
+        0,                                  // halt
+    };
+    static const uint8_t emit[64] = {
+        0b01000000, 0x00,                   // push-u8    channel=0
+        0b11000000, 0x78, 0x56, 0x34, 0x12, // push-u32   0x12345678
+        0b01101111, 0x0C,                   // syscall-u8 12 (emit-u32)
+        0b01000000, 0x00,                   // push-u8    channel=0
+        0b01000000, 0x05,                   // push-u8    len=5
+        0b01000000, 0x20,                   // push-u8    src=0x20
+        0b01101111, 0x0B,                   // syscall-u8 11 (emit)
+        0b01000000, 0x00,                   // push-u8    channel=0
+        0b01000000, 0x30,                   // push-u8    len=48
+        0b01000000, 0x20,                   // push-u8    src=0x20
+        0b01101111, 0x0B,                   // syscall-u8 11 (emit), full
+        0,                                  // halt
+    };
+    static const uint8_t no_output[64] = {
+        0b01000000, 0x01,                   // push-u8    channel=1
+        0b01000000, 0x01,                   // push-u8    0x01
+        0b01101111, 0x0C,                   // syscall-u8 12 (emit-u32)
+        0,                                  // halt
+    };
+    static const uint8_t recv[64] = {
+        0b01101111, 0x0F,                   // syscall-u8 15 (recv)
+        0b00111011,                         // discard    len
+        0b00111101,                         // dup
+        0b01101101, 3,                      // jump-rel-if-imm8 +3
+        0b00111011,                         // discard
+        0b01101001, 0,                      // jump-abs-imm8 0
+        0b01010101, 0x01,                   // ld-u8-offs-imm8 0x01
+        0b01101111, 0x10,                   // syscall-u8 16 (recv-release)
+        0b01101111, 0x0D,                   // syscall-u8 13 (recv-poll)
+        0,                                  // halt
+    };
+    const uint8_t *m;
+    uint32_t len;
+    const struct rexlang_chip_span spans[4] = {
+        {0x200, 4}, {0x300, 2},             // gathered
+        {0x400, 1}, {0x1FFFB, 5},           // scattered
+    };
+    struct rexlang_stdlib lib;
+    struct rexlang_vm vm;
+    uint8_t data[256];
+    int i;
+
+    for (uint32_t p = 0; p < sizeof(wram); p++) {
+        wram[p] = (uint8_t)(p ^ (p >> 8));
+    }
+
+    memset(data, 0, sizeof(data));
+    i = sprintf(msg, "blk err");
+    expect(REXLANG_ERR_HALTED, stdlib_run(&vm, &lib, blk, data), msg+i);
+    i = sprintf(msg, "blk d[0x10..0x1F]");
+    expect(0, memcmp(&data[0x10], &wram[0x100], 16), msg+i);
+    i = sprintf(msg, "blk result");
+    expect(0x20, vm.ki[REXLANG_DATA_STACKSZ - 1], msg+i);
+    i = sprintf(msg, "blk rda-u16 after the block");
+    expect(wram[0x110] | (wram[0x111] << 8), vm.ki[REXLANG_DATA_STACKSZ - 2], msg+i);
+    i = sprintf(msg, "blk chip address");
+    expect(0x112, lib.addr[0], msg+i);
+
+    memset(data, 0, sizeof(data));
+    memcpy(&data[0x40], &spans[0], 2 * sizeof(spans[0]));
+    memcpy(&data[0x50], &spans[2], 2 * sizeof(spans[0]));
+    i = sprintf(msg, "gather/scatter err");
+    expect(REXLANG_ERR_HALTED, stdlib_run(&vm, &lib, gather_scatter, data), msg+i);
+    i = sprintf(msg, "gather result");
+    expect(0x86, vm.ki[REXLANG_DATA_STACKSZ - 1], msg+i);
+    i = sprintf(msg, "gather d[0x80..0x85]");
+    expect(0, memcmp(&data[0x80], &wram[0x200], 4) || memcmp(&data[0x84], &wram[0x300], 2), msg+i);
+    i = sprintf(msg, "scatter wram");
+    expect(0, wram[0x400] != data[0x80] || memcmp(&wram[0x1FFFB], &data[0x81], 5), msg+i);
+
+    memset(data, 0, sizeof(data));
+    i = sprintf(msg, "echo err");
+    expect(REXLANG_ERR_HALTED, stdlib_run(&vm, &lib, echo, data), msg+i);
+    i = sprintf(msg, "echo rda-u8");
+    expect(0x42, vm.ki[REXLANG_DATA_STACKSZ - 1], msg+i);
+    i = sprintf(msg, "echo rdn-u8");
+    expect(0x43, vm.ki[REXLANG_DATA_STACKSZ - 2], msg+i);
+
+    i = sprintf(msg, "bad dest err");
+    expect(REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS, stdlib_run(&vm, &lib, bad_dest, data), msg+i);
+    i = sprintf(msg, "no chip err");
+    expect(REXLANG_ERR_CALL_ARG_OUT_OF_RANGE, stdlib_run(&vm, &lib, no_chip, data), msg+i);
+
+    memset(data, 0, sizeof(data));
+    memcpy(&data[0x20], "hello", 5);
+    i = sprintf(msg, "emit err");
+    expect(REXLANG_ERR_HALTED, stdlib_run(&vm, &lib, emit, data), msg+i);
+    i = sprintf(msg, "emit results");
+    expect(1, vm.ki[REXLANG_DATA_STACKSZ - 1], msg+i);
+    expect(1, vm.ki[REXLANG_DATA_STACKSZ - 2], msg+i);
+    expect(0, vm.ki[REXLANG_DATA_STACKSZ - 3], msg+i);
+    i = sprintf(msg, "emit-u32 message");
+    expect(1, rexlang_channel_peek(&out, &m, &len), msg+i);
+    expect(4, len, msg+i);
+    expect(0x12345678, m[0] | (m[1] << 8) | (m[2] << 16) | ((uint32_t)m[3] << 24), msg+i);
+    rexlang_channel_consume(&out);
+    i = sprintf(msg, "emit message");
+    expect(1, rexlang_channel_peek(&out, &m, &len), msg+i);
+    expect(5, len, msg+i);
+    expect(0, memcmp(m, "hello", 5), msg+i);
+    rexlang_channel_consume(&out);
+    i = sprintf(msg, "emit drained");
+    expect(0, rexlang_channel_peek(&out, &m, &len), msg+i);
+
+    i = sprintf(msg, "no output err");
+    expect(REXLANG_ERR_CALL_ARG_OUT_OF_RANGE, stdlib_run(&vm, &lib, no_output, data), msg+i);
+
+    // recv yields while the queue is empty and resumes without runtime checks once acknowledged:
+    memset(data, 0, sizeof(data));
+    i = sprintf(msg, "recv yields");
+    expect(REXLANG_ERR_YIELDED, stdlib_run(&vm, &lib, recv, data), msg+i);
+    expect(2, vm.ip, msg+i);
+    expect(1, rexlang_channel_write(&in, "XYZ", 3), msg+i);
+    rexlang_vm_error_ack(&vm);
+    expect(1, vm.unchecked, msg+i);
+    i = sprintf(msg, "recv err");
+    expect(REXLANG_ERR_HALTED, rexlang_vm_exec(&vm, 1024), msg+i);
+    i = sprintf(msg, "recv results");
+    expect('Y', vm.ki[REXLANG_DATA_STACKSZ - 1], msg+i);
+    expect(0, vm.ki[REXLANG_DATA_STACKSZ - 2], msg+i);
+    expect(0, rexlang_channel_peek(&in, &m, &len), msg+i);
+
+    // a frame length overwritten in data memory breaks the queue instead of misleading it:
+    memset(data, 0, sizeof(data));
+    i = sprintf(msg, "recv forged");
+    expect(REXLANG_ERR_YIELDED, stdlib_run(&vm, &lib, recv, data), msg+i);
+    expect(1, rexlang_channel_write(&in, "XYZ", 3), msg+i);
+    data[0xC0] = 0x40;
+    rexlang_vm_error_ack(&vm);
+    expect(REXLANG_ERR_CALL_ARG_OUT_OF_RANGE, rexlang_vm_exec(&vm, 1024), msg+i);
+    expect(1, in.bad, msg+i);
+    expect(0, in.tail, msg+i);
+
+    return 0;
+}
+
+int channel_test(char* msg) {
+    uint8_t buf[32];
+    uint8_t payload[28];
+    struct rexlang_channel ch;
+    const uint8_t *m;
+    uint32_t len;
+    int i;
+
+    for (size_t k = 0; k < sizeof(payload); k++) {
+        payload[k] = k + 1;
+    }
+    rexlang_channel_init(&ch, buf, sizeof(buf));
+
+    i = sprintf(msg, "empty");
+    expect(0, rexlang_channel_peek(&ch, &m, &len), msg+i);
+    i = sprintf(msg, "too long");
+    expect(0, rexlang_channel_write(&ch, payload, 29), msg+i);
+
+    // frames of 4+12, 4+8 and 4 bytes fill the buffer:
+    i = sprintf(msg, "fill");
+    expect(1, rexlang_channel_write(&ch, payload, 10), msg+i);
+    expect(1, rexlang_channel_write(&ch, payload, 7), msg+i);
+    expect(1, rexlang_channel_write(&ch, payload, 0), msg+i);
+    expect(0, rexlang_channel_write(&ch, payload, 1), msg+i);
+
+    i = sprintf(msg, "first");
+    expect(1, rexlang_channel_peek(&ch, &m, &len), msg+i);
+    expect(10, len, msg+i);
+    expect(0, memcmp(m, payload, 10), msg+i);
+    rexlang_channel_consume(&ch);
+
+    // the space of the first frame is reused:
+    i = sprintf(msg, "wrap");
+    expect(1, rexlang_channel_write(&ch, payload + 2, 9), msg+i);
+    expect(1, rexlang_channel_peek(&ch, &m, &len), msg+i);
+    expect(7, len, msg+i);
+    rexlang_channel_consume(&ch);
+    expect(1, rexlang_channel_peek(&ch, &m, &len), msg+i);
+    expect(0, len, msg+i);
+    rexlang_channel_consume(&ch);
+    expect(1, rexlang_channel_peek(&ch, &m, &len), msg+i);
+    expect(9, len, msg+i);
+    expect(0, memcmp(m, payload + 2, 9), msg+i);
+    expect(1, m == buf + 4, msg+i);
+    rexlang_channel_consume(&ch);
+    expect(0, rexlang_channel_peek(&ch, &m, &len), msg+i);
+
+    // the longest message does not fit before the end of the buffer; it fits at offset 0
+    // once the consumer has skipped the padding:
+    i = sprintf(msg, "longest");
+    expect(0, rexlang_channel_write(&ch, payload, 28), msg+i);
+    expect(0, rexlang_channel_peek(&ch, &m, &len), msg+i);
+    expect(1, rexlang_channel_write(&ch, payload, 28), msg+i);
+    expect(1, rexlang_channel_peek(&ch, &m, &len), msg+i);
+    expect(28, len, msg+i);
+    expect(0, memcmp(m, payload, 28), msg+i);
+
+    // frames overwritten by someone other than the producer must still fit what was written:
+    i = sprintf(msg, "forged length");
+    rexlang_channel_init(&ch, buf, sizeof(buf));
+    expect(1, rexlang_channel_write(&ch, payload, 7), msg+i);
+    buf[0] = 12;
+    expect(0, rexlang_channel_peek(&ch, &m, &len), msg+i);
+    expect(1, ch.bad, msg+i);
+    buf[0] = 7;
+    expect(0, rexlang_channel_peek(&ch, &m, &len), msg+i);
+
+    i = sprintf(msg, "forged padding");
+    rexlang_channel_init(&ch, buf, sizeof(buf));
+    expect(1, rexlang_channel_write(&ch, payload, 7), msg+i);
+    memset(buf, 0xFF, 4);
+    expect(0, rexlang_channel_peek(&ch, &m, &len), msg+i);
+    expect(1, ch.bad, msg+i);
+    expect(0, ch.tail, msg+i);
+
+    i = sprintf(msg, "forged after peek");
+    rexlang_channel_init(&ch, buf, sizeof(buf));
+    expect(1, rexlang_channel_write(&ch, payload, 7), msg+i);
+    expect(1, rexlang_channel_peek(&ch, &m, &len), msg+i);
+    buf[0] = 28;
+    rexlang_channel_consume(&ch);
+    expect(1, ch.bad, msg+i);
+    expect(0, ch.tail, msg+i);
+
+    return 0;
+}
+
+int verify_test(const struct verify_test_t *t, char* msg) {
+    enum rexlang_error err;
+    struct rexlang_vm vm;
+    uint16_t scratch[64];
+    uint8_t data[256] = {0};
+    rexlang_ip fail_ip = 0;
+
+    rexlang_vm_init(&vm, 64, t->prgm, 256, data, syscall, STACKS(0));
+    err = rexlang_vm_verify(&vm, syscall_sigs, 2, scratch, 64, &fail_ip);
+    if (err != t->check_error) {
+        sprintf(msg, "verify expected %d, got %d at ip %u", t->check_error, err, fail_ip);
+        return 1;
+    }
+    if (err != REXLANG_ERR_SUCCESS && fail_ip != t->check_ip) {
+        sprintf(msg, "verify failure ip expected %u, got %u", t->check_ip, fail_ip);
+        return 1;
+    }
+
+    return 0;
+}
+
+int stacks_test(char* msg) {
+    struct rexlang_vm vm;
+    uint16_t scratch[64];
+    uint8_t data[256] = {0};
+    uint8_t deep[64] = {0};
+    uint8_t wide[64] = {0};
+    uint32_t ki[8];
+    rexlang_ip cs[32];
+    int i, n;
+
+    // 20 nested calls, then halt:
+    for (n = 0; n < 20; n++) {
+        deep[2*n+0] = 0b01101000;           // call-imm8  next
+        deep[2*n+1] = 2*(n+1);
+    }
+    // 8 pushes, then halt:
+    for (n = 0; n < 8; n++) {
+        wide[2*n+0] = 0b01000000;           // push-u8    n
+        wide[2*n+1] = n;
+    }
+
+    rexlang_vm_init(&vm, 64, deep, 256, data, syscall, ki, 8, cs, 16);
+    i = sprintf(msg, "call stack of 16");
+    expect(REXLANG_ERR_CALL_STACK_FULL, rexlang_vm_verify(&vm, syscall_sigs, 2, scratch, 64, NULL), msg+i);
+    rexlang_vm_exec(&vm, 1024);
+    expect(REXLANG_ERR_CALL_STACK_FULL, vm.err, msg+i);
+    expect(0, vm.cp, msg+i);
+
+    rexlang_vm_init(&vm, 64, deep, 256, data, syscall, ki, 8, cs, 32);
+    i = sprintf(msg, "call stack of 32");
+    expect(REXLANG_ERR_SUCCESS, rexlang_vm_verify(&vm, syscall_sigs, 2, scratch, 64, NULL), msg+i);
+    rexlang_vm_exec(&vm, 1024);
+    expect(REXLANG_ERR_HALTED, vm.err, msg+i);
+    expect(12, vm.cp, msg+i);
+    expect(40, cs[12], msg+i);
+
+    rexlang_vm_init(&vm, 64, wide, 256, data, syscall, ki, 4, cs, 32);
+    i = sprintf(msg, "data stack of 4");
+    expect(REXLANG_ERR_DATA_STACK_FULL, rexlang_vm_verify(&vm, syscall_sigs, 2, scratch, 64, NULL), msg+i);
+    rexlang_vm_exec(&vm, 1024);
+    expect(REXLANG_ERR_DATA_STACK_FULL, vm.err, msg+i);
+
+    rexlang_vm_init(&vm, 64, wide, 256, data, syscall, ki, 8, cs, 32);
+    i = sprintf(msg, "data stack of 8");
+    expect(REXLANG_ERR_SUCCESS, rexlang_vm_verify(&vm, syscall_sigs, 2, scratch, 64, NULL), msg+i);
+    rexlang_vm_exec(&vm, 1024);
+    expect(REXLANG_ERR_HALTED, vm.err, msg+i);
+    expect(0, vm.sp, msg+i);
+    expect(7, ki[0], msg+i);
+
+#ifdef REXLANG_TOS_CACHE
+    // the cached top slot is found by masking sp, so other sizes are refused:
+    rexlang_vm_init(&vm, 64, wide, 256, data, syscall, ki, 6, cs, 32);
+    i = sprintf(msg, "data stack of 6");
+    expect(REXLANG_ERR_DATA_STACK_FULL, vm.err, msg+i);
+    rexlang_vm_error_ack(&vm);
+    expect(REXLANG_ERR_DATA_STACK_FULL, rexlang_vm_exec(&vm, 1024), msg+i);
+    expect(0, vm.ip, msg+i);
+    expect(6, vm.sp, msg+i);
+#endif
+
+    return 0;
+}
+
+int pool_test(char* msg) {
+    static void *arena[1024];
+    struct rexlang_vm_pool pool;
+    struct rexlang_vm *vm[4];
+    uint8_t data[4][256] = {{0}};
+    uint8_t prgm[64] = {
+        0b01000000, 7,                      // push-u8    7
+        0b01101000, 5,                      // call-imm8  5
+        0,                                  // halt
+        0x38,                               // return
+    };
+    uint32_t capacity, n;
+    size_t slot;
+    int i;
+
+    // room for four and a half VMs:
+    i = sprintf(msg, "capacity");
+    slot = rexlang_vm_pool_slot_size(16, 8);
+    expect(1, 5 * slot <= sizeof(arena), msg+i);
+    capacity = rexlang_vm_pool_init(&pool, arena, 4 * slot + slot / 2, 16, 8);
+    expect(4, capacity, msg+i);
+
+    i = sprintf(msg, "alloc");
+    for (n = 0; n < capacity; n++) {
+        vm[n] = rexlang_vm_pool_alloc(&pool, 64, prgm, 256, data[n], syscall);
+        expect(1, vm[n] != NULL, msg+i);
+        expect(16, vm[n]->ki_size, msg+i);
+        expect(8, vm[n]->cs_size, msg+i);
+        expect(1, (uint8_t *)vm[n]->cs >= (uint8_t *)arena && (uint8_t *)(vm[n]->cs + 8) <= (uint8_t *)arena + 4 * slot, msg+i);
+    }
+    expect(capacity, pool.used, msg+i);
+    expect(1, rexlang_vm_pool_alloc(&pool, 64, prgm, 256, data[0], syscall) == NULL, msg+i);
+
+    // VMs do not share stacks:
+    i = sprintf(msg, "exec");
+    for (n = 0; n < capacity; n++) {
+        rexlang_vm_exec(vm[n], 1024);
+        expect(REXLANG_ERR_HALTED, vm[n]->err, msg+i);
+        expect(7, vm[n]->ki[15], msg+i);
+    }
+    vm[0]->ki[15] = 1;
+    expect(7, vm[1]->ki[15], msg+i);
+
+    i = sprintf(msg, "recycle");
+    rexlang_vm_pool_free(&pool, vm[1]);
+    expect(capacity - 1, pool.used, msg+i);
+    expect((uintptr_t)vm[1], (uintptr_t)rexlang_vm_pool_alloc(&pool, 64, prgm, 256, data[1], syscall), msg+i);
+    expect(REXLANG_ERR_SUCCESS, vm[1]->err, msg+i);
+    expect(16, vm[1]->sp, msg+i);
+
+    return 0;
+}
+
+int snapshot_test(char* msg) {
+    struct rexlang_vm vm, other;
+    static uint8_t data[1000];              // four pages, the last one short
+    static uint8_t full[2048], delta[2][2048];
+    static uint16_t scratch[64];
+    uint32_t dirty[REXLANG_DIRTY_WORDS(1000, 8)];
+    uint8_t prgm[64] = {
+        0b01000000, 7,                      // push-u8    7
+        0b01101000, 4,                      // call-imm8  4
+        0b10010100, 0x00, 0x02,             // ld-u32-imm16 0x0200
+        0b01000000, 1,                      // push-u8    1
+        0b00001111,                         // add
+        0b10100100, 0x00, 0x02,             // st-u32-discard-imm16 0x0200
+        0b01101001, 4,                      // jump-abs-imm8 4
+    };
+    const size_t header = 13 * sizeof(uint32_t);
+    const size_t live = sizeof(uint32_t) + sizeof(rexlang_ip);
+    size_t n[2];
+    int i;
+
+    memset(data, 0xAA, sizeof(data));
+    memset(data + 0x200, 0, 4);
+    rexlang_vm_init(&vm, 64, prgm, sizeof(data), data, syscall, STACKS(0));
+    rexlang_vm_track_writes(&vm, dirty, 8);
+
+    i = sprintf(msg, "full");
+    rexlang_vm_exec(&vm, 2 + 3*5);
+    expect(3, *(uint32_t*)&data[0x200], msg+i);
+    n[0] = rexlang_vm_save(&vm, full, sizeof(full), false);
+    expect(header + live + 2*sizeof(uint32_t) + sizeof(data), n[0], msg+i);
+    expect(1, n[0] <= rexlang_vm_save_size(&vm), msg+i);
+    expect(0, rexlang_vm_save(&vm, full, n[0] - 1, false), msg+i);
+
+    // only the page holding the counter was written since:
+    i = sprintf(msg, "incremental");
+    expect(header + live, rexlang_vm_save(&vm, delta[0], sizeof(delta[0]), true), msg+i);
+    rexlang_vm_exec(&vm, 2*5);
+    n[0] = rexlang_vm_save(&vm, delta[0], sizeof(delta[0]), true);
+    expect(header + live + 2*sizeof(uint32_t) + 256, n[0], msg+i);
+
+    // host writes are tracked when marked; adjacent pages form one run:
+    i = sprintf(msg, "marked");
+    rexlang_vm_exec(&vm, 4*5);
+    data[999] = 1;
+    rexlang_vm_mark_written(&vm, 999, 1);
+    n[1] = rexlang_vm_save(&vm, delta[1], sizeof(delta[1]), true);
+    expect(header + live + 2*sizeof(uint32_t) + sizeof(data) - 0x200, n[1], msg+i);
+
+    // roll back to the state after the first incremental snapshot:
+    i = sprintf(msg, "rollback");
+    memset(data, 0, sizeof(data));
+    rexlang_vm_reset(&vm);
+    expect(1, rexlang_vm_load(&vm, full, sizeof(full)), msg+i);
+    expect(3, *(uint32_t*)&data[0x200], msg+i);
+    expect(0xAAAAAAAA, *(uint32_t*)&data[0], msg+i);
+    expect(1, rexlang_vm_load(&vm, delta[0], n[0]), msg+i);
+    expect(5, *(uint32_t*)&data[0x200], msg+i);
+    expect(4, vm.ip, msg+i);
+    expect(REXLANG_DATA_STACKSZ - 1, vm.sp, msg+i);
+    expect(7, vm.ki[REXLANG_DATA_STACKSZ - 1], msg+i);
+    expect(REXLANG_CALL_STACKSZ - 1, vm.cp, msg+i);
+    expect(4, vm.cs[REXLANG_CALL_STACKSZ - 1], msg+i);
+    rexlang_vm_exec(&vm, 4*5);
+    expect(9, *(uint32_t*)&data[0x200], msg+i);
+
+    // snapshots that are cut short or taken of another shape are refused:
+    i = sprintf(msg, "malformed");
+    vm.ip = 1;
+    expect(0, rexlang_vm_load(&vm, delta[0], n[0] - 1), msg+i);
+    expect(0, rexlang_vm_load(&vm, delta[0], header - 1), msg+i);
+    expect(1, vm.ip, msg+i);
+    rexlang_vm_init(&other, 64, prgm, sizeof(data) - 1, data, syscall, STACKS(1));
+    expect(0, rexlang_vm_load(&other, full, sizeof(full)), msg+i);
+    memcpy(delta[1], delta[0], n[0]);
+    ((uint32_t*)delta[1])[2] = 0x100000;    // IP
+    expect(0, rexlang_vm_load(&vm, delta[1], n[0]), msg+i);
+    expect(1, vm.ip, msg+i);
+
+    // a verified VM restored from a snapshot runs checked:
+    i = sprintf(msg, "verified");
+    rexlang_vm_reset(&vm);
+    expect(REXLANG_ERR_SUCCESS, rexlang_vm_verify(&vm, syscall_sigs, 2, scratch, 64, NULL), msg+i);
+    expect(1, vm.unchecked, msg+i);
+    expect(1, rexlang_vm_load(&vm, delta[0], n[0]), msg+i);
+    expect(0, vm.unchecked, msg+i);
+    expect(1, vm.verified, msg+i);
+
+    // without tracking an incremental snapshot is a full one:
+    i = sprintf(msg, "untracked");
+    rexlang_vm_track_writes(&vm, NULL, 0);
+    expect(header + live + 2*sizeof(uint32_t) + sizeof(data), rexlang_vm_save(&vm, delta[1], sizeof(delta[1]), true), msg+i);
+
+    return 0;
+}
+
+int dirty_test(char* msg) {
+    struct rexlang_vm vm;
+    uint8_t data[1000] = {0};               // 64-byte blocks, the last one short
+    uint32_t dirty[REXLANG_DIRTY_WORDS(1000, 6)];
+    uint8_t prgm[64] = {
+        0b01000000, 0x55,                   // push-u8    0x55
+        0b10100010, 0x41, 0x00,             // st-u8-discard-imm16  0x0041
+        0b01000000, 0x01,                   // push-u8    1
+        0b10100100, 0x7E, 0x00,             // st-u32-discard-imm16 0x007E
+        0b10000000, 0x00, 0x02,             // push-u16   0x0200
+        0b01000000, 0x00,                   // push-u8    0
+        0b01000000, 0x80,                   // push-u8    0x80
+        0b00111110,                         // dcopy
+        0b00111011,                         // discard
+        0b10000000, 0xD0, 0x03,             // push-u16   0x03D0
+        0b01000000, 0x00,                   // push-u8    0
+        0b01000000, 0x10,                   // push-u8    0x10
+        0b00111111,                         // pcopy
+        0b00111011,                         // discard
+        0b00000000,                         // halt
+    };
+    uint32_t p, len;
+    int i;
+
+    rexlang_vm_init(&vm, 64, prgm, sizeof(data), data, syscall, STACKS(0));
+    rexlang_vm_track_writes(&vm, dirty, 6);
+
+    i = sprintf(msg, "initial");
+    p = 0;
+    expect(1, rexlang_vm_dirty_next(&vm, &p, &len), msg+i);
+    expect(0, p, msg+i);
+    expect(sizeof(data), len, msg+i);
+    rexlang_vm_dirty_clear(&vm, 0, sizeof(data));
+    p = 0;
+    expect(0, rexlang_vm_dirty_next(&vm, &p, &len), msg+i);
+
+    // stores, dcopy and pcopy mark the blocks they write:
+    i = sprintf(msg, "exec");
+    rexlang_vm_exec(&vm, 1024);
+    expect(REXLANG_ERR_HALTED, vm.err, msg+i);
+    p = 0;
+    expect(1, rexlang_vm_dirty_next(&vm, &p, &len), msg+i);
+    expect(0x40, p, msg+i);
+    expect(0x80, len, msg+i);
+    p += len;
+    expect(1, rexlang_vm_dirty_next(&vm, &p, &len), msg+i);
+    expect(0x200, p, msg+i);
+    expect(0x80, len, msg+i);
+    p += len;
+    expect(1, rexlang_vm_dirty_next(&vm, &p, &len), msg+i);
+    expect(0x3C0, p, msg+i);
+    expect(sizeof(data) - 0x3C0, len, msg+i);
+    p += len;
+    expect(0, rexlang_vm_dirty_next(&vm, &p, &len), msg+i);
+
+    // clearing a byte clears its whole block:
+    i = sprintf(msg, "clear");
+    rexlang_vm_dirty_clear(&vm, 0x41, 1);
+    p = 0;
+    expect(1, rexlang_vm_dirty_next(&vm, &p, &len), msg+i);
+    expect(0x80, p, msg+i);
+    expect(0x40, len, msg+i);
+    p = 0x210;
+    expect(1, rexlang_vm_dirty_next(&vm, &p, &len), msg+i);
+    expect(0x200, p, msg+i);
+    rexlang_vm_dirty_clear(&vm, 0, sizeof(data));
+    p = 0;
+    expect(0, rexlang_vm_dirty_next(&vm, &p, &len), msg+i);
+
+    return 0;
+}
+
+int asm_test(char* msg) {
+    static const char sum[] =
+        "; d[4] = 1 + 2 + ... + N\n"
+        ".equ N, 10\n"
+        "        push N\n"
+        "loop:   dup\n"
+        "        ld-u32 4\n"
+        "        add\n"
+        "        st-u32-discard 4\n"
+        "        sub 1\n"
+        "        dup\n"
+        "        jump-rel-if loop    ; back while nonzero\n"
+        "        halt\n";
+    static const uint8_t sum_bin[] = {
+        0b01000000, 10,                     // push-u8    10
+        0b00111101,                         // dup
+        0b01010100, 4,                      // ld-u32-imm8 4
+        0b00001111,                         // add
+        0b01100100, 4,                      // st-u32-discard-imm8 4
+        0b01010000, 1,                      // sub-imm8   1
+        0b00111101,                         // dup
+        0b01101101, (uint8_t)-11,           // jump-rel-if-imm8 -11
+        0b00000000,                         // halt
+    };
+    static const char widths[] =
+        "push 300\n"
+        "push -1\n"
+        "push -200\n"
+        "push 0x12345678\n"
+        "push-u32 1\n"
+        "add-imm16 1\n"
+        "le-si -2\n"
+        "add -1\n"
+        "discard 3\n"
+        "discard\n";
+    static const uint8_t widths_bin[] = {
+        0b10000000, 0x2C, 0x01,             // push-u16   300
+        0b01000001, 0xFF,                   // push-s8    -1
+        0b10000001, 0x38, 0xFF,             // push-s16   -200
+        0b11000000, 0x78, 0x56, 0x34, 0x12, // push-u32   0x12345678
+        0b11000000, 0x01, 0x00, 0x00, 0x00, // push-u32   1
+        0b10001111, 0x01, 0x00,             // add-imm16  1
+        0b01000101, 0xFE,                   // le-si-imm8 -2
+        0b11001111, 0xFF, 0xFF, 0xFF, 0xFF, // add-imm32  -1
+        0b01110011, 3,                      // discard-imm8 3
+        0b00111011,                         // discard
+    };
+    static const struct {
+        const char *src;
+        unsigned int line;
+    } errors[] = {
+        {"push 1\nfoo 2\n", 2},
+        {"halt\njump-abs nowhere\n", 2},
+        {"shl 300\n", 1},
+        {"push-u8 -1\n", 1},
+        {"x: halt\nx: halt\n", 2},
+        {"halt 1\n", 1},
+        {"push\n", 1},
+        {"push 0x1_0000_0000\n", 1},
+    };
+    static char relax[2048];
+    static uint8_t out[1024];
+    struct rexlang_asm_result res;
+    struct rexlang_vm vm;
+    uint8_t data[8] = {0};
+    int i, n, k;
+
+    i = sprintf(msg, "sum");
+    expect(1, rexlang_asm(sum, strlen(sum), out, sizeof(out), &res), msg+i);
+    expect(sizeof(sum_bin), res.size, msg+i);
+    expect(0, memcmp(out, sum_bin, sizeof(sum_bin)), msg+i);
+    rexlang_vm_init(&vm, res.size, out, sizeof(data), data, syscall, STACKS(0));
+    rexlang_vm_exec(&vm, 1024);
+    expect(REXLANG_ERR_HALTED, vm.err, msg+i);
+    expect(55, *(uint32_t*)&data[4], msg+i);
+
+    i = sprintf(msg, "widths");
+    expect(1, rexlang_asm(widths, strlen(widths), out, sizeof(out), &res), msg+i);
+    expect(sizeof(widths_bin), res.size, msg+i);
+    expect(0, memcmp(out, widths_bin, sizeof(widths_bin)), msg+i);
+
+    // the jump-abs outgrows imm8 and pushes `a` out of reach of jump-rel-imm8:
+    i = sprintf(msg, "relax");
+    n = sprintf(relax, "jump-rel a\njump-abs b\n");
+    for (k = 0; k < 125; k++) {
+        n += sprintf(relax + n, ".byte %d\n", k);
+    }
+    n += sprintf(relax + n, "a: jump-rel-if-not c\nc: .u32 0\n");
+    for (k = 0; k < 40; k++) {
+        n += sprintf(relax + n, ".u32 %d\n", k);
+    }
+    n += sprintf(relax + n, "b: halt\n");
+    expect(1, rexlang_asm(relax, n, out, sizeof(out), &res), msg+i);
+    expect(0b10101100, out[0], msg+i);         // jump-rel-imm16
+    expect(128, out[1] | out[2] << 8, msg+i);
+    expect(0b10101001, out[3], msg+i);         // jump-abs-imm16
+    expect(res.size - 1, out[4] | out[5] << 8, msg+i);
+    expect(0b01101110, out[131], msg+i);       // jump-rel-if-not-imm8
+    expect(0, out[132], msg+i);
+    expect(133 + 4 + 160 + 1, res.size, msg+i);
+
+    i = sprintf(msg, "errors");
+    for (k = 0; k < (int)(sizeof(errors) / sizeof(errors[0])); k++) {
+        expect(0, rexlang_asm(errors[k].src, strlen(errors[k].src), out, sizeof(out), &res), msg+i);
+        expect(errors[k].line, res.line, msg+i);
+    }
+    expect(0, rexlang_asm(widths, strlen(widths), out, 2, &res), msg+i);
+    expect(sizeof(widths_bin), res.size, msg+i);
+
+    return 0;
+}
+
+int opt_test(char* msg) {
+    static const char src[] =
+        "        push 4          ; d[0] = 4 * (2 + 3)\n"
+        "        push 2\n"
+        "        push 3\n"
+        "        add\n"
+        "        mul\n"
+        "        push 0\n"
+        "        st-u32\n"
+        "        discard\n"
+        "        push 5          ; d[4] = 5 + 4 + ... + 1\n"
+        "loop:   dup\n"
+        "        push 4\n"
+        "        ld-u32\n"
+        "        add\n"
+        "        push 4\n"
+        "        st-u32-discard\n"
+        "        push 1\n"
+        "        sub\n"
+        "        dup\n"
+        "        jump-abs-if next\n"
+        "        jump-abs done\n"
+        "next:   jump-abs again\n"
+        "again:  jump-abs loop\n"
+        "done:   discard\n"
+        "        push fn\n"
+        "        call\n"
+        "        push 0\n"
+        "        jump-abs-if never\n"
+        "        nop\n"
+        "        halt\n"
+        "never:  push 99\n"
+        "        st-u32-discard 0\n"
+        "        halt\n"
+        "fn:     push 1          ; d[8] = 1\n"
+        "        st-u8-discard 8\n"
+        "        return\n"
+        "        push 77\n"
+        "        halt\n";
+    static const uint8_t opt_bin[] = {
+        0b01000000, 20,                     // push-u8    20
+        0b01100100, 0,                      // st-u32-discard-imm8 0
+        0b01000000, 5,                      // push-u8    5
+        0b00111101,                         // dup
+        0b01010100, 4,                      // ld-u32-imm8 4
+        0b00001111,                         // add
+        0b01100100, 4,                      // st-u32-discard-imm8 4
+        0b01010000, 1,                      // sub-imm8   1
+        0b00111101,                         // dup
+        0b01101010, 6,                      // jump-abs-if-imm8 6
+        0b00111011,                         // discard
+        0b01101000, 22,                     // call-imm8  22
+        0b00000001,                         // nop
+        0b00000000,                         // halt
+        0b01000000, 1,                      // push-u8    1
+        0b01100010, 8,                      // st-u8-discard-imm8 8
+        0b00111000,                         // return
+    };
+    static const struct {
+        const char *src;
+        uint32_t ip;
+    } errors[] = {
+        {"ld-u32 0\njump-abs\n", 2},
+        {"push 1\nx: jump-rel\njump-abs-imm8 x\n", 2},
+        {"jump-abs 1\npush-u16 0\n", 0},
+        {"push 0\npush 0\npush 0\npcopy\n", 6},
+    };
+    // signed pushes of positive operands shrink to unsigned ones:
+    static const uint8_t wide_push[] = {
+        0b10000001, 200, 0,                 // push-s16   200
+        0b10000001, 0x38, 0xFF,             // push-s16   -200
+        0b11000001, 0xFF, 0, 0, 0,          // push-s32   255
+        0b11000001, 0x40, 0x9C, 0, 0,       // push-s32   40000
+        0b11000001, 0xFF, 0xFF, 0, 0,       // push-s32   65535
+        0b00000000,                         // halt
+    };
+    static const uint8_t wide_push_bin[] = {
+        0b01000000, 200,                    // push-u8    200
+        0b10000001, 0x38, 0xFF,             // push-s16   -200
+        0b01000000, 255,                    // push-u8    255
+        0b10000000, 0x40, 0x9C,             // push-u16   40000
+        0b10000000, 0xFF, 0xFF,             // push-u16   65535
+        0b00000000,                         // halt
+    };
+    static uint8_t prgm[256], out[256];
+    static uint16_t scratch[256];
+    struct rexlang_asm_result res;
+    struct rexlang_opt_result opt;
+    struct rexlang_vm vm;
+    uint8_t data[2][12] = {{0}};
+    int i, k;
+
+    i = sprintf(msg, "fold");
+    expect(1, rexlang_asm(src, strlen(src), prgm, sizeof(prgm), &res), msg+i);
+    expect(1, rexlang_asm_optimize(prgm, res.size, out, sizeof(out), &opt), msg+i);
+    expect(37, opt.insns_before, msg+i);
+    expect(res.size, opt.bytes_before, msg+i);
+    expect(17, opt.insns_after, msg+i);
+    expect(sizeof(opt_bin), opt.bytes_after, msg+i);
+    expect(0, memcmp(out, opt_bin, sizeof(opt_bin)), msg+i);
+
+    i = sprintf(msg, "run");
+    rexlang_vm_init(&vm, res.size, prgm, sizeof(data[0]), data[0], syscall, STACKS(0));
+    rexlang_vm_exec(&vm, 1024);
+    expect(REXLANG_ERR_HALTED, vm.err, msg+i);
+    rexlang_vm_init(&vm, opt.bytes_after, out, sizeof(data[1]), data[1], syscall, STACKS(0));
+    expect(REXLANG_ERR_SUCCESS, rexlang_vm_verify(&vm, NULL, 0, scratch, 256, NULL), msg+i);
+    rexlang_vm_exec(&vm, 1024);
+    expect(REXLANG_ERR_HALTED, vm.err, msg+i);
+    expect(20, *(uint32_t*)&data[1][0], msg+i);
+    expect(15, *(uint32_t*)&data[1][4], msg+i);
+    expect(1, data[1][8], msg+i);
+    expect(0, memcmp(data[0], data[1], sizeof(data[0])), msg+i);
+
+    // in place, and again without change:
+    i = sprintf(msg, "idempotent");
+    expect(1, rexlang_asm_optimize(out, opt.bytes_after, out, sizeof(out), &opt), msg+i);
+    expect(opt.insns_before, opt.insns_after, msg+i);
+    expect(sizeof(opt_bin), opt.bytes_after, msg+i);
+    expect(0, memcmp(out, opt_bin, sizeof(opt_bin)), msg+i);
+
+    i = sprintf(msg, "signed push");
+    expect(1, rexlang_asm_optimize(wide_push, sizeof(wide_push), out, sizeof(out), &opt), msg+i);
+    expect(sizeof(wide_push_bin), opt.bytes_after, msg+i);
+    expect(0, memcmp(out, wide_push_bin, sizeof(wide_push_bin)), msg+i);
+
+    i = sprintf(msg, "errors");
+    for (k = 0; k < (int)(sizeof(errors) / sizeof(errors[0])); k++) {
+        expect(1, rexlang_asm(errors[k].src, strlen(errors[k].src), prgm, sizeof(prgm), &res), msg+i);
+        expect(0, rexlang_asm_optimize(prgm, res.size, out, sizeof(out), &opt), msg+i);
+        expect(errors[k].ip, opt.ip, msg+i);
+    }
+    expect(1, rexlang_asm(src, strlen(src), prgm, sizeof(prgm), &res), msg+i);
+    expect(0, rexlang_asm_optimize(prgm, res.size, out, 4, &opt), msg+i);
+    expect(sizeof(opt_bin), opt.bytes_after, msg+i);
+
+    return 0;
+}
+
+int image_test(char* msg) {
+    static const char src[] =
+        ".export main, cb\n"
+        "main:   push 0          ; d[0] = table\n"
+        "        push table\n"
+        "        push 4\n"
+        "        pcopy\n"
+        "        discard\n"
+        "        call cb\n"
+        "        halt\n"
+        "cb:     push 7          ; d[8] = 7\n"
+        "        st-u8-discard 8\n"
+        "        return\n"
+        ".rodata\n"
+        "table:  .u32 0x11223344\n";
+    static const struct {
+        const char *src;
+        unsigned int line;
+    } errors[] = {
+        {"x: halt\n.byte x\n", 2},
+        {"shl x\nx: halt\n", 1},
+        {".equ x, 1\n.export x\n", 1},
+        {".export x\nhalt\n.rodata\nx: .byte 1\n", 4},
+        {".rodata\n.rodata\n", 2},
+    };
+    static uint8_t buf[256], bad[256], m[64];
+    struct rexlang_asm_result res;
+    struct rexlang_image img;
+    struct rexlang_vm vm;
+    uint8_t data[12];
+    uint32_t main_ip, cb_ip, relocs;
+    int i, k;
+
+    i = sprintf(msg, "open");
+    expect(1, rexlang_asm_image(src, strlen(src), buf, sizeof(buf), &res), msg+i);
+    expect(1, rexlang_image_open(&img, buf, res.size), msg+i);
+    expect(17 + 5, img.code_size, msg+i);
+    expect(img.code_size + 4, img.m_size, msg+i);
+    expect(2, img.reloc_count, msg+i);
+    expect(2, img.symbol_count, msg+i);
+    expect(1, rexlang_image_symbol(&img, "main", &main_ip), msg+i);
+    expect(1, rexlang_image_symbol(&img, "cb", &cb_ip), msg+i);
+    expect(0, rexlang_image_symbol(&img, "table", NULL), msg+i);
+    expect(0, main_ip, msg+i);
+    expect(17, cb_ip, msg+i);
+    expect(0, memcmp(img.m, buf + sizeof(struct rexlang_image_header), img.m_size), msg+i);
+    relocs = img.relocs - buf;
+
+    // in place:
+    i = sprintf(msg, "run");
+    memset(data, 0, sizeof(data));
+    rexlang_vm_init(&vm, img.m_size, img.m, sizeof(data), data, syscall, STACKS(0));
+    rexlang_vm_exec(&vm, 100);
+    expect(REXLANG_ERR_HALTED, vm.err, msg+i);
+    expect(0x11223344, *(uint32_t*)&data[0], msg+i);
+    expect(7, data[8], msg+i);
+
+    // behind another program:
+    i = sprintf(msg, "relocate");
+    memset(data, 0, sizeof(data));
+    memset(m, 0, sizeof(m));
+    expect(1, rexlang_image_relocate(&img, m, sizeof(m), 16), msg+i);
+    expect(0, rexlang_image_relocate(&img, m, sizeof(m), sizeof(m) - img.m_size + 1), msg+i);
+    rexlang_vm_init(&vm, sizeof(m), m, sizeof(data), data, syscall, STACKS(0));
+    vm.ip = 16 + main_ip;
+    rexlang_vm_exec(&vm, 100);
+    expect(REXLANG_ERR_HALTED, vm.err, msg+i);
+    expect(0x11223344, *(uint32_t*)&data[0], msg+i);
+    expect(7, data[8], msg+i);
+
+    i = sprintf(msg, "malformed");
+    expect(0, rexlang_image_open(&img, buf, res.size - 1), msg+i);
+    memcpy(bad, buf, res.size);
+    bad[0] ^= 1;
+    expect(0, rexlang_image_open(&img, bad, res.size), msg+i);
+    memcpy(bad, buf, res.size);
+    bad[relocs] = img.m_size - 3;
+    expect(0, rexlang_image_open(&img, bad, res.size), msg+i);
+    memcpy(bad, buf, res.size);
+    bad[res.size - 1] = 'x';
+    expect(0, rexlang_image_open(&img, bad, res.size), msg+i);
+
+    i = sprintf(msg, "errors");
+    for (k = 0; k < (int)(sizeof(errors) / sizeof(errors[0])); k++) {
+        expect(0, rexlang_asm_image(errors[k].src, strlen(errors[k].src), buf, sizeof(buf), &res), msg+i);
+        expect(errors[k].line, res.line, msg+i);
+    }
+
+    return 0;
+}
+
+int patch_test(char* msg) {
+    static const char src[] =
+        "loop:   push 1          ; d[8] = 1\n"
+        "        st-u8-discard 8\n"
+        "        call fn\n"
+        "        jump-abs loop\n"
+        "fn:     push 5          ; d[0] = 5\n"
+        "        st-u8-discard 0\n"
+        "        return\n";
+    static const uint8_t st_9[] = {0b01100010, 9};     // st-u8-discard-imm8 9
+    static const uint8_t push_7 = 7;
+    static const uint8_t fused_src[] = {
+        0b00000001,                         // nop
+        0b01000000, 3,                      // push-u8    3
+        0b01101111, 1,                      // syscall-imm8 1
+        0b00000000,                         // halt
+    };
+    static const uint8_t nops[] = {0b00000001, 0b00000001};
+    static const uint8_t table_src[] = {
+        0b01000000, 0,                      // push-u8    0
+        0b01000000, 8,                      // push-u8    8
+        0b01000000, 4,                      // push-u8    4
+        0b00111111,                         // pcopy
+        0b00000000,                         // halt
+        0x40, 0x01, 0x6F, 0x02,             // table, which reads as push-u8, syscall-imm8
+    };
+    static const uint8_t byte_55 = 0x55;
+    static uint8_t old[16], m[16], stream[64], staging[4];
+    static struct rexlang_insn x[16];
+    struct rexlang_asm_result res;
+    struct rexlang_patch_stream ps;
+    struct rexlang_vm vm, other;
+    struct rexlang_vm *vms[2] = {&vm, &other};
+    uint32_t generation = 0;
+    uint16_t scratch[16];
+#ifdef REXLANG_JIT
+    struct rexlang_jit jit;
+#endif
+    uint8_t data[12];
+    size_t n, used;
+    int i, mode, busy = 0;
+
+    i = sprintf(msg, "asm");
+    expect(1, rexlang_asm(src, strlen(src), old, sizeof(old), &res), msg+i);
+    expect(13, res.size, msg+i);
+
+    for (mode = 0; mode < 2; mode++) {
+        i = sprintf(msg, "%s ", mode ? "predecoded" : "plain");
+        memcpy(m, old, sizeof(m));
+        memset(data, 0, sizeof(data));
+        rexlang_vm_init(&vm, res.size, m, sizeof(data), data, syscall, STACKS(0));
+        if (mode) {
+            rexlang_vm_predecode(&vm, x, res.size);
+        }
+
+        // stopped at the start of fn, returning to the jump-abs at 6:
+        rexlang_vm_exec(&vm, 3);
+        expect(8, vm.ip, msg+i);
+        expect(REXLANG_PATCH_BUSY, rexlang_vm_patch_check(&vm, 9, 1), msg+i);
+        expect(REXLANG_PATCH_BUSY, rexlang_vm_patch(vms, 1, m, &generation, 7, &push_7, 1), msg+i);
+        expect(REXLANG_PATCH_BAD, rexlang_vm_patch(vms, 1, m, &generation, 12, st_9, 2), msg+i);
+        expect(0b00111000, m[12], msg+i);
+        expect(REXLANG_PATCH_OK, rexlang_vm_patch(vms, 1, m, &generation, 2, st_9, 2), msg+i);
+        expect(9, m[3], msg+i);
+
+        // back at the call, fn may change:
+        rexlang_vm_exec(&vm, 6);
+        expect(4, vm.ip, msg+i);
+        expect(1, data[9], msg+i);
+        expect(REXLANG_PATCH_OK, rexlang_vm_patch(vms, 1, m, &generation, 9, &push_7, 1), msg+i);
+        rexlang_vm_exec(&vm, 3);
+        expect(REXLANG_ERR_SUCCESS, vm.err, msg+i);
+        expect(7, data[0], msg+i);
+    }
+
+    // the fused push-u8, syscall-imm8 loses its syscall:
+    i = sprintf(msg, "fused");
+    expect(1, rexlang_vm_fuse(fused_src, sizeof(fused_src), sizeof(fused_src), m), msg+i);
+    rexlang_vm_init(&vm, sizeof(fused_src), m, sizeof(data), data, syscall, STACKS(0));
+    expect(REXLANG_PATCH_OK, rexlang_vm_patch(vms, 1, m, &generation, 3, nops, 2), msg+i);
+    expect(0b01000000, m[1], msg+i);
+    rexlang_vm_exec(&vm, 10);
+    expect(REXLANG_ERR_HALTED, vm.err, msg+i);
+    expect(3, vm.ki[vm.sp], msg+i);
+
+    // the changes of the first test as a stream, fed three bytes at a time:
+    i = sprintf(msg, "stream");
+    memcpy(m, old, sizeof(m));
+    m[3] = 9;
+    m[9] = 7;
+    expect(8 + 7, rexlang_patch_diff(old, m, res.size, 16, stream, 0), msg+i);
+    n = rexlang_patch_diff(old, m, res.size, 4, stream, sizeof(stream));
+    expect(2 * (8 + 1), n, msg+i);
+
+    memcpy(m, old, sizeof(m));
+    memset(data, 0, sizeof(data));
+    rexlang_vm_init(&vm, res.size, m, sizeof(data), data, syscall, STACKS(0));
+    rexlang_patch_stream_init(&ps, staging, sizeof(staging));
+    rexlang_vm_exec(&vm, 1);
+    for (size_t k = 0; k < n; k += used) {
+        enum rexlang_patch_status st = rexlang_vm_patch_feed(vms, 1, m, &generation, &ps, stream + k, n - k < 3 ? n - k : 3, &used);
+
+        if (st == REXLANG_PATCH_BUSY) {
+            // the st-u8-discard at 2 is about to run:
+            expect(2, vm.ip, msg+i);
+            rexlang_vm_exec(&vm, 1);
+            busy++;
+        } else {
+            expect(REXLANG_PATCH_OK, st, msg+i);
+        }
+    }
+    expect(1, busy, msg+i);
+    expect(9, m[3], msg+i);
+    expect(7, m[9], msg+i);
+    expect(1, data[8], msg+i);
+
+    i = sprintf(msg, "bad");
+    memset(stream, 0, 8);
+    stream[0] = 13;
+    stream[4] = 1;
+    expect(REXLANG_PATCH_BAD, rexlang_vm_patch_feed(vms, 1, m, &generation, &ps, stream, 9, &used), msg+i);
+    expect(REXLANG_PATCH_BAD, rexlang_vm_patch_feed(vms, 1, m, &generation, &ps, stream, 9, &used), msg+i);
+
+    // VMs sharing the program are patched together once neither is busy:
+    i = sprintf(msg, "shared");
+    memcpy(m, old, sizeof(m));
+    memset(data, 0, sizeof(data));
+    rexlang_vm_init(&vm, res.size, m, sizeof(data), data, syscall, STACKS(0));
+    rexlang_vm_init(&other, res.size, m, sizeof(data), data, syscall, STACKS(1));
+    expect(REXLANG_ERR_SUCCESS, rexlang_vm_verify(&vm, syscall_sigs, 2, scratch, 16, NULL), msg+i);
+    expect(REXLANG_ERR_SUCCESS, rexlang_vm_verify(&other, syscall_sigs, 2, scratch, 16, NULL), msg+i);
+#ifdef REXLANG_JIT
+    expect(1, rexlang_vm_jit_compile(&vm, &jit), msg+i);
+#endif
+    rexlang_vm_exec(&other, 3);
+    expect(REXLANG_PATCH_BUSY, rexlang_vm_patch(vms, 2, m, &generation, 9, &push_7, 1), msg+i);
+    expect(5, m[9], msg+i);
+    expect(1, vm.unchecked, msg+i);
+    rexlang_vm_exec(&other, 3);
+    expect(REXLANG_PATCH_OK, rexlang_vm_patch(vms, 2, m, &generation, 9, &push_7, 1), msg+i);
+    expect(0, vm.unchecked, msg+i);
+    expect(0, other.verified, msg+i);
+    expect(generation, vm.generation, msg+i);
+    expect(generation, other.generation, msg+i);
+#ifdef REXLANG_JIT
+    // native code compiled before the patch would still store 5:
+    expect(REXLANG_ERR_SUCCESS, rexlang_vm_verify(&vm, syscall_sigs, 2, scratch, 16, NULL), msg+i);
+    expect(REXLANG_ERR_SUCCESS, rexlang_vm_jit_exec(&vm, &jit, 5), msg+i);
+    expect(7, data[0], msg+i);
+    rexlang_vm_jit_free(&jit);
+#endif
+
+    // read-only data after the code is neither fused nor taken apart as fused:
+    i = sprintf(msg, "rodata");
+    expect(0, rexlang_vm_fuse(table_src, sizeof(table_src), 8, m), msg+i);
+    expect(0, memcmp(m, table_src, sizeof(table_src)), msg+i);
+    memset(data, 0, sizeof(data));
+    rexlang_vm_init(&vm, sizeof(table_src), m, sizeof(data), data, syscall, STACKS(0));
+    vm.code_size = 8;
+    expect(REXLANG_ERR_HALTED, rexlang_vm_exec(&vm, 10), msg+i);
+    expect(0, memcmp(data, table_src + 8, 4), msg+i);
+    m[8] = 0xF0;
+    rexlang_vm_init(&vm, sizeof(table_src), m, sizeof(data), data, syscall, STACKS(0));
+    vm.code_size = 8;
+    expect(REXLANG_PATCH_OK, rexlang_vm_patch(vms, 1, m, &generation, 10, &byte_55, 1), msg+i);
+    expect(0xF0, m[8], msg+i);
+    expect(0x55, m[10], msg+i);
+
+    return 0;
+}
+
+int call_test(char* msg) {
+    static const char src[] =
+        ".export add, swap, sumsq, count, bad, spin, deep\n"
+        "        halt\n"
+        "add:    add             ; (a b -- a+b)\n"
+        "        return\n"
+        "swap:   swap            ; (a b -- b a)\n"
+        "        return\n"
+        "sumsq:  dup             ; (a b -- a*a + b*b)\n"
+        "        mul\n"
+        "        swap\n"
+        "        dup\n"
+        "        mul\n"
+        "        add\n"
+        "        return\n"
+        "count:  ld-u32 0        ; ( -- ++d[0])\n"
+        "        add 1\n"
+        "        dup\n"
+        "        st-u32-discard 0\n"
+        "        return\n"
+        "bad:    discard\n"
+        "        return\n"
+        "spin:   jump-abs spin\n"
+        "deep:   call deep\n";
+    static uint8_t buf[256];
+    static struct rexlang_insn x[64];
+    struct rexlang_asm_result res;
+    struct rexlang_image img;
+    struct rexlang_vm vm;
+    uint8_t data[4];
+    uint32_t add, swap, sumsq, count, bad, spin, deep;
+    uint32_t args[2], r[2];
+    int i, k;
+
+    i = sprintf(msg, "load");
+    expect(1, rexlang_asm_image(src, strlen(src), buf, sizeof(buf), &res), msg+i);
+    expect(1, rexlang_image_open(&img, buf, res.size), msg+i);
+    expect(1, rexlang_image_symbol(&img, "add", &add)
+        && rexlang_image_symbol(&img, "swap", &swap)
+        && rexlang_image_symbol(&img, "sumsq", &sumsq)
+        && rexlang_image_symbol(&img, "count", &count)
+        && rexlang_image_symbol(&img, "bad", &bad)
+        && rexlang_image_symbol(&img, "spin", &spin)
+        && rexlang_image_symbol(&img, "deep", &deep), msg+i);
+    memset(data, 0, sizeof(data));
+    rexlang_vm_init(&vm, img.m_size, img.m, sizeof(data), data, syscall, STACKS(0));
+
+    for (k = 0; k < 2; k++) {
+        i = sprintf(msg, "%s call", k ? "predecoded" : "plain");
+        args[0] = 2;
+        args[1] = 3;
+        expect(REXLANG_ERR_SUCCESS, rexlang_vm_call(&vm, add, args, 2, r, 1, 100), msg+i);
+        expect(5, r[0], msg+i);
+        expect(REXLANG_ERR_SUCCESS, rexlang_vm_call(&vm, swap, args, 2, r, 2, 100), msg+i);
+        expect(3, r[0], msg+i);
+        expect(2, r[1], msg+i);
+        args[0] = 3;
+        args[1] = 4;
+        expect(REXLANG_ERR_SUCCESS, rexlang_vm_call(&vm, sumsq, args, 2, r, 1, 100), msg+i);
+        expect(25, r[0], msg+i);
+        expect(0, vm.ip, msg+i);
+        expect(REXLANG_DATA_STACKSZ, vm.sp, msg+i);
+        expect(REXLANG_CALL_STACKSZ, vm.cp, msg+i);
+
+        // data memory persists between calls:
+        i = sprintf(msg, "%s count", k ? "predecoded" : "plain");
+        expect(REXLANG_ERR_SUCCESS, rexlang_vm_call(&vm, count, NULL, 0, r, 1, 100), msg+i);
+        expect(REXLANG_ERR_SUCCESS, rexlang_vm_call(&vm, count, NULL, 0, r, 1, 100), msg+i);
+        expect(2 + 2*k, r[0], msg+i);
+        expect(2 + 2*k, *(uint32_t*)&data[0], msg+i);
+
+        rexlang_vm_predecode(&vm, x, sizeof(x) / sizeof(x[0]));
+    }
+
+    // failed calls are abandoned and leave the VM as it was:
+    i = sprintf(msg, "failures");
+    expect(REXLANG_ERR_DATA_STACK_EMPTY, rexlang_vm_call(&vm, bad, NULL, 0, NULL, 0, 100), msg+i);
+    expect(REXLANG_ERR_DATA_STACK_EMPTY, rexlang_vm_call(&vm, count, NULL, 0, r, 2, 100), msg+i);
+    expect(REXLANG_ERR_YIELDED, rexlang_vm_call(&vm, spin, NULL, 0, NULL, 0, 100), msg+i);
+    expect(REXLANG_ERR_CALL_STACK_FULL, rexlang_vm_call(&vm, deep, NULL, 0, NULL, 0, 100), msg+i);
+#ifndef REXLANG_NO_BOUNDS_CHECK
+    expect(REXLANG_ERR_PRGM_ADDRESS_OUT_OF_BOUNDS, rexlang_vm_call(&vm, img.m_size, NULL, 0, NULL, 0, 100), msg+i);
+#endif
+    expect(REXLANG_ERR_SUCCESS, vm.err, msg+i);
+    expect(0, vm.ip, msg+i);
+    expect(REXLANG_DATA_STACKSZ, vm.sp, msg+i);
+    expect(REXLANG_CALL_STACKSZ, vm.cp, msg+i);
+
+    // the callee cannot pop the caller's items:
+    i = sprintf(msg, "isolated");
+    vm.ki[--vm.sp] = 7;
+    args[0] = 3;
+    expect(REXLANG_ERR_DATA_STACK_EMPTY, rexlang_vm_call(&vm, bad, NULL, 0, NULL, 0, 100), msg+i);
+    expect(REXLANG_ERR_DATA_STACK_EMPTY, rexlang_vm_call(&vm, add, args, 1, r, 1, 100), msg+i);
+    expect(REXLANG_DATA_STACKSZ - 1, vm.sp, msg+i);
+    expect(7, vm.ki[vm.sp], msg+i);
+    vm.sp++;
+
+    // a halted program still serves calls:
+    i = sprintf(msg, "halted");
+    expect(REXLANG_ERR_HALTED, rexlang_vm_exec(&vm, 100), msg+i);
+    args[0] = 2;
+    args[1] = 3;
+    expect(REXLANG_ERR_SUCCESS, rexlang_vm_call(&vm, add, args, 2, r, 1, 100), msg+i);
+    expect(5, r[0], msg+i);
+    expect(REXLANG_ERR_HALTED, vm.err, msg+i);
+    expect(1, vm.ip, msg+i);
+
+    return 0;
+}
+
+// device registers for mmio_test: reads return 0xA0 + offset, writes are logged:
+static uint32_t reg_writes, reg_last;
+
+static uint32_t reg_read(void *ctx, uint32_t offset, unsigned int size) {
+    (void)ctx;
+    return 0xA0 + offset + 0x100 * (size - 1);
+}
+
+static void reg_write(void *ctx, uint32_t offset, uint32_t v, unsigned int size) {
+    (void)ctx;
+    reg_writes++;
+    reg_last = offset << 24 | size << 16 | v;
+}
+
+int mmio_test(char* msg) {
+    static const char src[] =
+        "        push 0x1234\n"
+        "        st-u16-discard 0x104    ; alias[4] = 0x1234\n"
+        "        ld-u8 0x105\n"
+        "        st-u8-discard 0         ; d[0] = 0x12\n"
+        "        push 0x200\n"
+        "        ld-u8-offs 3            ; read(3, 1)\n"
+        "        st-u8-discard 1         ; d[1] = 0xA3\n"
+        "        push 0x55\n"
+        "        push 0x202\n"
+        "        st-u16                  ; write(2, 0x55, 2)\n"
+        "        st-u8-discard 2         ; d[2] = 0x55\n"
+        "        push 0x80\n"
+        "        st-u8-discard 0x10F     ; alias[15] = 0x80\n"
+        "        ld-s8 0x10F\n"
+        "        st-u32-discard 4        ; d[4] = -128\n"
+        "        halt\n";
+    static const char *const faults[] = {
+        "ld-u16 0x10F\n",               // straddles the end of the alias window
+        "ld-u8 0x208\n",                // in a mapped page, past the window
+        "ld-u8 0x300\n",                // unmapped page
+        "push 1\nst-u8 0x400\n",        // read-only window
+        "push 0x7FFFFFFF\nld-u8\n",     // beyond the page table
+    };
+    static struct rexlang_insn x[64];
+    struct rexlang_mmio_window w;
+    struct rexlang_asm_result res;
+    struct rexlang_mmio io;
+    struct rexlang_vm vm;
+    uint8_t prgm[64], data[16], alias[16];
+    int i, k;
+
+    i = sprintf(msg, "windows");
+    rexlang_mmio_init(&io, 8);
+    memset(&w, 0, sizeof(w));
+    w.base = 0x100;
+    w.size = sizeof(alias);
+    w.mem = alias;
+    expect(1, rexlang_mmio_add(&io, &w), msg+i);
+    w.base = 0x1F0;                     // shares page 1 with the alias window
+    expect(0, rexlang_mmio_add(&io, &w), msg+i);
+    w.base = 64 << 8;                   // beyond the table
+    expect(0, rexlang_mmio_add(&io, &w), msg+i);
+    w.base = 0x200;
+    w.size = 8;
+    w.mem = NULL;
+    w.read = reg_read;
+    w.write = reg_write;
+    expect(1, rexlang_mmio_add(&io, &w), msg+i);
+    w.base = 0x400;
+    w.write = NULL;
+    expect(1, rexlang_mmio_add(&io, &w), msg+i);
+    w.size = 0;
+    expect(0, rexlang_mmio_add(&io, &w), msg+i);
+
+    expect(1, rexlang_asm(src, strlen(src), prgm, sizeof(prgm), &res), msg+i);
+    for (k = 0; k < 2; k++) {
+        i = sprintf(msg, "%s run", k ? "predecoded" : "plain");
+        memset(data, 0, sizeof(data));
+        memset(alias, 0, sizeof(alias));
+        reg_writes = 0;
+        rexlang_vm_init(&vm, res.size, prgm, sizeof(data), data, syscall, STACKS(0));
+        rexlang_vm_mmio(&vm, &io);
+        if (k) {
+            rexlang_vm_predecode(&vm, x, sizeof(x) / sizeof(x[0]));
+        }
+        expect(REXLANG_ERR_HALTED, rexlang_vm_exec(&vm, 100), msg+i);
+        expect(0x34, alias[4], msg+i);
+        expect(0x12, alias[5], msg+i);
+        expect(0x80, alias[15], msg+i);
+        expect(0x12, data[0], msg+i);
+        expect(0xA3, data[1], msg+i);
+        expect(0x55, data[2], msg+i);
+        expect(-128, *(int32_t*)&data[4], msg+i);
+        expect(1, reg_writes, msg+i);
+        expect(2 << 24 | 2 << 16 | 0x55, reg_last, msg+i);
+        expect(REXLANG_DATA_STACKSZ, vm.sp, msg+i);
+    }
+
+    i = sprintf(msg, "faults");
+    for (k = 0; k < (int)(sizeof(faults) / sizeof(faults[0])); k++) {
+        expect(1, rexlang_asm(faults[k], strlen(faults[k]), prgm, sizeof(prgm), &res), msg+i);
+        rexlang_vm_init(&vm, res.size, prgm, sizeof(data), data, syscall, STACKS(0));
+        rexlang_vm_mmio(&vm, &io);
+        expect(REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS, rexlang_vm_exec(&vm, 100), msg+i);
+    }
+    expect(1, reg_writes, msg+i);
+
+    // without windows, addresses beyond data memory fault as before:
+    i = sprintf(msg, "detached");
+    expect(1, rexlang_asm(src, strlen(src), prgm, sizeof(prgm), &res), msg+i);
+    rexlang_vm_init(&vm, res.size, prgm, sizeof(data), data, syscall, STACKS(0));
+    expect(REXLANG_ERR_DATA_ADDRESS_OUT_OF_BOUNDS, rexlang_vm_exec(&vm, 100), msg+i);
+
+    return 0;
+}
+
+#define BATCH_IMAGES 1000
+#define BATCH_KI     8
+
+static uint8_t batch_data[BATCH_IMAGES][64];
+static uint8_t batch_ref[BATCH_IMAGES][64];
+static uint32_t batch_stacks[BATCH_IMAGES * BATCH_KI];
+static struct rexlang_batch_result batch_results[BATCH_IMAGES];
+
+int batch_test(char* msg) {
+    static const uint8_t prgm[64] = {
+        0b01010010, 0,                      // ld-u8-imm8 0             n = d[0]
+        0b00111101,                         // loop: dup
+        0b01101011, 15,                     // jump-abs-if-not-imm8 done
+        0b00111101,                         // dup
+        0b01010100, 4,                      // ld-u32-imm8 4
+        0b00001111,                         // add
+        0b01100100, 4,                      // st-u32-discard-imm8 4    d[4] += n
+        0b01010000, 1,                      // sub-imm8   1
+        0b01101001, 2,                      // jump-abs-imm8 loop
+        0b01010100, 4,                      // done: ld-u32-imm8 4
+        0,                                  // halt
+    };
+    static uint8_t *images[BATCH_IMAGES];
+    struct rexlang_vm vm;
+    struct rexlang_insn x[64];
+    uint16_t scratch[64];
+    uint32_t ki[BATCH_KI];
+    rexlang_ip cs[4];
+    struct rexlang_batch b = {0};
+    int i;
+
+    // the images with large n run out of budget:
+    for (uint32_t n = 0; n < BATCH_IMAGES; n++) {
+        memset(batch_ref[n], 0, sizeof(batch_ref[n]));
+        batch_ref[n][0] = n * 7;
+        images[n] = batch_data[n];
+    }
+
+    b.m = prgm;
+    b.m_size = sizeof(prgm);
+    b.syscall = syscall;
+    b.instruction_count = 1000;
+    b.d = images;
+    b.d_size = sizeof(batch_data[0]);
+    b.count = BATCH_IMAGES;
+    b.stacks = batch_stacks;
+    b.ki_size = BATCH_KI;
+    b.cs_size = 4;
+
+    // reference: run every image on its own:
+    for (uint32_t n = 0; n < BATCH_IMAGES; n++) {
+        rexlang_vm_init(&vm, b.m_size, prgm, b.d_size, batch_ref[n], syscall, ki, BATCH_KI, cs, 4);
+        rexlang_vm_exec(&vm, b.instruction_count);
+        batch_results[n].err = vm.err;
+        batch_results[n].ip = vm.ip;
+        batch_results[n].sp = vm.sp;
+        memcpy(batch_stacks + n * BATCH_KI, ki, sizeof(ki));
+    }
+
+    rexlang_vm_init(&vm, b.m_size, prgm, b.d_size, batch_ref[0], syscall, ki, BATCH_KI, cs, 4);
+    rexlang_vm_predecode(&vm, x, 64);
+    i = sprintf(msg, "verify");
+    expect(REXLANG_ERR_SUCCESS, rexlang_vm_verify(&vm, syscall_sigs, 2, scratch, 64, NULL), msg+i);
+#ifdef REXLANG_JIT
+    struct rexlang_jit jit = {0};
+    expect(1, rexlang_vm_jit_compile(&vm, &jit), msg+i);
+#endif
+
+    for (int mode = 0; mode < 5; mode++) {
+        static const unsigned int threads[] = {1, 4, 0, 3, 2};
+        struct rexlang_batch_result results[BATCH_IMAGES];
+        uint32_t stacks[BATCH_IMAGES * BATCH_KI];
+
+        memcpy(stacks, batch_stacks, sizeof(stacks));
+        memcpy(results, batch_results, sizeof(results));
+        for (uint32_t n = 0; n < BATCH_IMAGES; n++) {
+            memset(batch_data[n], 0, sizeof(batch_data[n]));
+            batch_data[n][0] = n * 7;
+        }
+        memset(batch_stacks, 0, sizeof(batch_stacks));
+        memset(batch_results, 0xFF, sizeof(batch_results));
+
+        // plain, verified, pre-decoded, native, lockstep:
+        b.verified = mode >= 1;
+        b.x = mode >= 2 ? x : NULL;
+        b.lockstep = mode == 4;
+#ifdef REXLANG_JIT
+        b.jit = mode == 3 ? &jit : NULL;
+#endif
+        i = sprintf(msg, "mode %d run", mode);
+        expect(1, rexlang_batch_run(&b, threads[mode], batch_results), msg+i);
+
+        for (uint32_t n = 0; n < BATCH_IMAGES; n++) {
+            i = sprintf(msg, "mode %d image %u", mode, n);
+            expect(results[n].err, batch_results[n].err, msg+i);
+            expect(results[n].ip, batch_results[n].ip, msg+i);
+            expect(results[n].sp, batch_results[n].sp, msg+i);
+            for (uint32_t k = results[n].sp; k < BATCH_KI; k++) {
+                expect(stacks[n * BATCH_KI + k], batch_stacks[n * BATCH_KI + k], msg+i);
+            }
+            expect(0, memcmp(batch_ref[n], batch_data[n], sizeof(batch_ref[n])), msg+i);
+        }
+    }
+#ifdef REXLANG_JIT
+    // native code for another generation of the program is refused, not quietly interpreted:
+    i = sprintf(msg, "stale jit");
+    b.jit = &jit;
+    b.lockstep = false;
+    b.generation = 1;
+    expect(0, rexlang_batch_run(&b, 1, batch_results), msg+i);
+    b.generation = 0;
+#endif
+
+    i = sprintf(msg, "outcomes");
+    expect(REXLANG_ERR_HALTED, batch_results[1].err, msg+i);
+    expect(28, batch_stacks[2 * BATCH_KI - 2], msg+i);
+    expect(REXLANG_ERR_SUCCESS, batch_results[30].err, msg+i);
+
+#ifdef REXLANG_JIT
+    rexlang_vm_jit_free(&jit);
+#endif
+    return 0;
+}
+
+#ifdef REXLANG_JIT
+// native code only runs for the program it was compiled from:
+int jit_test(char* msg) {
+    static uint8_t prgm[2][4] = {
+        {0b01000000, 1, 0b00000000},        // push-u8 1; halt
+        {0b01000000, 2, 0b00000000},        // push-u8 2; halt
+    };
+    struct rexlang_vm vm;
+    struct rexlang_jit jit;
+    uint16_t scratch[4];
+    uint8_t data[4];
+    int i;
+
+    i = sprintf(msg, "compile");
+    rexlang_vm_init(&vm, 4, prgm[0], sizeof(data), data, syscall, STACKS(0));
+    expect(REXLANG_ERR_SUCCESS, rexlang_vm_verify(&vm, syscall_sigs, 2, scratch, 4, NULL), msg+i);
+    expect(1, rexlang_vm_jit_compile(&vm, &jit), msg+i);
+    expect(REXLANG_ERR_HALTED, rexlang_vm_jit_exec(&vm, &jit, 16), msg+i);
+    expect(1, vm.ki[REXLANG_DATA_STACKSZ - 1], msg+i);
+
+    i = sprintf(msg, "other program");
+    rexlang_vm_init(&vm, 4, prgm[1], sizeof(data), data, syscall, STACKS(0));
+    expect(REXLANG_ERR_SUCCESS, rexlang_vm_verify(&vm, syscall_sigs, 2, scratch, 4, NULL), msg+i);
+    expect(REXLANG_ERR_HALTED, rexlang_vm_jit_exec(&vm, &jit, 16), msg+i);
+    expect(2, vm.ki[REXLANG_DATA_STACKSZ - 1], msg+i);
+
+    i = sprintf(msg, "other generation");
+    rexlang_vm_init(&vm, 4, prgm[0], sizeof(data), data, syscall, STACKS(0));
+    expect(REXLANG_ERR_SUCCESS, rexlang_vm_verify(&vm, syscall_sigs, 2, scratch, 4, NULL), msg+i);
+    prgm[0][1] = 3;
+    vm.generation = jit.generation + 1;
+    expect(REXLANG_ERR_HALTED, rexlang_vm_jit_exec(&vm, &jit, 16), msg+i);
+    expect(3, vm.ki[REXLANG_DATA_STACKSZ - 1], msg+i);
+
+    rexlang_vm_jit_free(&jit);
+    return 0;
+}
+#endif
+
 typedef uint32_t (*rexlang_eval_fn)(uint8_t opcode, uint32_t b, uint32_t a);
 
 void push_ui(uint8_t** p, uint32_t a) {
@@ -308,6 +2328,7 @@ struct named_op { const char *name; uint8_t op; };
 int main(void) {
     int ret = 0;
     char msg[256] = {0};
+    memset(unit_cost, 1, sizeof(unit_cost));
     uint32_t ranges_ui[][2] = {
         {           0U,            2U},
         {  INT8_MAX-2U,   INT8_MAX+2U},
@@ -385,7 +2406,149 @@ int main(void) {
             printf("** test FAILED! (%d); %s\n", ret, msg);
             return ret;
         }
+        ret = lockstep_test(&tests[i], msg, MODE_FUSED);
+        if (ret) {
+            printf("** test FAILED! (%d); %s (fused)\n", ret, msg);
+            return ret;
+        }
+        ret = lockstep_test(&tests[i], msg, MODE_TIMED | MODE_FUSED);
+        if (ret) {
+            printf("** test FAILED! (%d); %s (timed, fused)\n", ret, msg);
+            return ret;
+        }
+#ifdef REXLANG_JIT
+        ret = lockstep_test(&tests[i], msg, MODE_JIT | MODE_VERIFIED);
+        if (ret) {
+            printf("** test FAILED! (%d); %s (jit)\n", ret, msg);
+            return ret;
+        }
+#endif
+        ret = lanes_test(tests[i].prgm, msg);
+        if (ret) {
+            printf("** test FAILED! (%d); %s (lanes)\n", ret, msg);
+            return ret;
+        }
+    }
+    for (size_t i = 0; i < sizeof(lanes_prgms)/sizeof(lanes_prgms[0]); i++) {
+        printf("executing lanes test: %zu\n", i);
+        int ret = lanes_test(lanes_prgms[i], msg);
+        if (ret) {
+            printf("** test FAILED! (%d); %s\n", ret, msg);
+            return ret;
+        }
+    }
+
+    // verifier tests:
+    for (size_t i = 0; i < sizeof(verify_tests)/sizeof(struct verify_test_t); i++) {
+        printf("executing verify test: %s\n", verify_tests[i].name);
+        int ret = verify_test(&verify_tests[i], msg);
+        if (ret) {
+            printf("** test FAILED! (%d); %s\n", ret, msg);
+            return ret;
+        }
+    }
+
+    printf("executing batch test\n");
+    if ((ret = batch_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+
+#ifdef REXLANG_JIT
+    printf("executing jit test\n");
+    if ((ret = jit_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+
+#endif
+    printf("executing channel test\n");
+    if ((ret = channel_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+
+    printf("executing stdlib test\n");
+    if ((ret = stdlib_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+
+    printf("executing scheduler test\n");
+    if ((ret = scheduler_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+
+    printf("executing stacks test\n");
+    if ((ret = stacks_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+
+    printf("executing pool test\n");
+    if ((ret = pool_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+
+    printf("executing snapshot test\n");
+    if ((ret = snapshot_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+
+    printf("executing dirty test\n");
+    if ((ret = dirty_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+
+    printf("executing asm test\n");
+    if ((ret = asm_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+
+    printf("executing opt test\n");
+    if ((ret = opt_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+
+    printf("executing image test\n");
+    if ((ret = image_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+
+    printf("executing patch test\n");
+    if ((ret = patch_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+
+    printf("executing call test\n");
+    if ((ret = call_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+
+#ifndef REXLANG_NO_BOUNDS_CHECK
+    printf("executing mmio test\n");
+    if ((ret = mmio_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
+    }
+#endif
+
+#ifdef REXLANG_PROFILE
+    printf("executing profile test\n");
+    if ((ret = profile_test(msg)) != 0) {
+        printf("** test FAILED! (%d); %s\n", ret, msg);
+        return ret;
     }
+#endif
 
     return 0;
 }